@@ -0,0 +1,333 @@
+#include "BPlusTree.h"
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+IndexKey::IndexKey()
+    : type(INT), number(0) {
+}
+
+IndexKey::IndexKey(const string& value, DataType t)
+    : type(t), number(0) {
+    if (type == VARCHAR) {
+        text = value;
+    }
+    else {
+        number = atof(value.c_str());
+    }
+}
+
+IndexKey::IndexKey(double value, DataType t)
+    : type(t), number(value) {
+}
+
+bool IndexKey::operator<(const IndexKey& other) const {
+    if (type == VARCHAR) return text < other.text;
+    return number < other.number;
+}
+
+bool IndexKey::operator==(const IndexKey& other) const {
+    if (type == VARCHAR) return text == other.text;
+    return number == other.number;
+}
+
+static bool entryLess(const pair<IndexKey, int>& a, const pair<IndexKey, int>& b) {
+    if (a.first < b.first) return true;
+    if (b.first < a.first) return false;
+    return a.second < b.second;
+}
+
+BPlusTree::Node::Node(bool leaf)
+    : isLeaf(leaf), next(NULL) {
+}
+
+BPlusTree::BPlusTree()
+    : root(new Node(true)), entryCount(0) {
+}
+
+BPlusTree::~BPlusTree() {
+    destroy(root);
+}
+
+void BPlusTree::destroy(Node* node) {
+    if (!node->isLeaf) {
+        for (int i = 0; i < (int)node->children.size(); i++) {
+            destroy(node->children[i]);
+        }
+    }
+    delete node;
+}
+
+void BPlusTree::clear() {
+    destroy(root);
+    root = new Node(true);
+    entryCount = 0;
+}
+
+void BPlusTree::swap(BPlusTree& other) {
+    std::swap(root, other.root);
+    std::swap(entryCount, other.entryCount);
+}
+
+BPlusTree::Node* BPlusTree::findLeaf(const IndexKey& key) const {
+    Node* node = root;
+    while (!node->isLeaf) {
+        int child = (int)(upper_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin());
+        node = node->children[child];
+    }
+    return node;
+}
+
+BPlusTree::Node* BPlusTree::leftmostLeaf() const {
+    Node* node = root;
+    while (!node->isLeaf) {
+        node = node->children[0];
+    }
+    return node;
+}
+
+void BPlusTree::insertInto(Node* node, const IndexKey& key, int rowId,
+    IndexKey& splitKey, Node*& splitNode) {
+    splitNode = NULL;
+
+    if (node->isLeaf) {
+        int pos = (int)(lower_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin());
+        if (pos < (int)node->keys.size() && node->keys[pos] == key) {
+            node->rowIds[pos].push_back(rowId);
+            return;
+        }
+
+        node->keys.insert(node->keys.begin() + pos, key);
+        node->rowIds.insert(node->rowIds.begin() + pos, vector<int>(1, rowId));
+
+        if ((int)node->keys.size() > ORDER) {
+            int half = (int)node->keys.size() / 2;
+            Node* right = new Node(true);
+            right->keys.assign(node->keys.begin() + half, node->keys.end());
+            right->rowIds.assign(node->rowIds.begin() + half, node->rowIds.end());
+            node->keys.resize(half);
+            node->rowIds.resize(half);
+
+            right->next = node->next;
+            node->next = right;
+
+            splitKey = right->keys[0];
+            splitNode = right;
+        }
+        return;
+    }
+
+    int child = (int)(upper_bound(node->keys.begin(), node->keys.end(), key) - node->keys.begin());
+    IndexKey childSplitKey;
+    Node* childSplit;
+    insertInto(node->children[child], key, rowId, childSplitKey, childSplit);
+
+    if (childSplit == NULL) return;
+
+    node->keys.insert(node->keys.begin() + child, childSplitKey);
+    node->children.insert(node->children.begin() + child + 1, childSplit);
+
+    if ((int)node->keys.size() > ORDER) {
+        int half = (int)node->keys.size() / 2;
+        Node* right = new Node(false);
+
+        // keys[half] moves up; it is not kept in either half
+        splitKey = node->keys[half];
+        right->keys.assign(node->keys.begin() + half + 1, node->keys.end());
+        right->children.assign(node->children.begin() + half + 1, node->children.end());
+        node->keys.resize(half);
+        node->children.resize(half + 1);
+
+        splitNode = right;
+    }
+}
+
+void BPlusTree::insert(const IndexKey& key, int rowId) {
+    IndexKey splitKey;
+    Node* splitNode;
+    insertInto(root, key, rowId, splitKey, splitNode);
+
+    if (splitNode != NULL) {
+        Node* newRoot = new Node(false);
+        newRoot->keys.push_back(splitKey);
+        newRoot->children.push_back(root);
+        newRoot->children.push_back(splitNode);
+        root = newRoot;
+    }
+    entryCount++;
+}
+
+void BPlusTree::remove(const IndexKey& key, int rowId) {
+    Node* leaf = findLeaf(key);
+    int pos = (int)(lower_bound(leaf->keys.begin(), leaf->keys.end(), key) - leaf->keys.begin());
+    if (pos >= (int)leaf->keys.size() || !(leaf->keys[pos] == key)) return;
+
+    vector<int>& ids = leaf->rowIds[pos];
+    vector<int>::iterator it = std::find(ids.begin(), ids.end(), rowId);
+    if (it == ids.end()) return;
+
+    ids.erase(it);
+    entryCount--;
+
+    if (ids.empty()) {
+        leaf->keys.erase(leaf->keys.begin() + pos);
+        leaf->rowIds.erase(leaf->rowIds.begin() + pos);
+    }
+}
+
+void BPlusTree::build(vector<pair<IndexKey, int> >& entries) {
+    clear();
+    if (entries.empty()) return;
+
+    sort(entries.begin(), entries.end(), entryLess);
+
+    // Fill leaves left to right, leaving some room for later inserts
+    const int fill = ORDER * 3 / 4;
+    vector<Node*> level;
+    vector<IndexKey> firstKeys;
+    Node* leaf = NULL;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const IndexKey& key = entries[i].first;
+        if (leaf != NULL && !leaf->keys.empty() && leaf->keys.back() == key) {
+            leaf->rowIds.back().push_back(entries[i].second);
+            continue;
+        }
+        if (leaf == NULL || (int)leaf->keys.size() >= fill) {
+            Node* next = new Node(true);
+            if (leaf != NULL) leaf->next = next;
+            leaf = next;
+            level.push_back(leaf);
+            firstKeys.push_back(key);
+        }
+        leaf->keys.push_back(key);
+        leaf->rowIds.push_back(vector<int>(1, entries[i].second));
+    }
+
+    // Build internal levels until a single root remains
+    while (level.size() > 1) {
+        vector<Node*> parents;
+        vector<IndexKey> parentFirstKeys;
+
+        for (size_t i = 0; i < level.size(); i += fill + 1) {
+            Node* parent = new Node(false);
+            size_t end = min(level.size(), i + fill + 1);
+            for (size_t c = i; c < end; c++) {
+                if (c > i) parent->keys.push_back(firstKeys[c]);
+                parent->children.push_back(level[c]);
+            }
+            parents.push_back(parent);
+            parentFirstKeys.push_back(firstKeys[i]);
+        }
+
+        level = parents;
+        firstKeys = parentFirstKeys;
+    }
+
+    delete root;
+    root = level[0];
+    entryCount = (int)entries.size();
+}
+
+void BPlusTree::remapRows(const vector<int>& newPositions) {
+    entryCount = 0;
+
+    for (Node* leaf = leftmostLeaf(); leaf != NULL; leaf = leaf->next) {
+        int out = 0;
+        for (int k = 0; k < (int)leaf->keys.size(); k++) {
+            vector<int>& ids = leaf->rowIds[k];
+            int kept = 0;
+            for (int i = 0; i < (int)ids.size(); i++) {
+                int pos = newPositions[ids[i]];
+                if (pos != -1) ids[kept++] = pos;
+            }
+            ids.resize(kept);
+            if (kept == 0) continue;
+
+            if (out != k) {
+                leaf->keys[out] = leaf->keys[k];
+                leaf->rowIds[out].swap(ids);
+            }
+            out++;
+            entryCount += kept;
+        }
+        leaf->keys.resize(out);
+        leaf->rowIds.resize(out);
+    }
+}
+
+void BPlusTree::find(const IndexKey& key, vector<int>& out) const {
+    range(&key, true, &key, true, out);
+}
+
+void BPlusTree::range(const IndexKey* low, bool lowInclusive,
+    const IndexKey* high, bool highInclusive,
+    vector<int>& out) const {
+    Node* leaf = (low != NULL) ? findLeaf(*low) : leftmostLeaf();
+
+    int pos = 0;
+    if (low != NULL) {
+        if (lowInclusive) {
+            pos = (int)(lower_bound(leaf->keys.begin(), leaf->keys.end(), *low) - leaf->keys.begin());
+        }
+        else {
+            pos = (int)(upper_bound(leaf->keys.begin(), leaf->keys.end(), *low) - leaf->keys.begin());
+        }
+    }
+
+    while (leaf != NULL) {
+        for (; pos < (int)leaf->keys.size(); pos++) {
+            const IndexKey& key = leaf->keys[pos];
+            if (high != NULL) {
+                if (*high < key) return;
+                if (!highInclusive && key == *high) return;
+            }
+            // a non-inclusive low bound may still match keys in a following leaf
+            if (low != NULL && !lowInclusive && key == *low) continue;
+
+            const vector<int>& ids = leaf->rowIds[pos];
+            out.insert(out.end(), ids.begin(), ids.end());
+        }
+        leaf = leaf->next;
+        pos = 0;
+    }
+}
+
+void BPlusTree::scan(bool descending, EntryVisitor visit, void* context) const {
+    if (descending) {
+        scanBackward(root, visit, context);
+        return;
+    }
+
+    for (const Node* leaf = leftmostLeaf(); leaf != NULL; leaf = leaf->next) {
+        for (int k = 0; k < (int)leaf->keys.size(); k++) {
+            const vector<int>& ids = leaf->rowIds[k];
+            for (int i = 0; i < (int)ids.size(); i++) {
+                if (!visit(context, ids[i])) return;
+            }
+        }
+    }
+}
+
+// Leaves only link to the right, so a descending scan walks the tree
+bool BPlusTree::scanBackward(const Node* node, EntryVisitor visit, void* context) const {
+    if (!node->isLeaf) {
+        for (int c = (int)node->children.size() - 1; c >= 0; c--) {
+            if (!scanBackward(node->children[c], visit, context)) return false;
+        }
+        return true;
+    }
+
+    for (int k = (int)node->keys.size() - 1; k >= 0; k--) {
+        const vector<int>& ids = node->rowIds[k];
+        for (int i = 0; i < (int)ids.size(); i++) {
+            if (!visit(context, ids[i])) return false;
+        }
+    }
+    return true;
+}
+
+int BPlusTree::size() const {
+    return entryCount;
+}
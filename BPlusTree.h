@@ -0,0 +1,89 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+using namespace std;
+
+#include "Column.h"
+
+// Typed index key: INT/FLOAT compare numerically (like Condition::evaluate),
+// VARCHAR compares lexicographically.
+struct IndexKey {
+    DataType type;
+    double number;
+    string text;
+
+    IndexKey();
+    IndexKey(const string& value, DataType t);
+    IndexKey(double value, DataType t);
+
+    bool operator<(const IndexKey& other) const;
+    bool operator==(const IndexKey& other) const;
+};
+
+// Ordered index mapping a key to the positions of the rows holding it.
+// Deletions do not rebalance; underfull nodes are tolerated and disappear
+// the next time the tree is bulk-built.
+class BPlusTree {
+public:
+    // Called per row id by scan(); returning false stops the scan
+    typedef bool (*EntryVisitor)(void* context, int rowId);
+
+private:
+    static const int ORDER = 64; // max keys per node
+
+    struct Node {
+        bool isLeaf;
+        vector<IndexKey> keys;
+        vector<Node*> children;      // internal nodes: keys.size() + 1 children
+        vector<vector<int> > rowIds; // leaves: row ids per key
+        Node* next;                  // leaves: right sibling
+
+        Node(bool leaf);
+    };
+
+    Node* root;
+    int entryCount;
+
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+
+    void destroy(Node* node);
+    Node* findLeaf(const IndexKey& key) const;
+    Node* leftmostLeaf() const;
+    bool scanBackward(const Node* node, EntryVisitor visit, void* context) const;
+    void insertInto(Node* node, const IndexKey& key, int rowId,
+        IndexKey& splitKey, Node*& splitNode);
+
+public:
+    BPlusTree();
+    ~BPlusTree();
+
+    void clear();
+    void insert(const IndexKey& key, int rowId);
+    void remove(const IndexKey& key, int rowId);
+
+    // Replaces the contents with the given entries (sorted bottom-up load).
+    void build(vector<pair<IndexKey, int> >& entries);
+
+    // Exchanges contents, so a tree can be built aside and swapped in
+    void swap(BPlusTree& other);
+
+    // Rewrites row ids after rows were compacted; -1 drops the entry.
+    void remapRows(const vector<int>& newPositions);
+
+    void find(const IndexKey& key, vector<int>& out) const;
+    void range(const IndexKey* low, bool lowInclusive,
+        const IndexKey* high, bool highInclusive,
+        vector<int>& out) const;
+
+    // Visits every row id in key order, or from the largest key down when
+    // descending; the ids of one key come in the order they are stored
+    void scan(bool descending, EntryVisitor visit, void* context) const;
+
+    int size() const;
+};
+
+#endif
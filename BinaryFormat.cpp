@@ -0,0 +1,241 @@
+#include "BinaryFormat.h"
+#include "Table.h"
+#include "MappedFile.h"
+#include "Checksum.h"
+#include "Encoding.h"
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+static const char TABLE_MAGIC[8] = { 'D', 'B', 'E', 'N', 'G', 'B', 'I', 'N' };
+static const char MANIFEST_MAGIC[8] = { 'D', 'B', 'E', 'N', 'G', 'C', 'A', 'T' };
+
+// magic, version, page size, lsn, table count, catalog offset/length/crc
+static const size_t HEADER_FIELDS_SIZE = 8 + 4 + 4 + 8 + 4 + 8 + 8 + 4;
+
+static void padToPage(string& out) {
+    size_t rem = out.size() % BinaryFormat::PAGE_SIZE;
+    if (rem != 0) out.append(BinaryFormat::PAGE_SIZE - rem, '\0');
+}
+
+DataFileKind BinaryFormat::detect(const string& path) {
+    ifstream in(path.c_str(), ios::binary);
+    if (!in) return FILE_MISSING;
+
+    char magic[8];
+    if (!in.read(magic, sizeof(magic))) return FILE_TEXT;
+    if (memcmp(magic, TABLE_MAGIC, sizeof(magic)) == 0) return FILE_TABLES;
+    if (memcmp(magic, MANIFEST_MAGIC, sizeof(magic)) == 0) return FILE_MANIFEST;
+    return FILE_TEXT;
+}
+
+string BinaryFormat::encodeTable(const Table& table, uint64_t lsn, vector<ColumnSegment>& segments) {
+    string out(PAGE_SIZE, '\0'); // header page, filled in last
+    string catalog;
+
+    putU32(catalog, 1); // table count
+
+    const vector<Column>& cols = table.getColumns();
+
+    putString(catalog, table.getTableName());
+    putU32(catalog, (uint32_t)cols.size());
+    for (size_t i = 0; i < cols.size(); i++) {
+        putString(catalog, cols[i].getName());
+        putU8(catalog, (uint8_t)cols[i].getType());
+        putU32(catalog, (uint32_t)cols[i].getSize());
+        putU8(catalog, cols[i].getIsPrimaryKey() ? 1 : 0);
+        putU8(catalog, cols[i].getIsNotNull() ? 1 : 0);
+    }
+
+    putU64(catalog, (uint64_t)table.getRowCount());
+
+    const vector<SecondaryIndex*>& indexes = table.getIndexes();
+    putU32(catalog, (uint32_t)indexes.size());
+    for (size_t i = 0; i < indexes.size(); i++) {
+        putString(catalog, indexes[i]->name);
+        putU32(catalog, (uint32_t)indexes[i]->columnIndex);
+    }
+
+    // A table that was never loaded is written by copying its segments
+    const MappedFile* storage = table.getStorage();
+    segments.resize(table.getColumnCount());
+    for (int c = 0; c < table.getColumnCount(); c++) {
+        padToPage(out);
+        size_t start = out.size();
+        if (storage != NULL) {
+            const ColumnSegment& stored = table.getSegments()[c];
+            if (stored.offset + stored.length > storage->getSize()) {
+                throw runtime_error("Data for table '" + table.getTableName() + "' is truncated");
+            }
+            out.append(storage->getData() + stored.offset, (size_t)stored.length);
+            segments[c].crc = stored.crc;
+        }
+        else {
+            table.getColumnData(c).encode(out);
+            segments[c].crc = Checksum::crc32(out.data() + start, out.size() - start);
+        }
+        segments[c].offset = (uint64_t)start;
+        segments[c].length = (uint64_t)(out.size() - start);
+
+        putU64(catalog, segments[c].offset);
+        putU64(catalog, segments[c].length);
+        putU32(catalog, segments[c].crc);
+    }
+
+    // Optional tail, after every table: per table whether it was analyzed
+    // and its statistics
+    const TableStats& stats = table.getStats();
+    putU8(catalog, stats.isAnalyzed() ? 1 : 0);
+    if (stats.isAnalyzed()) stats.encode(catalog);
+
+    padToPage(out);
+    uint64_t catalogOffset = out.size();
+    out += catalog;
+
+    string header(TABLE_MAGIC, sizeof(TABLE_MAGIC));
+    putU32(header, VERSION);
+    putU32(header, PAGE_SIZE);
+    putU64(header, lsn);
+    putU32(header, 1);
+    putU64(header, catalogOffset);
+    putU64(header, (uint64_t)catalog.size());
+    putU32(header, Checksum::crc32(catalog.data(), catalog.size()));
+    putU32(header, Checksum::crc32(header.data(), header.size()));
+    out.replace(0, header.size(), header);
+
+    return out;
+}
+
+void BinaryFormat::readCatalog(const MappedFile& file, map<string, Table*>& tables, uint64_t& lsn) {
+    const char* data = file.getData();
+    size_t size = file.getSize();
+
+    if (size < PAGE_SIZE || memcmp(data, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0) {
+        throw runtime_error("Not a database file");
+    }
+    if (Checksum::crc32(data, HEADER_FIELDS_SIZE) != getU32(data + HEADER_FIELDS_SIZE)) {
+        throw runtime_error("Database header checksum mismatch");
+    }
+
+    ByteReader header(data + sizeof(TABLE_MAGIC), HEADER_FIELDS_SIZE - sizeof(TABLE_MAGIC));
+    uint32_t version = header.u32();
+    uint32_t pageSize = header.u32();
+    if (version != VERSION || pageSize != PAGE_SIZE) {
+        throw runtime_error("Unsupported database file version " + to_string(version));
+    }
+    lsn = header.u64();
+    uint32_t tableCount = header.u32();
+    uint64_t catalogOffset = header.u64();
+    uint64_t catalogLength = header.u64();
+    uint32_t catalogCrc = header.u32();
+
+    if (catalogOffset > size || catalogLength > size - catalogOffset) {
+        throw runtime_error("Database catalog is truncated");
+    }
+    const char* catalogData = data + catalogOffset;
+    if (Checksum::crc32(catalogData, (size_t)catalogLength) != catalogCrc) {
+        throw runtime_error("Database catalog checksum mismatch");
+    }
+
+    ByteReader catalog(catalogData, (size_t)catalogLength);
+    if (catalog.u32() != tableCount) {
+        throw runtime_error("Database catalog is inconsistent");
+    }
+
+    vector<Table*> read;
+    for (uint32_t ti = 0; ti < tableCount; ti++) {
+        Table* table = new Table(catalog.str());
+        try {
+            uint32_t colCount = catalog.u32();
+            for (uint32_t ci = 0; ci < colCount; ci++) {
+                string name = catalog.str();
+                DataType type = (DataType)catalog.u8();
+                int colSize = (int)catalog.u32();
+                bool pk = catalog.u8() != 0;
+                bool nn = catalog.u8() != 0;
+                table->addColumn(Column(name, type, colSize, pk, nn));
+            }
+
+            int rowCount = (int)catalog.u64();
+
+            vector<pair<string, int> > indexDefs;
+            uint32_t indexCount = catalog.u32();
+            for (uint32_t i = 0; i < indexCount; i++) {
+                string indexName = catalog.str();
+                int colIndex = (int)catalog.u32();
+                indexDefs.push_back(make_pair(indexName, colIndex));
+            }
+
+            vector<ColumnSegment> segments(colCount);
+            for (uint32_t ci = 0; ci < colCount; ci++) {
+                segments[ci].offset = catalog.u64();
+                segments[ci].length = catalog.u64();
+                segments[ci].crc = catalog.u32();
+            }
+            table->attachStorage(&file, segments, rowCount);
+
+            // Trees are built when the table is loaded
+            for (size_t i = 0; i < indexDefs.size(); i++) {
+                if (indexDefs[i].second < (int)colCount) {
+                    table->createIndex(indexDefs[i].first, indexDefs[i].second);
+                }
+            }
+            table->markClean(lsn);
+        }
+        catch (...) {
+            delete table;
+            throw;
+        }
+
+        tables[table->getTableName()] = table;
+        read.push_back(table);
+    }
+
+    // Files written before ANALYZE existed end here
+    if (catalog.atEnd()) return;
+    for (size_t i = 0; i < read.size(); i++) {
+        if (catalog.u8() == 0) continue;
+        TableStats stats;
+        stats.decode(catalog);
+        read[i]->setStats(stats);
+    }
+}
+
+string BinaryFormat::encodeManifest(uint64_t checkpointLsn, const vector<string>& tableNames) {
+    string out(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    putU32(out, VERSION);
+    putU64(out, checkpointLsn);
+    putU32(out, (uint32_t)tableNames.size());
+    for (size_t i = 0; i < tableNames.size(); i++) {
+        putString(out, tableNames[i]);
+    }
+    putU32(out, Checksum::crc32(out.data(), out.size()));
+    return out;
+}
+
+void BinaryFormat::readManifest(const string& data, uint64_t& checkpointLsn, vector<string>& tableNames) {
+    if (data.size() < sizeof(MANIFEST_MAGIC) + 4 ||
+        memcmp(data.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0) {
+        throw runtime_error("Not a database manifest");
+    }
+
+    size_t bodyLength = data.size() - 4;
+    if (Checksum::crc32(data.data(), bodyLength) != getU32(data.data() + bodyLength)) {
+        throw runtime_error("Database manifest checksum mismatch");
+    }
+
+    ByteReader in(data.data() + sizeof(MANIFEST_MAGIC), bodyLength - sizeof(MANIFEST_MAGIC));
+    uint32_t version = in.u32();
+    if (version != VERSION) {
+        throw runtime_error("Unsupported database manifest version " + to_string(version));
+    }
+    checkpointLsn = in.u64();
+
+    uint32_t tableCount = in.u32();
+    tableNames.clear();
+    for (uint32_t i = 0; i < tableCount; i++) {
+        tableNames.push_back(in.str());
+    }
+}
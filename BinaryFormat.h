@@ -0,0 +1,64 @@
+#ifndef BINARYFORMAT_H
+#define BINARYFORMAT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+using namespace std;
+
+class Table;
+class MappedFile;
+struct ColumnSegment;
+
+enum DataFileKind {
+    FILE_MISSING,
+    FILE_TEXT,     // pre-binary text database
+    FILE_TABLES,   // paged table file (magic "DBENGBIN")
+    FILE_MANIFEST  // database manifest (magic "DBENGCAT")
+};
+
+// A database folder holds a manifest (database.db) naming the tables, and
+// one paged file per table (<table>.tbl).
+//
+// Paged table file (version 1), little-endian:
+//
+//   page 0     header: magic "DBENGBIN", version, page size, LSN the file
+//              is current to, table count, catalog offset/length/crc32,
+//              header crc32
+//   pages 1..  column segments, each starting on a page boundary and
+//              encoded by ColumnVector::encode
+//   last pages catalog: per table its schema, row count, index
+//              definitions and the offset/length/crc32 of every segment;
+//              then, when present, per table a u8 flag and the
+//              statistics of its last ANALYZE (TableStats::encode)
+//
+// Table files hold one table; the single-file databases written before
+// the manifest existed hold all of them and are still readable.
+//
+// Manifest: magic "DBENGCAT", u32 version, u64 checkpoint LSN,
+// u32 table count, table names, u32 crc32 of everything before it.
+//
+// Opening a file only reads the header and the catalog; each table's
+// segments are decoded straight from the mapping on first use.
+class BinaryFormat {
+public:
+    static const uint32_t VERSION = 1;
+    static const uint32_t PAGE_SIZE = 4096;
+
+    static DataFileKind detect(const string& path);
+
+    // File image of one table, and where its column segments are in it.
+    // The segments of a table that is not loaded are copied from its file.
+    static string encodeTable(const Table& table, uint64_t lsn, vector<ColumnSegment>& segments);
+
+    // Creates the tables from the catalog, attached to file for lazy
+    // loading and marked clean as of the file's LSN. Throws runtime_error
+    // on a damaged header or catalog.
+    static void readCatalog(const MappedFile& file, map<string, Table*>& tables, uint64_t& lsn);
+
+    static string encodeManifest(uint64_t checkpointLsn, const vector<string>& tableNames);
+    static void readManifest(const string& data, uint64_t& checkpointLsn, vector<string>& tableNames);
+};
+
+#endif
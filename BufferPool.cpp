@@ -0,0 +1,206 @@
+#include "BufferPool.h"
+#include "FileSystem.h"
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+BufferPool::BufferPool(size_t capacityBytes)
+    : capacityPages(0), hand(0), hits(0), misses(0), evictions(0), writeBacks(0) {
+    setCapacity(capacityBytes);
+}
+
+BufferPool::~BufferPool() {
+    for (int i = 0; i < (int)fileDescriptors.size(); i++) {
+        closeFile(i);
+    }
+}
+
+uint64_t BufferPool::pageKey(int fileId, uint64_t pageNo) {
+    return ((uint64_t)fileId << 40) | pageNo;
+}
+
+int BufferPool::openFile(const string& path) {
+    int fd = FileSystem::openForUpdate(path);
+    if (fd == -1) return -1;
+
+    lock_guard<mutex> guard(lock);
+    fileDescriptors.push_back(fd);
+    return (int)fileDescriptors.size() - 1;
+}
+
+void BufferPool::closeFile(int fileId) {
+    lock_guard<mutex> guard(lock);
+    if (fileId < 0 || fileId >= (int)fileDescriptors.size() || fileDescriptors[fileId] == -1) return;
+
+    for (int i = 0; i < (int)frames.size(); i++) {
+        Frame& frame = frames[i];
+        if (frame.fileId != fileId) continue;
+
+        writeBack(frame);
+        pageTable.erase(pageKey(fileId, frame.pageNo));
+        frame.fileId = -1;
+        frame.pinCount = 0;
+        frame.usage = 0;
+    }
+
+    FileSystem::close(fileDescriptors[fileId]);
+    fileDescriptors[fileId] = -1;
+}
+
+void BufferPool::writeBack(Frame& frame) {
+    if (!frame.dirty) return;
+    FileSystem::writeAt(fileDescriptors[frame.fileId], frame.pageNo * PAGE_SIZE,
+        frame.data.data(), PAGE_SIZE);
+    frame.dirty = false;
+    writeBacks++;
+}
+
+// Next frame to reuse: an empty one, else the first unpinned page the
+// sweeping hand finds with a zero usage count.
+int BufferPool::findVictim() {
+    if (frames.size() < capacityPages) {
+        Frame frame;
+        frame.fileId = -1;
+        frame.pageNo = 0;
+        frame.pinCount = 0;
+        frame.usage = 0;
+        frame.dirty = false;
+        frame.data.resize(PAGE_SIZE);
+        frames.push_back(frame);
+        return (int)frames.size() - 1;
+    }
+
+    size_t limit = frames.size() * (MAX_USAGE + 1);
+    for (size_t step = 0; step <= limit; step++) {
+        int i = (int)hand;
+        hand = (hand + 1) % frames.size();
+
+        Frame& frame = frames[i];
+        if (frame.fileId == -1) return i;
+        if (frame.pinCount > 0) continue;
+        if (frame.usage > 0) {
+            frame.usage--;
+            continue;
+        }
+
+        writeBack(frame);
+        pageTable.erase(pageKey(frame.fileId, frame.pageNo));
+        frame.fileId = -1;
+        evictions++;
+        return i;
+    }
+
+    throw runtime_error("Buffer pool is full: every page is pinned");
+}
+
+char* BufferPool::pin(int fileId, uint64_t pageNo, bool sequential) {
+    lock_guard<mutex> guard(lock);
+
+    unordered_map<uint64_t, int>::iterator it = pageTable.find(pageKey(fileId, pageNo));
+    if (it != pageTable.end()) {
+        Frame& frame = frames[it->second];
+        frame.pinCount++;
+        if (frame.usage < MAX_USAGE) frame.usage++;
+        hits++;
+        return frame.data.data();
+    }
+
+    misses++;
+    int i = findVictim();
+    Frame& frame = frames[i];
+
+    size_t got = FileSystem::readAt(fileDescriptors[fileId], pageNo * PAGE_SIZE,
+        frame.data.data(), PAGE_SIZE);
+    if (got < PAGE_SIZE) memset(frame.data.data() + got, 0, PAGE_SIZE - got);
+
+    frame.fileId = fileId;
+    frame.pageNo = pageNo;
+    frame.pinCount = 1;
+    frame.usage = sequential ? 0 : 1;
+    frame.dirty = false;
+    pageTable[pageKey(fileId, pageNo)] = i;
+    return frame.data.data();
+}
+
+void BufferPool::unpin(int fileId, uint64_t pageNo, bool dirty) {
+    lock_guard<mutex> guard(lock);
+
+    unordered_map<uint64_t, int>::iterator it = pageTable.find(pageKey(fileId, pageNo));
+    if (it == pageTable.end()) return;
+
+    Frame& frame = frames[it->second];
+    if (frame.pinCount > 0) frame.pinCount--;
+    if (dirty) frame.dirty = true;
+}
+
+void BufferPool::read(int fileId, uint64_t offset, char* dest, size_t length, bool sequential) {
+    while (length > 0) {
+        uint64_t pageNo = offset / PAGE_SIZE;
+        size_t inPage = (size_t)(offset % PAGE_SIZE);
+        size_t n = PAGE_SIZE - inPage;
+        if (n > length) n = length;
+
+        const char* page = pin(fileId, pageNo, sequential);
+        memcpy(dest, page + inPage, n);
+        unpin(fileId, pageNo);
+
+        dest += n;
+        offset += n;
+        length -= n;
+    }
+}
+
+void BufferPool::flush() {
+    lock_guard<mutex> guard(lock);
+    for (int i = 0; i < (int)frames.size(); i++) {
+        if (frames[i].fileId != -1) writeBack(frames[i]);
+    }
+}
+
+// Drops unpinned frames from the end until at most pages remain
+void BufferPool::shrinkTo(size_t pages) {
+    while (frames.size() > pages) {
+        Frame& frame = frames.back();
+        if (frame.pinCount > 0) break;
+
+        if (frame.fileId != -1) {
+            writeBack(frame);
+            pageTable.erase(pageKey(frame.fileId, frame.pageNo));
+            evictions++;
+        }
+        frames.pop_back();
+    }
+    if (hand >= frames.size()) hand = 0;
+}
+
+void BufferPool::setCapacity(size_t capacityBytes) {
+    lock_guard<mutex> guard(lock);
+    capacityPages = capacityBytes / PAGE_SIZE;
+    if (capacityPages < 16) capacityPages = 16;
+    shrinkTo(capacityPages);
+}
+
+size_t BufferPool::getCapacity() const {
+    lock_guard<mutex> guard(lock);
+    return capacityPages * PAGE_SIZE;
+}
+
+BufferPoolStats BufferPool::getStats() const {
+    lock_guard<mutex> guard(lock);
+
+    BufferPoolStats stats;
+    stats.capacityPages = capacityPages;
+    stats.usedPages = 0;
+    stats.pinnedPages = 0;
+    for (int i = 0; i < (int)frames.size(); i++) {
+        if (frames[i].fileId == -1) continue;
+        stats.usedPages++;
+        if (frames[i].pinCount > 0) stats.pinnedPages++;
+    }
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.writeBacks = writeBacks;
+    return stats;
+}
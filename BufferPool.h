@@ -0,0 +1,87 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <mutex>
+using namespace std;
+
+struct BufferPoolStats {
+    size_t capacityPages;
+    size_t usedPages;
+    size_t pinnedPages;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writeBacks;
+};
+
+// Fixed-size page cache over table files with a memory budget.
+//
+// Replacement is CLOCK-sweep with usage counts: a hit raises a page's count
+// (up to MAX_USAGE), the sweeping hand lowers it, and a page is evicted when
+// it reaches zero unpinned. Pages read by sequential scans start at zero, so
+// one large scan recycles its own frames instead of flushing the hot set.
+class BufferPool {
+private:
+    struct Frame {
+        int fileId;
+        uint64_t pageNo;
+        int pinCount;
+        int usage;
+        bool dirty;
+        vector<char> data;
+    };
+
+    vector<Frame> frames;
+    unordered_map<uint64_t, int> pageTable; // (file, page) -> frame
+    size_t capacityPages;
+    size_t hand;
+
+    vector<int> fileDescriptors; // -1 once closed
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writeBacks;
+
+    mutable mutex lock;
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    static uint64_t pageKey(int fileId, uint64_t pageNo);
+    int findVictim();
+    void writeBack(Frame& frame);
+    void shrinkTo(size_t pages);
+
+public:
+    static const size_t PAGE_SIZE = 4096;
+    static const int MAX_USAGE = 5;
+
+    BufferPool(size_t capacityBytes);
+    ~BufferPool();
+
+    // Returns the file id used by the other calls, or -1
+    int openFile(const string& path);
+    // Writes back and drops the file's pages; none may be pinned
+    void closeFile(int fileId);
+
+    // The page stays in memory until the matching unpin. Bytes past the end
+    // of the file read as zero.
+    char* pin(int fileId, uint64_t pageNo, bool sequential = false);
+    void unpin(int fileId, uint64_t pageNo, bool dirty = false);
+
+    // Copies a byte range through the pool, a page at a time
+    void read(int fileId, uint64_t offset, char* dest, size_t length, bool sequential = true);
+
+    void flush();
+
+    void setCapacity(size_t capacityBytes);
+    size_t getCapacity() const;
+    BufferPoolStats getStats() const;
+};
+
+#endif
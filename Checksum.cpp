@@ -0,0 +1,26 @@
+#include "Checksum.h"
+
+struct CrcTable {
+    uint32_t values[256];
+
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            values[i] = c;
+        }
+    }
+};
+
+uint32_t Checksum::crc32(const void* data, size_t length, uint32_t seed) {
+    static const CrcTable table;
+
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint32_t c = seed ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        c = table.values[(c ^ bytes[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,13 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+class Checksum {
+public:
+    // CRC-32 (IEEE); pass the previous result as seed to continue a running checksum
+    static uint32_t crc32(const void* data, size_t length, uint32_t seed = 0);
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "Client.h"
+#include "WireProtocol.h"
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+using namespace std;
+
+Client::Client() : fd(-1) {
+}
+
+Client::~Client() {
+    close();
+}
+
+const string& Client::getDatabase() const {
+    return database;
+}
+
+bool Client::isOpen() const {
+    return fd >= 0;
+}
+
+bool Client::fail(const string& reason, string& error) {
+    error = "Error: " + reason;
+    close();
+    return false;
+}
+
+#ifndef _WIN32
+
+bool Client::connect(const string& host, int port, string& error) {
+    close();
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses = NULL;
+    int status = getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses);
+    if (status != 0) return fail(gai_strerror(status), error);
+
+    string reason = "no address for " + host;
+    for (addrinfo* address = addresses; address != NULL && fd < 0; address = address->ai_next) {
+        int candidate = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (candidate < 0) {
+            reason = strerror(errno);
+            continue;
+        }
+        if (::connect(candidate, address->ai_addr, address->ai_addrlen) == 0) {
+            fd = candidate;
+        }
+        else {
+            reason = strerror(errno);
+            ::close(candidate);
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) return fail("Could not connect to " + host + ":" + to_string(port) + ": " + reason, error);
+
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return true;
+}
+
+bool Client::send(const string& commands, string& error) {
+    if (fd < 0) return fail("Not connected", error);
+
+    string frame;
+    try {
+        WireProtocol::appendFrame(frame, commands);
+    }
+    catch (runtime_error& e) {
+        return fail(e.what(), error);
+    }
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        ssize_t written = ::send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return fail(string("Connection lost: ") + strerror(errno), error);
+        sent += (size_t)written;
+    }
+    return true;
+}
+
+bool Client::receive(string& output) {
+    if (fd < 0) return fail("Not connected", output);
+
+    string payload;
+    char chunk[64 * 1024];
+    try {
+        while (!WireProtocol::takeFrame(buffer, payload)) {
+            ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received == 0) return fail("Connection closed by the server", output);
+            if (received < 0) return fail(string("Connection lost: ") + strerror(errno), output);
+            buffer.append(chunk, (size_t)received);
+        }
+    }
+    catch (runtime_error& e) {
+        return fail(e.what(), output);
+    }
+
+    WireProtocol::ResponseStatus status;
+    if (!WireProtocol::decodeResponse(payload, status, database, output)) {
+        return fail("Malformed response", output);
+    }
+    if (status == WireProtocol::RESPONSE_CLOSED) {
+        ::close(fd);
+        fd = -1;
+        buffer.clear();
+    }
+    return true;
+}
+
+void Client::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    buffer.clear();
+}
+
+#else
+
+bool Client::connect(const string& host, int port, string& error) {
+    return fail("the client needs POSIX sockets", error);
+}
+
+bool Client::send(const string& commands, string& error) {
+    return fail("Not connected", error);
+}
+
+bool Client::receive(string& output) {
+    return fail("Not connected", output);
+}
+
+void Client::close() {
+    fd = -1;
+    buffer.clear();
+}
+
+#endif
+
+bool Client::query(const string& commands, string& output) {
+    return send(commands, output) && receive(output);
+}
@@ -0,0 +1,47 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <string>
+using namespace std;
+
+// Blocking client for the server (WireProtocol.h). Not thread-safe: use
+// one per thread.
+//
+//     Client client;
+//     string output;
+//     if (client.connect("127.0.0.1", 5433, output) && client.query("USE shop; SELECT * FROM users", output))
+//         cout << output;
+class Client {
+private:
+    int fd;
+    string database;   // the session's, as of the last response
+    string buffer;     // received, not yet a complete response
+
+    bool fail(const string& reason, string& error);
+
+    Client(const Client&);
+    Client& operator=(const Client&);
+
+public:
+    Client();
+    ~Client();
+
+    // False with the reason in error
+    bool connect(const string& host, int port, string& error);
+
+    // Sends commands (';'-separated) without waiting for their output,
+    // so several requests can be in flight on one connection
+    bool send(const string& commands, string& error);
+    // Output of the oldest request not yet received. After EXIT the
+    // server closes the session and the client is closed too.
+    bool receive(string& output);
+
+    // send() then receive(); on failure output holds the reason
+    bool query(const string& commands, string& output);
+
+    const string& getDatabase() const;
+    bool isOpen() const;
+    void close();
+};
+
+#endif
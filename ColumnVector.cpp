@@ -0,0 +1,410 @@
+#include "ColumnVector.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+ColumnVector::ColumnVector(DataType t)
+    : type(t), count(0), garbageBytes(0) {
+}
+
+DataType ColumnVector::getType() const {
+    return type;
+}
+
+int ColumnVector::size() const {
+    return count;
+}
+
+// Capacity at least doubles, so repeated batch appends stay amortized O(1)
+template <typename T>
+static void growTo(vector<T>& v, size_t n) {
+    if (n <= v.capacity()) return;
+    v.reserve(max(n, v.capacity() * 2));
+}
+
+void ColumnVector::reserve(int rows) {
+    if (type == INT) growTo(ints, rows);
+    else if (type == FLOAT) growTo(doubles, rows);
+    else {
+        growTo(offsets, rows);
+        growTo(lengths, rows);
+    }
+    growTo(nullBits, (rows + 63) / 64);
+}
+
+void ColumnVector::reserve(int rows, size_t textBytes) {
+    reserve(rows);
+    if (type == VARCHAR) growTo(bytes, textBytes);
+}
+
+bool ColumnVector::hasRoom(int rows, size_t textBytes) const {
+    size_t needed = (size_t)count + rows;
+    if ((needed + 63) / 64 > nullBits.capacity()) return false;
+    if (type == INT) return needed <= ints.capacity();
+    if (type == FLOAT) return needed <= doubles.capacity();
+    return needed <= offsets.capacity() && needed <= lengths.capacity() &&
+        bytes.size() + textBytes <= bytes.capacity();
+}
+
+void ColumnVector::clear() {
+    count = 0;
+    ints.clear();
+    doubles.clear();
+    offsets.clear();
+    lengths.clear();
+    bytes.clear();
+    garbageBytes = 0;
+    nullBits.clear();
+}
+
+bool ColumnVector::parseInt(const string& value, int64_t& result) {
+    if (value.empty()) return false;
+    char* end;
+    errno = 0;
+    long long parsed = strtoll(value.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE) return false;
+    result = parsed;
+    return true;
+}
+
+bool ColumnVector::parseDouble(const string& value, double& result) {
+    if (value.empty()) return false;
+    char* end;
+    double parsed = strtod(value.c_str(), &end);
+    if (*end != '\0') return false;
+    result = parsed;
+    return true;
+}
+
+// Shortest of %.15g / %.17g that reads back as the same double
+string ColumnVector::formatDouble(double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", value);
+    if (strtod(buf, NULL) != value) {
+        snprintf(buf, sizeof(buf), "%.17g", value);
+    }
+    return buf;
+}
+
+void ColumnVector::setNull(int row, bool isNull) {
+    uint64_t mask = (uint64_t)1 << (row % 64);
+    NullWord& word = nullBits[row / 64];
+    if (isNull) word.set(mask);
+    else if (word.load() & mask) word.clear(mask);
+}
+
+bool ColumnVector::isNull(int row) const {
+    return (nullBits[row / 64].load() >> (row % 64)) & 1;
+}
+
+void ColumnVector::storeText(int row, const string& value) {
+    offsets[row] = bytes.size();
+    lengths[row] = (uint32_t)value.size();
+    bytes.insert(bytes.end(), value.begin(), value.end());
+}
+
+void ColumnVector::append(const string& value) {
+    int row = count++;
+    if (row % 64 == 0) nullBits.push_back(0);
+
+    if (type == INT) {
+        int64_t v = 0;
+        bool ok = parseInt(value, v);
+        ints.push_back(ok ? v : 0);
+        setNull(row, !ok);
+    }
+    else if (type == FLOAT) {
+        double v = 0;
+        bool ok = parseDouble(value, v);
+        doubles.push_back(ok ? v : 0);
+        setNull(row, !ok);
+    }
+    else {
+        offsets.push_back(0);
+        lengths.push_back(0);
+        storeText(row, value);
+        setNull(row, value.empty());
+    }
+}
+
+void ColumnVector::appendInt(int64_t value) {
+    int row = count++;
+    if (row % 64 == 0) nullBits.push_back(0);
+    ints.push_back(value);
+    setNull(row, false);
+}
+
+void ColumnVector::appendDouble(double value) {
+    int row = count++;
+    if (row % 64 == 0) nullBits.push_back(0);
+    doubles.push_back(value);
+    setNull(row, false);
+}
+
+void ColumnVector::appendText(const char* data, uint32_t length) {
+    int row = count++;
+    if (row % 64 == 0) nullBits.push_back(0);
+    offsets.push_back(bytes.size());
+    lengths.push_back(length);
+    bytes.insert(bytes.end(), data, data + length);
+    setNull(row, length == 0);
+}
+
+void ColumnVector::appendNull() {
+    int row = count++;
+    if (row % 64 == 0) nullBits.push_back(0);
+    if (type == INT) ints.push_back(0);
+    else if (type == FLOAT) doubles.push_back(0);
+    else {
+        offsets.push_back(bytes.size());
+        lengths.push_back(0);
+    }
+    setNull(row, true);
+}
+
+void ColumnVector::appendFrom(const ColumnVector& source, int row) {
+    if (source.isNull(row)) {
+        appendNull();
+    }
+    else if (type == INT) {
+        appendInt(source.ints[row]);
+    }
+    else if (type == FLOAT) {
+        appendDouble(source.doubles[row]);
+    }
+    else if (&source == this) {
+        // the bytes may move while they are copied
+        string value(bytes.data() + offsets[row], lengths[row]);
+        appendText(value.data(), (uint32_t)value.size());
+    }
+    else {
+        appendText(source.bytes.data() + source.offsets[row], source.lengths[row]);
+    }
+}
+
+void ColumnVector::appendFrom(const ColumnVector& source, int begin, int end) {
+    if (type == INT) {
+        ints.insert(ints.end(), source.ints.begin() + begin, source.ints.begin() + end);
+    }
+    else if (type == FLOAT) {
+        doubles.insert(doubles.end(), source.doubles.begin() + begin, source.doubles.begin() + end);
+    }
+    else {
+        for (int r = begin; r < end; r++) {
+            offsets.push_back(bytes.size());
+            lengths.push_back(source.lengths[r]);
+            bytes.insert(bytes.end(), source.bytes.begin() + source.offsets[r],
+                source.bytes.begin() + source.offsets[r] + source.lengths[r]);
+        }
+    }
+    for (int r = begin; r < end; r++) {
+        int row = count++;
+        if (row % 64 == 0) nullBits.push_back(0);
+        if (source.isNull(r)) setNull(row, true);
+    }
+}
+
+void ColumnVector::set(int row, const string& value) {
+    if (type == INT) {
+        int64_t v = 0;
+        bool ok = parseInt(value, v);
+        ints[row] = ok ? v : 0;
+        setNull(row, !ok);
+    }
+    else if (type == FLOAT) {
+        double v = 0;
+        bool ok = parseDouble(value, v);
+        doubles[row] = ok ? v : 0;
+        setNull(row, !ok);
+    }
+    else {
+        // The old bytes stay in the buffer until there is enough garbage to compact
+        garbageBytes += lengths[row];
+        storeText(row, value);
+        setNull(row, value.empty());
+        if (garbageBytes > bytes.size() / 2 && garbageBytes > 4096) {
+            compactBytes();
+        }
+    }
+}
+
+string ColumnVector::getString(int row) const {
+    if (isNull(row)) return "";
+
+    if (type == INT) return to_string((long long)ints[row]);
+    if (type == FLOAT) return formatDouble(doubles[row]);
+    return string(bytes.data() + offsets[row], lengths[row]);
+}
+
+void ColumnVector::appendString(int row, string& out) const {
+    if (isNull(row)) return;
+
+    if (type == INT) {
+        char buf[24];
+        char* end = buf + sizeof(buf);
+        char* p = end;
+        int64_t value = ints[row];
+        uint64_t magnitude = (value < 0) ? 0 - (uint64_t)value : (uint64_t)value;
+        do {
+            *--p = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) *--p = '-';
+        out.append(p, end - p);
+    }
+    else if (type == FLOAT) {
+        out += formatDouble(doubles[row]);
+    }
+    else {
+        out.append(bytes.data() + offsets[row], lengths[row]);
+    }
+}
+
+int64_t ColumnVector::getInt(int row) const {
+    return ints[row];
+}
+
+double ColumnVector::getDouble(int row) const {
+    return doubles[row];
+}
+
+double ColumnVector::getNumber(int row) const {
+    return (type == INT) ? (double)ints[row] : doubles[row];
+}
+
+const char* ColumnVector::getText(int row, uint32_t& length) const {
+    length = lengths[row];
+    return bytes.data() + offsets[row];
+}
+
+const int64_t* ColumnVector::intData() const {
+    return ints.data();
+}
+
+const double* ColumnVector::doubleData() const {
+    return doubles.data();
+}
+
+const ColumnVector::NullWord* ColumnVector::nullData() const {
+    return nullBits.data();
+}
+
+void ColumnVector::compactBytes() {
+    vector<char> packed;
+    packed.reserve(bytes.size() - garbageBytes);
+    for (int r = 0; r < count; r++) {
+        uint64_t start = packed.size();
+        packed.insert(packed.end(), bytes.begin() + offsets[r], bytes.begin() + offsets[r] + lengths[r]);
+        offsets[r] = start;
+    }
+    bytes.swap(packed);
+    garbageBytes = 0;
+}
+
+void ColumnVector::compact(const vector<int>& newPositions, int newCount) {
+    vector<uint64_t> newNulls((newCount + 63) / 64, 0);
+
+    for (int r = 0; r < count; r++) {
+        int pos = newPositions[r];
+        if (pos == -1) {
+            if (type == VARCHAR) garbageBytes += lengths[r];
+            continue;
+        }
+
+        if (isNull(r)) newNulls[pos / 64] |= (uint64_t)1 << (pos % 64);
+
+        if (type == INT) ints[pos] = ints[r];
+        else if (type == FLOAT) doubles[pos] = doubles[r];
+        else {
+            offsets[pos] = offsets[r];
+            lengths[pos] = lengths[r];
+        }
+    }
+
+    count = newCount;
+    nullBits.assign(newNulls.begin(), newNulls.end());
+    if (type == INT) ints.resize(newCount);
+    else if (type == FLOAT) doubles.resize(newCount);
+    else {
+        offsets.resize(newCount);
+        lengths.resize(newCount);
+        if (garbageBytes > bytes.size() / 2) compactBytes();
+    }
+}
+
+size_t ColumnVector::memoryUsage() const {
+    return ints.capacity() * sizeof(int64_t)
+        + doubles.capacity() * sizeof(double)
+        + offsets.capacity() * sizeof(uint64_t)
+        + lengths.capacity() * sizeof(uint32_t)
+        + bytes.capacity()
+        + nullBits.capacity() * sizeof(NullWord);
+}
+
+void ColumnVector::encode(string& out) const {
+    if (type == INT) {
+        out.append((const char*)ints.data(), ints.size() * sizeof(int64_t));
+    }
+    else if (type == FLOAT) {
+        out.append((const char*)doubles.data(), doubles.size() * sizeof(double));
+    }
+    else {
+        out.append((const char*)lengths.data(), lengths.size() * sizeof(uint32_t));
+        for (int r = 0; r < count; r++) {
+            out.append(bytes.data() + offsets[r], lengths[r]);
+        }
+    }
+    for (size_t w = 0; w < nullBits.size(); w++) {
+        uint64_t word = nullBits[w].load();
+        out.append((const char*)&word, sizeof(word));
+    }
+}
+
+void ColumnVector::decode(const char* data, size_t length, int rows) {
+    clear();
+
+    size_t nullWords = (rows + 63) / 64;
+    size_t nullLength = nullWords * sizeof(uint64_t);
+    size_t valueWidth = (type == VARCHAR) ? sizeof(uint32_t) : sizeof(int64_t);
+    if (length < (size_t)rows * valueWidth + nullLength) {
+        throw runtime_error("Column data is truncated");
+    }
+
+    if (type == INT) {
+        ints.resize(rows);
+        memcpy(ints.data(), data, rows * sizeof(int64_t));
+    }
+    else if (type == FLOAT) {
+        doubles.resize(rows);
+        memcpy(doubles.data(), data, rows * sizeof(double));
+    }
+    else {
+        lengths.resize(rows);
+        memcpy(lengths.data(), data, rows * sizeof(uint32_t));
+
+        offsets.resize(rows);
+        uint64_t total = 0;
+        for (int r = 0; r < rows; r++) {
+            offsets[r] = total;
+            total += lengths[r];
+        }
+        if (length != rows * sizeof(uint32_t) + total + nullLength) {
+            throw runtime_error("Column data is truncated");
+        }
+        bytes.assign(data + rows * sizeof(uint32_t), data + rows * sizeof(uint32_t) + total);
+    }
+
+    const char* nulls = data + length - nullLength;
+    nullBits.reserve(nullWords);
+    for (size_t w = 0; w < nullWords; w++) {
+        uint64_t word;
+        memcpy(&word, nulls + w * sizeof(uint64_t), sizeof(word));
+        nullBits.push_back(word);
+    }
+    count = rows;
+}
@@ -0,0 +1,116 @@
+#ifndef COLUMNVECTOR_H
+#define COLUMNVECTOR_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+#include "Column.h"
+
+// Contiguous storage for one column of a table:
+//   INT     -> int64_t array
+//   FLOAT   -> double array
+//   VARCHAR -> (offset, length) per value into one byte buffer
+// plus a null bitmap. An empty or unparsable value is stored as NULL and
+// reads back as "" (numeric NULLs hold 0 in the array).
+class ColumnVector {
+public:
+    // One word of the null bitmap. Snapshot readers test the bits of
+    // committed rows while a writer sets the bit of a row it appends to
+    // the same word, so the word is only accessed atomically. Relaxed is
+    // enough: rows are published by their commit stamps, not the bitmap.
+    class NullWord {
+    private:
+        atomic<uint64_t> bits;
+
+    public:
+        NullWord(uint64_t value = 0) : bits(value) {}
+        NullWord(const NullWord& other) : bits(other.load()) {}
+        NullWord& operator=(const NullWord& other) {
+            bits.store(other.load(), memory_order_relaxed);
+            return *this;
+        }
+
+        uint64_t load() const { return bits.load(memory_order_relaxed); }
+        void set(uint64_t mask) { bits.fetch_or(mask, memory_order_relaxed); }
+        void clear(uint64_t mask) { bits.fetch_and(~mask, memory_order_relaxed); }
+    };
+
+private:
+    DataType type;
+    int count;
+
+    vector<int64_t> ints;
+    vector<double> doubles;
+
+    vector<uint64_t> offsets;
+    vector<uint32_t> lengths;
+    vector<char> bytes;
+    size_t garbageBytes; // bytes no longer referenced after updates
+
+    vector<NullWord> nullBits;
+
+    void setNull(int row, bool isNull);
+    void storeText(int row, const string& value);
+    void compactBytes();
+
+public:
+    ColumnVector(DataType t);
+
+    DataType getType() const;
+    int size() const;
+
+    void reserve(int rows);
+    // Room for `rows` rows and `textBytes` bytes of text in all
+    void reserve(int rows, size_t textBytes);
+    // Whether `rows` more rows holding `textBytes` bytes of text fit
+    // without moving any array, so readers of the rows already there are
+    // not disturbed by the appends
+    bool hasRoom(int rows, size_t textBytes) const;
+    void clear();
+
+    void append(const string& value);
+    // Typed appends, for values that are already in the column's type
+    void appendInt(int64_t value);
+    void appendDouble(double value);
+    void appendText(const char* data, uint32_t length);  // empty is NULL, as with append
+    void appendNull();
+    // Copies rows of a column of the same type (this one included)
+    void appendFrom(const ColumnVector& source, int row);
+    void appendFrom(const ColumnVector& source, int begin, int end);
+    void set(int row, const string& value);
+
+    bool isNull(int row) const;
+    string getString(int row) const;
+    // Same text as getString, appended without a temporary (nothing for NULL)
+    void appendString(int row, string& out) const;
+
+    // Typed access; getNumber works for INT and FLOAT columns
+    int64_t getInt(int row) const;
+    double getDouble(int row) const;
+    double getNumber(int row) const;
+    const char* getText(int row, uint32_t& length) const;
+
+    const int64_t* intData() const;
+    const double* doubleData() const;
+    const NullWord* nullData() const;  // bit row % 64 of word row / 64
+
+    // Keeps the rows whose newPositions entry is not -1, moving them there
+    void compact(const vector<int>& newPositions, int newCount);
+
+    size_t memoryUsage() const;
+
+    // On-disk encoding (host byte order, little-endian in practice):
+    //   INT int64 x n | FLOAT double x n | VARCHAR u32 length x n + bytes
+    // followed by the null bitmap as u64 words.
+    void encode(string& out) const;
+    void decode(const char* data, size_t length, int rows);
+
+    static string formatDouble(double value);
+    static bool parseInt(const string& value, int64_t& result);
+    static bool parseDouble(const string& value, double& result);
+};
+
+#endif
@@ -4,23 +4,17 @@
 using namespace std;
 
 Condition::Condition(string col, string operation, string val)
-    : columnName(col), op(operation), value(val) {
+    : kind(CONDITION_COMPARE), columnName(col), op(operation), value(val) {
+}
+
+Condition::Condition(ConditionKind conditionKind)
+    : kind(conditionKind) {
 }
 
 bool Condition::evaluate(const string& actualValue, DataType type) const {
 
     if (type == INT || type == FLOAT) {
-        double actual = atof(actualValue.c_str());
-        double expected = atof(value.c_str());
-
-        if (op == "=")  return actual == expected;
-        if (op == "!=") return actual != expected;
-        if (op == "<")  return actual < expected;
-        if (op == ">")  return actual > expected;
-        if (op == "<=") return actual <= expected;
-        if (op == ">=") return actual >= expected;
-
-        return false;
+        return evaluateNumber(atof(actualValue.c_str()));
     }
 
     if (op == "=")  return actualValue == value;
@@ -32,3 +26,80 @@ bool Condition::evaluate(const string& actualValue, DataType type) const {
 
     return false;
 }
+
+bool Condition::evaluateNumber(double actual) const {
+    double expected = atof(value.c_str());
+
+    if (op == "=")  return actual == expected;
+    if (op == "!=") return actual != expected;
+    if (op == "<")  return actual < expected;
+    if (op == ">")  return actual > expected;
+    if (op == "<=") return actual <= expected;
+    if (op == ">=") return actual >= expected;
+
+    return false;
+}
+
+void Condition::getLeaves(vector<Condition*>& leaves) {
+    if (kind == CONDITION_COMPARE || kind == CONDITION_IN) {
+        leaves.push_back(this);
+        return;
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+        children[i].getLeaves(leaves);
+    }
+}
+
+void Condition::getLeaves(vector<const Condition*>& leaves) const {
+    if (kind == CONDITION_COMPARE || kind == CONDITION_IN) {
+        leaves.push_back(this);
+        return;
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+        children[i].getLeaves(leaves);
+    }
+}
+
+// Numbers as written, anything else quoted
+static string quoteValue(const string& value) {
+    char* end = NULL;
+    if (!value.empty()) strtod(value.c_str(), &end);
+    if (end != NULL && *end == '\0') return value;
+
+    string quoted = "'";
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '\'') quoted += '\'';
+        quoted += value[i];
+    }
+    return quoted + "'";
+}
+
+string Condition::toString() const {
+    if (kind == CONDITION_COMPARE) {
+        return columnName + " " + op + " " + quoteValue(value);
+    }
+    if (kind == CONDITION_IN) {
+        string text = columnName + " " + op + " (";
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0) text += ", ";
+            text += quoteValue(values[i]);
+        }
+        return text + ")";
+    }
+
+    string text = "(";
+    for (size_t i = 0; i < children.size(); i++) {
+        if (i > 0) text += (kind == CONDITION_AND) ? " AND " : " OR ";
+        text += children[i].toString();
+    }
+    return text + ")";
+}
+
+string Condition::toString(const vector<Condition>& conditions) {
+    string text;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        if (i > 0) text += " AND ";
+        text += conditions[i].toString();
+    }
+    return text;
+}
@@ -2,19 +2,43 @@
 #define CONDITION_H
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "Column.h"
 
+enum ConditionKind {
+    CONDITION_COMPARE,  // columnName op value
+    CONDITION_IN,       // columnName IN values; op is "IN" or "NOT IN"
+    CONDITION_AND,      // every child holds
+    CONDITION_OR        // some child holds
+};
+
+// One WHERE condition. A query's conditions are a list that is ANDed;
+// each entry is a comparison, an IN list, or an AND/OR of nested
+// conditions. NOT and BETWEEN are rewritten into these by the parser.
 class Condition {
 public:
+    ConditionKind kind;
     string columnName;
     string op;
     string value;
+    vector<string> values;         // IN
+    vector<Condition> children;    // AND, OR
 
     Condition(string col, string operation, string val);
+    explicit Condition(ConditionKind conditionKind);
 
     bool evaluate(const string& actualValue, DataType type) const;
+    bool evaluateNumber(double actual) const;
+
+    // The comparisons and IN lists of this condition, in the order written
+    void getLeaves(vector<Condition*>& leaves);
+    void getLeaves(vector<const Condition*>& leaves) const;
+
+    // As SQL, for EXPLAIN: a = 5, name IN ('a', 'b'), (x < 1 OR y > 2)
+    string toString() const;
+    static string toString(const vector<Condition>& conditions);  // ANDed
 };
 
 #endif
@@ -0,0 +1,246 @@
+#include "CsvLoader.h"
+#include "DatabaseEngine.h"
+#include "ThreadPool.h"
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+
+CsvLoader::CsvLoader(const vector<Column>& tableColumns, char fieldDelimiter, bool hasHeader, int workerCount)
+    : columns(tableColumns), delimiter(fieldDelimiter), header(hasHeader),
+      threads(workerCount < 1 ? 1 : workerCount), position(NULL), linesBefore(0), rejected(0) {
+}
+
+bool CsvLoader::open(const string& path) {
+    if (!file.open(path)) return false;
+    position = file.getData();
+
+    if (header) {
+        vector<string> fields;
+        string error;
+        const char* end = file.getData() + file.getSize();
+        while (position < end && !parseRecord(position, end, fields, linesBefore, error)) {
+        }
+    }
+    return true;
+}
+
+// The quote state is tracked from the start of the chunk, so a newline
+// inside a quoted field never ends a chunk
+const char* CsvLoader::findChunkEnd(const char* from) const {
+    const char* end = file.getData() + file.getSize();
+    if ((size_t)(end - from) <= CHUNK_BYTES) return end;
+
+    const char* target = from + CHUNK_BYTES;
+    bool quoted = false;
+    const char* p = from;
+    while (true) {
+        const char* quote = (const char*)memchr(p, '"', target - p);
+        if (quote == NULL) break;
+        quoted = !quoted;
+        p = quote + 1;
+    }
+
+    for (p = target; p < end; p++) {
+        if (*p == '"') quoted = !quoted;
+        else if (*p == '\n' && !quoted) return p + 1;
+    }
+    return end;
+}
+
+// Splits one record starting at p and moves p past its newline; returns
+// false for a blank line. Quoted fields may hold delimiters, newlines and
+// "" for a quote; unquoted fields are trimmed like INSERT values.
+bool CsvLoader::parseRecord(const char*& p, const char* end, vector<string>& fields, int& lines, string& error) const {
+    fields.clear();
+    error.clear();
+
+    const char* q = p;
+    while (q < end && *q != delimiter && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+    if (q == end || *q == '\n') {
+        p = (q < end) ? q + 1 : end;
+        lines++;
+        return false;
+    }
+
+    while (true) {
+        while (p < end && *p != delimiter && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+
+        string field;
+        if (p < end && *p == '"') {
+            p++;
+            while (true) {
+                const char* quote = (const char*)memchr(p, '"', end - p);
+                if (quote == NULL) {
+                    lines += (int)count(p, end, '\n') + 1;
+                    p = end;
+                    error = "Unterminated quoted field";
+                    return true;
+                }
+                lines += (int)count(p, quote, '\n');
+                field.append(p, quote);
+                p = quote + 1;
+                if (p < end && *p == '"') {
+                    field += '"';
+                    p++;
+                    continue;
+                }
+                break;
+            }
+            while (p < end && *p != delimiter && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+            if (p < end && *p != delimiter && *p != '\n') {
+                error = "Unexpected text after a quoted field";
+                while (p < end && *p != '\n') p++;
+                if (p < end) p++;
+                lines++;
+                return true;
+            }
+        }
+        else {
+            const char* start = p;
+            while (p < end && *p != delimiter && *p != '\n') p++;
+            const char* stop = p;
+            while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t' || stop[-1] == '\r')) stop--;
+            field.assign(start, stop);
+        }
+        fields.push_back(field);
+
+        if (p < end && *p == delimiter) {
+            p++;
+            continue;
+        }
+        if (p < end) p++; // the newline
+        lines++;
+        return true;
+    }
+}
+
+// Same checks and messages as INSERT, minus the primary key, which needs
+// the whole table and is checked by the caller
+bool CsvLoader::checkRow(const vector<string>& fields, string& error) const {
+    if (fields.size() != columns.size()) {
+        error = "Expected " + to_string(columns.size()) + " values but got " + to_string(fields.size());
+        return false;
+    }
+
+    for (int c = 0; c < (int)columns.size(); c++) {
+        const Column& col = columns[c];
+        const string& value = fields[c];
+
+        if (col.getIsNotNull() && value.empty()) {
+            error = "Column '" + col.getName() + "' cannot be NULL";
+            return false;
+        }
+        if (col.getType() == INT) {
+            if (!DatabaseEngine::isValidInt(value)) {
+                error = "Column '" + col.getName() + "' expects INT but got '" + value + "'";
+                return false;
+            }
+        }
+        else if (col.getType() == FLOAT) {
+            if (!DatabaseEngine::isValidFloat(value)) {
+                error = "Column '" + col.getName() + "' expects FLOAT but got '" + value + "'";
+                return false;
+            }
+        }
+        else if (col.getType() == VARCHAR) {
+            if ((int)value.length() > col.getSize()) {
+                error = "Column '" + col.getName() + "' VARCHAR(" + to_string(col.getSize()) +
+                    ") exceeded. Got " + to_string(value.length()) + " characters";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Runs on a pool thread; touches only its own chunk
+void CsvLoader::parseChunk(Chunk* chunk) {
+    const char* p = chunk->begin;
+    vector<string> fields;
+    string error;
+
+    while (p < chunk->end) {
+        int line = chunk->lineCount + 1;
+        if (!parseRecord(p, chunk->end, fields, chunk->lineCount, error)) continue;
+
+        if (error.empty() && checkRow(fields, error)) {
+            chunk->rows.push_back(vector<string>());
+            chunk->rows.back().swap(fields);
+            chunk->lines.push_back(line);
+            continue;
+        }
+
+        chunk->rejected++;
+        if ((int)chunk->errors.size() < MAX_ERRORS) {
+            chunk->errors.push_back(make_pair(line, error));
+        }
+    }
+}
+
+void CsvLoader::parseChunkTask(void* context, int index) {
+    ChunkBatch* batch = (ChunkBatch*)context;
+    batch->loader->parseChunk(&(*batch->chunks)[index]);
+}
+
+bool CsvLoader::next(vector<vector<string> >& rows, vector<int>& lines) {
+    rows.clear();
+    lines.clear();
+
+    const char* end = file.getData() + file.getSize();
+    if (position == NULL || position >= end) return false;
+
+    vector<Chunk> chunks;
+    while ((int)chunks.size() < threads && position < end) {
+        Chunk chunk;
+        chunk.begin = position;
+        chunk.end = findChunkEnd(position);
+        chunk.lineCount = 0;
+        chunk.rejected = 0;
+        chunks.push_back(chunk);
+        position = chunk.end;
+    }
+
+    ChunkBatch batch;
+    batch.loader = this;
+    batch.chunks = &chunks;
+    ThreadPool::shared().run(parseChunkTask, &batch, (int)chunks.size());
+
+    // Chunks are merged in file order, so rows keep the order of the file
+    for (int i = 0; i < (int)chunks.size(); i++) {
+        Chunk& chunk = chunks[i];
+        rows.insert(rows.end(), make_move_iterator(chunk.rows.begin()), make_move_iterator(chunk.rows.end()));
+        for (int r = 0; r < (int)chunk.lines.size(); r++) {
+            lines.push_back(linesBefore + chunk.lines[r]);
+        }
+
+        rejected += chunk.rejected;
+        for (int e = 0; e < (int)chunk.errors.size(); e++) {
+            if ((int)errors.size() < MAX_ERRORS) {
+                errors.push_back("Line " + to_string(linesBefore + chunk.errors[e].first) + ": " + chunk.errors[e].second);
+            }
+        }
+        linesBefore += chunk.lineCount;
+    }
+    return true;
+}
+
+void CsvLoader::reject(int line, const string& message) {
+    rejected++;
+    if ((int)errors.size() < MAX_ERRORS) {
+        errors.push_back("Line " + to_string(line) + ": " + message);
+    }
+}
+
+int CsvLoader::getRejected() const {
+    return rejected;
+}
+
+const vector<string>& CsvLoader::getErrors() const {
+    return errors;
+}
+
+size_t CsvLoader::getFileSize() const {
+    return file.getSize();
+}
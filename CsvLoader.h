@@ -0,0 +1,76 @@
+#ifndef CSVLOADER_H
+#define CSVLOADER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+using namespace std;
+
+#include "Column.h"
+#include "MappedFile.h"
+
+// Reads a CSV file for COPY against a table's columns.
+//
+// The file is memory-mapped and cut into CHUNK_BYTES pieces at record
+// boundaries (a newline outside double quotes). Each call to next() parses
+// and type-checks up to `threads` chunks at once on the shared thread
+// pool and returns their valid rows in file order. Bad records are counted and
+// the first MAX_ERRORS are kept for the report.
+class CsvLoader {
+private:
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        vector<vector<string> > rows;
+        vector<int> lines;                     // chunk-relative, per row
+        vector<pair<int, string> > errors;     // chunk-relative line, message
+        int lineCount;
+        int rejected;
+    };
+
+    struct ChunkBatch {
+        CsvLoader* loader;
+        vector<Chunk>* chunks;
+    };
+
+    const vector<Column>& columns;
+    char delimiter;
+    bool header;
+    int threads;
+
+    MappedFile file;
+    const char* position;
+    int linesBefore;    // lines in the chunks already returned
+
+    int rejected;
+    vector<string> errors;
+
+    const char* findChunkEnd(const char* from) const;
+    void parseChunk(Chunk* chunk);
+    static void parseChunkTask(void* context, int index);
+    bool parseRecord(const char*& p, const char* end, vector<string>& fields, int& lines, string& error) const;
+    bool checkRow(const vector<string>& fields, string& error) const;
+
+    CsvLoader(const CsvLoader&);
+    CsvLoader& operator=(const CsvLoader&);
+
+public:
+    static const size_t CHUNK_BYTES = 4 * 1024 * 1024;
+    static const int MAX_ERRORS = 5;
+
+    CsvLoader(const vector<Column>& tableColumns, char fieldDelimiter, bool hasHeader, int workerCount);
+
+    bool open(const string& path);
+
+    // Next batch of valid rows and their line numbers; false at end of file
+    bool next(vector<vector<string> >& rows, vector<int>& lines);
+
+    // Counts a row that passed parsing but was refused later (e.g. a duplicate key)
+    void reject(int line, const string& message);
+
+    int getRejected() const;
+    const vector<string>& getErrors() const;
+    size_t getFileSize() const;
+};
+
+#endif
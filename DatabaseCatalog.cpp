@@ -0,0 +1,100 @@
+#include "DatabaseCatalog.h"
+#include "FileSystem.h"
+#include <algorithm>
+
+using namespace std;
+
+static const char* MASTER_DATABASE = "master";
+
+DatabaseCatalog::DatabaseCatalog(const string& folder)
+    : baseFolder(folder) {
+    if (!FileSystem::directoryExists(baseFolder)) FileSystem::createDirectory(baseFolder);
+    if (!exists(MASTER_DATABASE)) create(MASTER_DATABASE);
+}
+
+DatabaseCatalog::~DatabaseCatalog() {
+    for (map<string, Database*>::iterator it = openDatabases.begin(); it != openDatabases.end(); ++it) {
+        it->second->engine.saveToDisk(fileOf(it->first));
+        delete it->second;
+    }
+}
+
+bool DatabaseCatalog::isValidName(const string& name) {
+    if (name.empty() || name.size() > MAX_NAME_LENGTH) return false;
+    if (name == "." || name == "..") return false;
+    return name.find_first_of("/\\") == string::npos;
+}
+
+string DatabaseCatalog::folderOf(const string& name) const {
+    return FileSystem::joinPath(baseFolder, name);
+}
+
+string DatabaseCatalog::fileOf(const string& name) const {
+    return FileSystem::joinPath(folderOf(name), "database.db");
+}
+
+bool DatabaseCatalog::exists(const string& name) {
+    return isValidName(name) && FileSystem::directoryExists(folderOf(name));
+}
+
+bool DatabaseCatalog::create(const string& name) {
+    if (!isValidName(name)) return false;
+    lock_guard<mutex> guard(lock);
+    if (FileSystem::directoryExists(folderOf(name))) return false;
+    return FileSystem::createDirectory(folderOf(name));
+}
+
+void DatabaseCatalog::list(vector<string>& names) {
+    names.clear();
+    FileSystem::listDirectories(baseFolder, names);
+    sort(names.begin(), names.end());
+}
+
+DatabaseCatalog::DropResult DatabaseCatalog::drop(const string& name) {
+    if (!isValidName(name)) return DROP_INVALID;
+    lock_guard<mutex> guard(lock);
+    if (!FileSystem::directoryExists(folderOf(name))) return DROP_MISSING;
+    if (openDatabases.count(name) > 0) return DROP_IN_USE;
+    // the folder itself could be a link out of the base folder
+    if (!FileSystem::isWithin(baseFolder, folderOf(name))) return DROP_FAILED;
+    return FileSystem::removeDirectory(folderOf(name)) ? DROP_OK : DROP_FAILED;
+}
+
+DatabaseCatalog::Database* DatabaseCatalog::open(const string& name) {
+    if (!isValidName(name)) return NULL;
+    lock_guard<mutex> guard(lock);
+    map<string, Database*>::iterator it = openDatabases.find(name);
+    if (it != openDatabases.end()) {
+        it->second->users++;
+        return it->second;
+    }
+    if (!FileSystem::directoryExists(folderOf(name))) return NULL;
+
+    Database* database = new Database();
+    database->name = name;
+    database->users = 1;
+    try {
+        database->engine.loadFromDisk(fileOf(name));
+    }
+    catch (...) {
+        delete database;
+        throw;
+    }
+    openDatabases[name] = database;
+    return database;
+}
+
+void DatabaseCatalog::close(Database* database) {
+    // The checkpoint is written under the catalog lock, so a session
+    // reopening the database waits for it instead of loading a stale file
+    lock_guard<mutex> guard(lock);
+    if (--database->users > 0) return;
+
+    openDatabases.erase(database->name);
+    database->engine.saveToDisk(fileOf(database->name));
+    delete database;
+}
+
+void DatabaseCatalog::checkpoint(Database* database) {
+    database->engine.saveToDisk(fileOf(database->name));
+}
@@ -0,0 +1,73 @@
+#ifndef DATABASECATALOG_H
+#define DATABASECATALOG_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+using namespace std;
+
+#include "DatabaseEngine.h"
+
+// The databases under one folder (one subfolder each) and the engines of
+// those in use. A database is loaded when its first session opens it and
+// checkpointed and closed when its last session leaves, so the REPL's
+// USE still saves the database it leaves.
+//
+// Sessions sharing a database run their statements on its engine
+// concurrently; the engine does its own locking.
+class DatabaseCatalog {
+public:
+    struct Database {
+        string name;
+        DatabaseEngine engine;
+        int users;    // sessions that opened it
+    };
+
+    enum DropResult {
+        DROP_OK,
+        DROP_INVALID, // not a valid database name
+        DROP_MISSING,
+        DROP_IN_USE,  // another session has it open
+        DROP_FAILED   // the folder could not be removed
+    };
+
+private:
+    string baseFolder;
+    map<string, Database*> openDatabases;
+    mutex lock;   // guards openDatabases and the users counts
+
+    DatabaseCatalog(const DatabaseCatalog&);
+    DatabaseCatalog& operator=(const DatabaseCatalog&);
+
+public:
+    // Creates the folder and its "master" database when missing
+    explicit DatabaseCatalog(const string& folder);
+    // Checkpoints and closes the databases still open
+    ~DatabaseCatalog();
+
+    // Names become folder names under the base folder, so "", ".", ".."
+    // and names holding a path separator or longer than MAX_NAME_LENGTH
+    // are refused by every method below
+    static const size_t MAX_NAME_LENGTH = 64;
+    static bool isValidName(const string& name);
+
+    string folderOf(const string& name) const;
+    string fileOf(const string& name) const;
+
+    bool exists(const string& name);
+    bool create(const string& name);
+    // Sorted names
+    void list(vector<string>& names);
+    DropResult drop(const string& name);
+
+    // The database, loaded if no session has it open; NULL if it does not
+    // exist or the name is invalid. Every open() is paired with a close().
+    Database* open(const string& name);
+    void close(Database* database);
+
+    // Writes a checkpoint of an open database
+    void checkpoint(Database* database);
+};
+
+#endif
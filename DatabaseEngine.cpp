@@ -4,21 +4,49 @@
 #include "Condition.h"
 #include "Column.h"
 #include "Row.h"
+#include "FileSystem.h"
+#include "BinaryFormat.h"
+#include "MappedFile.h"
+#include "PagedScan.h"
+#include "CsvLoader.h"
+#include "ThreadPool.h"
+#include "ResultSink.h"
+#include "HashAggregate.h"
+#include "ExternalSort.h"
+#include "HashJoin.h"
+#include "QueryPlan.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
 using namespace std;
 
-DatabaseEngine::DatabaseEngine() {
+// chrono::milliseconds binds it by reference
+const int DatabaseEngine::COLLECT_INTERVAL_MS;
+
+DatabaseEngine::DatabaseEngine()
+    : checkpointBytes(64 * 1024 * 1024), bufferPool(64 * 1024 * 1024),
+    sortMemory(64 * 1024 * 1024), joinMemory(64 * 1024 * 1024),
+    catalogVersion(0), stopping(false) {
+    collector = thread(&DatabaseEngine::collectorLoop, this);
 }
 
 DatabaseEngine::~DatabaseEngine() {
-    map<string, Table*>::iterator it;
-    for (it = tables.begin(); it != tables.end(); ++it) {
-        delete it->second;
+    {
+        lock_guard<mutex> guard(collectorLock);
+        stopping = true;
     }
-    tables.clear();
+    collectorWake.notify_all();
+    collector.join();
+
+    wal.close();
+    clearTables();
+    versions.reclaim();
 }
 
 bool DatabaseEngine::isValidInt(const string& str) {
@@ -62,7 +90,74 @@ bool DatabaseEngine::isValidFloat(const string& str) {
     return hasDigit;
 }
 
+// A comparison is logged as column, op, value. An IN list is column, op,
+// the value count and the values; an AND or OR is an empty column, the
+// kind, the child count and the children.
+static void appendCondition(vector<string>& fields, const Condition& condition) {
+    if (condition.kind == CONDITION_COMPARE) {
+        fields.push_back(condition.columnName);
+        fields.push_back(condition.op);
+        fields.push_back(condition.value);
+        return;
+    }
+    if (condition.kind == CONDITION_IN) {
+        fields.push_back(condition.columnName);
+        fields.push_back(condition.op);
+        fields.push_back(to_string(condition.values.size()));
+        fields.insert(fields.end(), condition.values.begin(), condition.values.end());
+        return;
+    }
+    fields.push_back("");
+    fields.push_back(condition.kind == CONDITION_AND ? "AND" : "OR");
+    fields.push_back(to_string(condition.children.size()));
+    for (size_t i = 0; i < condition.children.size(); i++) {
+        appendCondition(fields, condition.children[i]);
+    }
+}
+
+static void appendConditions(vector<string>& fields, const vector<Condition>& conditions) {
+    for (size_t i = 0; i < conditions.size(); i++) {
+        appendCondition(fields, conditions[i]);
+    }
+}
+
+static Condition readCondition(const vector<string>& fields, size_t& position) {
+    if (position + 2 >= fields.size()) throw runtime_error("Truncated condition in log record");
+    const string& column = fields[position];
+    const string& op = fields[position + 1];
+    const string& third = fields[position + 2];
+    position += 3;
+
+    if (op == "IN" || op == "NOT IN") {
+        Condition list(CONDITION_IN);
+        list.columnName = column;
+        list.op = op;
+        size_t count = (size_t)atol(third.c_str());
+        if (position + count > fields.size()) throw runtime_error("Truncated condition in log record");
+        list.values.assign(fields.begin() + position, fields.begin() + position + count);
+        position += count;
+        return list;
+    }
+    if (column.empty() && (op == "AND" || op == "OR")) {
+        Condition tree(op == "AND" ? CONDITION_AND : CONDITION_OR);
+        int count = atoi(third.c_str());
+        for (int i = 0; i < count; i++) {
+            tree.children.push_back(readCondition(fields, position));
+        }
+        return tree;
+    }
+    return Condition(column, op, third);
+}
+
+static void readConditions(const vector<string>& fields, size_t start, vector<Condition>& conditions) {
+    size_t position = start;
+    while (position + 2 < fields.size()) {
+        conditions.push_back(readCondition(fields, position));
+    }
+}
+
 void DatabaseEngine::createTable(const string& query) {
+    unique_lock<shared_mutex> guard(catalogLock);
     try {
         Table* table = QueryParser::parseCreateTable(query);
         string tableName = table->getTableName();
@@ -73,9 +168,23 @@ void DatabaseEngine::createTable(const string& query) {
             return;
         }
 
+        table->setVersions(&versions);
         tables[tableName] = table;
+        catalogChanged();
         table->display();
 
+        vector<string> fields;
+        fields.push_back(tableName);
+        const vector<Column>& cols = table->getColumns();
+        for (size_t i = 0; i < cols.size(); i++) {
+            fields.push_back(cols[i].getName());
+            fields.push_back(to_string((int)cols[i].getType()));
+            fields.push_back(to_string(cols[i].getSize()));
+            fields.push_back(cols[i].getIsPrimaryKey() ? "1" : "0");
+            fields.push_back(cols[i].getIsNotNull() ? "1" : "0");
+        }
+        logChange(LOG_CREATE_TABLE, fields);
+
     }
     catch (exception& e) {
         cout << "Error: " << e.what() << endl;
@@ -83,377 +192,1824 @@ void DatabaseEngine::createTable(const string& query) {
 }
 
 void DatabaseEngine::insertInto(const string& query) {
+    shared_lock<shared_mutex> guard(catalogLock);
     try {
+        QueryResult result;
         string tableName;
-        vector<string> values;
-
-        QueryParser::parseInsert(query, tableName, values);
-
-        if (tables.find(tableName) == tables.end()) {
-            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+        if (runCached(query, result, tableName)) {
+            if (!result.ok()) {
+                cout << "Error: " << result.getMessage() << endl;
+            }
+            else if (result.getRowsAffected() == 1) {
+                cout << "[" << findTable(tableName)->getLiveRowCount()
+                    << "] Row inserted successfully into '" << tableName << "'!" << endl;
+            }
+            else {
+                cout << "[" << result.getRowsAffected() << "] Rows inserted successfully into '"
+                    << tableName << "'!" << endl;
+            }
             return;
         }
 
-        Table* table = tables[tableName];
+        vector<vector<string> > rows;
 
-        if ((int)values.size() != table->getColumnCount()) {
-            cout << "Error: Expected " << table->getColumnCount()
-                << " values but got " << values.size() << endl;
-            return;
+        QueryParser::parseInsert(query, tableName, rows);
+        insertRows(tableName, rows);
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+// Batch errors name the failing row; single-row errors read as before
+static string rowPrefix(bool single, int row) {
+    return single ? "" : "Row " + to_string(row + 1) + ": ";
+}
+
+// Checks run column by column so each type test and the key lookups happen
+// in one pass over the batch. Any bad row rejects the whole batch.
+static StatusCode checkRows(const Table* table, const vector<vector<string> >& rows, string& message) {
+    // Single-row errors read exactly as before; batches say which row failed
+    bool single = rows.size() == 1;
+    int columnCount = table->getColumnCount();
+
+    for (int r = 0; r < (int)rows.size(); r++) {
+        if ((int)rows[r].size() != columnCount) {
+            message = rowPrefix(single, r) + "Expected " + to_string(columnCount) +
+                " values but got " + to_string(rows[r].size());
+            return STATUS_SYNTAX_ERROR;
         }
+    }
 
-        const vector<Column>& columns = table->getColumns();
+    const vector<Column>& columns = table->getColumns();
 
-        for (int i = 0; i < (int)values.size(); i++) {
-            const Column& col = columns[i];
-            string value = values[i];
+    for (int c = 0; c < columnCount; c++) {
+        const Column& col = columns[c];
 
-            // NOT NULL
-            if (col.getIsNotNull() && value.empty()) {
-                cout << "Error: Column '" << col.getName() << "' cannot be NULL" << endl;
-                return;
+        // NOT NULL
+        if (col.getIsNotNull()) {
+            for (int r = 0; r < (int)rows.size(); r++) {
+                if (rows[r][c].empty()) {
+                    message = rowPrefix(single, r) + "Column '" + col.getName() + "' cannot be NULL";
+                    return STATUS_CONSTRAINT;
+                }
             }
+        }
 
-            // PRIMARY KEY uniqueness
-            if (col.getIsPrimaryKey()) {
-                if (table->hasPrimaryKey(value)) {
-                    cout << "Error: Duplicate PRIMARY KEY value '" << value << "'" << endl;
-                    return;
-                }
+        // PRIMARY KEY uniqueness, against the table and within the batch
+        if (col.getIsPrimaryKey()) {
+            vector<bool> duplicate;
+            if (table->findDuplicateKeys(rows, duplicate) > 0) {
+                int r = (int)(find(duplicate.begin(), duplicate.end(), true) - duplicate.begin());
+                message = rowPrefix(single, r) + "Duplicate PRIMARY KEY value '" + rows[r][c] + "'";
+                return STATUS_CONSTRAINT;
             }
+        }
 
-            // Type checks
+        // Type checks
+        for (int r = 0; r < (int)rows.size(); r++) {
+            const string& value = rows[r][c];
             if (col.getType() == INT) {
-                if (!isValidInt(value)) {
-                    cout << "Error: Column '" << col.getName()
-                        << "' expects INT but got '" << value << "'" << endl;
-                    return;
+                if (!DatabaseEngine::isValidInt(value)) {
+                    message = rowPrefix(single, r) + "Column '" + col.getName() +
+                        "' expects INT but got '" + value + "'";
+                    return STATUS_TYPE_MISMATCH;
                 }
             }
             else if (col.getType() == FLOAT) {
-                if (!isValidFloat(value)) {
-                    cout << "Error: Column '" << col.getName()
-                        << "' expects FLOAT but got '" << value << "'" << endl;
-                    return;
+                if (!DatabaseEngine::isValidFloat(value)) {
+                    message = rowPrefix(single, r) + "Column '" + col.getName() +
+                        "' expects FLOAT but got '" + value + "'";
+                    return STATUS_TYPE_MISMATCH;
                 }
             }
             else if (col.getType() == VARCHAR) {
                 if ((int)value.length() > col.getSize()) {
-                    cout << "Error: Column '" << col.getName()
-                        << "' VARCHAR(" << col.getSize() << ") exceeded. Got "
-                        << value.length() << " characters" << endl;
-                    return;
+                    message = rowPrefix(single, r) + "Column '" + col.getName() +
+                        "' VARCHAR(" + to_string(col.getSize()) + ") exceeded. Got " +
+                        to_string(value.length()) + " characters";
+                    return STATUS_CONSTRAINT;
                 }
             }
         }
+    }
+    return STATUS_OK;
+}
 
-        Row row;
-        for (int i = 0; i < (int)values.size(); i++) {
-            row.addValue(values[i]);
-        }
+// The key checks and the append happen under the table's write lock, so
+// no other writer can slip a clashing key in between
+StatusCode DatabaseEngine::runInsert(Table* table, const vector<vector<string> >& rows, string& message) {
+    if (rows.empty()) {
+        message = "No rows to insert";
+        return STATUS_ERROR;
+    }
+
+    StatusCode status;
+    table->beginWrite();
+    try {
+        table->load();
+        status = checkRows(table, rows, message);
+        if (status == STATUS_OK) table->appendRows(rows);
+    }
+    catch (...) {
+        table->rollback();
+        throw;
+    }
+    if (status != STATUS_OK) {
+        table->rollback();
+        return status;
+    }
 
-        table->addRow(row);
+    // One log record for the whole batch: table, then row-major values
+    vector<string> fields;
+    fields.reserve(1 + rows.size() * table->getColumnCount());
+    fields.push_back(table->getTableName());
+    for (int r = 0; r < (int)rows.size(); r++) {
+        fields.insert(fields.end(), rows[r].begin(), rows[r].end());
+    }
+    commitWrite(table, LOG_INSERT, &fields);
+    return STATUS_OK;
+}
 
-        cout << "[" << table->getRowCount() << "] Row inserted successfully into '"
-            << tableName << "'!" << endl;
+bool DatabaseEngine::insertBatch(const string& tableName, const vector<vector<string> >& rows) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    return insertRows(tableName, rows);
+}
 
+bool DatabaseEngine::insertRows(const string& tableName, const vector<vector<string> >& rows) {
+    Table* table = findTable(tableName);
+    if (table == NULL) {
+        cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+        return false;
     }
-    catch (exception& e) {
-        cout << "Error: " << e.what() << endl;
+
+    string message;
+    if (runInsert(table, rows, message) != STATUS_OK) {
+        cout << "Error: " << message << endl;
+        return false;
+    }
+
+    if (rows.size() == 1) {
+        cout << "[" << table->getLiveRowCount() << "] Row inserted successfully into '"
+            << tableName << "'!" << endl;
+    }
+    else {
+        cout << "[" << rows.size() << "] Rows inserted successfully into '"
+            << tableName << "'!" << endl;
     }
+    return true;
 }
 
-void DatabaseEngine::selectFrom(const string& query) {
+// Rows are parsed and checked in parallel chunks, appended a batch at a
+// time, and made durable by one checkpoint at the end instead of logging
+// every row. Bad records are skipped and counted, not fatal. The copy is
+// one transaction: readers see none of its rows until all are in.
+void DatabaseEngine::copyFrom(const string& query) {
+    shared_lock<shared_mutex> guard(catalogLock);
     try {
-        string tableName;
-        vector<string> columns;
-        vector<Condition> conditions;
-
-        QueryParser::parseSelect(query, tableName, columns, conditions);
+        string tableName, fileName;
+        char delimiter;
+        bool header;
+        QueryParser::parseCopy(query, tableName, fileName, delimiter, header);
 
-        if (tables.find(tableName) == tables.end()) {
+        Table* table = findTable(tableName);
+        if (table == NULL) {
             cout << "Error: Table '" << tableName << "' does not exist!" << endl;
             return;
         }
 
-        Table* table = tables[tableName];
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-        // No WHERE
-        if (conditions.empty()) {
-            if (columns.empty()) {
-                table->displayData();
-            }
-            else {
-                vector<int> colIndices;
-                for (int i = 0; i < (int)columns.size(); i++) {
-                    int idx = table->getColumnIndex(columns[i]);
-                    if (idx == -1) {
-                        cout << "Error: Column '" << columns[i] << "' does not exist!" << endl;
-                        return;
+        CsvLoader loader(table->getColumns(), delimiter, header, ThreadPool::shared().getThreadCount());
+        if (!loader.open(fileName)) {
+            cout << "Error: Cannot read '" << fileName << "'" << endl;
+            return;
+        }
+
+        vector<vector<string> > rows;
+        vector<int> lines;
+        vector<bool> duplicate;
+        int copied = 0;
+
+        // The checkpoint lock comes before the table's write lock
+        unique_lock<mutex> checkpointing(checkpointLock);
+        table->beginWrite();
+        try {
+            table->load();
+            while (loader.next(rows, lines)) {
+                if (table->findDuplicateKeys(rows, duplicate) > 0) {
+                    int kept = 0;
+                    int pk = table->getPrimaryKeyIndex();
+                    for (int r = 0; r < (int)rows.size(); r++) {
+                        if (duplicate[r]) {
+                            loader.reject(lines[r], "Duplicate PRIMARY KEY value '" + rows[r][pk] + "'");
+                            continue;
+                        }
+                        if (kept != r) rows[kept].swap(rows[r]);
+                        kept++;
                     }
-                    colIndices.push_back(idx);
+                    rows.resize(kept);
                 }
-                table->displayData(colIndices);
+                table->appendRows(rows);
+                copied += (int)rows.size();
             }
-            return;
+
+            if (copied > 0 && wal.isOpen()) {
+                writeCheckpoint(dataFile, false, table);
+            }
+        }
+        catch (...) {
+            table->rollback();
+            throw;
+        }
+        checkpointing.unlock();
+        if (copied > 0) commitWrite(table, LOG_INSERT, NULL);
+        else table->rollback();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        const vector<string>& errors = loader.getErrors();
+        for (int i = 0; i < (int)errors.size(); i++) {
+            cout << "Rejected " << errors[i] << endl;
+        }
+        if (loader.getRejected() > (int)errors.size()) {
+            cout << "... and " << (loader.getRejected() - (int)errors.size()) << " more rejected rows" << endl;
         }
 
-        // With WHERE
-        cout << "\nTable: " << tableName << endl;
-        cout << "--------------------------------------" << endl;
+        char timing[64];
+        snprintf(timing, sizeof(timing), "%.3f s, %.0f rows/s", seconds, seconds > 0 ? copied / seconds : 0.0);
 
-        const vector<Column>& tableCols = table->getColumns();
-        vector<int> displayCols;
+        cout << "[" << copied << "] Rows copied into '" << tableName << "' from '" << fileName
+            << "' (" << loader.getRejected() << " rejected) in " << timing << endl;
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
 
-        if (columns.empty()) {
-            for (int i = 0; i < (int)tableCols.size(); i++) {
-                displayCols.push_back(i);
-            }
+// Resolves the table and columns up front, so a bad query fails before any
+// row is produced
+ResultSet* DatabaseEngine::executeSelect(const string& query) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    QueryResult result;
+    string tableName;
+    if (runCached(query, result, tableName)) {
+        if (!result.ok()) throw runtime_error(result.getMessage());
+        return result.releaseRows();
+    }
+    return runQuery(query, NULL);
+}
+
+// A SELECT parsed and run from scratch, bypassing the plan cache. It
+// reads views of its tables; a plain SELECT's result keeps its view, the
+// others are done with theirs once the groups or joined rows are built.
+ResultSet* DatabaseEngine::runQuery(const string& query, PlanNode* plan) {
+    string tableName;
+    vector<string> columns;
+    vector<Condition> conditions;
+    AggregateQuery aggregate;
+    SortQuery order;
+    JoinQuery join;
+
+    QueryParser::parseSelect(query, tableName, columns, conditions, aggregate, order, join);
+
+    map<string, Table*>::iterator it = tables.find(tableName);
+    if (it == tables.end()) {
+        throw runtime_error("Table '" + tableName + "' does not exist!");
+    }
+    Table* handles[2] = { it->second, NULL };
+    int count = 1;
+    if (!join.isEmpty()) {
+        it = tables.find(join.table);
+        if (it == tables.end()) {
+            throw runtime_error("Table '" + join.table + "' does not exist!");
+        }
+        if (it->second == handles[0]) {
+            throw runtime_error("Table '" + join.table + "' cannot be joined with itself");
+        }
+        handles[1] = it->second;
+        count = 2;
+    }
+
+    Table* views[2] = { NULL, NULL };
+    openSnapshot(handles, count, views);
+    Table* table = views[0];
+    ResultSet* result;
+    try {
+        if (!join.isEmpty()) {
+            result = runJoin(table, views[1], join, columns, conditions, aggregate, order, plan);
+        }
+        else if (!aggregate.isEmpty()) {
+            result = runAggregate(table, aggregate, conditions, order, plan);
         }
         else {
+            vector<int> columnIndices;
             for (int i = 0; i < (int)columns.size(); i++) {
                 int idx = table->getColumnIndex(columns[i]);
                 if (idx == -1) {
-                    cout << "Error: Column '" << columns[i] << "' does not exist!" << endl;
-                    return;
+                    throw runtime_error("Column '" + columns[i] + "' does not exist!");
                 }
-                displayCols.push_back(idx);
+                columnIndices.push_back(idx);
             }
-        }
 
-        // headers
-        for (int i = 0; i < (int)displayCols.size(); i++) {
-            cout << tableCols[displayCols[i]].getName();
-            if (i < (int)displayCols.size() - 1) cout << " | ";
+            result = runSelect(table, columnIndices, conditions, order, plan);
+            result->takeTable(table);
+            return result;
         }
-        cout << endl;
+    }
+    catch (...) {
+        delete views[0];
+        delete views[1];
+        throw;
+    }
+    delete views[0];
+    delete views[1];
+    return result;
+}
 
-        for (int i = 0; i < (int)displayCols.size(); i++) {
-            cout << "----------";
-            if (i < (int)displayCols.size() - 1) cout << "-+-";
-        }
-        cout << endl;
+// Rows wanted from a sort: OFFSET + LIMIT, or -1 for all
+static long long rowsToKeep(long long offset, long long limit) {
+    if (limit < 0 || limit > LLONG_MAX - offset) return -1;
+    return offset + limit;
+}
 
-        int count = 0;
-        const vector<Row>& rows = table->getRows();
+// ================== PLANS ==================
+//
+// The executor below takes the operator an EXPLAIN hangs its steps under,
+// NULL otherwise. A plain EXPLAIN builds the same operators but feeds
+// them no rows (planOnly), so only the estimates are filled in.
 
-        for (int r = 0; r < (int)rows.size(); r++) {
-            const Row& row = rows[r];
-            bool matchesAll = true;
+static bool planOnly(const PlanNode* plan) {
+    return plan != NULL && !plan->analyzing;
+}
 
-            for (int c = 0; c < (int)conditions.size(); c++) {
-                const Condition& cond = conditions[c];
-                int colIndex = table->getColumnIndex(cond.columnName);
-                if (colIndex == -1) continue;
+static double plannedRows(const Table& table, const PlanNode* plan) {
+    if (plan->inputRows >= 0) return plan->inputRows;
+    return table.getRowCount();
+}
 
-                string actualValue = row.getValue(colIndex);
-                DataType colType = tableCols[colIndex].getType();
+static double keptRows(double rows, long long keep) {
+    return keep >= 0 ? min(rows, (double)keep) : rows;
+}
 
-                if (!cond.evaluate(actualValue, colType)) {
-                    matchesAll = false;
-                    break;
-                }
-            }
+static string sortKeyText(const Table& table, const vector<SortKey>& keys) {
+    string text;
+    for (int i = 0; i < (int)keys.size(); i++) {
+        if (i > 0) text += ", ";
+        text += table.getColumns()[keys[i].column].getName();
+        if (keys[i].descending) text += " DESC";
+    }
+    return text;
+}
 
-            if (matchesAll) {
-                for (int i = 0; i < (int)displayCols.size(); i++) {
-                    cout << row.getValue(displayCols[i]);
-                    if (i < (int)displayCols.size() - 1) cout << " | ";
-                }
-                cout << endl;
-                count++;
-            }
-        }
+// Names an access operator after the path it took
+static void describeAccess(PlanNode* node, const Table& table, const AccessPath& path,
+    const vector<Condition>& conditions) {
+    node->detail = "on " + table.getTableName();
+    switch (path.kind) {
+    case ACCESS_SCAN:
+        node->name = "Seq Scan";
+        break;
+    case ACCESS_PARALLEL_SCAN:
+        node->name = "Parallel Seq Scan";
+        break;
+    case ACCESS_PRIMARY_KEY:
+        node->name = "Primary Key Lookup";
+        break;
+    case ACCESS_INDEX:
+        node->name = "Index Scan";
+        node->detail = "using " + path.index->name + " " + node->detail;
+        break;
+    }
 
-        if (count == 0) {
-            cout << "No matching rows found." << endl;
-        }
+    vector<Condition> tested;
+    for (int i = 0; i < (int)conditions.size(); i++) {
+        if (i == path.condition) node->lines.push_back("Index Cond: " + conditions[i].toString());
+        else tested.push_back(conditions[i]);
+    }
+    if (!tested.empty()) node->lines.push_back("Filter: " + Condition::toString(tested));
+}
 
-        cout << "\nRows returned: " << count << endl;
+// The rows of a loaded table that pass the conditions; false when every
+// row is wanted: there are no conditions and no row is deleted as of the
+// table's snapshot. Under EXPLAIN the read is an operator below `plan`.
+static bool matchRows(const Table& table, const vector<Condition>& conditions, vector<int>& matches,
+    PlanNode* plan) {
+    bool everyRow = conditions.empty() && !table.hasHiddenRows();
+    if (plan == NULL) {
+        if (everyRow) return false;
+        table.findMatchingRows(conditions, matches);
+        return true;
+    }
 
+    double estimate = table.getStats().selectivity(table, conditions) * plannedRows(table, plan);
+    PlanNode* node = plan->add("Seq Scan", "on " + table.getTableName(), estimate);
+    if (everyRow) {
+        // nothing to test: the consumer reads the columns itself
+        node->folded = true;
+        if (node->analyzing) node->rowsIn = node->rowsOut = table.getRowCount();
+        return false;
     }
-    catch (exception& e) {
-        cout << "Error: " << e.what() << endl;
+    if (!node->analyzing) {
+        describeAccess(node, table, table.planAccess(conditions), conditions);
+        return true;
     }
-}
 
-void DatabaseEngine::deleteFrom(const string& query) {
-    try {
-        string tableName;
-        vector<Condition> conditions;
+    AccessPath path;
+    OperatorTimer timer(node);
+    table.findMatchingRows(conditions, matches, &path);
+    timer.stop();
+    describeAccess(node, table, path, conditions);
+    node->rowsIn = path.rowsRead;
+    node->rowsOut = (long long)matches.size();
+    node->bytes = path.bytesRead;
+    node->memoryPeak = matches.size() * sizeof(int);
+    return true;
+}
 
-        QueryParser::parseDelete(query, tableName, conditions);
+// The operator for a streamed scan, which PagedScan measures itself
+static PlanNode* addPagedScan(PlanNode* plan, const Table& table, const vector<Condition>& conditions) {
+    if (plan == NULL) return NULL;
+    double estimate = table.getStats().selectivity(table, conditions) * plannedRows(table, plan);
+    PlanNode* node = plan->add("Paged Scan", "on " + table.getTableName(), estimate);
+    if (!conditions.empty()) node->lines.push_back("Filter: " + Condition::toString(conditions));
+    if (node->analyzing) node->rowsIn = node->rowsOut = 0;
+    return node;
+}
 
-        if (tables.find(tableName) == tables.end()) {
-            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
-            return;
+// Groups expected from `rows` input rows: the product of the GROUP BY
+// columns' distinct counts, or a fixed guess before ANALYZE, at most one
+// per row. HAVING is taken to keep a third of them.
+static double groupEstimate(const Table& table, const AggregateQuery& query, double rows) {
+    double groups = 1;
+    const TableStats& stats = table.getStats();
+    for (int i = 0; i < (int)query.groupBy.size(); i++) {
+        int column = table.getColumnIndex(query.groupBy[i]);
+        if (!stats.isAnalyzed() || column == -1) {
+            groups = 200;
+            break;
         }
-
-        Table* table = tables[tableName];
-        int deletedCount = table->deleteRows(conditions);
-
-        cout << "[" << deletedCount << "] Row(s) deleted from '"
-            << tableName << "'!" << endl;
-
+        groups *= max(stats.columns[column].distinct, 1.0);
     }
-    catch (exception& e) {
-        cout << "Error: " << e.what() << endl;
+    groups = min(groups, max(rows, 1.0));
+    if (!query.having.empty()) groups /= 3;
+    return groups;
+}
+
+static string havingText(const vector<HavingCondition>& having) {
+    string text;
+    for (int i = 0; i < (int)having.size(); i++) {
+        if (i > 0) text += " AND ";
+        text += HashAggregate::label(having[i].term.function, having[i].term.column) + " " + having[i].op +
+            " " + having[i].value;
     }
+    return text;
 }
 
-void DatabaseEngine::updateTable(const string& query) {
-    try {
-        string tableName;
-        map<string, string> updates;
-        vector<Condition> conditions;
+ResultSet* DatabaseEngine::runSelect(Table* table, const vector<int>& columnIndices,
+    const vector<Condition>& conditions, const SortQuery& order, PlanNode* plan) {
+    long long limit = order.getLimit();
+    long long offset = order.getOffset();
+    vector<SortKey> keys;
+    ExternalSort::resolveKeys(*table, order, false, keys);
 
-        QueryParser::parseUpdate(query, tableName, updates, conditions);
+    // Tables larger than the buffer pool are streamed instead of loaded
+    int poolFile = pagedFile(table);
+    if (poolFile == -1) table->load();
 
-        if (tables.find(tableName) == tables.end()) {
-            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
-            return;
+    ResultSet* result;
+    if (!keys.empty()) {
+        result = runSorted(table, poolFile, columnIndices, conditions, keys, rowsToKeep(offset, limit), plan);
+    }
+    else if (poolFile != -1) {
+        PagedScan* scan = new PagedScan(*table, bufferPool, poolFile);
+        scan->setProfile(addPagedScan(plan, *table, conditions));
+        result = new ResultSet(*table, columnIndices, scan, conditions);
+    }
+    else {
+        vector<int> matches;
+        if (matchRows(*table, conditions, matches, plan)) {
+            result = new ResultSet(*table, columnIndices, matches, !conditions.empty());
+        }
+        else {
+            result = new ResultSet(*table, columnIndices);
         }
+    }
+
+    result->setWindow(offset, limit);
+    return result;
+}
 
-        Table* table = tables[tableName];
+// With a LIMIT, an index on a lone sort key is walked in order and stops
+// once enough rows match. Otherwise the matching rows go through an
+// ExternalSort: a loaded table's by position, a streamed table's copied
+// slice by slice.
+ResultSet* DatabaseEngine::runSorted(Table* table, int poolFile, const vector<int>& columnIndices,
+    const vector<Condition>& conditions, const vector<SortKey>& keys, long long keep, PlanNode* plan) {
+    const SecondaryIndex* index = NULL;
+    if (poolFile == -1 && keep >= 0 && keys.size() == 1) index = table->orderedIndex(keys[0].column);
+    if (index != NULL) {
+        PlanNode* node = NULL;
+        if (plan != NULL) {
+            double estimate = table->getStats().selectivity(*table, conditions) * plannedRows(*table, plan);
+            node = plan->add("Ordered Index Scan", "using " + index->name + " on " + table->getTableName(),
+                keptRows(estimate, keep));
+            node->lines.push_back("Order: " + sortKeyText(*table, keys) + ", stops after " + to_string(keep) +
+                " rows");
+            if (!conditions.empty()) node->lines.push_back("Filter: " + Condition::toString(conditions));
+        }
+        vector<int> rows;
+        if (!planOnly(plan)) {
+            OperatorTimer timer(node);
+            table->findOrderedRows(keys[0].column, keys[0].descending, conditions,
+                (int)min(keep, (long long)INT_MAX), rows);
+        }
+        if (node != NULL && node->analyzing) {
+            node->rowsOut = (long long)rows.size();
+            node->memoryPeak = rows.size() * sizeof(int);
+        }
+        return new ResultSet(*table, columnIndices, rows, true);
+    }
 
-        // Validate updates
-        map<string, string>::const_iterator it;
-        for (it = updates.begin(); it != updates.end(); ++it) {
-            const string& colName = it->first;
-            const string& value = it->second;
+    PlanNode* node = NULL;
+    if (plan != NULL) {
+        node = plan->add(keep >= 0 ? "Top-N Sort" : "Sort", "by " + sortKeyText(*table, keys), -1);
+        if (keep >= 0) node->lines.push_back("Keeps " + to_string(keep) + " rows");
+    }
+    OperatorTimer timer(node);
 
-            int colIndex = table->getColumnIndex(colName);
-            if (colIndex == -1) {
-                cout << "Error: Column '" << colName << "' does not exist!" << endl;
-                return;
+    ExternalSort* sorter = new ExternalSort(*table, keys, keep, sortMemory, poolFile != -1, columnIndices);
+    try {
+        if (poolFile == -1) {
+            vector<int> matches;
+            bool filtered = matchRows(*table, conditions, matches, node);
+            if (!planOnly(plan)) sorter->add(*table, filtered ? &matches : NULL, 0);
+        }
+        else {
+            PagedScan scan(*table, bufferPool, poolFile);
+            scan.setProfile(addPagedScan(node, *table, conditions));
+            int firstRow;
+            Table* chunk;
+            vector<int> matches;
+            while (!planOnly(plan) && (chunk = scan.next(firstRow, conditions, matches)) != NULL) {
+                try {
+                    sorter->add(*chunk, conditions.empty() ? NULL : &matches, firstRow);
+                }
+                catch (...) {
+                    delete chunk;
+                    throw;
+                }
+                delete chunk;
             }
+        }
+        sorter->finish();
+    }
+    catch (...) {
+        delete sorter;
+        throw;
+    }
 
-            const Column& col = table->getColumns()[colIndex];
+    timer.stop();
+    if (node != NULL) {
+        const PlanNode* input = node->children[0];
+        node->estimatedRows = keptRows(input->estimatedRows, keep);
+        if (node->analyzing) {
+            node->rowsIn = input->rowsOut;
+            node->rowsOut = (long long)keptRows((double)input->rowsOut, keep);
+            node->memoryPeak = sorter->getMemoryPeak();
+            node->bytes = sorter->getSpilledBytes();
+            if (sorter->getRunCount() > 0) {
+                node->lines.push_back("Runs on disk: " + to_string(sorter->getRunCount()));
+            }
+        }
+    }
+    return new ResultSet(*table, columnIndices, sorter, !conditions.empty());
+}
 
-            if (col.getType() == INT && !isValidInt(value)) {
-                cout << "Error: Invalid INT value for column '" << colName << "'" << endl;
-                return;
+// The WHERE clause picks the rows as for a plain SELECT; a streamed table
+// is aggregated one slice at a time
+ResultSet* DatabaseEngine::runAggregate(Table* table, const AggregateQuery& query,
+    const vector<Condition>& conditions, const SortQuery& order, PlanNode* plan) {
+    long long limit = order.getLimit();
+    long long offset = order.getOffset();
+    HashAggregate aggregate(*table, query);
+
+    PlanNode* node = NULL;
+    if (plan != NULL) {
+        string detail;
+        for (int i = 0; i < (int)query.groupBy.size(); i++) {
+            detail += (i == 0 ? "by " : ", ") + query.groupBy[i];
+        }
+        node = plan->add("Hash Aggregate", detail, -1);
+        if (!query.having.empty()) node->lines.push_back("Having: " + havingText(query.having));
+    }
+    OperatorTimer timer(node);
+
+    int poolFile = pagedFile(table);
+    if (poolFile == -1) {
+        table->load();
+        vector<int> matches;
+        bool filtered = matchRows(*table, conditions, matches, node);
+        if (!planOnly(plan)) aggregate.accumulate(*table, filtered ? &matches : NULL, 0);
+    }
+    else {
+        PagedScan scan(*table, bufferPool, poolFile);
+        scan.setProfile(addPagedScan(node, *table, conditions));
+        int firstRow;
+        Table* chunk;
+        vector<int> matches;
+        while (!planOnly(plan) && (chunk = scan.next(firstRow, conditions, matches)) != NULL) {
+            try {
+                aggregate.accumulate(*chunk, conditions.empty() ? NULL : &matches, firstRow);
             }
-            if (col.getType() == FLOAT && !isValidFloat(value)) {
-                cout << "Error: Invalid FLOAT value for column '" << colName << "'" << endl;
-                return;
+            catch (...) {
+                delete chunk;
+                throw;
             }
+            delete chunk;
         }
-
-        int updatedCount = table->updateRows(updates, conditions);
-
-        cout << "[" << updatedCount << "] Row(s) updated in '"
-            << tableName << "'!" << endl;
-
     }
-    catch (exception& e) {
-        cout << "Error: " << e.what() << endl;
+
+    // The groups are sorted by the columns of their own table
+    Table* groups = aggregate.finish();
+    timer.stop();
+    if (node != NULL) {
+        const PlanNode* input = node->children[0];
+        node->estimatedRows = groupEstimate(*table, query, input->estimatedRows);
+        if (node->analyzing) {
+            node->rowsIn = input->rowsOut;
+            node->rowsOut = groups->getRowCount();
+            node->memoryPeak = aggregate.getMemoryPeak();
+        }
     }
-}
 
-void DatabaseEngine::dropTable(const string& query) {
+    ResultSet* result;
     try {
-        string tableName = QueryParser::parseDropTable(query);
-
-        if (tables.find(tableName) == tables.end()) {
-            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
-            return;
+        vector<SortKey> keys;
+        ExternalSort::resolveKeys(*groups, order, true, keys);
+        if (keys.empty()) {
+            result = new ResultSet(groups, true);
+        }
+        else {
+            long long keep = rowsToKeep(offset, limit);
+            PlanNode* sortNode = NULL;
+            if (plan != NULL) {
+                sortNode = plan->wrap(node, keep >= 0 ? "Top-N Sort" : "Sort", "by " + sortKeyText(*groups, keys),
+                    keptRows(node->estimatedRows, keep));
+                if (keep >= 0) sortNode->lines.push_back("Keeps " + to_string(keep) + " rows");
+            }
+            OperatorTimer sortTimer(sortNode);
+            ExternalSort* sorter = new ExternalSort(*groups, keys, keep, sortMemory, false, vector<int>());
+            try {
+                sorter->add(*groups, NULL, 0);
+                sorter->finish();
+            }
+            catch (...) {
+                delete sorter;
+                throw;
+            }
+            sortTimer.stop();
+            if (sortNode != NULL && sortNode->analyzing) {
+                sortNode->rowsIn = groups->getRowCount();
+                sortNode->rowsOut = (long long)keptRows((double)groups->getRowCount(), keep);
+                sortNode->memoryPeak = sorter->getMemoryPeak();
+                sortNode->bytes = sorter->getSpilledBytes();
+            }
+            result = new ResultSet(groups, sorter);
         }
-
-        delete tables[tableName];
-        
-        tables.erase(tableName);
-
-        cout << "Table '" << tableName << "' dropped successfully!" << endl;
     }
-    catch (exception& e) {
-        cout << "Error: " << e.what() << endl;
+    catch (...) {
+        delete groups;
+        throw;
     }
-}
 
-void DatabaseEngine::listTables() {
-    if (tables.empty()) {
-        cout << "No tables in database." << endl;
-        return;
-    }
+    result->setWindow(offset, limit);
+    return result;
+}
 
-    cout << "Tables in database:" << endl;
+// A name the joined query uses, as the joined table calls it; marks its
+// column to be carried through the join. Empty stays empty (COUNT(*)).
+static string joinedName(const Table& left, const Table& right, const string& name,
+    vector<bool>* carried) {
+    if (name.empty()) return name;
+    JoinColumn column = HashJoin::resolveColumn(left, right, name);
+    carried[column.right ? 1 : 0][column.column] = true;
+    return HashJoin::qualifiedName(column.right ? right : left, column.column);
+}
 
-    map<string, Table*>::iterator it;
-    for (it = tables.begin(); it != tables.end(); ++it) {
-        cout << "  - " << it->first << " ("
-            << it->second->getRowCount() << " rows)" << endl;
+// Rows expected from a join of inputs expected to give `rows`: each left
+// row meets the right rows sharing its key, from the distinct key counts
+// when both tables are analyzed
+static double joinEstimate(const Table& left, int leftKey, const Table& right, int rightKey,
+    JoinType type, const double rows[2]) {
+    double estimate = max(rows[0], rows[1]);
+    const TableStats& leftStats = left.getStats();
+    const TableStats& rightStats = right.getStats();
+    if (leftStats.isAnalyzed() && rightStats.isAnalyzed()) {
+        double distinct = max(leftStats.columns[leftKey].distinct, rightStats.columns[rightKey].distinct);
+        estimate = rows[0] * rows[1] / max(distinct, 1.0);
     }
+    if (type == JOIN_LEFT) estimate = max(estimate, rows[0]);
+    return estimate;
 }
 
-void DatabaseEngine::saveToDisk(const string& filename) const {
-    ofstream out(filename.c_str());
-    if (!out) {
-        cout << "Warning: Could not open '" << filename << "' for saving.\n";
-        return;
+// Moves the join's operator under those run on its output, where their
+// scan of the joined table was: that scan is dropped, or kept as the
+// filter of the conditions checked after the join
+static void attachJoin(PlanNode* plan, PlanNode* joinNode, bool filtered) {
+    plan->children.erase(find(plan->children.begin(), plan->children.end(), joinNode));
+
+    PlanNode* parent = plan;
+    PlanNode* scan = plan->children.back();
+    while (!scan->children.empty()) {
+        parent = scan;
+        scan = scan->children[0];
     }
 
-    // Number of tables
-    out << tables.size() << '\n';
+    if (filtered) {
+        scan->name = "Filter";
+        scan->detail.clear();
+        scan->children.push_back(joinNode);
+        return;
+    }
+    replace(parent->children.begin(), parent->children.end(), scan, joinNode);
+    delete scan;
+}
 
-    map<string, Table*>::const_iterator it;
-    for (it = tables.begin(); it != tables.end(); ++it) {
-        Table* t = it->second;
+// WHERE conditions go below the join, each to the table it names, except
+// an OR across both tables and those on the right table of a LEFT join:
+// they are checked on the joined rows, since a row the join pads with
+// NULLs must still be tested. The
+// smaller input is hashed. Only the columns the query names are carried,
+// and the joined table is then selected, aggregated and sorted like any
+// other under table.column names.
+ResultSet* DatabaseEngine::runJoin(Table* left, Table* right, const JoinQuery& join,
+    const vector<string>& columns, const vector<Condition>& conditions, const AggregateQuery& aggregate,
+    const SortQuery& order, PlanNode* plan) {
+    JoinColumn leftKey = HashJoin::resolveColumn(*left, *right, join.leftKey);
+    JoinColumn rightKey = HashJoin::resolveColumn(*left, *right, join.rightKey);
+    if (leftKey.right == rightKey.right) {
+        throw runtime_error("ON must compare a column of '" + left->getTableName() + "' with one of '" +
+            right->getTableName() + "'");
+    }
+    if (leftKey.right) swap(leftKey, rightKey);
 
-        out << "TABLE\n";
-        out << t->getTableName() << '\n';
 
-        // Columns
-        const vector<Column>& cols = t->getColumns();
-        out << cols.size() << '\n';
+    vector<bool> carried[2];
+    carried[0].assign(left->getColumnCount(), columns.empty() && aggregate.isEmpty());
+    carried[1].assign(right->getColumnCount(), columns.empty() && aggregate.isEmpty());
 
-        for (size_t i = 0; i < cols.size(); ++i) {
-            const Column& col = cols[i];
+    vector<string> selected;
+    for (int i = 0; i < (int)columns.size(); i++) {
+        selected.push_back(joinedName(*left, *right, columns[i], carried));
+    }
+    AggregateQuery joinedAggregate = aggregate;
+    for (int i = 0; i < (int)joinedAggregate.outputs.size(); i++) {
+        AggregateTerm& term = joinedAggregate.outputs[i];
+        term.column = joinedName(*left, *right, term.column, carried);
+    }
+    for (int i = 0; i < (int)joinedAggregate.groupBy.size(); i++) {
+        joinedAggregate.groupBy[i] = joinedName(*left, *right, joinedAggregate.groupBy[i], carried);
+    }
+    for (int i = 0; i < (int)joinedAggregate.having.size(); i++) {
+        AggregateTerm& term = joinedAggregate.having[i].term;
+        term.column = joinedName(*left, *right, term.column, carried);
+    }
+    SortQuery joinedOrder = order;
+    for (int i = 0; i < (int)joinedOrder.keys.size(); i++) {
+        AggregateTerm& term = joinedOrder.keys[i].term;
+        term.column = joinedName(*left, *right, term.column, carried);
+    }
 
-            out << col.getName() << '\n';
-            out << (int)col.getType() << ' '
-                << col.getSize() << ' '
-                << (col.getIsPrimaryKey() ? 1 : 0) << ' '
-                << (col.getIsNotNull() ? 1 : 0) << '\n';
+    JoinInput inputs[2];
+    vector<Condition> afterJoin;
+    for (int i = 0; i < (int)conditions.size(); i++) {
+        // which tables the condition names: bit 0 left, bit 1 right
+        Condition pushed = conditions[i];
+        vector<Condition*> leaves;
+        pushed.getLeaves(leaves);
+        int sides = 0;
+        for (int l = 0; l < (int)leaves.size(); l++) {
+            JoinColumn column = HashJoin::resolveColumn(*left, *right, leaves[l]->columnName);
+            const Table* table = column.right ? right : left;
+            leaves[l]->columnName = table->getColumns()[column.column].getName();
+            sides |= column.right ? 2 : 1;
         }
 
-        // Rows
-        const vector<Row>& rows = t->getRows();
-        out << rows.size() << '\n';
-
-        for (size_t r = 0; r < rows.size(); ++r) {
-            const Row& row = rows[r];
-
-            int valueCount = row.getValueCount();
-            out << valueCount << '\n';
-
-            for (int v = 0; v < valueCount; ++v) {
-                out << row.getValue(v) << '\n';
+        if (sides == 3 || ((sides & 2) != 0 && join.type == JOIN_LEFT)) {
+            Condition after = conditions[i];
+            leaves.clear();
+            after.getLeaves(leaves);
+            for (int l = 0; l < (int)leaves.size(); l++) {
+                leaves[l]->columnName = joinedName(*left, *right, leaves[l]->columnName, carried);
             }
+            afterJoin.push_back(after);
+            continue;
         }
+        inputs[sides == 2 ? 1 : 0].conditions.push_back(pushed);
     }
-}
 
-void DatabaseEngine::loadFromDisk(const string& filename) {
-    ifstream in(filename.c_str());
-    if (!in) {
-        return; // No DB file, first run
+    vector<int> carriedColumns[2];
+    for (int side = 0; side < 2; side++) {
+        for (int c = 0; c < (int)carried[side].size(); c++) {
+            if (carried[side][c]) carriedColumns[side].push_back(c);
+        }
     }
 
-    // Clear old tables
-    map<string, Table*>::iterator itold;
-    for (itold = tables.begin(); itold != tables.end(); ++itold) {
-        delete itold->second;
+    PlanNode* joinNode = NULL;
+    if (plan != NULL) {
+        joinNode = plan->add(join.type == JOIN_LEFT ? "Hash Left Join" : "Hash Join",
+            "on " + join.leftKey + " = " + join.rightKey, -1);
     }
-    tables.clear();
+    OperatorTimer timer(joinNode);
 
-    string line;
-    if (!getline(in, line)) return;
-    if (line.empty()) return;
-
-    int tableCount = stoi(line);
+    openJoinInput(left, inputs[0], joinNode);
+    openJoinInput(right, inputs[1], joinNode);
+    int buildSide = inputs[0].rows < inputs[1].rows ? 0 : 1;
 
-    for (int ti = 0; ti < tableCount; ++ti) {
+    HashJoin hashJoin(*left, leftKey.column, carriedColumns[0], *right, rightKey.column, carriedColumns[1],
+        join.type, buildSide == 0, joinMemory);
+    if (!planOnly(plan)) {
+        feedJoin(inputs[buildSide], hashJoin, true);
+        feedJoin(inputs[1 - buildSide], hashJoin, false);
+    }
+    Table* joined = hashJoin.finish();
+    timer.stop();
+
+    if (joinNode != NULL) {
+        double rows[2] = { joinNode->children[0]->estimatedRows, joinNode->children[1]->estimatedRows };
+        joinNode->estimatedRows = joinEstimate(*left, leftKey.column, *right, rightKey.column, join.type, rows);
+        joinNode->lines.push_back("Hashed: " + inputs[buildSide].table->getTableName());
+        if (joinNode->analyzing) {
+            joinNode->rowsIn = joinNode->children[0]->rowsOut + joinNode->children[1]->rowsOut;
+            joinNode->rowsOut = joined->getRowCount();
+            joinNode->memoryPeak = hashJoin.getMemoryPeak();
+            joinNode->bytes = hashJoin.getSpilledBytes();
+            if (hashJoin.getSpilledPartitions() > 0) {
+                joinNode->lines.push_back("Partitions on disk: " + to_string(hashJoin.getSpilledPartitions()));
+            }
+        }
+        // the joined table's scan expects the join's rows, not what a
+        // plain EXPLAIN built
+        plan->inputRows = joinNode->estimatedRows;
+    }
+
+    ResultSet* result;
+    try {
+        if (!aggregate.isEmpty()) {
+            result = runAggregate(joined, joinedAggregate, afterJoin, joinedOrder, plan);
+        }
+        else {
+            vector<int> columnIndices;
+            for (int i = 0; i < (int)selected.size(); i++) {
+                columnIndices.push_back(joined->getColumnIndex(selected[i]));
+            }
+            result = runSelect(joined, columnIndices, afterJoin, joinedOrder, plan);
+            result->takeTable(joined);
+            joined = NULL;
+            // conditions pushed below the join filtered its inputs instead
+            if (!conditions.empty()) result->markFiltered();
+        }
+    }
+    catch (...) {
+        delete joined;
+        throw;
+    }
+    if (plan != NULL) {
+        plan->inputRows = -1;
+        attachJoin(plan, joinNode, !afterJoin.empty());
+    }
+
+    // The groups are a table of their own
+    delete joined;
+    return result;
+}
+
+void DatabaseEngine::openJoinInput(Table* table, JoinInput& input, PlanNode* plan) {
+    input.table = table;
+    input.poolFile = pagedFile(table);
+    input.rows = table->getRowCount();
+    input.filtered = false;
+    input.profile = NULL;
+    if (input.poolFile != -1) {
+        // not filtered until it is fed to the join
+        input.rows = (long long)(input.rows * table->getStats().selectivity(*table, input.conditions));
+        input.profile = addPagedScan(plan, *table, input.conditions);
+        return;
+    }
+
+    table->load();
+    if (matchRows(*table, input.conditions, input.matches, plan)) {
+        input.filtered = true;
+        input.rows = (long long)input.matches.size();
+    }
+    if (planOnly(plan)) input.rows = (long long)plan->children.back()->estimatedRows;
+}
+
+// A loaded input goes to the join at once, a streamed one slice by slice
+void DatabaseEngine::feedJoin(JoinInput& input, HashJoin& join, bool build) {
+    if (input.poolFile == -1) {
+        const vector<int>* rows = input.filtered ? &input.matches : NULL;
+        if (build) join.build(*input.table, rows);
+        else join.probe(*input.table, rows);
+        return;
+    }
+
+    PagedScan scan(*input.table, bufferPool, input.poolFile);
+    scan.setProfile(input.profile);
+    int firstRow;
+    Table* chunk;
+    vector<int> matches;
+    while ((chunk = scan.next(firstRow, input.conditions, matches)) != NULL) {
+        try {
+            const vector<int>* rows = input.conditions.empty() ? NULL : &matches;
+            if (build) join.build(*chunk, rows);
+            else join.probe(*chunk, rows);
+        }
+        catch (...) {
+            delete chunk;
+            throw;
+        }
+        delete chunk;
+    }
+}
+
+long long DatabaseEngine::selectInto(const string& query, ResultSink& sink) {
+    ResultSet* result = executeSelect(query);
+    long long rowCount;
+    try {
+        rowCount = ResultSink::drain(*result, sink);
+    }
+    catch (...) {
+        delete result;
+        throw;
+    }
+    delete result;
+    return rowCount;
+}
+
+void DatabaseEngine::selectFrom(const string& query, OutputFormat format) {
+    try {
+        if (format == OUTPUT_CSV) {
+            CsvWriter sink(cout);
+            selectInto(query, sink);
+        }
+        else if (format == OUTPUT_COUNT) {
+            CountingSink sink;
+            cout << "Rows returned: " << selectInto(query, sink) << endl;
+        }
+        else {
+            TablePrinter sink(cout);
+            selectInto(query, sink);
+        }
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+// Runs a statement through the plan cache: a statement for its shape is
+// taken from the cache (or prepared) and its literals are bound; it goes
+// back to the cache afterwards, so concurrent runs of a shape each have
+// their own. Returns false to leave the statement to the uncached path,
+// which then reports any error the way it always has: statements that are
+// not cached, shapes the prepared path rejects (such as a WHERE on an
+// unknown column, which the REPL ignores) and literals that do not bind.
+// tableName receives the statement's table.
+bool DatabaseEngine::runCached(const string& query, QueryResult& result, string& tableName) {
+    string shape;
+    vector<string> literals;
+    if (!PlanCache::normalize(query, shape, literals)) return false;
+
+    PreparedStatement* statement = planCache.take(shape);
+    // one returned after a schema change would resolve again, which
+    // takes the catalog lock held here
+    if (statement != NULL && statement->catalogVersion != catalogVersion) {
+        delete statement;
+        statement = NULL;
+    }
+    if (statement == NULL) {
+        statement = new PreparedStatement(*this, shape);
+    }
+
+    bool bound = statement->getStatus() == STATUS_OK &&
+        statement->getParameterCount() == (int)literals.size();
+    for (int i = 0; bound && i < (int)literals.size(); i++) {
+        bound = statement->bind(i + 1, literals[i]) == STATUS_OK;
+    }
+    if (bound) {
+        statement->run(result);
+        tableName = statement->getTableName();
+    }
+    planCache.release(shape, statement);
+    return bound;
+}
+
+PreparedStatement* DatabaseEngine::prepare(const string& sql) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    return new PreparedStatement(*this, sql);
+}
+
+StatusCode DatabaseEngine::execute(const string& sql, QueryResult& result) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    PreparedStatement statement(*this, sql);
+    return statement.run(result);
+}
+
+// A large table is scanned through the pool first and only loaded when
+// rows actually go. The rows are stamped deleted, so readers of an older
+// snapshot still see them.
+int DatabaseEngine::runDelete(Table* table, const vector<Condition>& conditions) {
+    int poolFile = pagedFile(table);
+    if (!conditions.empty() && poolFile != -1 && scanPaged(table, poolFile, conditions) == 0) {
+        return 0;
+    }
+
+    int deletedCount;
+    table->beginWrite();
+    try {
+        table->load();
+        deletedCount = table->deleteRows(conditions);
+    }
+    catch (...) {
+        table->rollback();
+        throw;
+    }
+    if (deletedCount == 0) {
+        table->rollback();
+        return 0;
+    }
+
+    vector<string> fields(1, table->getTableName());
+    appendConditions(fields, conditions);
+    commitWrite(table, LOG_DELETE, &fields);
+    return deletedCount;
+}
+
+void DatabaseEngine::deleteFrom(const string& query) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    try {
+        QueryResult result;
+        string tableName;
+        if (runCached(query, result, tableName)) {
+            if (!result.ok()) {
+                cout << "Error: " << result.getMessage() << endl;
+            }
+            else {
+                cout << "[" << result.getRowsAffected() << "] Row(s) deleted from '"
+                    << tableName << "'!" << endl;
+            }
+            return;
+        }
+
+        vector<Condition> conditions;
+
+        QueryParser::parseDelete(query, tableName, conditions);
+
+        if (tables.find(tableName) == tables.end()) {
+            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+            return;
+        }
+
+        int deletedCount = runDelete(tables[tableName], conditions);
+
+        cout << "[" << deletedCount << "] Row(s) deleted from '"
+            << tableName << "'!" << endl;
+
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+StatusCode DatabaseEngine::runUpdate(Table* table, const map<string, string>& updates,
+    const vector<Condition>& conditions, int& updatedCount, string& message) {
+    updatedCount = 0;
+
+    // Validate updates
+    map<string, string>::const_iterator it;
+    for (it = updates.begin(); it != updates.end(); ++it) {
+        const string& colName = it->first;
+        const string& value = it->second;
+
+        int colIndex = table->getColumnIndex(colName);
+        if (colIndex == -1) {
+            message = "Column '" + colName + "' does not exist!";
+            return STATUS_NO_SUCH_COLUMN;
+        }
+
+        const Column& col = table->getColumns()[colIndex];
+
+        if (col.getType() == INT && !isValidInt(value)) {
+            message = "Invalid INT value for column '" + colName + "'";
+            return STATUS_TYPE_MISMATCH;
+        }
+        if (col.getType() == FLOAT && !isValidFloat(value)) {
+            message = "Invalid FLOAT value for column '" + colName + "'";
+            return STATUS_TYPE_MISMATCH;
+        }
+    }
+
+    // As for DELETE, a large table is loaded only when some row matches
+    int poolFile = pagedFile(table);
+    if (poolFile != -1 && scanPaged(table, poolFile, conditions) == 0) {
+        return STATUS_OK;
+    }
+
+    table->beginWrite();
+    try {
+        table->load();
+        updatedCount = table->updateRows(updates, conditions);
+    }
+    catch (runtime_error& e) {
+        // the only refusal: a PRIMARY KEY clash, found before any change
+        table->rollback();
+        message = e.what();
+        return STATUS_CONSTRAINT;
+    }
+    catch (...) {
+        table->rollback();
+        throw;
+    }
+    if (updatedCount == 0) {
+        table->rollback();
+        return STATUS_OK;
+    }
+
+    vector<string> fields(1, table->getTableName());
+    fields.push_back(to_string(updates.size()));
+    for (it = updates.begin(); it != updates.end(); ++it) {
+        fields.push_back(it->first);
+        fields.push_back(it->second);
+    }
+    appendConditions(fields, conditions);
+    commitWrite(table, LOG_UPDATE, &fields);
+    return STATUS_OK;
+}
+
+void DatabaseEngine::updateTable(const string& query) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    try {
+        QueryResult result;
+        string tableName;
+        if (runCached(query, result, tableName)) {
+            if (!result.ok()) {
+                cout << "Error: " << result.getMessage() << endl;
+            }
+            else {
+                cout << "[" << result.getRowsAffected() << "] Row(s) updated in '"
+                    << tableName << "'!" << endl;
+            }
+            return;
+        }
+
+        map<string, string> updates;
+        vector<Condition> conditions;
+
+        QueryParser::parseUpdate(query, tableName, updates, conditions);
+
+        if (tables.find(tableName) == tables.end()) {
+            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+            return;
+        }
+
+        int updatedCount;
+        string message;
+        if (runUpdate(tables[tableName], updates, conditions, updatedCount, message) != STATUS_OK) {
+            cout << "Error: " << message << endl;
+            return;
+        }
+
+        cout << "[" << updatedCount << "] Row(s) updated in '"
+            << tableName << "'!" << endl;
+
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+void DatabaseEngine::dropTable(const string& query) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    try {
+        string tableName = QueryParser::parseDropTable(query);
+
+        if (tables.find(tableName) == tables.end()) {
+            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+            return;
+        }
+
+        removeTable(tableName);
+
+        cout << "Table '" << tableName << "' dropped successfully!" << endl;
+
+        logChange(LOG_DROP_TABLE, vector<string>(1, tableName));
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+// Lookup for statements that touch rows: decodes a lazily opened table
+Table* DatabaseEngine::findTable(const string& tableName) {
+    map<string, Table*>::iterator it = tables.find(tableName);
+    if (it == tables.end()) return NULL;
+
+    it->second->load();
+    return it->second;
+}
+
+// Pool file to stream an unloaded table from, or -1 when the table should
+// just be loaded (it fits in the buffer pool or has no table file yet).
+int DatabaseEngine::pagedFile(const Table* table) {
+    if (table->isLoaded() || table->getStoredSize() <= bufferPool.getCapacity()) return -1;
+
+    lock_guard<mutex> guard(fileLock);
+    map<string, int>::iterator it = poolFiles.find(tableFilePath(table->getTableName()));
+    return (it == poolFiles.end()) ? -1 : it->second;
+}
+
+// Evaluates the conditions slice by slice through the buffer pool and
+// prints the matching rows when displayCols is given. Returns the count.
+int DatabaseEngine::scanPaged(Table* table, int poolFile, const vector<Condition>& conditions) {
+    PagedScan scan(*table, bufferPool, poolFile);
+    int count = 0;
+    int firstRow;
+    Table* chunk;
+
+    while ((chunk = scan.next(firstRow)) != NULL) {
+        vector<int> matches;
+        try {
+            chunk->findMatchingRows(conditions, matches);
+        }
+        catch (...) {
+            delete chunk;
+            throw;
+        }
+
+        count += (int)matches.size();
+        delete chunk;
+    }
+    return count;
+}
+
+Table* DatabaseEngine::findIndexOwner(const string& indexName) {
+    map<string, Table*>::iterator it;
+    for (it = tables.begin(); it != tables.end(); ++it) {
+        if (it->second->hasIndex(indexName)) return it->second;
+    }
+    return NULL;
+}
+
+void DatabaseEngine::createIndex(const string& query) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    try {
+        string indexName, tableName, columnName;
+        QueryParser::parseCreateIndex(query, indexName, tableName, columnName);
+
+        Table* table = findTable(tableName);
+        if (table == NULL) {
+            cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+            return;
+        }
+
+        if (findIndexOwner(indexName) != NULL) {
+            cout << "Error: Index '" << indexName << "' already exists!" << endl;
+            return;
+        }
+
+        int colIndex = table->getColumnIndex(columnName);
+        if (colIndex == -1) {
+            cout << "Error: Column '" << columnName << "' does not exist!" << endl;
+            return;
+        }
+
+        table->createIndex(indexName, colIndex);
+        catalogChanged();
+
+        cout << "Index '" << indexName << "' created on '" << tableName
+            << "(" << table->getColumns()[colIndex].getName() << ")'!" << endl;
+
+        vector<string> fields;
+        fields.push_back(indexName);
+        fields.push_back(tableName);
+        fields.push_back(table->getColumns()[colIndex].getName());
+        logChange(LOG_CREATE_INDEX, fields);
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+void DatabaseEngine::dropIndex(const string& query) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    try {
+        string indexName = QueryParser::parseDropIndex(query);
+
+        Table* table = findIndexOwner(indexName);
+        if (table == NULL) {
+            cout << "Error: Index '" << indexName << "' does not exist!" << endl;
+            return;
+        }
+
+        table->dropIndex(indexName);
+        catalogChanged();
+
+        cout << "Index '" << indexName << "' dropped successfully!" << endl;
+
+        logChange(LOG_DROP_INDEX, vector<string>(1, indexName));
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+void DatabaseEngine::listTables() {
+    shared_lock<shared_mutex> guard(catalogLock);
+    if (tables.empty()) {
+        cout << "No tables in database." << endl;
+        return;
+    }
+
+    cout << "Tables in database:" << endl;
+
+    map<string, Table*>::iterator it;
+    for (it = tables.begin(); it != tables.end(); ++it) {
+        cout << "  - " << it->first << " ("
+            << it->second->getLiveRowCount() << " rows)" << endl;
+    }
+}
+
+// Statistics of every column, from the loaded rows or, for a table
+// larger than the buffer pool, slice by slice through it
+TableStats DatabaseEngine::collectStats(Table* table) {
+    StatsCollector collector(*table);
+
+    int poolFile = pagedFile(table);
+    if (poolFile == -1) {
+        table->load();
+        collector.add(*table);
+        return collector.finish();
+    }
+
+    PagedScan scan(*table, bufferPool, poolFile);
+    int firstRow;
+    Table* chunk;
+    while ((chunk = scan.next(firstRow)) != NULL) {
+        try {
+            collector.add(*chunk);
+        }
+        catch (...) {
+            delete chunk;
+            throw;
+        }
+        delete chunk;
+    }
+    return collector.finish();
+}
+
+void DatabaseEngine::analyze(const string& query) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    try {
+        string tableName = QueryParser::parseAnalyze(query);
+
+        vector<Table*> targets;
+        if (tableName.empty()) {
+            map<string, Table*>::iterator it;
+            for (it = tables.begin(); it != tables.end(); ++it) {
+                targets.push_back(it->second);
+            }
+            if (targets.empty()) {
+                cout << "No tables in database." << endl;
+                return;
+            }
+        }
+        else {
+            map<string, Table*>::iterator it = tables.find(tableName);
+            if (it == tables.end()) {
+                cout << "Error: Table '" << tableName << "' does not exist!" << endl;
+                return;
+            }
+            targets.push_back(it->second);
+        }
+
+        for (size_t t = 0; t < targets.size(); t++) {
+            Table* table = targets[t];
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            // no writer runs now; the statistics count only live rows
+            table->compact(versions.getLastCommitted());
+            TableStats stats = collectStats(table);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            // Saved with the table at the next checkpoint
+            table->setStats(stats);
+            table->markDirty();
+
+            char timing[32];
+            snprintf(timing, sizeof(timing), "%.3f s", seconds);
+            cout << "Analyzed '" << table->getTableName() << "': " << stats.rowCount
+                << " rows in " << timing << endl;
+
+            const vector<Column>& cols = table->getColumns();
+            for (size_t c = 0; c < cols.size(); c++) {
+                const ColumnStats& column = stats.columns[c];
+                cout << "  " << cols[c].getName() << ": " << column.nullCount << " NULLs, ~"
+                    << (long long)column.distinct << " distinct";
+                if (!column.numberBounds.empty()) {
+                    cout << ", range " << ColumnVector::formatDouble(column.numberBounds.front())
+                        << " .. " << ColumnVector::formatDouble(column.numberBounds.back());
+                }
+                else if (!column.textBounds.empty()) {
+                    cout << ", range '" << column.textBounds.front() << "' .. '"
+                        << column.textBounds.back() << "'";
+                }
+                cout << endl;
+            }
+        }
+
+        if (wal.isOpen()) {
+            checkpoint(dataFile, true);
+        }
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+// The plan is built as the query runs: under a Project (and a Limit for
+// LIMIT/OFFSET, which apply as the rows are read) come the operators the
+// executor adds. ANALYZE reads the result to the end, so lazy steps such
+// as a streamed scan are measured too.
+void DatabaseEngine::explain(const string& query) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    try {
+        bool analyzing;
+        string select = QueryParser::parseExplain(query, analyzing);
+
+        string tableName;
+        vector<string> columns;
+        vector<Condition> conditions;
+        AggregateQuery aggregate;
+        SortQuery order;
+        JoinQuery join;
+        QueryParser::parseSelect(select, tableName, columns, conditions, aggregate, order, join);
+
+        string outputs;
+        for (int i = 0; i < (int)aggregate.outputs.size(); i++) {
+            const AggregateTerm& term = aggregate.outputs[i];
+            outputs += (i > 0 ? ", " : "") + HashAggregate::label(term.function, term.column);
+        }
+        for (int i = 0; i < (int)columns.size(); i++) {
+            outputs += (i > 0 ? ", " : "") + columns[i];
+        }
+        if (outputs.empty()) outputs = "*";
+
+        PlanNode root("Project", outputs, -1, analyzing);
+        PlanNode* plan = &root;
+        long long limit = order.getLimit();
+        long long offset = order.getOffset();
+        if (limit >= 0 || offset > 0) {
+            string detail = limit >= 0 ? to_string(limit) : "all";
+            if (offset > 0) detail += " offset " + to_string(offset);
+            plan = root.add("Limit", detail, -1);
+        }
+
+        OperatorTimer timer(&root);
+        OperatorTimer limitTimer(plan == &root ? NULL : plan);
+        ResultSet* result = runQuery(select, plan);
+        long long rows = 0;
+        try {
+            CountingSink sink;
+            if (analyzing) rows = ResultSink::drain(*result, sink);
+        }
+        catch (...) {
+            delete result;
+            throw;
+        }
+        delete result;
+        limitTimer.stop();
+        timer.stop();
+
+        double estimate = plan->children[0]->estimatedRows;
+        if (plan != &root) {
+            estimate = max(estimate - offset, 0.0);
+            if (limit >= 0) estimate = min(estimate, (double)limit);
+            plan->estimatedRows = estimate;
+            plan->rowsOut = rows;
+        }
+        root.estimatedRows = estimate;
+        root.rowsOut = rows;
+        root.print(cout, 0);
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+}
+
+// Directory part of path, including the trailing separator
+static string folderOf(const string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return (slash == string::npos) ? "" : path.substr(0, slash + 1);
+}
+
+string DatabaseEngine::tableFilePath(const string& tableName) const {
+    return folderOf(dataFile) + tableName + ".tbl";
+}
+
+// A checkpoint rewrites only the dirty tables' files, then the manifest;
+// replacing the manifest is what makes the new checkpoint LSN visible.
+// A dirty table that is not loaded (its statistics changed, or it is
+// moving out of a single-file database) keeps streaming from its new file.
+void DatabaseEngine::saveToDisk(const string& filename) {
+    shared_lock<shared_mutex> guard(catalogLock);
+    checkpoint(filename, false);
+}
+
+void DatabaseEngine::checkpoint(const string& filename, bool exclusive) {
+    lock_guard<mutex> guard(checkpointLock);
+    writeCheckpoint(filename, exclusive, NULL);
+}
+
+// Another writer may have checkpointed since the log grew too long
+void DatabaseEngine::checkpointIfDue() {
+    lock_guard<mutex> guard(checkpointLock);
+    {
+        lock_guard<mutex> committing(commitLock);
+        if (!wal.isOpen() || wal.getSize() < checkpointBytes) return;
+    }
+    writeCheckpoint(dataFile, false, NULL);
+}
+
+// Every table's write lock is held throughout, so the files and the log
+// position agree; readers carry on with their snapshots. Deleted rows are
+// compacted away first, as no snapshot can still need them in the file.
+// Without the catalog held exclusively a view may be reading an unloaded
+// table's file, so such a table is loaded rather than given a new file.
+void DatabaseEngine::writeCheckpoint(const string& filename, bool exclusive, Table* held) {
+    vector<Table*> locked;
+    map<string, Table*>::iterator it;
+    for (it = tables.begin(); it != tables.end(); ++it) {
+        if (it->second == held) continue;
+        it->second->lockWrites();
+        locked.push_back(it->second);
+    }
+
+    try {
+        uint64_t lsn;
+        {
+            lock_guard<mutex> committing(commitLock);
+            lsn = wal.getNextLsn() - 1;
+        }
+        vector<string> tableNames;
+        for (it = tables.begin(); it != tables.end(); ++it) {
+            tableNames.push_back(it->first);
+        }
+
+        bool saved = true;
+        for (it = tables.begin(); it != tables.end(); ++it) {
+            Table* t = it->second;
+            if (!t->isDirty()) continue;
+
+            string path = tableFilePath(it->first);
+            string image;
+            vector<ColumnSegment> segments;
+            try {
+                if (!exclusive) t->load();
+                t->compact(versions.getLastCommitted());
+                image = BinaryFormat::encodeTable(*t, lsn, segments);
+            }
+            catch (exception& e) {
+                cout << "Warning: Could not save '" << filename << "': " << e.what() << endl;
+                saved = false;
+                break;
+            }
+
+            bool loaded = t->isLoaded();
+            releaseMapping(path);
+            if (!FileSystem::writeFileAtomic(path, image)) {
+                cout << "Warning: Could not open '" << path << "' for saving.\n";
+                saved = false;
+                break;
+            }
+            if (!loaded) {
+                t->attachStorage(mapTableFile(path), segments, t->getRowCount());
+            }
+            t->markClean(lsn);
+        }
+
+        if (saved) {
+            // The table files' renames must be on disk before the manifest
+            // that names them, and the manifest's before the log is dropped
+            FileSystem::syncDirectory(folderOf(dataFile));
+
+            // Mapped only while converting a single-file database
+            releaseMapping(filename);
+
+            if (!FileSystem::writeFileAtomic(filename, BinaryFormat::encodeManifest(lsn, tableNames))) {
+                cout << "Warning: Could not open '" << filename << "' for saving.\n";
+            }
+            else {
+                FileSystem::syncDirectory(folderOf(filename));
+                if (filename == dataFile) {
+                    // Everything in the log is now part of the table files
+                    lock_guard<mutex> committing(commitLock);
+                    wal.reset();
+                }
+            }
+        }
+    }
+    catch (...) {
+        for (size_t i = 0; i < locked.size(); i++) locked[i]->unlockWrites();
+        throw;
+    }
+    for (size_t i = 0; i < locked.size(); i++) locked[i]->unlockWrites();
+}
+
+static void freeMapping(void* file) {
+    delete (MappedFile*)file;
+}
+
+// A pool file closed once no reader of it is left
+struct PoolFileClose {
+    BufferPool* pool;
+    int file;
+};
+
+static void closePoolFile(void* close) {
+    PoolFileClose* pending = (PoolFileClose*)close;
+    pending->pool->closeFile(pending->file);
+    delete pending;
+}
+
+void DatabaseEngine::clearTables() {
+    catalogChanged();
+
+    map<string, Table*>::iterator it;
+    for (it = tables.begin(); it != tables.end(); ++it) {
+        delete it->second;
+    }
+    tables.clear();
+
+    vector<string> paths;
+    {
+        lock_guard<mutex> guard(fileLock);
+        map<string, MappedFile*>::iterator m;
+        for (m = mappedFiles.begin(); m != mappedFiles.end(); ++m) paths.push_back(m->first);
+        map<string, int>::iterator p;
+        for (p = poolFiles.begin(); p != poolFiles.end(); ++p) paths.push_back(p->first);
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+        releaseMapping(paths[i]);
+    }
+}
+
+// Results still reading the file keep it until they are done
+void DatabaseEngine::releaseMapping(const string& path) {
+    lock_guard<mutex> guard(fileLock);
+    map<string, int>::iterator p = poolFiles.find(path);
+    if (p != poolFiles.end()) {
+        PoolFileClose* close = new PoolFileClose();
+        close->pool = &bufferPool;
+        close->file = p->second;
+        versions.retire(closePoolFile, close);
+        poolFiles.erase(p);
+    }
+
+    map<string, MappedFile*>::iterator it = mappedFiles.find(path);
+    if (it == mappedFiles.end()) return;
+
+    versions.retire(freeMapping, it->second);
+    mappedFiles.erase(it);
+}
+
+void DatabaseEngine::removeTable(const string& tableName) {
+    // also covers a replayed CREATE TABLE, which removes any old table first
+    catalogChanged();
+
+    map<string, Table*>::iterator it = tables.find(tableName);
+    if (it == tables.end()) return;
+
+    delete it->second;
+    tables.erase(it);
+
+    string path = tableFilePath(tableName);
+    releaseMapping(path);
+    FileSystem::removeFile(path);
+}
+
+// Maps a paged file, also for reading through the buffer pool
+const MappedFile* DatabaseEngine::mapTableFile(const string& path) {
+    MappedFile* file = new MappedFile();
+    if (!file->open(path)) {
+        delete file;
+        throw runtime_error("Could not map '" + path + "'");
+    }
+    lock_guard<mutex> guard(fileLock);
+    mappedFiles[path] = file;
+    poolFiles[path] = bufferPool.openFile(path);
+    return file;
+}
+
+// Maps a paged file and registers its tables; rows are decoded on first use
+void DatabaseEngine::openTableFile(const string& path) {
+    const MappedFile* file = mapTableFile(path);
+
+    uint64_t lsn;
+    BinaryFormat::readCatalog(*file, tables, lsn);
+}
+
+bool DatabaseEngine::loadBaseFile(const string& filename, uint64_t& checkpointLsn, DataFileKind& kind) {
+    checkpointLsn = 0;
+
+    kind = BinaryFormat::detect(filename);
+    if (kind == FILE_MISSING) {
+        return false; // No DB file, first run
+    }
+    if (kind == FILE_TEXT) {
+        return loadTextFile(filename, checkpointLsn);
+    }
+
+    if (kind == FILE_TABLES) {
+        // Single-file database: every table moves to its own file at the next save
+        openTableFile(filename);
+        map<string, Table*>::iterator it;
+        for (it = tables.begin(); it != tables.end(); ++it) {
+            checkpointLsn = it->second->getFlushedLsn();
+            it->second->markDirty();
+        }
+        return true;
+    }
+
+    ifstream in(filename.c_str(), ios::binary);
+    ostringstream data;
+    data << in.rdbuf();
+
+    vector<string> tableNames;
+    BinaryFormat::readManifest(data.str(), checkpointLsn, tableNames);
+
+    for (size_t i = 0; i < tableNames.size(); i++) {
+        string path = tableFilePath(tableNames[i]);
+        if (!FileSystem::fileExists(path)) {
+            // Dropped after the last checkpoint; the log has the DROP
+            cout << "Warning: Table file '" << path << "' is missing.\n";
+            continue;
+        }
+
+        try {
+            openTableFile(path);
+        }
+        catch (exception& e) {
+            // Keep the damaged file for inspection instead of overwriting it
+            releaseMapping(path);
+            string aside = path + ".corrupt";
+            FileSystem::removeFile(aside);
+            rename(path.c_str(), aside.c_str());
+            cout << "Error: " << e.what() << " (moved to '" << aside << "')" << endl;
+        }
+    }
+    return true;
+}
+
+// True when the change is already contained in its table's file, i.e. the
+// file was rewritten after the record but the manifest was not.
+bool DatabaseEngine::isFlushed(const LogRecord& record) {
+    const vector<string>& f = record.fields;
+    if (f.empty()) return false;
+
+    const Table* table = NULL;
+    if (record.type == LOG_CREATE_INDEX) {
+        if (f.size() > 1 && tables.find(f[1]) != tables.end()) table = tables[f[1]];
+    }
+    else if (record.type == LOG_DROP_INDEX) {
+        table = findIndexOwner(f[0]);
+    }
+    else if (tables.find(f[0]) != tables.end()) {
+        table = tables[f[0]];
+    }
+
+    return table != NULL && record.lsn <= table->getFlushedLsn();
+}
+
+// Text format used before the binary file; only read, to convert it
+bool DatabaseEngine::loadTextFile(const string& filename, uint64_t& checkpointLsn) {
+    ifstream in(filename.c_str());
+    if (!in) {
+        return false; // No DB file, first run
+    }
+
+    string line;
+    if (!getline(in, line)) return false;
+
+    // Files written before the log existed start directly with the table count
+    if (line.compare(0, 4, "LSN ") == 0) {
+        checkpointLsn = strtoull(line.c_str() + 4, NULL, 10);
+        if (!getline(in, line)) return false;
+    }
+    if (line.empty()) return false;
+
+    int tableCount = stoi(line);
+
+    for (int ti = 0; ti < tableCount; ++ti) {
         string marker;
         if (!getline(in, marker)) break;
         if (marker != "TABLE") break;
@@ -469,9 +2025,9 @@ void DatabaseEngine::loadFromDisk(const string& filename) {
         // Columns
         for (int ci = 0; ci < colCount; ++ci) {
             string colName;
-            if (!getline(in, colName)) { delete table; return; }
+            if (!getline(in, colName)) { delete table; return true; }
 
-            if (!getline(in, line)) { delete table; return; }
+            if (!getline(in, line)) { delete table; return true; }
 
             istringstream iss(line);
             int typeInt, size, pk, nn;
@@ -483,26 +2039,384 @@ void DatabaseEngine::loadFromDisk(const string& filename) {
         }
 
         // Rows
-        if (!getline(in, line)) { delete table; return; }
+        if (!getline(in, line)) { delete table; return true; }
         int rowCount = stoi(line);
 
         for (int ri = 0; ri < rowCount; ++ri) {
-            if (!getline(in, line)) { delete table; return; }
+            if (!getline(in, line)) { delete table; return true; }
 
             int valueCount = stoi(line);
             Row row;
 
             for (int vi = 0; vi < valueCount; ++vi) {
                 string val;
-                if (!getline(in, val)) { delete table; return; }
+                if (!getline(in, val)) { delete table; return true; }
                 row.addValue(val);
             }
 
             table->addRow(row);
         }
 
+        // Optional index definitions (older files have none)
+        streampos afterRows = in.tellg();
+        while (getline(in, line) && line.compare(0, 6, "INDEX ") == 0) {
+            istringstream iss(line.substr(6));
+            string indexName, columnName;
+            iss >> indexName >> columnName;
+
+            int colIndex = table->getColumnIndex(columnName);
+            if (colIndex != -1) {
+                table->createIndex(indexName, colIndex);
+            }
+            afterRows = in.tellg();
+        }
+        in.clear();
+        in.seekg(afterRows);
+
         tables[tableName] = table;
     }
 
-    cout << "Database loaded from '" << filename << "'.\n";
+    return true;
+}
+
+void DatabaseEngine::loadFromDisk(const string& filename) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    wal.close();
+    clearTables();
+    dataFile = filename;
+
+    uint64_t checkpointLsn = 0;
+    DataFileKind kind = FILE_MISSING;
+    bool loaded = false;
+    try {
+        loaded = loadBaseFile(filename, checkpointLsn, kind);
+    }
+    catch (exception& e) {
+        // A damaged manifest or single-file database; keep it for inspection
+        clearTables();
+        string aside = filename + ".corrupt";
+        FileSystem::removeFile(aside);
+        rename(filename.c_str(), aside.c_str());
+        cout << "Error: " << e.what() << " (moved to '" << aside << "')" << endl;
+    }
+
+    // Redo everything logged after the snapshot
+    string logFile = filename + ".wal";
+    vector<LogRecord> records;
+    uint64_t validLength;
+    WriteAheadLog::readAll(logFile, records, validLength);
+
+    uint64_t lastLsn = checkpointLsn;
+    int replayed = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].lsn <= checkpointLsn) continue;
+        if (records[i].lsn > lastLsn) lastLsn = records[i].lsn;
+        if (isFlushed(records[i])) continue;
+        try {
+            applyLogRecord(records[i]);
+        }
+        catch (exception& e) {
+            cout << "Warning: Could not replay log record " << records[i].lsn
+                << ": " << e.what() << endl;
+        }
+        replayed++;
+    }
+
+    if (!wal.open(logFile, validLength, lastLsn + 1)) {
+        cout << "Warning: Could not open log '" << logFile << "'; changes will not be durable.\n";
+    }
+
+    // Loaded and replayed unshared; from here on readers take views
+    map<string, Table*>::iterator it;
+    for (it = tables.begin(); it != tables.end(); ++it) {
+        it->second->setVersions(&versions);
+    }
+
+    if (loaded) {
+        cout << "Database loaded from '" << filename << "'.\n";
+    }
+    if (replayed > 0) {
+        cout << "Recovered " << replayed << " change(s) from '" << logFile << "'.\n";
+    }
+
+    // One-shot upgrade of an older database; a text original is kept as a backup
+    if (loaded && kind == FILE_TEXT) {
+        string backup = filename + ".txt";
+        ifstream in(filename.c_str(), ios::binary);
+        ostringstream text;
+        text << in.rdbuf();
+        in.close();
+
+        if (FileSystem::writeFileAtomic(backup, text.str())) {
+            checkpoint(filename, true);
+            cout << "Converted '" << filename << "' to the binary format (old file kept as '"
+                << backup << "').\n";
+        }
+    }
+    else if (loaded && kind == FILE_TABLES) {
+        checkpoint(filename, true);
+        cout << "Split '" << filename << "' into one file per table.\n";
+    }
+}
+
+void DatabaseEngine::setSyncMode(SyncMode mode, int param) {
+    lock_guard<mutex> guard(commitLock);
+    wal.setSyncMode(mode, param);
+}
+
+void DatabaseEngine::setCheckpointSize(uint64_t bytes) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    checkpointBytes = bytes;
+}
+
+void DatabaseEngine::setBufferPoolSize(size_t bytes) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    bufferPool.setCapacity(bytes);
+}
+
+void DatabaseEngine::setSortMemory(size_t bytes) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    sortMemory = bytes;
+}
+
+void DatabaseEngine::setJoinMemory(size_t bytes) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    joinMemory = bytes;
+}
+
+// The collector's compactions copy columns on the pool too
+void DatabaseEngine::setThreadCount(int threads) {
+    unique_lock<shared_mutex> guard(catalogLock);
+    ThreadPool::shared().resize(threads);
+}
+
+int DatabaseEngine::getThreadCount() const {
+    return ThreadPool::shared().getThreadCount();
+}
+
+void DatabaseEngine::showBufferStats() {
+    BufferPoolStats stats = bufferPool.getStats();
+    uint64_t lookups = stats.hits + stats.misses;
+    double ratio = (lookups == 0) ? 0.0 : 100.0 * (double)stats.hits / (double)lookups;
+
+    char line[64];
+    snprintf(line, sizeof(line), "%.1f%%", ratio);
+
+    cout << "Buffer pool: " << (stats.capacityPages * BufferPool::PAGE_SIZE) / (1024 * 1024) << " MB ("
+        << stats.capacityPages << " pages of " << BufferPool::PAGE_SIZE / 1024 << " KB)" << endl;
+    cout << "  Pages in use: " << stats.usedPages << " (" << stats.pinnedPages << " pinned)" << endl;
+    cout << "  Hits: " << stats.hits << "  Misses: " << stats.misses << "  Hit ratio: " << line << endl;
+    cout << "  Evictions: " << stats.evictions << "  Write-backs: " << stats.writeBacks << endl;
+}
+
+void DatabaseEngine::setPlanCacheSize(size_t entries) {
+    planCache.setCapacity(entries);
+}
+
+void DatabaseEngine::showCacheStats() {
+    PlanCacheStats stats = planCache.getStats();
+    uint64_t lookups = stats.hits + stats.misses;
+    double ratio = (lookups == 0) ? 0.0 : 100.0 * (double)stats.hits / (double)lookups;
+
+    char line[64];
+    snprintf(line, sizeof(line), "%.1f%%", ratio);
+
+    cout << "Plan cache: " << stats.entries << " of " << stats.capacity << " query shapes" << endl;
+    cout << "  Hits: " << stats.hits << "  Misses: " << stats.misses << "  Hit ratio: " << line << endl;
+    cout << "  Evictions: " << stats.evictions << "  Invalidations: " << stats.invalidations << endl;
+}
+
+// Schema change: prepared statements re-resolve on their next use and the
+// cached shapes are dropped
+void DatabaseEngine::catalogChanged() {
+    catalogVersion++;
+    planCache.invalidate();
+}
+
+// Schema changes, which hold the catalog exclusively
+void DatabaseEngine::logChange(LogRecordType type, const vector<string>& fields) {
+    if (!wal.isOpen()) return;
+
+    bool due;
+    {
+        lock_guard<mutex> guard(commitLock);
+        wal.append(type, fields);
+        due = wal.getSize() >= checkpointBytes;
+    }
+
+    // Fold a long log into the base file so recovery stays short
+    if (due) {
+        checkpoint(dataFile, true);
+    }
+}
+
+void DatabaseEngine::commitWrite(Table* table, LogRecordType type, const vector<string>* fields) {
+    bool due;
+    {
+        lock_guard<mutex> guard(commitLock);
+        if (fields != NULL && wal.isOpen()) {
+            wal.append(type, *fields);
+        }
+        // logged before it is visible, and published in log order
+        uint64_t transaction = versions.getLastCommitted() + 1;
+        table->commit(transaction);
+        versions.publish(transaction);
+        due = wal.isOpen() && wal.getSize() >= checkpointBytes;
+    }
+
+    // Fold a long log into the base file so recovery stays short
+    if (due) {
+        checkpointIfDue();
+    }
+}
+
+// The views are opened before the snapshot is read, so the rows they hold
+// include every transaction up to it; a view whose table moved to new
+// rows (or a new file) since it opened is opened again. A table that is to
+// be loaded is loaded through its handle, so later views share the rows.
+void DatabaseEngine::openSnapshot(Table* const* handles, int count, Table** views) {
+    for (int i = 0; i < count; i++) views[i] = NULL;
+    try {
+        while (true) {
+            for (int i = 0; i < count; i++) views[i] = handles[i]->openView();
+            uint64_t snapshot = versions.getLastCommitted();
+
+            bool current = true;
+            Table* unloaded = NULL;
+            for (int i = 0; i < count; i++) {
+                if (!views[i]->setSnapshot(snapshot)) current = false;
+                else if (!views[i]->isLoaded() && pagedFile(views[i]) == -1) unloaded = handles[i];
+            }
+            if (current && unloaded == NULL) return;
+
+            for (int i = 0; i < count; i++) {
+                delete views[i];
+                views[i] = NULL;
+            }
+            if (unloaded != NULL) unloaded->load();
+        }
+    }
+    catch (...) {
+        for (int i = 0; i < count; i++) delete views[i];
+        throw;
+    }
+}
+
+// ================== COLLECTOR ==================
+
+void DatabaseEngine::collectorLoop() {
+    uint64_t previousPass = 0;
+    unique_lock<mutex> guard(collectorLock);
+    while (!stopping) {
+        collectorWake.wait_for(guard, chrono::milliseconds(COLLECT_INTERVAL_MS));
+        if (stopping) break;
+
+        guard.unlock();
+        uint64_t started = versions.getLastCommitted();
+        try {
+            collectGarbage(previousPass);
+        }
+        catch (exception& e) {
+            cout << "Warning: Could not compact tables: " << e.what() << endl;
+        }
+        previousPass = started;
+        guard.lock();
+    }
+}
+
+// A table is compacted once an eighth of its rows are dead, or once it
+// has dead rows and no commit since the previous pass (a table being
+// written would otherwise be copied again and again). Compacting as of
+// the last commit is safe even while older snapshots are open: those
+// keep the rows they hold, which are freed when the last one closes.
+void DatabaseEngine::collectGarbage(uint64_t previousPass) {
+    {
+        shared_lock<shared_mutex> guard(catalogLock);
+        map<string, Table*>::iterator it;
+        for (it = tables.begin(); it != tables.end(); ++it) {
+            Table* table = it->second;
+            long long dead = table->getDeadRowCount();
+            long long live = table->getLiveRowCount();
+            if (dead == 0) continue;
+            if (dead * 8 < live + dead && table->getLastCommit() > previousPass) continue;
+
+            table->lockWrites();
+            try {
+                table->compact(versions.getLastCommitted());
+            }
+            catch (...) {
+                table->unlockWrites();
+                throw;
+            }
+            table->unlockWrites();
+        }
+    }
+    versions.reclaim();
+}
+
+// Redo of one logged change; the change already passed validation when it
+// was first executed, so it is applied directly to the tables.
+void DatabaseEngine::applyLogRecord(const LogRecord& record) {
+    const vector<string>& f = record.fields;
+    if (f.empty()) return;
+
+    switch (record.type) {
+    case LOG_CREATE_TABLE: {
+        Table* table = new Table(f[0]);
+        for (size_t i = 1; i + 4 < f.size(); i += 5) {
+            table->addColumn(Column(f[i], (DataType)atoi(f[i + 1].c_str()),
+                atoi(f[i + 2].c_str()), f[i + 3] == "1", f[i + 4] == "1"));
+        }
+        removeTable(f[0]);
+        tables[f[0]] = table;
+        break;
+    }
+    case LOG_DROP_TABLE:
+        removeTable(f[0]);
+        break;
+    case LOG_INSERT: {
+        Table* table = findTable(f[0]);
+        if (table == NULL) break;
+        int columnCount = table->getColumnCount();
+        vector<vector<string> > rows;
+        for (size_t i = 1; i + columnCount <= f.size(); i += columnCount) {
+            rows.push_back(vector<string>(f.begin() + i, f.begin() + i + columnCount));
+        }
+        table->appendRows(rows);
+        break;
+    }
+    case LOG_DELETE: {
+        Table* table = findTable(f[0]);
+        if (table == NULL) break;
+        vector<Condition> conditions;
+        readConditions(f, 1, conditions);
+        table->deleteRows(conditions);
+        break;
+    }
+    case LOG_UPDATE: {
+        Table* table = findTable(f[0]);
+        if (table == NULL || f.size() < 2) break;
+        size_t updateCount = (size_t)atoi(f[1].c_str());
+        map<string, string> updates;
+        for (size_t i = 0; i < updateCount && 3 + 2 * i < f.size(); i++) {
+            updates[f[2 + 2 * i]] = f[3 + 2 * i];
+        }
+        vector<Condition> conditions;
+        readConditions(f, 2 + 2 * updateCount, conditions);
+        table->updateRows(updates, conditions);
+        break;
+    }
+    case LOG_CREATE_INDEX: {
+        Table* table = f.size() < 3 ? NULL : findTable(f[1]);
+        if (table == NULL) break;
+        int colIndex = table->getColumnIndex(f[2]);
+        if (colIndex != -1 && !table->hasIndex(f[0])) table->createIndex(f[0], colIndex);
+        break;
+    }
+    case LOG_DROP_INDEX: {
+        Table* table = findIndexOwner(f[0]);
+        if (table != NULL) table->dropIndex(f[0]);
+        break;
+    }
+    }
 }
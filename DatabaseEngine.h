@@ -4,32 +4,233 @@
 #include <string>
 #include <map>
 #include <cstdlib> 
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
 
 using namespace std;
 
+#include "WriteAheadLog.h"
+#include "BinaryFormat.h"
+#include "BufferPool.h"
+#include "Condition.h"
+#include "PreparedStatement.h"
+#include "PlanCache.h"
+#include "HashJoin.h"
+#include "Statistics.h"
+#include "VersionManager.h"
+
 class Table;
+class MappedFile;
+class ResultSet;
+class ResultSink;
+struct PlanNode;
+
+// How the REPL prints SELECT results
+enum OutputFormat {
+    OUTPUT_TABLE,
+    OUTPUT_CSV,
+    OUTPUT_COUNT  // row count only
+};
 
+// Statements may run on several threads at once. A SELECT reads views
+// of its tables as of one snapshot (see VersionManager), so it never waits
+// for writers; INSERT, UPDATE and DELETE hold the written table's write
+// lock and commit as one transaction. Schema changes, ANALYZE, loading
+// and the settings wait for every running statement instead.
 class DatabaseEngine {
 private:
     map<string, Table*> tables;
 
-    bool isValidInt(const string& str);
-    bool isValidFloat(const string& str);
+    // Transaction numbers, and the rows and files kept for open snapshots
+    VersionManager versions;
+
+    // Held shared by every statement and exclusively by those changing
+    // the tables map, a schema or a setting
+    shared_mutex catalogLock;
+    // Orders the log records and the transaction numbers of commits
+    mutex commitLock;
+    // One checkpoint at a time; taken before any table's write lock
+    mutex checkpointLock;
+    // Guards mappedFiles and poolFiles
+    mutex fileLock;
+
+    // Durability: mutations are appended to <dataFile>.wal and folded
+    // into the table files by saveToDisk (a checkpoint). dataFile is the
+    // manifest; each table lives in <table>.tbl next to it.
+    WriteAheadLog wal;
+    string dataFile;
+    uint64_t checkpointBytes;
+
+    // Mapped table files by path; tables decode their rows on first use
+    map<string, MappedFile*> mappedFiles;
+
+    // Tables larger than the pool are scanned through it instead of loaded
+    BufferPool bufferPool;
+    map<string, int> poolFiles; // path -> pool file id
+
+    // Memory an ORDER BY may hold before spilling sorted runs to disk
+    size_t sortMemory;
+
+    // Memory a JOIN's hashed side may hold before it is partitioned to disk
+    size_t joinMemory;
+
+    // Bumped whenever tables or indexes are created, dropped or reloaded,
+    // so prepared statements know when their resolved table is stale
+    atomic<unsigned long> catalogVersion;
+
+    // Resolved statements per query shape, for the REPL commands
+    PlanCache planCache;
+
+    // Compacts away the row versions no snapshot can see any more, then
+    // frees what was retired, every COLLECT_INTERVAL_MS
+    static const int COLLECT_INTERVAL_MS = 100;
+    thread collector;
+    mutex collectorLock;
+    condition_variable collectorWake;
+    bool stopping;
+
+    friend class PreparedStatement;
+
+    void logChange(LogRecordType type, const vector<string>& fields);
+    void catalogChanged();
+    bool runCached(const string& query, QueryResult& result, string& tableName);
+    bool insertRows(const string& tableName, const vector<vector<string> >& rows);
+
+    // Ends the table's open transaction: logs `fields` (unless NULL),
+    // stamps the changes with the next transaction number and publishes it
+    void commitWrite(Table* table, LogRecordType type, const vector<string>* fields);
+    // Views of `count` tables as of the last commit, one per handle (caller
+    // deletes them)
+    void openSnapshot(Table* const* handles, int count, Table** views);
+
+    // saveToDisk's work; checkpointLock must be held. `exclusive`: the
+    // catalog is held exclusively, so files can be swapped under unloaded
+    // tables. `held` is a table whose write lock the caller has.
+    void writeCheckpoint(const string& filename, bool exclusive, Table* held);
+    void checkpoint(const string& filename, bool exclusive);
+    void checkpointIfDue();
+
+    void collectorLoop();
+    void collectGarbage(uint64_t previousPass);
+    void applyLogRecord(const LogRecord& record);
+    void clearTables();
+    void releaseMapping(const string& path);
+    void removeTable(const string& tableName);
+    string tableFilePath(const string& tableName) const;
+    const MappedFile* mapTableFile(const string& path);
+    void openTableFile(const string& path);
+    bool loadBaseFile(const string& filename, uint64_t& checkpointLsn, DataFileKind& kind);
+    bool loadTextFile(const string& filename, uint64_t& checkpointLsn);
+    bool isFlushed(const LogRecord& record);
+
+    Table* findTable(const string& tableName);
+    Table* findIndexOwner(const string& indexName);
+
+    int pagedFile(const Table* table);
+    // Rows of a streamed table matching the conditions
+    int scanPaged(Table* table, int poolFile, const vector<Condition>& conditions);
+
+    // Statement cores shared by the REPL commands and prepared statements:
+    // they validate, apply and log, but print nothing. Those that write run
+    // as one transaction on the table handle; the SELECT ones read views
+    // (see openSnapshot) and add their operators under `plan` for EXPLAIN
+    // (NULL otherwise). The catalog lock is held by the caller.
+    StatusCode runInsert(Table* table, const vector<vector<string> >& rows, string& message);
+    int runDelete(Table* table, const vector<Condition>& conditions);
+    StatusCode runUpdate(Table* table, const map<string, string>& updates,
+        const vector<Condition>& conditions, int& updatedCount, string& message);
+    ResultSet* runQuery(const string& query, PlanNode* plan);
+    ResultSet* runSelect(Table* table, const vector<int>& columnIndices,
+        const vector<Condition>& conditions, const SortQuery& order, PlanNode* plan);
+    ResultSet* runAggregate(Table* table, const AggregateQuery& query,
+        const vector<Condition>& conditions, const SortQuery& order, PlanNode* plan);
+    ResultSet* runSorted(Table* table, int poolFile, const vector<int>& columnIndices,
+        const vector<Condition>& conditions, const vector<SortKey>& keys, long long keep, PlanNode* plan);
+
+    // One side of a join: its rows that pass the WHERE conditions on it
+    struct JoinInput {
+        Table* table;
+        int poolFile;
+        vector<Condition> conditions;
+        vector<int> matches;
+        bool filtered;   // matches lists the rows, rather than every row going
+        long long rows;  // matching rows, estimated for a streamed table
+        PlanNode* profile;  // of a streamed table's scan
+    };
+
+    ResultSet* runJoin(Table* left, Table* right, const JoinQuery& join, const vector<string>& columns,
+        const vector<Condition>& conditions, const AggregateQuery& aggregate, const SortQuery& order,
+        PlanNode* plan);
+    void openJoinInput(Table* table, JoinInput& input, PlanNode* plan);
+    void feedJoin(JoinInput& input, HashJoin& join, bool build);
+
+    TableStats collectStats(Table* table);
 
 public:
     DatabaseEngine();
     ~DatabaseEngine();
 
+    // Value rules shared by INSERT and COPY
+    static bool isValidInt(const string& str);
+    static bool isValidFloat(const string& str);
+
     void createTable(const string& query);
     void insertInto(const string& query);
-    void selectFrom(const string& query);
+    // Validates and appends rows as one unit; prints a single summary line
+    bool insertBatch(const string& tableName, const vector<vector<string> >& rows);
+    void copyFrom(const string& query);
+    // Prints the result in the caller's format (a session's SET OUTPUT)
+    void selectFrom(const string& query, OutputFormat format = OUTPUT_TABLE);
+
+    // SELECT without printing: the result (caller deletes) reads a snapshot
+    // of the table, which later statements leave as it was. Errors are
+    // thrown as runtime_error.
+    ResultSet* executeSelect(const string& query);
+    long long selectInto(const string& query, ResultSink& sink);
+
+    // Embedding API: parses and resolves once, then binds and runs many
+    // times. Never returns NULL; a statement that failed to prepare reports
+    // the error from getStatus() and from every execute(). Caller deletes.
+    PreparedStatement* prepare(const string& sql);
+    // One-off statement through the same path
+    StatusCode execute(const string& sql, QueryResult& result);
     void deleteFrom(const string& query);
     void updateTable(const string& query);
     void dropTable(const string& query);
+    void createIndex(const string& query);
+    void dropIndex(const string& query);
     void listTables();
 
-    void saveToDisk(const string& filename = "database.db") const;
+    // ANALYZE [table]: gathers column statistics for the cost-based choice
+    // between index lookups and (parallel) scans, and prints a summary
+    void analyze(const string& query);
+
+    // EXPLAIN [ANALYZE] SELECT ...: prints the operators of the query's
+    // plan with the rows each is expected to produce. ANALYZE runs the
+    // query as well, discarding its rows, and adds what each operator
+    // measured: rows in and out, wall and CPU time, bytes read or spilled
+    // and peak memory.
+    void explain(const string& query);
+
+    void saveToDisk(const string& filename = "database.db");
     void loadFromDisk(const string& filename = "database.db");
+
+    void setSyncMode(SyncMode mode, int param = 0);
+    void setCheckpointSize(uint64_t bytes);
+    void setBufferPoolSize(size_t bytes);
+    void setSortMemory(size_t bytes);
+    void setJoinMemory(size_t bytes);
+    void showBufferStats();
+    void setPlanCacheSize(size_t entries);
+    void showCacheStats();
+
+    // Threads used for parallel scans and loads (the calling thread included)
+    void setThreadCount(int threads);
+    int getThreadCount() const;
 };
 
 #endif
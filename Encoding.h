@@ -0,0 +1,87 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+using namespace std;
+
+// Little-endian helpers shared by the log and the binary file format
+
+inline void putU8(string& out, uint8_t v) {
+    out.push_back((char)v);
+}
+
+inline void putU32(string& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+inline void putU64(string& out, uint64_t v) {
+    for (int i = 0; i < 8; i++) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+inline void putString(string& out, const string& s) {
+    putU32(out, (uint32_t)s.size());
+    out += s;
+}
+
+inline uint32_t getU32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+inline uint64_t getU64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+// Bounds-checked sequential reader over a byte range
+class ByteReader {
+private:
+    const char* pos;
+    const char* end;
+
+    void need(size_t n) {
+        if ((size_t)(end - pos) < n) throw runtime_error("Unexpected end of data");
+    }
+
+public:
+    ByteReader(const char* data, size_t length)
+        : pos(data), end(data + length) {
+    }
+
+    uint8_t u8() {
+        need(1);
+        return (uint8_t)*pos++;
+    }
+
+    uint32_t u32() {
+        need(4);
+        uint32_t v = getU32(pos);
+        pos += 4;
+        return v;
+    }
+
+    uint64_t u64() {
+        need(8);
+        uint64_t v = getU64(pos);
+        pos += 8;
+        return v;
+    }
+
+    string str() {
+        uint32_t length = u32();
+        need(length);
+        string s(pos, length);
+        pos += length;
+        return s;
+    }
+
+    bool atEnd() const {
+        return pos == end;
+    }
+};
+
+#endif
@@ -0,0 +1,569 @@
+#include "ExternalSort.h"
+#include "Table.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+
+// ================== QUERY ==================
+
+bool SortQuery::isEmpty() const {
+    return keys.empty() && limit.empty() && offset.empty();
+}
+
+void SortQuery::clear() {
+    keys.clear();
+    limit.clear();
+    offset.clear();
+}
+
+static long long parseCount(const string& text, const char* clause) {
+    int64_t value;
+    if (!ColumnVector::parseInt(text, value) || value < 0) {
+        throw runtime_error(string(clause) + " expects a whole number >= 0 but got '" + text + "'");
+    }
+    return value;
+}
+
+long long SortQuery::getLimit() const {
+    return limit.empty() ? -1 : parseCount(limit, "LIMIT");
+}
+
+long long SortQuery::getOffset() const {
+    return offset.empty() ? 0 : parseCount(offset, "OFFSET");
+}
+
+// ================== RECORDS ==================
+
+static void putBigEndian(vector<char>& out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out.push_back((char)(value >> (i * 8)));
+    }
+}
+
+static uint64_t keyPrefix(const char* key, uint32_t length) {
+    uint64_t prefix = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | (i < length ? (unsigned char)key[i] : 0);
+    }
+    return prefix;
+}
+
+static int compareKeys(const char* a, uint32_t aLength, const char* b, uint32_t bLength) {
+    int cmp = memcmp(a, b, min(aLength, bLength));
+    if (cmp != 0) return cmp;
+    return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+}
+
+struct ExternalSort::EntryLess {
+    const char* base;
+
+    explicit EntryLess(const char* records) : base(records) {}
+
+    bool operator()(const Entry& a, const Entry& b) const {
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        return compareKeys(base + a.offset, a.keyLength, base + b.offset, b.keyLength) < 0;
+    }
+};
+
+// The current record of one run being merged
+struct ExternalSort::Cursor {
+    FILE* file;
+    vector<char> record;
+    uint32_t keyLength;
+    uint32_t length;
+    uint64_t prefix;
+
+    bool read() {
+        uint32_t header[2];
+        if (fread(header, sizeof(header), 1, file) != 1) return false;
+        keyLength = header[0];
+        length = header[1];
+        record.resize(length);
+        if (length > 0 && fread(&record[0], length, 1, file) != 1) {
+            throw runtime_error("Could not read a sort run back");
+        }
+        prefix = keyPrefix(record.data(), keyLength);
+        return true;
+    }
+};
+
+// Orders cursor numbers for a min-heap on their current record
+struct ExternalSort::CursorGreater {
+    const vector<Cursor*>* cursors;
+
+    explicit CursorGreater(const vector<Cursor*>& open) : cursors(&open) {}
+
+    bool operator()(int a, int b) const {
+        const Cursor* x = (*cursors)[a];
+        const Cursor* y = (*cursors)[b];
+        if (x->prefix != y->prefix) return x->prefix > y->prefix;
+        return compareKeys(x->record.data(), x->keyLength, y->record.data(), y->keyLength) > 0;
+    }
+};
+
+static void writeRecord(FILE* file, const char* data, uint32_t keyLength, uint32_t length) {
+    uint32_t header[2] = { keyLength, length };
+    if (fwrite(header, sizeof(header), 1, file) != 1 ||
+        (length > 0 && fwrite(data, length, 1, file) != 1)) {
+        throw runtime_error("Could not write a sort run to disk");
+    }
+}
+
+static FILE* openRun() {
+    FILE* file = tmpfile();
+    if (file == NULL) throw runtime_error("Could not create a temporary file for sorting");
+    return file;
+}
+
+// ================== SORT ==================
+
+ExternalSort::ExternalSort(const Table& table, const vector<SortKey>& sortKeys, long long rowsToKeep,
+    size_t budgetBytes, bool copyRows, const vector<int>& copied)
+    : keys(sortKeys), tableName(table.getTableName()), keep(rowsToKeep), memoryBudget(budgetBytes),
+    liveBytes(0), memoryPeak(0), spilledBytes(0), finished(false), produced(0), nextEntry(0) {
+    if (copyRows) {
+        copyColumns = copied;
+        if (copyColumns.empty()) {
+            for (int c = 0; c < table.getColumnCount(); c++) copyColumns.push_back(c);
+        }
+        const vector<Column>& columns = table.getColumns();
+        for (int i = 0; i < (int)copyColumns.size(); i++) {
+            const Column& column = columns[copyColumns[i]];
+            copySchema.push_back(Column(column.getName(), column.getType(), column.getSize()));
+        }
+    }
+}
+
+ExternalSort::~ExternalSort() {
+    closeCursors();
+    for (int i = 0; i < (int)runs.size(); i++) {
+        fclose(runs[i].file);
+    }
+}
+
+bool ExternalSort::copiesRows() const {
+    return !copyColumns.empty();
+}
+
+int ExternalSort::getRunCount() const {
+    return (int)runs.size();
+}
+
+size_t ExternalSort::getMemoryPeak() const {
+    return memoryPeak;
+}
+
+uint64_t ExternalSort::getSpilledBytes() const {
+    return spilledBytes;
+}
+
+size_t ExternalSort::memoryUsed() const {
+    return records.size() + entries.size() * sizeof(Entry);
+}
+
+void ExternalSort::add(const Table& source, const vector<int>* rows, int rowBase) {
+    if (keep == 0) return;
+
+    int count = (rows != NULL) ? (int)rows->size() : source.getRowCount();
+    for (int i = 0; i < count; i++) {
+        int row = (rows != NULL) ? (*rows)[i] : i;
+        scratch.clear();
+        encodeKey(source, row, (uint32_t)(rowBase + row));
+        uint32_t keyLength = (uint32_t)scratch.size();
+        if (!copyColumns.empty()) encodeCopy(source, row);
+
+        if (keep > 0) offerRecord(keyLength);
+        else addRecord(keyLength);
+    }
+}
+
+// Per key a null flag, then the value: INT and FLOAT as big-endian bits
+// that order like the numbers, VARCHAR bytes with 0 escaped as 0 0xFF and
+// ended by 0 0. DESC inverts the key's bytes. The row position comes last.
+void ExternalSort::encodeKey(const Table& source, int row, uint32_t position) {
+    for (int k = 0; k < (int)keys.size(); k++) {
+        const ColumnVector& data = source.getColumnData(keys[k].column);
+        size_t start = scratch.size();
+
+        if (data.isNull(row)) {
+            scratch.push_back('\0');
+        }
+        else {
+            scratch.push_back('\1');
+            if (data.getType() == INT) {
+                putBigEndian(scratch, (uint64_t)data.getInt(row) ^ (1ULL << 63), 8);
+            }
+            else if (data.getType() == FLOAT) {
+                double value = data.getDouble(row);
+                if (value == 0) value = 0;  // -0.0 sorts with 0.0
+                uint64_t bits;
+                memcpy(&bits, &value, 8);
+                bits = (bits >> 63) ? ~bits : bits | (1ULL << 63);
+                putBigEndian(scratch, bits, 8);
+            }
+            else {
+                uint32_t length;
+                const char* text = data.getText(row, length);
+                for (uint32_t i = 0; i < length; i++) {
+                    scratch.push_back(text[i]);
+                    if (text[i] == '\0') scratch.push_back('\xFF');
+                }
+                scratch.push_back('\0');
+                scratch.push_back('\0');
+            }
+        }
+
+        if (keys[k].descending) {
+            for (size_t i = start; i < scratch.size(); i++) scratch[i] = (char)~scratch[i];
+        }
+    }
+    putBigEndian(scratch, position, 4);
+}
+
+// Copied values: a null flag, then 8 bytes for INT/FLOAT or a u32 length
+// and the text for VARCHAR
+void ExternalSort::encodeCopy(const Table& source, int row) {
+    for (int i = 0; i < (int)copyColumns.size(); i++) {
+        const ColumnVector& data = source.getColumnData(copyColumns[i]);
+        if (data.isNull(row)) {
+            scratch.push_back('\0');
+            continue;
+        }
+        scratch.push_back('\1');
+
+        size_t at = scratch.size();
+        if (data.getType() == VARCHAR) {
+            uint32_t length;
+            const char* text = data.getText(row, length);
+            scratch.resize(at + 4 + length);
+            memcpy(&scratch[at], &length, 4);
+            if (length > 0) memcpy(&scratch[at + 4], text, length);
+        }
+        else {
+            scratch.resize(at + 8);
+            if (data.getType() == INT) {
+                int64_t value = data.getInt(row);
+                memcpy(&scratch[at], &value, 8);
+            }
+            else {
+                double value = data.getDouble(row);
+                memcpy(&scratch[at], &value, 8);
+            }
+        }
+    }
+}
+
+void ExternalSort::addRecord(uint32_t keyLength) {
+    Entry entry;
+    entry.prefix = keyPrefix(scratch.data(), keyLength);
+    entry.offset = records.size();
+    entry.keyLength = keyLength;
+    entry.length = (uint32_t)scratch.size();
+    records.insert(records.end(), scratch.begin(), scratch.end());
+    entries.push_back(entry);
+    liveBytes += entry.length;
+
+    if (memoryUsed() > memoryBudget) spill();
+}
+
+// Top rows only: `entries` is a heap whose front is the last row kept, so
+// a new row either replaces it or is dropped. Dropped records leave gaps
+// in `records` that are squeezed out once they outweigh the live ones.
+void ExternalSort::offerRecord(uint32_t keyLength) {
+    uint64_t prefix = keyPrefix(scratch.data(), keyLength);
+    if ((long long)entries.size() >= keep) {
+        const Entry& last = entries.front();
+        if (prefix > last.prefix) return;
+        if (prefix == last.prefix &&
+            compareKeys(scratch.data(), keyLength, &records[last.offset], last.keyLength) > 0) {
+            return;
+        }
+        pop_heap(entries.begin(), entries.end(), EntryLess(records.data()));
+        liveBytes -= entries.back().length;
+        entries.pop_back();
+    }
+
+    Entry entry;
+    entry.prefix = prefix;
+    entry.offset = records.size();
+    entry.keyLength = keyLength;
+    entry.length = (uint32_t)scratch.size();
+    records.insert(records.end(), scratch.begin(), scratch.end());
+    entries.push_back(entry);
+    push_heap(entries.begin(), entries.end(), EntryLess(records.data()));
+    liveBytes += entry.length;
+
+    if (records.size() > 2 * liveBytes + 65536) compactRecords();
+    if (memoryUsed() > memoryBudget) spill();
+}
+
+void ExternalSort::compactRecords() {
+    vector<char> compacted;
+    compacted.reserve(liveBytes);
+    for (size_t i = 0; i < entries.size(); i++) {
+        Entry& entry = entries[i];
+        size_t offset = compacted.size();
+        compacted.insert(compacted.end(), records.begin() + entry.offset,
+            records.begin() + entry.offset + entry.length);
+        entry.offset = offset;
+    }
+    records.swap(compacted);
+}
+
+// Large sorts are split into one piece per thread, each sorted on the
+// pool, then merged pairwise (also on the pool) until one is left
+struct ExternalSort::SortPiece {
+    const char* base;
+    vector<Entry>* from;
+    vector<Entry>* to;
+    vector<size_t> bounds;  // piece i is [bounds[i], bounds[i + 1])
+};
+
+void ExternalSort::sortPiece(void* context, int index) {
+    SortPiece* pieces = (SortPiece*)context;
+    vector<Entry>& data = *pieces->from;
+    sort(data.begin() + pieces->bounds[index], data.begin() + pieces->bounds[index + 1],
+        EntryLess(pieces->base));
+}
+
+void ExternalSort::mergePieces(void* context, int index) {
+    SortPiece* pieces = (SortPiece*)context;
+    vector<Entry>& from = *pieces->from;
+    size_t begin = pieces->bounds[2 * index];
+    size_t middle = pieces->bounds[min(2 * index + 1, (int)pieces->bounds.size() - 1)];
+    size_t end = pieces->bounds[min(2 * index + 2, (int)pieces->bounds.size() - 1)];
+    merge(from.begin() + begin, from.begin() + middle, from.begin() + middle, from.begin() + end,
+        pieces->to->begin() + begin, EntryLess(pieces->base));
+}
+
+void ExternalSort::sortEntries() {
+    static const size_t PARALLEL_MIN_ENTRIES = 65536;
+
+    int threads = ThreadPool::shared().getThreadCount();
+    if (threads == 1 || entries.size() < PARALLEL_MIN_ENTRIES) {
+        sort(entries.begin(), entries.end(), EntryLess(records.data()));
+        return;
+    }
+
+    vector<Entry> buffer(entries.size());
+    SortPiece pieces;
+    pieces.base = records.data();
+    pieces.from = &entries;
+    pieces.to = &buffer;
+    for (int i = 0; i <= threads; i++) {
+        pieces.bounds.push_back(entries.size() * i / threads);
+    }
+    ThreadPool::shared().run(sortPiece, &pieces, threads);
+
+    while (pieces.bounds.size() > 2) {
+        int count = (int)pieces.bounds.size() - 1;
+        ThreadPool::shared().run(mergePieces, &pieces, (count + 1) / 2);
+
+        vector<size_t> merged;
+        for (int i = 0; i < (int)pieces.bounds.size(); i += 2) merged.push_back(pieces.bounds[i]);
+        if (merged.back() != pieces.bounds.back()) merged.push_back(pieces.bounds.back());
+        pieces.bounds.swap(merged);
+        swap(pieces.from, pieces.to);
+    }
+    if (pieces.from != &entries) entries.swap(buffer);
+}
+
+// Writes the records in memory out as one sorted run
+void ExternalSort::spill() {
+    if (entries.empty()) return;
+    memoryPeak = max(memoryPeak, memoryUsed());
+    sortEntries();
+
+    Run run;
+    run.file = openRun();
+    run.count = (long long)entries.size();
+    runs.push_back(run);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        writeRecord(run.file, &records[entry.offset], entry.keyLength, entry.length);
+        spilledBytes += 2 * sizeof(uint32_t) + entry.length;
+    }
+
+    entries.clear();
+    records.clear();
+    liveBytes = 0;
+}
+
+void ExternalSort::openCursors(int first, int count) {
+    for (int i = first; i < first + count; i++) {
+        rewind(runs[i].file);
+        Cursor* cursor = new Cursor();
+        cursor->file = runs[i].file;
+        cursors.push_back(cursor);
+        if (cursor->read()) heap.push_back((int)cursors.size() - 1);
+    }
+    make_heap(heap.begin(), heap.end(), CursorGreater(cursors));
+}
+
+void ExternalSort::closeCursors() {
+    for (int i = 0; i < (int)cursors.size(); i++) delete cursors[i];
+    cursors.clear();
+    heap.clear();
+}
+
+// The smallest current record of the open runs, moved into `scratch`
+bool ExternalSort::popCursor(const char*& record, uint32_t& keyLength, uint32_t& length) {
+    if (heap.empty()) return false;
+
+    CursorGreater greater(cursors);
+    pop_heap(heap.begin(), heap.end(), greater);
+    Cursor* cursor = cursors[heap.back()];
+    scratch.swap(cursor->record);
+    record = scratch.data();
+    keyLength = cursor->keyLength;
+    length = cursor->length;
+
+    if (cursor->read()) push_heap(heap.begin(), heap.end(), greater);
+    else heap.pop_back();
+    return true;
+}
+
+ExternalSort::Run ExternalSort::mergeRuns(int first, int count) {
+    Run merged;
+    merged.file = openRun();
+    merged.count = 0;
+    try {
+        openCursors(first, count);
+        const char* record;
+        uint32_t keyLength, length;
+        while ((keep < 0 || merged.count < keep) && popCursor(record, keyLength, length)) {
+            writeRecord(merged.file, record, keyLength, length);
+            merged.count++;
+        }
+        closeCursors();
+    }
+    catch (...) {
+        fclose(merged.file);
+        throw;
+    }
+    return merged;
+}
+
+void ExternalSort::finish() {
+    if (finished) return;
+    finished = true;
+    memoryPeak = max(memoryPeak, memoryUsed());
+
+    if (runs.empty()) {
+        sortEntries();
+        return;
+    }
+
+    // Whatever is still in memory becomes one more run; too many runs are
+    // merged down in passes so few files are open at once
+    spill();
+    while ((int)runs.size() > MERGE_WIDTH) {
+        Run merged = mergeRuns(0, MERGE_WIDTH);
+        for (int i = 0; i < MERGE_WIDTH; i++) fclose(runs[i].file);
+        runs.erase(runs.begin(), runs.begin() + MERGE_WIDTH);
+        runs.push_back(merged);
+    }
+    openCursors(0, (int)runs.size());
+}
+
+bool ExternalSort::nextRecord(const char*& record, uint32_t& keyLength, uint32_t& length) {
+    if (keep >= 0 && produced >= keep) return false;
+
+    if (runs.empty()) {
+        if (nextEntry >= entries.size()) return false;
+        const Entry& entry = entries[nextEntry++];
+        record = &records[entry.offset];
+        keyLength = entry.keyLength;
+        length = entry.length;
+    }
+    else if (!popCursor(record, keyLength, length)) {
+        return false;
+    }
+    produced++;
+    return true;
+}
+
+// The position is the last 4 key bytes
+int ExternalSort::nextRows(vector<int>& rows, int maxRows) {
+    rows.clear();
+    const char* record;
+    uint32_t keyLength, length;
+    while ((int)rows.size() < maxRows && nextRecord(record, keyLength, length)) {
+        const unsigned char* position = (const unsigned char*)record + keyLength - 4;
+        rows.push_back((int)(((uint32_t)position[0] << 24) | ((uint32_t)position[1] << 16) |
+            ((uint32_t)position[2] << 8) | position[3]));
+    }
+    return (int)rows.size();
+}
+
+Table* ExternalSort::nextChunk(int maxRows) {
+    vector<ColumnVector> data;
+    for (int c = 0; c < (int)copySchema.size(); c++) {
+        data.push_back(ColumnVector(copySchema[c].getType()));
+    }
+
+    int count = 0;
+    const char* record;
+    uint32_t keyLength, length;
+    while (count < maxRows && nextRecord(record, keyLength, length)) {
+        const char* in = record + keyLength;
+        for (int c = 0; c < (int)data.size(); c++) {
+            if (*in++ == '\0') {
+                data[c].appendNull();
+                continue;
+            }
+            if (data[c].getType() == VARCHAR) {
+                uint32_t textLength;
+                memcpy(&textLength, in, 4);
+                data[c].appendText(in + 4, textLength);
+                in += 4 + textLength;
+            }
+            else if (data[c].getType() == INT) {
+                int64_t value;
+                memcpy(&value, in, 8);
+                data[c].appendInt(value);
+                in += 8;
+            }
+            else {
+                double value;
+                memcpy(&value, in, 8);
+                data[c].appendDouble(value);
+                in += 8;
+            }
+        }
+        count++;
+    }
+    if (count == 0) return NULL;
+
+    Table* chunk = new Table(tableName);
+    for (int c = 0; c < (int)copySchema.size(); c++) chunk->addColumn(copySchema[c]);
+    chunk->adoptColumns(data, count);
+    return chunk;
+}
+
+// ================== PLANNING ==================
+
+void ExternalSort::resolveKeys(const Table& table, const SortQuery& query, bool aggregated,
+    vector<SortKey>& sortKeys) {
+    sortKeys.clear();
+    for (int i = 0; i < (int)query.keys.size(); i++) {
+        const AggregateTerm& term = query.keys[i].term;
+        string name = HashAggregate::label(term.function, term.column);
+        if (!aggregated && term.function != AGGREGATE_NONE) {
+            throw runtime_error("ORDER BY " + name + " needs GROUP BY or an aggregate in the select list");
+        }
+
+        SortKey key;
+        key.column = table.getColumnIndex(name);
+        key.descending = query.keys[i].descending;
+        if (key.column == -1) {
+            if (aggregated) throw runtime_error("ORDER BY " + name + " must be in the select list");
+            throw runtime_error("Column '" + name + "' does not exist!");
+        }
+        sortKeys.push_back(key);
+    }
+}
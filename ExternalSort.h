@@ -0,0 +1,161 @@
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+using namespace std;
+
+#include "Column.h"
+#include "HashAggregate.h"
+
+class Table;
+
+// One ORDER BY entry in engine form: a column, or an aggregate from the
+// select list
+struct SortTerm {
+    AggregateTerm term;
+    bool descending;
+};
+
+// ORDER BY and LIMIT/OFFSET of a SELECT; empty for neither
+struct SortQuery {
+    vector<SortTerm> keys;
+    string limit;   // as written, empty when not given
+    string offset;
+
+    bool isEmpty() const;
+    void clear();
+
+    // The counts as numbers, -1 for no LIMIT; throws runtime_error unless
+    // they are whole numbers >= 0
+    long long getLimit() const;
+    long long getOffset() const;
+};
+
+// A sort key resolved against the table being sorted
+struct SortKey {
+    int column;
+    bool descending;
+};
+
+// Sorts rows by ORDER BY keys within a memory budget.
+//
+// Each row becomes a record whose key is the ORDER BY values encoded so
+// that memcmp gives the query's order (NULLs first when ascending), ended
+// by the row's position so equal values keep table order. Records are
+// compared on their first 8 key bytes held as an integer, and only fall
+// back to memcmp on a tie.
+//
+// With a LIMIT only the first `keep` rows are wanted and the records sit
+// in a bounded heap, so a row that cannot make the cut is dropped as soon
+// as its key is built. Without one, records gather until the budget is
+// used, then are sorted in parallel on the shared thread pool and written
+// to a temporary file as a sorted run; the runs are merged k ways at the
+// end.
+//
+// A loaded table's rows are referred to by position. A streamed table's
+// slices are gone by the time the result is read, so then the selected
+// columns' values are copied into the records too.
+class ExternalSort {
+private:
+    struct Entry {
+        uint64_t prefix;     // first 8 key bytes, big-endian
+        uint64_t offset;     // of the record in `records`
+        uint32_t keyLength;
+        uint32_t length;     // key and copied values
+    };
+
+    // A sorted run in a temporary file: per record its key length, its
+    // length and its bytes
+    struct Run {
+        FILE* file;
+        long long count;
+    };
+
+    struct Cursor;
+    struct EntryLess;
+    struct CursorGreater;
+    struct SortPiece;
+
+    vector<SortKey> keys;
+    vector<int> copyColumns;     // empty when rows are kept by position
+    vector<Column> copySchema;
+    string tableName;
+    long long keep;              // -1 for every row
+    size_t memoryBudget;
+
+    vector<char> records;
+    vector<Entry> entries;       // a max-heap on the key while keeping top rows
+    size_t liveBytes;            // record bytes still referenced by `entries`
+    vector<char> scratch;
+    vector<Run> runs;
+    size_t memoryPeak;
+    uint64_t spilledBytes;
+
+    // Output: the sorted entries, or a merge of the runs
+    bool finished;
+    long long produced;
+    size_t nextEntry;
+    vector<Cursor*> cursors;
+    vector<int> heap;
+
+    void encodeKey(const Table& source, int row, uint32_t position);
+    void encodeCopy(const Table& source, int row);
+    void addRecord(uint32_t keyLength);
+    void offerRecord(uint32_t keyLength);
+    void compactRecords();
+    void sortEntries();
+    void spill();
+    Run mergeRuns(int first, int count);
+    void openCursors(int first, int count);
+    void closeCursors();
+    bool popCursor(const char*& record, uint32_t& keyLength, uint32_t& length);
+    bool nextRecord(const char*& record, uint32_t& keyLength, uint32_t& length);
+    size_t memoryUsed() const;
+
+    static void sortPiece(void* context, int index);
+    static void mergePieces(void* context, int index);
+
+    ExternalSort(const ExternalSort&);
+    ExternalSort& operator=(const ExternalSort&);
+
+public:
+    // Runs merged at once; more are merged in several passes
+    static const int MERGE_WIDTH = 64;
+
+    // rowsToKeep is OFFSET + LIMIT, or -1 without a LIMIT. copied lists
+    // the columns to carry in the records (all of them when empty) when
+    // copyRows is set; otherwise next() returns row positions.
+    ExternalSort(const Table& table, const vector<SortKey>& sortKeys, long long rowsToKeep,
+        size_t budgetBytes, bool copyRows, const vector<int>& copied);
+    ~ExternalSort();
+
+    // Adds rows of `source` (the table above or a slice of it): the listed
+    // positions, or every row when `rows` is NULL. rowBase is the position
+    // of the source's first row.
+    void add(const Table& source, const vector<int>* rows, int rowBase);
+
+    // Sorts what is left in memory and prepares the merge
+    void finish();
+
+    bool copiesRows() const;
+    int getRunCount() const;  // sorted runs written to disk
+    size_t getMemoryPeak() const;
+    uint64_t getSpilledBytes() const;  // written to the first runs
+
+    // Up to maxRows more positions in order; 0 at the end
+    int nextRows(vector<int>& rows, int maxRows);
+    // Up to maxRows more rows in order as a table of the copied columns
+    // (caller deletes), or NULL at the end
+    Table* nextChunk(int maxRows);
+
+    // Resolves ORDER BY against the table to sort. For an aggregate query
+    // that is the table of groups, whose columns are the select list;
+    // throws runtime_error for anything that is not one of its columns.
+    static void resolveKeys(const Table& table, const SortQuery& query, bool aggregated,
+        vector<SortKey>& sortKeys);
+};
+
+#endif
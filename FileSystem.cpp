@@ -0,0 +1,263 @@
+#include "FileSystem.h"
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#include <share.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+int FileSystem::openForWrite(const string& path) {
+#ifdef _WIN32
+    int fd = -1;
+    _sopen_s(&fd, path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY, _SH_DENYWR, _S_IREAD | _S_IWRITE);
+    return fd;
+#else
+    return ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+#endif
+}
+
+bool FileSystem::writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, (unsigned int)length);
+#else
+        ssize_t written = ::write(fd, data, length);
+#endif
+        if (written <= 0) return false;
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+void FileSystem::sync(int fd) {
+#ifdef _WIN32
+    _commit(fd);
+#else
+    fsync(fd);
+#endif
+}
+
+void FileSystem::truncate(int fd, uint64_t length) {
+#ifdef _WIN32
+    _chsize_s(fd, (long long)length);
+    _lseeki64(fd, (long long)length, SEEK_SET);
+#else
+    if (ftruncate(fd, (off_t)length) != 0) return;
+    lseek(fd, (off_t)length, SEEK_SET);
+#endif
+}
+
+void FileSystem::close(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+int FileSystem::openForUpdate(const string& path) {
+#ifdef _WIN32
+    int fd = -1;
+    _sopen_s(&fd, path.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+    return fd;
+#else
+    return ::open(path.c_str(), O_RDWR);
+#endif
+}
+
+size_t FileSystem::readAt(int fd, uint64_t offset, char* data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+#ifdef _WIN32
+        if (_lseeki64(fd, (long long)(offset + total), SEEK_SET) < 0) break;
+        int got = _read(fd, data + total, (unsigned int)(length - total));
+#else
+        ssize_t got = pread(fd, data + total, length - total, (off_t)(offset + total));
+#endif
+        if (got <= 0) break;
+        total += (size_t)got;
+    }
+    return total;
+}
+
+bool FileSystem::writeAt(int fd, uint64_t offset, const char* data, size_t length) {
+#ifdef _WIN32
+    if (_lseeki64(fd, (long long)offset, SEEK_SET) < 0) return false;
+    return writeAll(fd, data, length);
+#else
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, (off_t)offset);
+        if (written <= 0) return false;
+        data += written;
+        offset += (uint64_t)written;
+        length -= (size_t)written;
+    }
+    return true;
+#endif
+}
+
+bool FileSystem::writeFileAtomic(const string& path, const string& data) {
+    string tmpPath = path + ".tmp";
+
+    int fd = openForWrite(tmpPath);
+    if (fd == -1) return false;
+
+    truncate(fd, 0);
+    bool ok = writeAll(fd, data.data(), data.size());
+    if (ok) sync(fd);
+    close(fd);
+
+    if (!ok) {
+        removeFile(tmpPath);
+        return false;
+    }
+
+#ifdef _WIN32
+    return MoveFileExA(tmpPath.c_str(), path.c_str(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+}
+
+void FileSystem::syncDirectory(const string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.empty() ? "." : path.c_str(), O_RDONLY);
+    if (fd == -1) return;
+    fsync(fd);
+    ::close(fd);
+#endif
+}
+
+bool FileSystem::fileExists(const string& path) {
+#ifdef _WIN32
+    struct _stat info;
+    return _stat(path.c_str(), &info) == 0;
+#else
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+#endif
+}
+
+bool FileSystem::removeFile(const string& path) {
+    return remove(path.c_str()) == 0;
+}
+
+bool FileSystem::directoryExists(const string& path) {
+#ifdef _WIN32
+    struct _stat info;
+    if (_stat(path.c_str(), &info) != 0) return false;
+    return (info.st_mode & _S_IFDIR) != 0;
+#else
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+    return S_ISDIR(info.st_mode);
+#endif
+}
+
+bool FileSystem::createDirectory(const string& path) {
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0;
+#else
+    return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+// Entries of a directory other than . and .., each flagged when it is a
+// directory itself
+static bool listEntries(const string& path, vector<string>& names, vector<bool>& directories) {
+#ifdef _WIN32
+    struct _finddata_t info;
+    intptr_t handle = _findfirst((path + "\\*.*").c_str(), &info);
+    if (handle == -1) return false;
+    do {
+        string name = info.name;
+        if (name == "." || name == "..") continue;
+        names.push_back(name);
+        directories.push_back((info.attrib & _A_SUBDIR) != 0);
+    } while (_findnext(handle, &info) == 0);
+    _findclose(handle);
+#else
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) return false;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        struct stat info;
+        // a link to a directory is removed as a link, not followed
+        bool directory = lstat((path + "/" + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+        names.push_back(name);
+        directories.push_back(directory);
+    }
+    closedir(dir);
+#endif
+    return true;
+}
+
+bool FileSystem::removeDirectory(const string& path) {
+    vector<string> names;
+    vector<bool> directories;
+    if (!listEntries(path, names, directories)) return false;
+
+    bool ok = true;
+    for (size_t i = 0; i < names.size(); i++) {
+        string child = joinPath(path, names[i]);
+        if (directories[i]) ok = removeDirectory(child) && ok;
+        else ok = removeFile(child) && ok;
+    }
+#ifdef _WIN32
+    return _rmdir(path.c_str()) == 0 && ok;
+#else
+    return rmdir(path.c_str()) == 0 && ok;
+#endif
+}
+
+static bool resolvePath(const string& path, string& resolved) {
+#ifdef _WIN32
+    char buffer[_MAX_PATH];
+    if (_fullpath(buffer, path.c_str(), sizeof(buffer)) == NULL) return false;
+#else
+    char buffer[PATH_MAX];
+    if (realpath(path.c_str(), buffer) == NULL) return false;
+#endif
+    resolved = buffer;
+    return true;
+}
+
+bool FileSystem::isWithin(const string& folder, const string& path) {
+    string base, target;
+    if (!resolvePath(folder, base) || !resolvePath(path, target)) return false;
+    string prefix = joinPath(base, "");
+    return target.size() > prefix.size() && target.compare(0, prefix.size(), prefix) == 0;
+}
+
+void FileSystem::listDirectories(const string& path, vector<string>& names) {
+    vector<string> entries;
+    vector<bool> directories;
+    listEntries(path, entries, directories);
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (directories[i]) names.push_back(entries[i]);
+    }
+}
+
+string FileSystem::joinPath(const string& folder, const string& name) {
+#ifdef _WIN32
+    return folder + "\\" + name;
+#else
+    return folder + "/" + name;
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef FILESYSTEM_H
+#define FILESYSTEM_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+// Portable wrappers over the POSIX / MSVC low-level file calls
+class FileSystem {
+public:
+    // Raw descriptors (used by the write-ahead log)
+    static int openForWrite(const string& path);
+    static bool writeAll(int fd, const char* data, size_t length);
+    static void sync(int fd);
+    static void truncate(int fd, uint64_t length);
+    static void close(int fd);
+
+    // Positioned I/O (used by the buffer pool); return the bytes transferred
+    static int openForUpdate(const string& path);
+    static size_t readAt(int fd, uint64_t offset, char* data, size_t length);
+    static bool writeAt(int fd, uint64_t offset, const char* data, size_t length);
+
+    // Writes to path.tmp, fsyncs it, then renames it over path, so readers
+    // see either the old or the new file, never a partial one.
+    static bool writeFileAtomic(const string& path, const string& data);
+    // Fsyncs a directory so the renames into it survive a crash; "" is the
+    // working directory. A no-op on Windows, where the rename writes through.
+    static void syncDirectory(const string& path);
+
+    static bool fileExists(const string& path);
+    static bool removeFile(const string& path);
+
+    // Directories (used by the REPL, one per database)
+    static bool directoryExists(const string& path);
+    static bool createDirectory(const string& path);
+    // Deletes the directory and everything in it
+    static bool removeDirectory(const string& path);
+    // Whether path, once . / .. and links are resolved, is strictly below
+    // folder; false if either does not exist
+    static bool isWithin(const string& folder, const string& path);
+    // Names of the subdirectories, without . and ..
+    static void listDirectories(const string& path, vector<string>& names);
+
+    // folder + the platform's separator + name
+    static string joinPath(const string& folder, const string& name);
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "FilterKernels.h"
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#define TARGET_AVX2
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace std;
+
+// ---------- scalar fallback (branch-free, auto-vectorizes with SSE2) ----------
+
+template <CompareOp OP, typename T>
+static inline uint64_t compareOne(T actual, T expected) {
+    switch (OP) {
+    case OP_EQ: return actual == expected;
+    case OP_NE: return actual != expected;
+    case OP_LT: return actual < expected;
+    case OP_GT: return actual > expected;
+    case OP_LE: return actual <= expected;
+    case OP_GE: return actual >= expected;
+    }
+    return 0;
+}
+
+template <CompareOp OP, typename T>
+static void scalarKernel(const T* values, int count, T literal, uint64_t* bits) {
+    memset(bits, 0, FilterKernels::BATCH_WORDS * sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        bits[i >> 6] |= compareOne<OP>(values[i], literal) << (i & 63);
+    }
+}
+
+template <CompareOp OP>
+static void int64KernelScalar(const int64_t* values, int count, int64_t literal, uint64_t* bits) {
+    scalarKernel<OP, int64_t>(values, count, literal, bits);
+}
+
+template <CompareOp OP>
+static void doubleKernelScalar(const double* values, int count, double literal, uint64_t* bits) {
+    scalarKernel<OP, double>(values, count, literal, bits);
+}
+
+// ---------- AVX2: 4 values per compare, movemask gives 4 result bits ----------
+
+#ifdef HAVE_X86_KERNELS
+
+template <CompareOp OP>
+TARGET_AVX2 static void int64KernelAvx2(const int64_t* values, int count, int64_t literal, uint64_t* bits) {
+    memset(bits, 0, FilterKernels::BATCH_WORDS * sizeof(uint64_t));
+
+    __m256i lit = _mm256_set1_epi64x(literal);
+    // NE/LE/GE are the negation of EQ/GT/LT
+    const uint64_t flip = (OP == OP_NE || OP == OP_LE || OP == OP_GE) ? 0xF : 0;
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        __m256i m;
+        if (OP == OP_EQ || OP == OP_NE)      m = _mm256_cmpeq_epi64(v, lit);
+        else if (OP == OP_GT || OP == OP_LE) m = _mm256_cmpgt_epi64(v, lit);
+        else                                 m = _mm256_cmpgt_epi64(lit, v);
+
+        uint64_t mask = (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(m)) ^ flip;
+        bits[i >> 6] |= mask << (i & 63);
+    }
+    for (; i < count; i++) {
+        bits[i >> 6] |= compareOne<OP>(values[i], literal) << (i & 63);
+    }
+}
+
+template <CompareOp OP>
+TARGET_AVX2 static void doubleKernelAvx2(const double* values, int count, double literal, uint64_t* bits) {
+    memset(bits, 0, FilterKernels::BATCH_WORDS * sizeof(uint64_t));
+
+    __m256d lit = _mm256_set1_pd(literal);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d v = _mm256_loadu_pd(values + i);
+        __m256d m;
+        switch (OP) {
+        case OP_EQ: m = _mm256_cmp_pd(v, lit, _CMP_EQ_OQ); break;
+        case OP_NE: m = _mm256_cmp_pd(v, lit, _CMP_NEQ_UQ); break;
+        case OP_LT: m = _mm256_cmp_pd(v, lit, _CMP_LT_OQ); break;
+        case OP_GT: m = _mm256_cmp_pd(v, lit, _CMP_GT_OQ); break;
+        case OP_LE: m = _mm256_cmp_pd(v, lit, _CMP_LE_OQ); break;
+        default:    m = _mm256_cmp_pd(v, lit, _CMP_GE_OQ); break;
+        }
+        bits[i >> 6] |= (uint64_t)_mm256_movemask_pd(m) << (i & 63);
+    }
+    for (; i < count; i++) {
+        bits[i >> 6] |= compareOne<OP>(values[i], literal) << (i & 63);
+    }
+}
+
+static bool detectAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    // the OS must save the YMM registers
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+bool FilterKernels::hasAvx2() {
+#ifdef HAVE_X86_KERNELS
+    static const bool supported = detectAvx2();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+const char* FilterKernels::instructionSet() {
+    return hasAvx2() ? "AVX2" : "scalar";
+}
+
+#define DISPATCH_OP(KERNEL, op, values, count, literal, bits)        \
+    switch (op) {                                                      \
+    case OP_EQ: KERNEL<OP_EQ>(values, count, literal, bits); break;    \
+    case OP_NE: KERNEL<OP_NE>(values, count, literal, bits); break;    \
+    case OP_LT: KERNEL<OP_LT>(values, count, literal, bits); break;    \
+    case OP_GT: KERNEL<OP_GT>(values, count, literal, bits); break;    \
+    case OP_LE: KERNEL<OP_LE>(values, count, literal, bits); break;    \
+    case OP_GE: KERNEL<OP_GE>(values, count, literal, bits); break;    \
+    }
+
+void FilterKernels::compareInt64(const int64_t* values, int count,
+    CompareOp op, int64_t literal, uint64_t* bits) {
+#ifdef HAVE_X86_KERNELS
+    if (hasAvx2()) {
+        DISPATCH_OP(int64KernelAvx2, op, values, count, literal, bits)
+        return;
+    }
+#endif
+    DISPATCH_OP(int64KernelScalar, op, values, count, literal, bits)
+}
+
+void FilterKernels::compareDouble(const double* values, int count,
+    CompareOp op, double literal, uint64_t* bits) {
+#ifdef HAVE_X86_KERNELS
+    if (hasAvx2()) {
+        DISPATCH_OP(doubleKernelAvx2, op, values, count, literal, bits)
+        return;
+    }
+#endif
+    DISPATCH_OP(doubleKernelScalar, op, values, count, literal, bits)
+}
+
+#undef DISPATCH_OP
+
+int FilterKernels::countTrailingZeros(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(word);
+#else
+    int index = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
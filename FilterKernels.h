@@ -0,0 +1,29 @@
+#ifndef FILTERKERNELS_H
+#define FILTERKERNELS_H
+
+#include <cstdint>
+
+#include "Predicate.h"
+
+// Batch comparison kernels used by CompiledPredicate. Each kernel compares
+// `count` (<= BATCH_SIZE) values against a literal and writes one bit per
+// value into `bits` (bit i of word i / 64); unused bits are cleared.
+// AVX2 versions are picked at runtime when the CPU supports them.
+class FilterKernels {
+public:
+    static const int BATCH_SIZE = 1024;
+    static const int BATCH_WORDS = BATCH_SIZE / 64;
+
+    static void compareInt64(const int64_t* values, int count,
+        CompareOp op, int64_t literal, uint64_t* bits);
+
+    static void compareDouble(const double* values, int count,
+        CompareOp op, double literal, uint64_t* bits);
+
+    static bool hasAvx2();
+    static const char* instructionSet();
+
+    static int countTrailingZeros(uint64_t word);
+};
+
+#endif
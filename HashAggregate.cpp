@@ -0,0 +1,846 @@
+#include "HashAggregate.h"
+#include "Table.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#elif defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void)0)
+#endif
+
+using namespace std;
+
+// ================== QUERY ==================
+
+AggregateTerm::AggregateTerm()
+    : function(AGGREGATE_NONE) {
+}
+
+AggregateTerm::AggregateTerm(AggregateFunction aggregateFunction, const string& columnName)
+    : function(aggregateFunction), column(columnName) {
+}
+
+bool AggregateQuery::isEmpty() const {
+    return outputs.empty() && groupBy.empty() && having.empty();
+}
+
+void AggregateQuery::clear() {
+    outputs.clear();
+    groupBy.clear();
+    having.clear();
+}
+
+// ================== GROUP TABLES ==================
+
+// Running value of one measure in one group
+struct AggregateState {
+    int64_t count;       // rows for COUNT(*), otherwise non-NULL values seen
+    int64_t integer;     // INT SUM, MIN and MAX
+    double number;       // FLOAT SUM, MIN and MAX; the sum for AVG
+    uint64_t textOffset; // VARCHAR MIN and MAX, in GroupTable::text
+    uint64_t textLength;
+};
+
+struct GroupHeader {
+    uint64_t hash;
+    int firstRow;
+    uint32_t keyLength;
+};
+
+struct GroupSlot {
+    uint64_t hash;
+    uint64_t entry;  // the group's entry + 1, or 0 when free
+};
+
+static const int HEADER_WORDS = sizeof(GroupHeader) / 8;
+static const int STATE_WORDS = sizeof(AggregateState) / 8;
+
+// Open-addressing hash table holding the groups of one partition. A group
+// is one entry in `entries`: its header, its key and its measures' states
+// side by side, so finding a group and updating it touch the same memory.
+struct GroupTable {
+    vector<GroupSlot> slots;
+    vector<uint64_t> entries;
+    vector<uint64_t> groups;  // entry of each group, in the order added
+    vector<char> text;
+
+    GroupTable();
+
+    int size() const;
+    GroupHeader& header(uint64_t entry);
+    const GroupHeader& header(uint64_t entry) const;
+    const char* key(uint64_t entry) const;
+    AggregateState* states(uint64_t entry);
+    const AggregateState* states(uint64_t entry) const;
+
+    // The entry of the group with this key, added with empty states when new
+    uint64_t findOrAdd(uint64_t hash, const char* key, uint32_t length, int row, int measureCount);
+    void grow();
+
+    // Start loading the slot for a hash, or the entry it points at
+    void prefetchSlot(uint64_t hash) const;
+    void prefetchEntry(uint64_t hash) const;
+};
+
+// One thread's share of the work, and its scratch space
+struct AggregatePartial {
+    GroupTable partitions[HashAggregate::PARTITIONS];
+    vector<char> keys;
+    vector<uint32_t> keyEnds;
+    vector<uint64_t> hashes;
+    vector<int> positions;
+    vector<int> rowPartitions;
+    vector<AggregateState*> rowStates;
+};
+
+GroupTable::GroupTable()
+    : slots(64) {
+}
+
+int GroupTable::size() const {
+    return (int)groups.size();
+}
+
+GroupHeader& GroupTable::header(uint64_t entry) {
+    return *(GroupHeader*)&entries[entry];
+}
+
+const GroupHeader& GroupTable::header(uint64_t entry) const {
+    return *(const GroupHeader*)&entries[entry];
+}
+
+const char* GroupTable::key(uint64_t entry) const {
+    return (const char*)&entries[entry + HEADER_WORDS];
+}
+
+AggregateState* GroupTable::states(uint64_t entry) {
+    return (AggregateState*)&entries[entry + HEADER_WORDS + (header(entry).keyLength + 7) / 8];
+}
+
+const AggregateState* GroupTable::states(uint64_t entry) const {
+    return (const AggregateState*)&entries[entry + HEADER_WORDS + (header(entry).keyLength + 7) / 8];
+}
+
+uint64_t GroupTable::findOrAdd(uint64_t hash, const char* key, uint32_t length, int row, int measureCount) {
+    size_t mask = slots.size() - 1;
+    size_t slot = (size_t)hash & mask;
+    while (slots[slot].entry != 0) {
+        if (slots[slot].hash == hash) {
+            uint64_t entry = slots[slot].entry - 1;
+            GroupHeader& found = header(entry);
+            if (found.keyLength == length && memcmp(&entries[entry + HEADER_WORDS], key, length) == 0) {
+                if (row < found.firstRow) found.firstRow = row;
+                return entry;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint64_t entry = entries.size();
+    size_t keyWords = (length + 7) / 8;
+    entries.resize(entry + HEADER_WORDS + keyWords + measureCount * STATE_WORDS, 0);
+    GroupHeader& added = header(entry);
+    added.hash = hash;
+    added.firstRow = row;
+    added.keyLength = length;
+    memcpy(&entries[entry + HEADER_WORDS], key, length);
+
+    groups.push_back(entry);
+    slots[slot].hash = hash;
+    slots[slot].entry = entry + 1;
+
+    if (groups.size() * 2 > slots.size()) grow();
+    return entry;
+}
+
+void GroupTable::prefetchSlot(uint64_t hash) const {
+    PREFETCH(&slots[(size_t)hash & (slots.size() - 1)]);
+}
+
+void GroupTable::prefetchEntry(uint64_t hash) const {
+    const GroupSlot& slot = slots[(size_t)hash & (slots.size() - 1)];
+    if (slot.entry != 0) PREFETCH(&entries[slot.entry - 1]);
+}
+
+// Keeps the table at most half full
+void GroupTable::grow() {
+    vector<GroupSlot> larger(slots.size() * 2);
+    size_t mask = larger.size() - 1;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].entry == 0) continue;
+        size_t slot = (size_t)slots[i].hash & mask;
+        while (larger[slot].entry != 0) slot = (slot + 1) & mask;
+        larger[slot] = slots[i];
+    }
+    slots.swap(larger);
+}
+
+static uint64_t hashKey(const char* data, size_t length) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    // Byte by byte: a variable-length memcpy here costs more than the hash
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < length; i++, shift += 8) {
+        tail |= (uint64_t)(unsigned char)data[i] << shift;
+    }
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+// Slots come from the low bits of the hash, partitions from the high ones
+static int partitionOf(uint64_t hash) {
+    return (int)(hash >> 56) % HashAggregate::PARTITIONS;
+}
+
+static inline bool nullAt(const ColumnVector::NullWord* bits, int row) {
+    return (bits[row / 64].load() >> (row % 64)) & 1;
+}
+
+static int compareText(const char* a, uint32_t aLength, const char* b, uint32_t bLength) {
+    int cmp = memcmp(a, b, min(aLength, bLength));
+    if (cmp != 0) return cmp;
+    return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+}
+
+static bool compareResult(CompareOp op, int cmp) {
+    switch (op) {
+    case OP_EQ: return cmp == 0;
+    case OP_NE: return cmp != 0;
+    case OP_LT: return cmp < 0;
+    case OP_GT: return cmp > 0;
+    case OP_LE: return cmp <= 0;
+    case OP_GE: return cmp >= 0;
+    }
+    return false;
+}
+
+// ================== PLAN ==================
+
+DataType HashAggregate::resultType(AggregateFunction function, DataType columnType) {
+    if (function == AGGREGATE_COUNT) return INT;
+    if (function == AGGREGATE_AVG) return FLOAT;
+    return columnType;
+}
+
+string HashAggregate::label(AggregateFunction function, const string& column) {
+    switch (function) {
+    case AGGREGATE_COUNT: return "COUNT(" + (column.empty() ? string("*") : column) + ")";
+    case AGGREGATE_SUM:   return "SUM(" + column + ")";
+    case AGGREGATE_AVG:   return "AVG(" + column + ")";
+    case AGGREGATE_MIN:   return "MIN(" + column + ")";
+    case AGGREGATE_MAX:   return "MAX(" + column + ")";
+    default:              return column;
+    }
+}
+
+HashAggregate::HashAggregate(const Table& table, const AggregateQuery& query)
+    : tableName(table.getTableName()), memoryPeak(0) {
+    if (query.outputs.empty()) {
+        throw runtime_error("SELECT * cannot be used with GROUP BY or aggregates");
+    }
+
+    const vector<Column>& columns = table.getColumns();
+    for (int i = 0; i < (int)query.groupBy.size(); i++) {
+        int col = table.getColumnIndex(query.groupBy[i]);
+        if (col == -1) {
+            throw runtime_error("Column '" + query.groupBy[i] + "' does not exist!");
+        }
+        if (find(groupColumns.begin(), groupColumns.end(), col) != groupColumns.end()) continue;
+        groupColumns.push_back(col);
+        groupTypes.push_back(columns[col].getType());
+    }
+
+    for (int i = 0; i < (int)query.outputs.size(); i++) {
+        const AggregateTerm& term = query.outputs[i];
+        outputs.push_back(resolve(table, term));
+
+        int col = table.getColumnIndex(term.column);
+        string name = (col == -1) ? term.column : columns[col].getName();
+        outputNames.push_back(label(term.function, name));
+    }
+
+    for (int i = 0; i < (int)query.having.size(); i++) {
+        const HavingCondition& condition = query.having[i];
+        Filter filter;
+        filter.source = resolve(table, condition.term);
+        filter.op = CompiledPredicate::parseOperator(condition.op);
+        filter.number = atof(condition.value.c_str());
+        filter.text = condition.value;
+        filters.push_back(filter);
+    }
+}
+
+HashAggregate::~HashAggregate() {
+    for (int i = 0; i < (int)partials.size(); i++) {
+        delete partials[i];
+    }
+}
+
+size_t HashAggregate::getMemoryPeak() const {
+    return memoryPeak;
+}
+
+size_t HashAggregate::memoryUsed() const {
+    size_t bytes = 0;
+    for (int i = 0; i < (int)partials.size(); i++) {
+        const AggregatePartial& partial = *partials[i];
+        for (int p = 0; p < PARTITIONS; p++) {
+            const GroupTable& groups = partial.partitions[p];
+            bytes += groups.slots.capacity() * sizeof(GroupSlot) + groups.entries.capacity() * sizeof(uint64_t) +
+                groups.groups.capacity() * sizeof(uint64_t) + groups.text.capacity();
+        }
+        bytes += partial.keys.capacity() + partial.hashes.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+// A plain column must be grouped on; equal aggregates share a measure
+HashAggregate::Source HashAggregate::resolve(const Table& table, const AggregateTerm& term) {
+    Source source;
+    int col = -1;
+    DataType type = INT;
+    if (term.function != AGGREGATE_COUNT || !term.column.empty()) {
+        col = table.getColumnIndex(term.column);
+        if (col == -1) {
+            throw runtime_error("Column '" + term.column + "' does not exist!");
+        }
+        type = table.getColumns()[col].getType();
+    }
+
+    if (term.function == AGGREGATE_NONE) {
+        for (int g = 0; g < (int)groupColumns.size(); g++) {
+            if (groupColumns[g] == col) {
+                source.group = true;
+                source.index = g;
+                source.type = type;
+                return source;
+            }
+        }
+        throw runtime_error("Column '" + term.column + "' must appear in GROUP BY or in an aggregate");
+    }
+
+    if ((term.function == AGGREGATE_SUM || term.function == AGGREGATE_AVG) && type == VARCHAR) {
+        throw runtime_error(label(term.function, term.column) + " needs a numeric column");
+    }
+
+    source.group = false;
+    source.type = resultType(term.function, type);
+    for (int m = 0; m < (int)measures.size(); m++) {
+        if (measures[m].function == term.function && measures[m].column == col) {
+            source.index = m;
+            return source;
+        }
+    }
+
+    Measure measure;
+    measure.function = term.function;
+    measure.column = col;
+    measure.type = type;
+    source.index = (int)measures.size();
+    measures.push_back(measure);
+    return source;
+}
+
+// ================== ACCUMULATE ==================
+
+AggregatePartial* HashAggregate::acquire() {
+    lock_guard<mutex> guard(partialLock);
+    if (idle.empty()) {
+        partials.push_back(new AggregatePartial());
+        return partials.back();
+    }
+    AggregatePartial* partial = idle.back();
+    idle.pop_back();
+    return partial;
+}
+
+void HashAggregate::release(AggregatePartial* partial) {
+    lock_guard<mutex> guard(partialLock);
+    idle.push_back(partial);
+}
+
+struct MorselAggregate {
+    HashAggregate* aggregate;
+    const Table* source;
+    const vector<int>* rows;
+    int rowBase;
+    int count;
+};
+
+void HashAggregate::accumulateMorsel(void* context, int index) {
+    MorselAggregate* work = (MorselAggregate*)context;
+    int begin = index * Table::MORSEL_ROWS;
+    int end = min(begin + Table::MORSEL_ROWS, work->count);
+    work->aggregate->accumulateRange(*work->source, work->rows, begin, end, work->rowBase);
+}
+
+void HashAggregate::accumulate(const Table& source, const vector<int>* rows, int rowBase) {
+    int count = (rows != NULL) ? (int)rows->size() : source.getRowCount();
+    if (count == 0) return;
+
+    if (count < Table::PARALLEL_MIN_ROWS || ThreadPool::shared().getThreadCount() == 1) {
+        accumulateRange(source, rows, 0, count, rowBase);
+        return;
+    }
+
+    // Morsels go to whichever thread is free; each thread works into a
+    // partial it holds for the length of a morsel
+    MorselAggregate work;
+    work.aggregate = this;
+    work.source = &source;
+    work.rows = rows;
+    work.rowBase = rowBase;
+    work.count = count;
+    int morsels = (count + Table::MORSEL_ROWS - 1) / Table::MORSEL_ROWS;
+    ThreadPool::shared().run(accumulateMorsel, &work, morsels);
+}
+
+// Entries [begin, end) of `rows` (or rows begin..end - 1), a batch at a
+// time: first every row's group, then each measure in a tight loop over
+// its column
+void HashAggregate::accumulateRange(const Table& source, const vector<int>* rows,
+    int begin, int end, int rowBase) {
+    static const int BATCH = 1024;
+    static const int PREFETCH_AHEAD = 8;
+    // Below this many slots in all (256 KB) the tables stay in cache and
+    // prefetching only costs time
+    static const size_t PREFETCH_MIN_SLOTS = 16384;
+
+    AggregatePartial* partial = acquire();
+    int measureCount = (int)measures.size();
+    int groupCount = (int)groupColumns.size();
+
+    vector<const ColumnVector*> keyData(groupCount);
+    vector<const ColumnVector::NullWord*> keyNulls(groupCount);
+    vector<const char*> keyValues(groupCount);  // INT and FLOAT arrays
+    for (int g = 0; g < groupCount; g++) {
+        keyData[g] = &source.getColumnData(groupColumns[g]);
+        keyNulls[g] = keyData[g]->nullData();
+        if (groupTypes[g] == INT) keyValues[g] = (const char*)keyData[g]->intData();
+        else if (groupTypes[g] == FLOAT) keyValues[g] = (const char*)keyData[g]->doubleData();
+        else keyValues[g] = NULL;
+    }
+
+    vector<int>& positions = partial->positions;
+    vector<int>& rowPartitions = partial->rowPartitions;
+    vector<AggregateState*>& rowStates = partial->rowStates;
+    vector<char>& keys = partial->keys;
+    vector<uint32_t>& keyEnds = partial->keyEnds;
+    vector<uint64_t>& hashes = partial->hashes;
+    vector<uint64_t> rowEntries(BATCH);
+
+    for (int start = begin; start < end; start += BATCH) {
+        int n = min(BATCH, end - start);
+        positions.resize(n);
+        rowPartitions.resize(n);
+        rowStates.resize(n);
+        keyEnds.resize(n);
+        hashes.resize(n);
+        for (int i = 0; i < n; i++) {
+            positions[i] = (rows != NULL) ? (*rows)[start + i] : start + i;
+        }
+
+        if (groupCount == 0) {
+            uint64_t hash = hashKey("", 0);
+            int p = partitionOf(hash);
+            uint64_t entry = partial->partitions[p].findOrAdd(hash, "", 0, rowBase + positions[0], measureCount);
+            for (int i = 0; i < n; i++) {
+                rowEntries[i] = entry;
+                rowPartitions[i] = p;
+            }
+        }
+        else {
+            size_t slotCount = 0;
+            for (int p = 0; p < PARTITIONS; p++) slotCount += partial->partitions[p].slots.size();
+            bool prefetch = slotCount >= PREFETCH_MIN_SLOTS;
+
+            // Keys and hashes for the whole batch first, so the slots they
+            // land in can be loaded while the next keys are built
+            size_t used = 0;
+            for (int i = 0; i < n; i++) {
+                int r = positions[i];
+                for (int g = 0; g < groupCount; g++) {
+                    bool isNull = nullAt(keyNulls[g], r);
+                    uint32_t length = 0;
+                    const char* text = NULL;
+                    if (groupTypes[g] == VARCHAR && !isNull) {
+                        text = keyData[g]->getText(r, length);
+                    }
+                    if (used + 1 + 8 + length > keys.size()) {
+                        keys.resize(max(keys.size() * 2, used + 1 + 8 + length));
+                    }
+
+                    char* out = &keys[used];
+                    if (isNull) {
+                        *out = '\0';
+                        used += 1;
+                    }
+                    else if (groupTypes[g] == VARCHAR) {
+                        *out = '\1';
+                        memcpy(out + 1, &length, 4);
+                        memcpy(out + 5, text, length);
+                        used += 5 + length;
+                    }
+                    else {
+                        uint64_t bits;
+                        memcpy(&bits, keyValues[g] + (size_t)r * 8, 8);
+                        if (groupTypes[g] == FLOAT && (bits << 1) == 0) bits = 0;  // -0.0 groups with 0.0
+                        *out = '\1';
+                        memcpy(out + 1, &bits, 8);
+                        used += 9;
+                    }
+                }
+                keyEnds[i] = (uint32_t)used;
+
+                uint32_t keyStart = (i == 0) ? 0 : keyEnds[i - 1];
+                hashes[i] = hashKey(keys.data() + keyStart, keyEnds[i] - keyStart);
+                rowPartitions[i] = partitionOf(hashes[i]);
+                if (prefetch) partial->partitions[rowPartitions[i]].prefetchSlot(hashes[i]);
+            }
+
+            for (int i = 0; i < n; i++) {
+                if (prefetch && i + PREFETCH_AHEAD < n) {
+                    partial->partitions[rowPartitions[i + PREFETCH_AHEAD]].prefetchEntry(hashes[i + PREFETCH_AHEAD]);
+                }
+                uint32_t keyStart = (i == 0) ? 0 : keyEnds[i - 1];
+                rowEntries[i] = partial->partitions[rowPartitions[i]].findOrAdd(hashes[i],
+                    keys.data() + keyStart, keyEnds[i] - keyStart, rowBase + positions[i], measureCount);
+            }
+        }
+
+        // Entries no longer move once the batch's groups are all added
+        for (int i = 0; i < n; i++) {
+            rowStates[i] = partial->partitions[rowPartitions[i]].states(rowEntries[i]);
+        }
+
+        for (int m = 0; m < measureCount; m++) {
+            const Measure& measure = measures[m];
+
+            if (measure.column == -1) {
+                for (int i = 0; i < n; i++) rowStates[i][m].count++;
+                continue;
+            }
+
+            const ColumnVector& data = source.getColumnData(measure.column);
+            const ColumnVector::NullWord* nulls = data.nullData();
+            const int64_t* ints = data.intData();
+            const double* doubles = data.doubleData();
+            bool isMin = measure.function == AGGREGATE_MIN;
+
+            for (int i = 0; i < n; i++) {
+                int r = positions[i];
+                if (nullAt(nulls, r)) continue;
+                AggregateState& state = rowStates[i][m];
+
+                switch (measure.function) {
+                case AGGREGATE_SUM:
+                case AGGREGATE_AVG:
+                    if (measure.type == INT) {
+                        state.integer += ints[r];
+                        state.number += (double)ints[r];
+                    }
+                    else {
+                        state.number += doubles[r];
+                    }
+                    break;
+
+                case AGGREGATE_MIN:
+                case AGGREGATE_MAX:
+                    if (measure.type == INT) {
+                        int64_t value = ints[r];
+                        if (state.count == 0 || (isMin ? value < state.integer : value > state.integer)) {
+                            state.integer = value;
+                        }
+                    }
+                    else if (measure.type == FLOAT) {
+                        double value = doubles[r];
+                        if (state.count == 0 || (isMin ? value < state.number : value > state.number)) {
+                            state.number = value;
+                        }
+                    }
+                    else {
+                        vector<char>& text = partial->partitions[rowPartitions[i]].text;
+                        uint32_t length;
+                        const char* value = data.getText(r, length);
+                        int cmp = (state.count == 0) ? 0 : compareText(value, length,
+                            text.data() + state.textOffset, (uint32_t)state.textLength);
+                        if (state.count == 0 || (isMin ? cmp < 0 : cmp > 0)) {
+                            state.textOffset = text.size();
+                            state.textLength = length;
+                            text.insert(text.end(), value, value + length);
+                        }
+                    }
+                    break;
+
+                default:
+                    break;
+                }
+                state.count++;
+            }
+        }
+    }
+
+    release(partial);
+}
+
+// ================== MERGE ==================
+
+// Folds partition `partition` of every other partial into the first
+void HashAggregate::mergePartition(int partition) {
+    GroupTable& target = partials[0]->partitions[partition];
+    int measureCount = (int)measures.size();
+
+    for (int k = 1; k < (int)partials.size(); k++) {
+        const GroupTable& from = partials[k]->partitions[partition];
+        for (int g = 0; g < from.size(); g++) {
+            uint64_t entry = from.groups[g];
+            const GroupHeader& header = from.header(entry);
+            uint64_t into = target.findOrAdd(header.hash, from.key(entry), header.keyLength,
+                header.firstRow, measureCount);
+            const AggregateState* adds = from.states(entry);
+            AggregateState* states = target.states(into);
+
+            for (int m = 0; m < measureCount; m++) {
+                const AggregateState& add = adds[m];
+                AggregateState& state = states[m];
+                if (add.count == 0) continue;
+
+                const Measure& measure = measures[m];
+                bool isMin = measure.function == AGGREGATE_MIN;
+                if (measure.function == AGGREGATE_MIN || measure.function == AGGREGATE_MAX) {
+                    bool better;
+                    if (state.count == 0) {
+                        better = true;
+                    }
+                    else if (measure.type == INT) {
+                        better = isMin ? add.integer < state.integer : add.integer > state.integer;
+                    }
+                    else if (measure.type == FLOAT) {
+                        better = isMin ? add.number < state.number : add.number > state.number;
+                    }
+                    else {
+                        int cmp = compareText(from.text.data() + add.textOffset, (uint32_t)add.textLength,
+                            target.text.data() + state.textOffset, (uint32_t)state.textLength);
+                        better = isMin ? cmp < 0 : cmp > 0;
+                    }
+
+                    if (better) {
+                        state.integer = add.integer;
+                        state.number = add.number;
+                        state.textOffset = target.text.size();
+                        state.textLength = add.textLength;
+                        const char* text = from.text.data() + add.textOffset;
+                        target.text.insert(target.text.end(), text, text + add.textLength);
+                    }
+                }
+                else {
+                    state.integer += add.integer;
+                    state.number += add.number;
+                }
+                state.count += add.count;
+            }
+        }
+    }
+}
+
+void HashAggregate::mergeTask(void* context, int index) {
+    ((HashAggregate*)context)->mergePartition(index);
+}
+
+// ================== OUTPUT ==================
+
+struct GroupRef {
+    int firstRow;
+    int partition;
+    uint64_t entry;
+};
+
+static bool firstSeen(const GroupRef& a, const GroupRef& b) {
+    return a.firstRow < b.firstRow;
+}
+
+// Value of a group column or measure; false for NULL. INT values come
+// back in both `integer` and `number`.
+static bool readValue(const AggregateState* states, const char* key, const GroupTable& table,
+    const vector<DataType>& groupTypes, bool group, int index, AggregateFunction function, DataType type,
+    int64_t& integer, double& number, const char*& text, uint32_t& length) {
+    if (group) {
+        // Step over the earlier key columns
+        const char* p = key;
+        for (int g = 0; g < index; g++) {
+            if (*p++ == '\0') continue;
+            if (groupTypes[g] == VARCHAR) {
+                uint32_t skip;
+                memcpy(&skip, p, sizeof(skip));
+                p += sizeof(skip) + skip;
+            }
+            else {
+                p += 8;
+            }
+        }
+        if (*p++ == '\0') return false;
+
+        if (type == INT) {
+            memcpy(&integer, p, sizeof(integer));
+            number = (double)integer;
+        }
+        else if (type == FLOAT) {
+            memcpy(&number, p, sizeof(number));
+        }
+        else {
+            memcpy(&length, p, sizeof(length));
+            text = p + sizeof(length);
+        }
+        return true;
+    }
+
+    const AggregateState& state = states[index];
+    if (function == AGGREGATE_COUNT) {
+        integer = state.count;
+        number = (double)integer;
+        return true;
+    }
+    if (state.count == 0) return false;
+
+    if (function == AGGREGATE_AVG) {
+        number = state.number / (double)state.count;
+    }
+    else if (type == INT) {
+        integer = state.integer;
+        number = (double)integer;
+    }
+    else if (type == FLOAT) {
+        number = state.number;
+    }
+    else {
+        text = table.text.data() + state.textOffset;
+        length = (uint32_t)state.textLength;
+    }
+    return true;
+}
+
+bool HashAggregate::passes(const AggregatePartial& partial, int partition, uint64_t entry) const {
+    const GroupTable& table = partial.partitions[partition];
+    const AggregateState* states = table.states(entry);
+
+    for (int i = 0; i < (int)filters.size(); i++) {
+        const Filter& filter = filters[i];
+        const Source& source = filter.source;
+        AggregateFunction function = source.group ? AGGREGATE_NONE : measures[source.index].function;
+
+        int64_t integer = 0;
+        double number = 0;
+        const char* text = NULL;
+        uint32_t length = 0;
+        if (!readValue(states, table.key(entry), table, groupTypes, source.group, source.index,
+            function, source.type, integer, number, text, length)) {
+            return false;  // NULL matches nothing
+        }
+
+        int cmp;
+        if (source.type == VARCHAR) {
+            cmp = compareText(text, length, filter.text.data(), (uint32_t)filter.text.size());
+        }
+        else {
+            cmp = number < filter.number ? -1 : (number > filter.number ? 1 : 0);
+        }
+        if (!compareResult(filter.op, cmp)) return false;
+    }
+    return true;
+}
+
+void HashAggregate::appendOutput(const AggregatePartial& partial, int partition, uint64_t entry,
+    int output, ColumnVector& out) const {
+    const GroupTable& table = partial.partitions[partition];
+    const AggregateState* states = table.states(entry);
+    const Source& source = outputs[output];
+    AggregateFunction function = source.group ? AGGREGATE_NONE : measures[source.index].function;
+
+    int64_t integer = 0;
+    double number = 0;
+    const char* text = NULL;
+    uint32_t length = 0;
+    if (!readValue(states, table.key(entry), table, groupTypes, source.group, source.index,
+        function, source.type, integer, number, text, length)) {
+        out.appendNull();
+    }
+    else if (source.type == INT) {
+        out.appendInt(integer);
+    }
+    else if (source.type == FLOAT) {
+        out.appendDouble(number);
+    }
+    else {
+        out.appendText(text, length);
+    }
+}
+
+Table* HashAggregate::finish() {
+    if (partials.empty()) partials.push_back(new AggregatePartial());
+    memoryPeak = max(memoryPeak, memoryUsed());
+
+    if (partials.size() > 1) {
+        if (ThreadPool::shared().getThreadCount() > 1) {
+            ThreadPool::shared().run(mergeTask, this, PARTITIONS);
+        }
+        else {
+            for (int p = 0; p < PARTITIONS; p++) mergePartition(p);
+        }
+        for (int i = 1; i < (int)partials.size(); i++) delete partials[i];
+        partials.resize(1);
+        idle.clear();
+    }
+    AggregatePartial& result = *partials[0];
+
+    // Without GROUP BY there is one group, even over no rows
+    if (groupColumns.empty()) {
+        uint64_t hash = hashKey("", 0);
+        result.partitions[partitionOf(hash)].findOrAdd(hash, "", 0, 0, (int)measures.size());
+    }
+
+    vector<GroupRef> order;
+    for (int p = 0; p < PARTITIONS; p++) {
+        const GroupTable& table = result.partitions[p];
+        for (int g = 0; g < table.size(); g++) {
+            uint64_t entry = table.groups[g];
+            if (!passes(result, p, entry)) continue;
+            GroupRef ref;
+            ref.firstRow = table.header(entry).firstRow;
+            ref.partition = p;
+            ref.entry = entry;
+            order.push_back(ref);
+        }
+    }
+    sort(order.begin(), order.end(), firstSeen);
+
+    Table* groups = new Table(tableName);
+    vector<ColumnVector> data;
+    for (int o = 0; o < (int)outputs.size(); o++) {
+        DataType type = outputs[o].type;
+        groups->addColumn(Column(outputNames[o], type, type == VARCHAR ? 255 : 0));
+        data.push_back(ColumnVector(type));
+        data.back().reserve((int)order.size());
+    }
+
+    for (int i = 0; i < (int)order.size(); i++) {
+        for (int o = 0; o < (int)outputs.size(); o++) {
+            appendOutput(result, order[i].partition, order[i].entry, o, data[o]);
+        }
+    }
+    groups->adoptColumns(data, (int)order.size());
+    return groups;
+}
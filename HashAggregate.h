@@ -0,0 +1,132 @@
+#ifndef HASHAGGREGATE_H
+#define HASHAGGREGATE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+#include "Column.h"
+#include "Statement.h"
+#include "Predicate.h"
+
+class Table;
+struct AggregatePartial;
+
+// One select list or HAVING entry in engine form: a column, or an
+// aggregate of one (column empty for COUNT(*))
+struct AggregateTerm {
+    AggregateFunction function;
+    string column;
+
+    AggregateTerm();
+    AggregateTerm(AggregateFunction aggregateFunction, const string& columnName);
+};
+
+struct HavingCondition {
+    AggregateTerm term;
+    string op;
+    string value;
+};
+
+// The aggregate part of a SELECT; empty for a plain one
+struct AggregateQuery {
+    vector<AggregateTerm> outputs;  // the select list, empty for *
+    vector<string> groupBy;
+    vector<HavingCondition> having; // ANDed
+
+    bool isEmpty() const;
+    void clear();
+};
+
+// Hash aggregation over typed column values.
+//
+// Each group's key is its GROUP BY values packed into bytes (a null flag,
+// then 8 bytes for INT/FLOAT or a length and the text for VARCHAR), kept
+// with the group's running states in one buffer per hash table, so no
+// group allocates on its own.
+// Large inputs are aggregated on the shared thread pool: every thread
+// fills a partial aggregate of its own, split into hash partitions, and
+// finish() merges the partials partition by partition in parallel.
+class HashAggregate {
+private:
+    // An aggregate computed per group; select items and HAVING share them
+    struct Measure {
+        AggregateFunction function;
+        int column;  // -1 for COUNT(*)
+        DataType type;
+    };
+
+    // Where an output or HAVING value comes from: GROUP BY column `index`
+    // or measure `index`
+    struct Source {
+        bool group;
+        int index;
+        DataType type;
+    };
+
+    struct Filter {
+        Source source;
+        CompareOp op;
+        double number;
+        string text;
+    };
+
+    string tableName;
+    vector<int> groupColumns;
+    vector<DataType> groupTypes;
+    vector<Measure> measures;
+    vector<Source> outputs;
+    vector<string> outputNames;
+    vector<Filter> filters;
+
+    mutex partialLock;
+    vector<AggregatePartial*> partials;
+    vector<AggregatePartial*> idle;
+    size_t memoryPeak;
+
+    Source resolve(const Table& table, const AggregateTerm& term);
+    AggregatePartial* acquire();
+    void release(AggregatePartial* partial);
+    void accumulateRange(const Table& source, const vector<int>* rows, int begin, int end, int rowBase);
+    void mergePartition(int partition);
+    size_t memoryUsed() const;
+    bool passes(const AggregatePartial& partial, int partition, uint64_t entry) const;
+    void appendOutput(const AggregatePartial& partial, int partition, uint64_t entry,
+        int output, ColumnVector& out) const;
+
+    static void accumulateMorsel(void* context, int index);
+    static void mergeTask(void* context, int index);
+
+    HashAggregate(const HashAggregate&);
+    HashAggregate& operator=(const HashAggregate&);
+
+public:
+    static const int PARTITIONS = 16;
+
+    // Resolves the query against the table's columns; throws runtime_error
+    // for an unknown column, a plain column missing from GROUP BY or
+    // SUM/AVG of text
+    HashAggregate(const Table& table, const AggregateQuery& query);
+    ~HashAggregate();
+
+    // Adds rows of `source` (the table above or a slice of it): the listed
+    // positions, or every row when `rows` is NULL. rowBase is the position
+    // of the source's first row, so groups keep the order they first
+    // appeared in across slices.
+    void accumulate(const Table& source, const vector<int>* rows, int rowBase);
+
+    // The groups that pass HAVING, in order of first appearance, as a new
+    // table named after the source (caller deletes)
+    Table* finish();
+
+    // Bytes the group tables of all threads held before they were merged
+    size_t getMemoryPeak() const;
+
+    // Type of an aggregate's result for a column of type `columnType`
+    static DataType resultType(AggregateFunction function, DataType columnType);
+    static string label(AggregateFunction function, const string& column);
+};
+
+#endif
@@ -0,0 +1,518 @@
+#include "HashJoin.h"
+#include "Table.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
+
+using namespace std;
+
+// ================== QUERY ==================
+
+JoinQuery::JoinQuery()
+    : type(JOIN_INNER) {
+}
+
+bool JoinQuery::isEmpty() const {
+    return table.empty();
+}
+
+void JoinQuery::clear() {
+    table.clear();
+    type = JOIN_INNER;
+    leftKey.clear();
+    rightKey.clear();
+}
+
+// ================== RECORDS ==================
+
+// Record header in a partition file, followed by `length` bytes
+struct SpillHeader {
+    uint64_t hash;
+    uint32_t keyLength;
+    uint32_t length;
+};
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hashKey(const char* data, size_t length) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = mix(h ^ word);
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < length; i++, shift += 8) {
+        tail |= (uint64_t)(unsigned char)data[i] << shift;
+    }
+    return mix(h ^ tail);
+}
+
+// Buckets come from the low bits of the hash; each split level of a grace
+// join takes the next 4 bits down from the top
+static int partitionOf(uint64_t hash, int level) {
+    return (int)((hash >> (60 - 4 * level)) & (HashJoin::PARTITIONS - 1));
+}
+
+static FILE* openSpillFile() {
+    FILE* file = tmpfile();
+    if (file == NULL) throw runtime_error("Could not create a temporary file for a join");
+    return file;
+}
+
+// Returns the bytes written
+static uint64_t writeRecord(FILE* file, uint64_t hash, const char* data, uint32_t keyLength, uint32_t length) {
+    SpillHeader header;
+    header.hash = hash;
+    header.keyLength = keyLength;
+    header.length = length;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        (length > 0 && fwrite(data, length, 1, file) != 1)) {
+        throw runtime_error("Could not write join rows to disk");
+    }
+    return sizeof(header) + length;
+}
+
+static bool readRecord(FILE* file, SpillHeader& header, vector<char>& data) {
+    if (fread(&header, sizeof(header), 1, file) != 1) return false;
+    data.resize(header.length);
+    if (header.length > 0 && fread(&data[0], header.length, 1, file) != 1) {
+        throw runtime_error("Could not read join rows back");
+    }
+    return true;
+}
+
+static void closeSpills(FILE* build, FILE* probe) {
+    if (build != NULL) fclose(build);
+    if (probe != NULL) fclose(probe);
+}
+
+static bool sameName(const string& a, const string& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (toupper((unsigned char)a[i]) != toupper((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+// ================== JOIN ==================
+
+HashJoin::HashJoin(const Table& left, int leftKey, const vector<int>& leftColumns,
+    const Table& right, int rightKey, const vector<int>& rightColumns,
+    JoinType joinType, bool buildLeft, size_t budgetBytes)
+    : buildSide(buildLeft ? 0 : 1), type(joinType), memoryBudget(budgetBytes), probing(false),
+    spilledPartitions(0), memoryPeak(0), spilledBytes(0), tableName(left.getTableName() + " JOIN " + right.getTableName()),
+    outputRows(0) {
+    const Table* tables[2] = { &left, &right };
+    int keys[2] = { leftKey, rightKey };
+    const vector<int>* carried[2] = { &leftColumns, &rightColumns };
+
+    for (int s = 0; s < 2; s++) {
+        const vector<Column>& columns = tables[s]->getColumns();
+        sides[s].key = keys[s];
+        sides[s].keyType = columns[keys[s]].getType();
+        sides[s].columns = *carried[s];
+        for (int i = 0; i < (int)sides[s].columns.size(); i++) {
+            const Column& column = columns[sides[s].columns[i]];
+            schema.push_back(Column(qualifiedName(*tables[s], sides[s].columns[i]), column.getType(),
+                column.getSize()));
+            output.push_back(ColumnVector(column.getType()));
+        }
+    }
+
+    if ((sides[0].keyType == VARCHAR) != (sides[1].keyType == VARCHAR)) {
+        throw runtime_error("Cannot join " + qualifiedName(left, leftKey) + " with " +
+            qualifiedName(right, rightKey) + ": one is text and the other a number");
+    }
+    numericKeys = sides[0].keyType != sides[1].keyType;
+}
+
+HashJoin::~HashJoin() {
+    for (int i = 0; i < (int)partitions.size(); i++) {
+        closeSpills(partitions[i].build, partitions[i].probe);
+    }
+}
+
+int HashJoin::getSpilledPartitions() const {
+    return spilledPartitions;
+}
+
+size_t HashJoin::getMemoryPeak() const {
+    return memoryPeak;
+}
+
+uint64_t HashJoin::getSpilledBytes() const {
+    return spilledBytes;
+}
+
+size_t HashJoin::memoryUsed() const {
+    return records.size() + entries.size() * sizeof(Entry) + buckets.size() * sizeof(int);
+}
+
+// The key, then per carried column a null flag and 8 bytes for INT/FLOAT
+// or a u32 length and the text for VARCHAR. False for a NULL key, which is
+// left out so it matches nothing.
+bool HashJoin::encode(const Table& source, int row, const Side& side, uint64_t& hash, uint32_t& keyLength) {
+    vector<char>& out = scratch;
+    out.clear();
+
+    const ColumnVector& key = source.getColumnData(side.key);
+    bool hasKey = !key.isNull(row);
+    if (hasKey) {
+        if (key.getType() == VARCHAR) {
+            uint32_t length;
+            const char* text = key.getText(row, length);
+            out.insert(out.end(), text, text + length);
+        }
+        else {
+            out.resize(8);
+            if (numericKeys) {
+                double value = key.getNumber(row);
+                if (value == 0) value = 0;  // -0.0 joins with 0.0
+                memcpy(&out[0], &value, 8);
+            }
+            else {
+                int64_t value = key.getInt(row);
+                memcpy(&out[0], &value, 8);
+            }
+        }
+        hash = hashKey(out.data(), out.size());
+    }
+    keyLength = (uint32_t)out.size();
+
+    for (int i = 0; i < (int)side.columns.size(); i++) {
+        const ColumnVector& data = source.getColumnData(side.columns[i]);
+        if (data.isNull(row)) {
+            out.push_back('\0');
+            continue;
+        }
+        out.push_back('\1');
+
+        size_t at = out.size();
+        if (data.getType() == VARCHAR) {
+            uint32_t length;
+            const char* text = data.getText(row, length);
+            out.resize(at + 4 + length);
+            memcpy(&out[at], &length, 4);
+            if (length > 0) memcpy(&out[at + 4], text, length);
+        }
+        else {
+            out.resize(at + 8);
+            if (data.getType() == INT) {
+                int64_t value = data.getInt(row);
+                memcpy(&out[at], &value, 8);
+            }
+            else {
+                double value = data.getDouble(row);
+                memcpy(&out[at], &value, 8);
+            }
+        }
+    }
+    return hasKey;
+}
+
+void HashJoin::addEntry(uint64_t hash, uint32_t keyLength, uint32_t length) {
+    Entry entry;
+    entry.hash = hash;
+    entry.offset = records.size();
+    entry.keyLength = keyLength;
+    entry.length = length;
+    entry.next = -1;
+    entry.matched = false;
+    records.insert(records.end(), scratch.begin(), scratch.begin() + length);
+    entries.push_back(entry);
+}
+
+void HashJoin::build(const Table& source, const vector<int>* rows) {
+    if (probing) throw runtime_error("Join build rows added after probing began");
+
+    const Side& side = sides[buildSide];
+    int count = (rows != NULL) ? (int)rows->size() : source.getRowCount();
+    for (int i = 0; i < count; i++) {
+        int row = (rows != NULL) ? (*rows)[i] : i;
+        uint64_t hash = 0;
+        uint32_t keyLength;
+        bool hasKey = encode(source, row, side, hash, keyLength);
+        uint32_t length = (uint32_t)scratch.size();
+
+        if (!hasKey) {
+            // A left row that can match nothing still comes out once
+            if (type == JOIN_LEFT && buildSide == 0) emit(scratch.data(), keyLength, NULL, 0);
+            continue;
+        }
+
+        if (!partitions.empty()) {
+            spilledBytes += writeRecord(partitions[partitionOf(hash, 0)].build, hash, scratch.data(), keyLength, length);
+            continue;
+        }
+        addEntry(hash, keyLength, length);
+        if (memoryUsed() > memoryBudget) spill();
+    }
+}
+
+// Moves the build records in memory into partition files; from here on
+// both sides go straight to the files
+void HashJoin::spill() {
+    partitions.resize(PARTITIONS);
+    for (int p = 0; p < PARTITIONS; p++) {
+        partitions[p].build = NULL;
+        partitions[p].probe = NULL;
+    }
+    for (int p = 0; p < PARTITIONS; p++) {
+        partitions[p].build = openSpillFile();
+        partitions[p].probe = openSpillFile();
+    }
+    spilledPartitions = PARTITIONS;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        spilledBytes += writeRecord(partitions[partitionOf(entry.hash, 0)].build, entry.hash, &records[entry.offset],
+            entry.keyLength, entry.length);
+    }
+    clearMemory();
+}
+
+void HashJoin::clearMemory() {
+    memoryPeak = max(memoryPeak, memoryUsed());
+    vector<char>().swap(records);
+    vector<Entry>().swap(entries);
+    vector<int>().swap(buckets);
+}
+
+// Chains the entries by bucket; a bucket per entry keeps chains short
+void HashJoin::buildBuckets() {
+    size_t size = 1;
+    while (size < entries.size()) size *= 2;
+    buckets.assign(size, -1);
+
+    size_t mask = size - 1;
+    for (int i = (int)entries.size() - 1; i >= 0; i--) {
+        size_t bucket = (size_t)entries[i].hash & mask;
+        entries[i].next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+}
+
+void HashJoin::probe(const Table& source, const vector<int>* rows) {
+    if (!probing) {
+        probing = true;
+        if (partitions.empty()) buildBuckets();
+    }
+
+    const Side& side = sides[1 - buildSide];
+    int count = (rows != NULL) ? (int)rows->size() : source.getRowCount();
+    for (int i = 0; i < count; i++) {
+        int row = (rows != NULL) ? (*rows)[i] : i;
+        uint64_t hash = 0;
+        uint32_t keyLength;
+        bool hasKey = encode(source, row, side, hash, keyLength);
+        uint32_t length = (uint32_t)scratch.size();
+
+        if (!hasKey) {
+            if (type == JOIN_LEFT && buildSide == 1) emit(scratch.data(), keyLength, NULL, 0);
+            continue;
+        }
+
+        if (!partitions.empty()) {
+            spilledBytes += writeRecord(partitions[partitionOf(hash, 0)].probe, hash, scratch.data(), keyLength, length);
+            continue;
+        }
+        probeEntries(scratch.data(), keyLength, hash);
+    }
+}
+
+// Emits the probe record joined to every build record with its key. A
+// left probe row with no match is emitted alone for a LEFT join; a left
+// build record is only marked, and emitUnmatched() picks up the rest.
+void HashJoin::probeEntries(const char* record, uint32_t keyLength, uint64_t hash) {
+    bool found = false;
+    if (!buckets.empty()) {
+        int i = buckets[(size_t)hash & (buckets.size() - 1)];
+        while (i != -1) {
+            Entry& entry = entries[i];
+            if (entry.hash == hash && entry.keyLength == keyLength &&
+                memcmp(&records[entry.offset], record, keyLength) == 0) {
+                found = true;
+                entry.matched = true;
+                const char* built = &records[entry.offset];
+                if (buildSide == 0) emit(built, entry.keyLength, record, keyLength);
+                else emit(record, keyLength, built, entry.keyLength);
+            }
+            i = entry.next;
+        }
+    }
+
+    if (!found && type == JOIN_LEFT && buildSide == 1) emit(record, keyLength, NULL, 0);
+}
+
+void HashJoin::emitUnmatched() {
+    if (type != JOIN_LEFT || buildSide != 0) return;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].matched) emit(&records[entries[i].offset], entries[i].keyLength, NULL, 0);
+    }
+}
+
+// One output row: the carried values of each side, or NULLs for a side
+// that has no record
+void HashJoin::emit(const char* leftRecord, uint32_t leftKeyLength, const char* rightRecord,
+    uint32_t rightKeyLength) {
+    const char* sideRecords[2] = { leftRecord, rightRecord };
+    uint32_t keyLengths[2] = { leftKeyLength, rightKeyLength };
+
+    int out = 0;
+    for (int s = 0; s < 2; s++) {
+        int count = (int)sides[s].columns.size();
+        if (sideRecords[s] == NULL) {
+            for (int c = 0; c < count; c++) output[out++].appendNull();
+            continue;
+        }
+
+        const char* in = sideRecords[s] + keyLengths[s];
+        for (int c = 0; c < count; c++, out++) {
+            ColumnVector& data = output[out];
+            if (*in++ == '\0') {
+                data.appendNull();
+                continue;
+            }
+            if (data.getType() == VARCHAR) {
+                uint32_t length;
+                memcpy(&length, in, 4);
+                data.appendText(in + 4, length);
+                in += 4 + length;
+            }
+            else if (data.getType() == INT) {
+                int64_t value;
+                memcpy(&value, in, 8);
+                data.appendInt(value);
+                in += 8;
+            }
+            else {
+                double value;
+                memcpy(&value, in, 8);
+                data.appendDouble(value);
+                in += 8;
+            }
+        }
+    }
+    outputRows++;
+}
+
+// Loads one partition's build records and streams its probe records past
+// them. A partition that still does not fit is split on the next hash bits.
+void HashJoin::joinPartition(FILE* build, FILE* probe, int level) {
+    SpillHeader header;
+    clearMemory();
+    rewind(build);
+    while (readRecord(build, header, scratch)) {
+        addEntry(header.hash, header.keyLength, header.length);
+    }
+
+    if (memoryUsed() > memoryBudget && level <= MAX_SPLITS) {
+        clearMemory();
+        vector<Spill> parts(PARTITIONS);
+        for (int p = 0; p < PARTITIONS; p++) {
+            parts[p].build = NULL;
+            parts[p].probe = NULL;
+        }
+        try {
+            for (int p = 0; p < PARTITIONS; p++) {
+                parts[p].build = openSpillFile();
+                parts[p].probe = openSpillFile();
+            }
+            spilledPartitions += PARTITIONS;
+
+            rewind(build);
+            while (readRecord(build, header, scratch)) {
+                spilledBytes += writeRecord(parts[partitionOf(header.hash, level)].build, header.hash, scratch.data(),
+                    header.keyLength, header.length);
+            }
+            rewind(probe);
+            while (readRecord(probe, header, scratch)) {
+                spilledBytes += writeRecord(parts[partitionOf(header.hash, level)].probe, header.hash, scratch.data(),
+                    header.keyLength, header.length);
+            }
+            for (int p = 0; p < PARTITIONS; p++) {
+                joinPartition(parts[p].build, parts[p].probe, level + 1);
+                closeSpills(parts[p].build, parts[p].probe);
+                parts[p].build = NULL;
+                parts[p].probe = NULL;
+            }
+        }
+        catch (...) {
+            for (int p = 0; p < PARTITIONS; p++) closeSpills(parts[p].build, parts[p].probe);
+            throw;
+        }
+        return;
+    }
+
+    buildBuckets();
+    rewind(probe);
+    while (readRecord(probe, header, scratch)) {
+        probeEntries(scratch.data(), header.keyLength, header.hash);
+    }
+    emitUnmatched();
+    clearMemory();
+}
+
+Table* HashJoin::finish() {
+    if (partitions.empty()) {
+        emitUnmatched();
+        clearMemory();
+    }
+    else {
+        for (int p = 0; p < (int)partitions.size(); p++) {
+            joinPartition(partitions[p].build, partitions[p].probe, 1);
+            closeSpills(partitions[p].build, partitions[p].probe);
+            partitions[p].build = NULL;
+            partitions[p].probe = NULL;
+        }
+        partitions.clear();
+    }
+
+    Table* joined = new Table(tableName);
+    for (int c = 0; c < (int)schema.size(); c++) joined->addColumn(schema[c]);
+    joined->adoptColumns(output, outputRows);
+    return joined;
+}
+
+// ================== PLANNING ==================
+
+string HashJoin::qualifiedName(const Table& table, int column) {
+    return table.getTableName() + "." + table.getColumns()[column].getName();
+}
+
+JoinColumn HashJoin::resolveColumn(const Table& left, const Table& right, const string& name) {
+    JoinColumn found;
+    size_t dot = name.find('.');
+    if (dot != string::npos) {
+        string qualifier = name.substr(0, dot);
+        if (sameName(qualifier, left.getTableName())) found.right = false;
+        else if (sameName(qualifier, right.getTableName())) found.right = true;
+        else throw runtime_error("Table '" + qualifier + "' is not part of the query");
+
+        found.column = (found.right ? right : left).getColumnIndex(name.substr(dot + 1));
+        if (found.column == -1) throw runtime_error("Column '" + name + "' does not exist!");
+        return found;
+    }
+
+    int inLeft = left.getColumnIndex(name);
+    int inRight = right.getColumnIndex(name);
+    if (inLeft != -1 && inRight != -1) {
+        throw runtime_error("Column '" + name + "' is in both tables; write " + left.getTableName() +
+            "." + name + " or " + right.getTableName() + "." + name);
+    }
+    if (inLeft == -1 && inRight == -1) throw runtime_error("Column '" + name + "' does not exist!");
+    found.right = inRight != -1;
+    found.column = found.right ? inRight : inLeft;
+    return found;
+}
@@ -0,0 +1,152 @@
+#ifndef HASHJOIN_H
+#define HASHJOIN_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+using namespace std;
+
+#include "Column.h"
+#include "ColumnVector.h"
+
+class Table;
+
+enum JoinType {
+    JOIN_INNER,
+    JOIN_LEFT   // every row of the left table, with NULLs when nothing matches
+};
+
+// The JOIN of a SELECT; empty for a single-table one. Column names may be
+// qualified with their table (users.id) and must be when both tables have
+// the column.
+struct JoinQuery {
+    string table;       // the table after JOIN
+    JoinType type;
+    string leftKey;     // ON leftKey = rightKey, as written
+    string rightKey;
+
+    JoinQuery();
+
+    bool isEmpty() const;
+    void clear();
+};
+
+// A column reference resolved against the two joined tables
+struct JoinColumn {
+    bool right;   // of the table after JOIN
+    int column;
+};
+
+// Equi-join of two tables on one column each.
+//
+// Rows of the build side are encoded as records: the key (8 bytes of an
+// INT or a FLOAT widened to double, or the text), then the values of the
+// columns carried into the result. Records sit in one buffer and are
+// chained per hash bucket; probe rows are encoded the same way and looked
+// up, and each match appends an output row. NULL keys never match.
+//
+// When the build records outgrow the memory budget, both sides are split
+// by hash into PARTITIONS temporary files instead (a grace hash join), and
+// finish() joins the partitions one at a time; a partition still too big
+// is split again on other hash bits.
+//
+// The result is a new table of the carried columns, left ones first, named
+// table.column.
+class HashJoin {
+private:
+    struct Entry {
+        uint64_t hash;
+        uint64_t offset;     // of the record in `records`
+        uint32_t keyLength;
+        uint32_t length;     // key and carried values
+        int next;            // next entry in the bucket, or -1
+        bool matched;
+    };
+
+    // Records of both sides of one partition
+    struct Spill {
+        FILE* build;
+        FILE* probe;
+    };
+
+    // One input's key and carried columns
+    struct Side {
+        int key;
+        DataType keyType;
+        vector<int> columns;
+    };
+
+    Side sides[2];       // left, right
+    int buildSide;       // index of the side that is hashed
+    bool numericKeys;    // keys compared as doubles (an INT joined to a FLOAT)
+    JoinType type;
+    size_t memoryBudget;
+
+    vector<char> records;
+    vector<Entry> entries;
+    vector<int> buckets;  // first entry per bucket, or -1
+    vector<char> scratch;
+    bool probing;
+
+    vector<Spill> partitions;  // empty until the build side spills
+    int spilledPartitions;
+    size_t memoryPeak;
+    uint64_t spilledBytes;
+
+    string tableName;
+    vector<Column> schema;
+    vector<ColumnVector> output;
+    int outputRows;
+
+    bool encode(const Table& source, int row, const Side& side, uint64_t& hash, uint32_t& keyLength);
+    void addEntry(uint64_t hash, uint32_t keyLength, uint32_t length);
+    void buildBuckets();
+    void probeEntries(const char* record, uint32_t keyLength, uint64_t hash);
+    void emit(const char* leftRecord, uint32_t leftKeyLength, const char* rightRecord,
+        uint32_t rightKeyLength);
+    void emitUnmatched();
+    void spill();
+    void clearMemory();
+    void joinPartition(FILE* build, FILE* probe, int level);
+    size_t memoryUsed() const;
+
+    HashJoin(const HashJoin&);
+    HashJoin& operator=(const HashJoin&);
+
+public:
+    static const int PARTITIONS = 16;
+    // Times a partition is split again before it is joined in memory anyway
+    static const int MAX_SPLITS = 3;
+
+    // leftKey and rightKey are the ON columns; the listed columns of each
+    // table are carried into the result. buildLeft picks the side that is
+    // hashed, normally the smaller. Throws runtime_error when the keys
+    // cannot be compared (text against a number).
+    HashJoin(const Table& left, int leftKey, const vector<int>& leftColumns,
+        const Table& right, int rightKey, const vector<int>& rightColumns,
+        JoinType joinType, bool buildLeft, size_t budgetBytes);
+    ~HashJoin();
+
+    // Rows of the build side, then of the probe side, each from the table
+    // or a slice of it: the listed positions, or every row when `rows` is
+    // NULL. All build rows must be added before the first probe row.
+    void build(const Table& source, const vector<int>* rows);
+    void probe(const Table& source, const vector<int>* rows);
+
+    // Joins what was spilled and returns the result (caller deletes)
+    Table* finish();
+
+    int getSpilledPartitions() const;  // partition files written, 0 in memory
+    size_t getMemoryPeak() const;
+    uint64_t getSpilledBytes() const;  // including partitions split again
+
+    // Name of a joined column in the result
+    static string qualifiedName(const Table& table, int column);
+
+    // Finds a column named `name` or `table.name`; throws runtime_error for
+    // an unknown table or column, or a bare name both tables have
+    static JoinColumn resolveColumn(const Table& left, const Table& right, const string& name);
+};
+
+#endif
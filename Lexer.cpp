@@ -0,0 +1,118 @@
+#include "Lexer.h"
+#include <stdexcept>
+
+using namespace std;
+
+// ASCII only; the <cctype> calls go through the locale for every character
+static inline bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool isWordStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool isWordChar(char c) {
+    return isWordStart(c) || isDigit(c);
+}
+
+bool Token::is(const char* keyword) const {
+    if (type != TOKEN_WORD) return false;
+
+    size_t i = 0;
+    for (; i < text.size(); i++) {
+        char c = text[i];
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c != keyword[i]) return false;
+    }
+    return keyword[i] == '\0';
+}
+
+bool Token::isSymbol(const char* symbol) const {
+    return type == TOKEN_SYMBOL && text == symbol;
+}
+
+size_t Token::end() const {
+    return offset + text.size();
+}
+
+Lexer::Lexer(string_view text)
+    : input(text), position(0) {
+    scan();
+}
+
+const Token& Lexer::peek() const {
+    return current;
+}
+
+Token Lexer::next() {
+    Token token = current;
+    if (token.type != TOKEN_END) scan();
+    return token;
+}
+
+string_view Lexer::slice(size_t begin, size_t end) const {
+    return input.substr(begin, end - begin);
+}
+
+void Lexer::scan() {
+    while (position < input.size() && isSpace(input[position])) position++;
+
+    size_t start = position;
+    current.offset = start;
+
+    if (position >= input.size()) {
+        current.type = TOKEN_END;
+        current.text = string_view();
+        return;
+    }
+
+    char c = input[position];
+
+    if (isWordStart(c)) {
+        while (position < input.size() && isWordChar(input[position])) position++;
+        current.type = TOKEN_WORD;
+    }
+    else if (isDigit(c) || (c == '.' && position + 1 < input.size() && isDigit(input[position + 1]))) {
+        while (position < input.size() && isDigit(input[position])) position++;
+        if (position < input.size() && input[position] == '.') {
+            position++;
+            while (position < input.size() && isDigit(input[position])) position++;
+        }
+        current.type = TOKEN_NUMBER;
+    }
+    else if (c == '\'' || c == '"') {
+        position++;
+        while (true) {
+            if (position >= input.size()) {
+                throw runtime_error("Unterminated string literal");
+            }
+            if (input[position] == c) {
+                if (position + 1 < input.size() && input[position + 1] == c) {
+                    position += 2;
+                    continue;
+                }
+                position++;
+                break;
+            }
+            position++;
+        }
+        current.type = TOKEN_STRING;
+    }
+    else {
+        position++;
+        if (position < input.size()) {
+            char n = input[position];
+            if ((c == '!' && n == '=') || (c == '<' && (n == '=' || n == '>')) || (c == '>' && n == '=')) {
+                position++;
+            }
+        }
+        current.type = TOKEN_SYMBOL;
+    }
+
+    current.text = input.substr(start, position - start);
+}
@@ -0,0 +1,47 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string>
+#include <string_view>
+using namespace std;
+
+enum TokenType {
+    TOKEN_END,
+    TOKEN_WORD,    // keyword or name: letter or '_', then letters, digits, '_'
+    TOKEN_NUMBER,  // digits with an optional fraction
+    TOKEN_STRING,  // '...' or "...", a doubled quote standing for one
+    TOKEN_SYMBOL   // punctuation and operators: ( ) , ; * = != <> < > <= >= ...
+};
+
+// A token is a view into the statement text; nothing is copied
+struct Token {
+    TokenType type;
+    string_view text;  // as written, quotes included
+    size_t offset;
+
+    // Case-insensitive keyword test, so the statement is never uppercased
+    bool is(const char* keyword) const;
+    bool isSymbol(const char* symbol) const;
+    size_t end() const;
+};
+
+// Single pass over the statement with one token of lookahead
+class Lexer {
+private:
+    string_view input;
+    size_t position;
+    Token current;
+
+    void scan();
+
+public:
+    explicit Lexer(string_view text);
+
+    const Token& peek() const;
+    Token next();
+
+    // The statement text from `begin` up to `end`
+    string_view slice(size_t begin, size_t end) const;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+using namespace std;
+
+// Read-only memory mapping of a whole file (mmap / MapViewOfFile)
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+
+    // POSIX uses fd; Windows keeps the file and mapping handles
+    int fd;
+    void* fileHandle;
+    void* mappingHandle;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const string& path);
+    void close();
+
+    const char* getData() const;
+    size_t getSize() const;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "PagedScan.h"
+#include "Table.h"
+#include "BufferPool.h"
+#include "QueryPlan.h"
+#include <algorithm>
+
+using namespace std;
+
+PagedScan::PagedScan(const Table& source, BufferPool& bufferPool, int poolFile)
+    : table(source), pool(bufferPool), fileId(poolFile), nextRow(0),
+    textOffsets(source.getColumnCount(), 0), bytesRead(0), profile(NULL) {
+}
+
+uint64_t PagedScan::getBytesRead() const {
+    return bytesRead;
+}
+
+void PagedScan::setProfile(PlanNode* node) {
+    profile = node;
+}
+
+Table* PagedScan::next(int& firstRow, const vector<Condition>& conditions, vector<int>& matches) {
+    OperatorTimer timer(profile);
+    Table* chunk = next(firstRow);
+    if (chunk == NULL) return NULL;
+
+    try {
+        if (conditions.empty()) {
+            matches.clear();
+            for (int r = 0; r < chunk->getRowCount(); r++) matches.push_back(r);
+        }
+        else {
+            chunk->findMatchingRows(conditions, matches);
+        }
+    }
+    catch (...) {
+        delete chunk;
+        throw;
+    }
+
+    if (profile != NULL) {
+        profile->rowsIn += chunk->getRowCount();
+        profile->rowsOut += (long long)matches.size();
+        profile->bytes = bytesRead;
+        profile->memoryPeak = max(profile->memoryPeak, chunk->getMemoryUsage() + matches.size() * sizeof(int));
+    }
+    return chunk;
+}
+
+Table* PagedScan::next(int& firstRow) {
+    int rows = table.getRowCount();
+    if (nextRow >= rows) return NULL;
+
+    int n = rows - nextRow;
+    if (n > CHUNK_ROWS) n = CHUNK_ROWS;
+
+    const vector<Column>& cols = table.getColumns();
+    const vector<ColumnSegment>& segments = table.getSegments();
+
+    Table* chunk = new Table(table.getTableName());
+    vector<string> encoded(cols.size());
+
+    for (int c = 0; c < (int)cols.size(); c++) {
+        const ColumnSegment& seg = segments[c];
+        string& out = encoded[c];
+
+        // Same layout as ColumnVector::encode, restricted to rows [nextRow, nextRow + n)
+        if (cols[c].getType() == VARCHAR) {
+            out.resize((size_t)n * sizeof(uint32_t));
+            pool.read(fileId, seg.offset + (uint64_t)nextRow * sizeof(uint32_t), &out[0], out.size());
+
+            uint64_t textLength = 0;
+            const uint32_t* lengths = (const uint32_t*)out.data();
+            for (int r = 0; r < n; r++) textLength += lengths[r];
+
+            uint64_t textStart = seg.offset + (uint64_t)rows * sizeof(uint32_t) + textOffsets[c];
+            out.resize(out.size() + (size_t)textLength);
+            if (textLength > 0) {
+                pool.read(fileId, textStart, &out[(size_t)n * sizeof(uint32_t)], (size_t)textLength);
+            }
+            textOffsets[c] += textLength;
+        }
+        else {
+            out.resize((size_t)n * sizeof(int64_t));
+            pool.read(fileId, seg.offset + (uint64_t)nextRow * sizeof(int64_t), &out[0], out.size());
+        }
+
+        uint64_t nullStart = seg.offset + seg.length - (uint64_t)((rows + 63) / 64) * sizeof(uint64_t);
+        size_t nullLength = (size_t)((n + 63) / 64) * sizeof(uint64_t);
+        size_t valuesLength = out.size();
+        out.resize(valuesLength + nullLength);
+        pool.read(fileId, nullStart + (uint64_t)(nextRow / 64) * sizeof(uint64_t), &out[valuesLength], nullLength);
+
+        bytesRead += out.size();
+        chunk->addColumn(cols[c]);
+    }
+    // estimates are fractions of the rows, so the table's apply per chunk
+    chunk->setStats(table.getStats());
+
+    try {
+        chunk->loadEncoded(encoded, n);
+    }
+    catch (...) {
+        delete chunk;
+        throw;
+    }
+
+    firstRow = nextRow;
+    nextRow += n;
+    return chunk;
+}
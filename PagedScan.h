@@ -0,0 +1,48 @@
+#ifndef PAGEDSCAN_H
+#define PAGEDSCAN_H
+
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+#include "Condition.h"
+
+class Table;
+class BufferPool;
+struct PlanNode;
+
+// Sequential scan of a table that is not loaded: reads its column segments
+// through the buffer pool in slices of CHUNK_ROWS rows, each returned as a
+// standalone Table with the same columns, so at most one slice is decoded
+// in memory at a time.
+class PagedScan {
+private:
+    const Table& table;
+    BufferPool& pool;
+    int fileId;
+    int nextRow;
+    vector<uint64_t> textOffsets; // VARCHAR bytes consumed per column
+    uint64_t bytesRead;
+    PlanNode* profile;
+
+public:
+    static const int CHUNK_ROWS = 65536; // multiple of 64 keeps null words aligned
+
+    PagedScan(const Table& source, BufferPool& bufferPool, int poolFile);
+
+    // Next slice (the caller deletes it) or NULL at the end; firstRow is
+    // the position of the slice's first row in the table.
+    Table* next(int& firstRow);
+
+    // Next slice as above, with `matches` set to the positions in it that
+    // pass the conditions (every position when there are none)
+    Table* next(int& firstRow, const vector<Condition>& conditions, vector<int>& matches);
+
+    uint64_t getBytesRead() const;  // encoded column bytes so far
+
+    // The slices read and filtered by the call above are timed and counted
+    // on this operator (EXPLAIN ANALYZE)
+    void setProfile(PlanNode* node);
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "PlanCache.h"
+#include "PreparedStatement.h"
+#include "Lexer.h"
+#include "Statement.h"
+#include <stdexcept>
+
+using namespace std;
+
+PlanCache::PlanCache(size_t maxEntries)
+    : capacity(maxEntries), hits(0), misses(0), evictions(0), invalidations(0) {
+}
+
+static void deleteAll(vector<PreparedStatement*>& statements) {
+    for (size_t i = 0; i < statements.size(); i++) {
+        delete statements[i];
+    }
+    statements.clear();
+}
+
+PlanCache::~PlanCache() {
+    EntryList::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        deleteAll(it->second);
+    }
+}
+
+// Tokens after which a value starts, and tokens that end one
+static bool isComparison(const Token& token) {
+    return token.isSymbol("=") || token.isSymbol("!=") || token.isSymbol("<>") ||
+        token.isSymbol("<") || token.isSymbol(">") || token.isSymbol("<=") || token.isSymbol(">=");
+}
+
+static bool startsValue(const Token& token) {
+    return isComparison(token) || token.isSymbol(",") || token.isSymbol("(") ||
+        token.is("LIMIT") || token.is("OFFSET") || token.is("BETWEEN") || token.is("AND");
+}
+
+static bool endsValue(const Token& token) {
+    return token.type == TOKEN_END || token.isSymbol(";") || token.isSymbol(",") ||
+        token.isSymbol(")") || token.is("AND") || token.is("OR") || token.is("WHERE") || token.is("GROUP") ||
+        token.is("HAVING") || token.is("ORDER") || token.is("LIMIT") || token.is("OFFSET");
+}
+
+// The clauses whose values may be unquoted text, each ending a value
+// where QueryParser::readValue does
+enum ValueClause {
+    CLAUSE_OTHER,
+    CLAUSE_VALUES,  // the INSERT tuples
+    CLAUSE_SET,
+    CLAUSE_WHERE,
+    CLAUSE_HAVING
+};
+
+static bool endsClauseValue(const Token& token, ValueClause clause) {
+    if (token.type == TOKEN_END || token.isSymbol(";")) return true;
+    switch (clause) {
+    case CLAUSE_VALUES:
+        return token.isSymbol(",") || token.isSymbol(")");
+    case CLAUSE_SET:
+        return token.isSymbol(",") || token.is("WHERE");
+    case CLAUSE_WHERE:
+        return token.isSymbol(")") || token.is("AND") || token.is("OR") || token.is("GROUP") ||
+            token.is("HAVING") || token.is("ORDER") || token.is("LIMIT");
+    case CLAUSE_HAVING:
+        return token.is("AND") || token.is("ORDER") || token.is("LIMIT");
+    default:
+        return endsValue(token);
+    }
+}
+
+bool PlanCache::normalize(const string& sql, string& shape, vector<string>& literals) {
+    shape.clear();
+    literals.clear();
+
+    try {
+        Lexer lexer(sql);
+        const Token& first = lexer.peek();
+        if (!first.is("SELECT") && !first.is("INSERT") && !first.is("UPDATE") && !first.is("DELETE")) {
+            return false;
+        }
+
+        size_t copied = 0;
+        bool afterValueStart = false;
+        // A value of a VALUES tuple, or after a comparison, is any text
+        // up to the end of the value, as in John Smith or 2024-01-31
+        bool textValueStart = false;
+        ValueClause clause = CLAUSE_OTHER;
+        int depth = 0;
+        while (lexer.peek().type != TOKEN_END) {
+            Token token = lexer.next();
+
+            // A '?' typed by the user would be taken for a parameter
+            if (token.isSymbol("?")) return false;
+            // Joins are not prepared
+            if (token.is("JOIN")) return false;
+
+            if (textValueStart && token.type != TOKEN_STRING && !endsClauseValue(token, clause)) {
+                size_t begin = token.offset;
+                size_t end = token.end();
+                int nested = token.isSymbol("(") ? 1 : 0;
+                while (nested > 0 || !endsClauseValue(lexer.peek(), clause)) {
+                    const Token& next = lexer.peek();
+                    if (next.type == TOKEN_END || next.isSymbol(";")) break;
+                    if (next.isSymbol("?")) return false;
+                    if (next.isSymbol("(")) nested++;
+                    else if (next.isSymbol(")") && nested > 0) nested--;
+                    end = next.end();
+                    lexer.next();
+                }
+
+                literals.push_back(sql.substr(begin, end - begin));
+                shape.append(sql, copied, begin - copied);
+                shape += '?';
+                copied = end;
+                afterValueStart = textValueStart = false;
+                continue;
+            }
+
+            bool signedNumber = (token.isSymbol("-") || token.isSymbol("+")) &&
+                lexer.peek().type == TOKEN_NUMBER && lexer.peek().offset == token.end();
+            if (afterValueStart && (token.type == TOKEN_NUMBER || token.type == TOKEN_STRING || signedNumber)) {
+                size_t begin = token.offset;
+                Token last = signedNumber ? lexer.next() : token;
+
+                if (textValueStart ? endsClauseValue(lexer.peek(), clause) : endsValue(lexer.peek())) {
+                    if (last.type == TOKEN_STRING) {
+                        Literal value;
+                        value.quote = last.text[0];
+                        value.text = last.text.substr(1, last.text.size() - 2);
+                        value.escaped = value.text.find(value.quote) != string_view::npos;
+                        literals.push_back(value.toString());
+                    }
+                    else {
+                        literals.push_back(sql.substr(begin, last.end() - begin));
+                    }
+                    shape.append(sql, copied, begin - copied);
+                    shape += '?';
+                    copied = last.end();
+                }
+                afterValueStart = textValueStart = false;
+                continue;
+            }
+
+            if (token.is("VALUES")) clause = CLAUSE_VALUES;
+            else if (token.is("SET")) clause = CLAUSE_SET;
+            else if (token.is("WHERE")) clause = CLAUSE_WHERE;
+            else if (token.is("HAVING")) clause = CLAUSE_HAVING;
+            else if (token.is("GROUP") || token.is("ORDER") || token.is("LIMIT")) clause = CLAUSE_OTHER;
+
+            if (token.isSymbol("(")) depth++;
+            else if (token.isSymbol(")")) depth--;
+
+            afterValueStart = startsValue(token);
+            textValueStart = (clause == CLAUSE_VALUES) ?
+                depth == 1 && (token.isSymbol("(") || token.isSymbol(",")) :
+                clause != CLAUSE_OTHER && isComparison(token);
+        }
+        shape.append(sql, copied, string::npos);
+    }
+    catch (runtime_error&) {
+        return false;  // left for the parser to report
+    }
+
+    return shape.size() <= MAX_SHAPE_BYTES;
+}
+
+// A shape whose statements are all running counts as a miss: the caller
+// prepares another
+PreparedStatement* PlanCache::take(const string& shape) {
+    lock_guard<mutex> guard(lock);
+    unordered_map<string, EntryList::iterator>::iterator it = index.find(shape);
+    if (it == index.end() || it->second->second.empty()) {
+        misses++;
+        return NULL;
+    }
+
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    PreparedStatement* statement = it->second->second.back();
+    it->second->second.pop_back();
+    return statement;
+}
+
+void PlanCache::release(const string& shape, PreparedStatement* statement) {
+    lock_guard<mutex> guard(lock);
+    if (capacity == 0) {
+        delete statement;
+        return;
+    }
+
+    unordered_map<string, EntryList::iterator>::iterator it = index.find(shape);
+    if (it == index.end()) {
+        entries.push_front(make_pair(shape, vector<PreparedStatement*>()));
+        it = index.insert(make_pair(shape, entries.begin())).first;
+    }
+    vector<PreparedStatement*>& idle = it->second->second;
+    if (idle.size() >= IDLE_PER_SHAPE) {
+        delete statement;
+    }
+    else {
+        idle.push_back(statement);
+    }
+    evictTo(capacity);
+}
+
+void PlanCache::evictTo(size_t count) {
+    while (entries.size() > count) {
+        index.erase(entries.back().first);
+        deleteAll(entries.back().second);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+void PlanCache::invalidate() {
+    lock_guard<mutex> guard(lock);
+    if (entries.empty()) return;
+
+    EntryList::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        deleteAll(it->second);
+    }
+    entries.clear();
+    index.clear();
+    invalidations++;
+}
+
+void PlanCache::setCapacity(size_t maxEntries) {
+    lock_guard<mutex> guard(lock);
+    capacity = maxEntries;
+    evictTo(capacity);
+}
+
+PlanCacheStats PlanCache::getStats() const {
+    lock_guard<mutex> guard(lock);
+    PlanCacheStats stats;
+    stats.entries = entries.size();
+    stats.capacity = capacity;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.invalidations = invalidations;
+    return stats;
+}
@@ -0,0 +1,78 @@
+#ifndef PLANCACHE_H
+#define PLANCACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+class PreparedStatement;
+
+struct PlanCacheStats {
+    size_t entries;
+    size_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+};
+
+// Prepared statements for recently seen query shapes. A shape is the query
+// text with each literal value replaced by '?', so "WHERE id = 7" and
+// "WHERE id = 8" share one parsed and resolved statement; the literals are
+// bound to it on every run. Least recently used shapes are evicted first.
+//
+// A statement is taken out while it runs and released afterwards, so
+// threads running the same shape at once each use their own; up to
+// IDLE_PER_SHAPE of them are kept per shape.
+class PlanCache {
+private:
+    typedef list<pair<string, vector<PreparedStatement*> > > EntryList;
+
+    EntryList entries;  // most recently used first
+    unordered_map<string, EntryList::iterator> index;
+    size_t capacity;
+    mutable mutex lock;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+
+    void evictTo(size_t count);
+
+    PlanCache(const PlanCache&);
+    PlanCache& operator=(const PlanCache&);
+
+public:
+    static const size_t DEFAULT_CAPACITY = 256;
+    static const size_t MAX_SHAPE_BYTES = 1024;  // longer statements, such as bulk INSERTs, are not cached
+    static const size_t IDLE_PER_SHAPE = 16;
+
+    explicit PlanCache(size_t maxEntries = DEFAULT_CAPACITY);
+    ~PlanCache();
+
+    // Splits a SELECT, INSERT, UPDATE or DELETE into its shape and literal
+    // values: numbers and quoted strings standing alone as a value, and
+    // the unquoted text of a VALUES entry or of the value after a
+    // comparison. False when the statement should not be cached.
+    static bool normalize(const string& sql, string& shape, vector<string>& literals);
+
+    // An idle statement for a shape, now the caller's, or NULL; counts a
+    // hit or a miss
+    PreparedStatement* take(const string& shape);
+    // Gives back a statement taken or prepared for the shape (takes
+    // ownership); may evict the least recently used shape
+    void release(const string& shape, PreparedStatement* statement);
+
+    // Drops every entry, after a schema change
+    void invalidate();
+    void setCapacity(size_t maxEntries);
+
+    PlanCacheStats getStats() const;
+};
+
+#endif
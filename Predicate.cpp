@@ -0,0 +1,514 @@
+#include "Predicate.h"
+#include "Table.h"
+#include "FilterKernels.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+template <CompareOp OP, typename T>
+inline bool compareValues(const T& actual, const T& expected) {
+    switch (OP) {
+    case OP_EQ: return actual == expected;
+    case OP_NE: return actual != expected;
+    case OP_LT: return actual < expected;
+    case OP_GT: return actual > expected;
+    case OP_LE: return actual <= expected;
+    case OP_GE: return actual >= expected;
+    }
+    return false;
+}
+
+template <CompareOp OP>
+bool testInt(const BoundCondition& cond, int row) {
+    return compareValues<OP>(cond.data->getInt(row), cond.intValue);
+}
+
+template <CompareOp OP>
+bool testIntAsDouble(const BoundCondition& cond, int row) {
+    return compareValues<OP>((double)cond.data->getInt(row), cond.numberValue);
+}
+
+template <CompareOp OP>
+bool testFloat(const BoundCondition& cond, int row) {
+    return compareValues<OP>(cond.data->getDouble(row), cond.numberValue);
+}
+
+// Byte-wise three-way compare, same order as std::string
+template <CompareOp OP>
+bool testText(const BoundCondition& cond, int row) {
+    uint32_t length;
+    const char* text = cond.data->getText(row, length);
+    size_t expectedLength = cond.textValue.size();
+
+    size_t common = length < expectedLength ? length : expectedLength;
+    // an empty value's text may be NULL, which memcmp must not be given
+    int cmp = (common == 0) ? 0 : memcmp(text, cond.textValue.data(), common);
+    if (cmp == 0) {
+        cmp = (length < expectedLength) ? -1 : (length > expectedLength ? 1 : 0);
+    }
+    return compareValues<OP>(cmp, 0);
+}
+
+// Maps the runtime operator onto one instantiation of a test template
+#define DEFINE_DISPATCH(NAME, FN)                          \
+    static RowTest NAME(CompareOp op) {                    \
+        switch (op) {                                      \
+        case OP_EQ: return &FN<OP_EQ>;                     \
+        case OP_NE: return &FN<OP_NE>;                     \
+        case OP_LT: return &FN<OP_LT>;                     \
+        case OP_GT: return &FN<OP_GT>;                     \
+        case OP_LE: return &FN<OP_LE>;                     \
+        case OP_GE: return &FN<OP_GE>;                     \
+        }                                                  \
+        return NULL;                                       \
+    }
+
+DEFINE_DISPATCH(pickIntTest, testInt)
+DEFINE_DISPATCH(pickIntAsDoubleTest, testIntAsDouble)
+DEFINE_DISPATCH(pickFloatTest, testFloat)
+DEFINE_DISPATCH(pickTextTest, testText)
+
+#undef DEFINE_DISPATCH
+
+// Relative per-row costs: a SIMD kernel, a row-at-a-time number test, a
+// text test and a hash set probe
+static const double KERNEL_COST = 0.25;
+static const double NUMBER_COST = 1.0;
+static const double TEXT_COST = 2.0;
+static const double PROBE_COST = 2.0;
+
+static uint64_t hashKey(const char* data, size_t length) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < length; i++, shift += 8) {
+        tail |= (uint64_t)(unsigned char)data[i] << shift;
+    }
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t hashInt(int64_t value) {
+    return hashKey((const char*)&value, sizeof(value));
+}
+
+static uint64_t hashDouble(double value) {
+    if (value == 0) value = 0;  // -0.0 equals 0.0, so it must hash the same
+    return hashKey((const char*)&value, sizeof(value));
+}
+
+// ================== IN LISTS ==================
+
+static bool inInts(const BoundCondition& cond, int64_t value) {
+    if (cond.slots.empty()) {
+        for (size_t i = 0; i < cond.intValues.size(); i++) {
+            if (cond.intValues[i] == value) return true;
+        }
+        return false;
+    }
+    size_t mask = cond.slots.size() - 1;
+    for (size_t s = hashInt(value) & mask; cond.slots[s] != -1; s = (s + 1) & mask) {
+        if (cond.intValues[cond.slots[s]] == value) return true;
+    }
+    return false;
+}
+
+static bool inNumbers(const BoundCondition& cond, double value) {
+    if (cond.slots.empty()) {
+        for (size_t i = 0; i < cond.numberValues.size(); i++) {
+            if (cond.numberValues[i] == value) return true;
+        }
+        return false;
+    }
+    size_t mask = cond.slots.size() - 1;
+    for (size_t s = hashDouble(value) & mask; cond.slots[s] != -1; s = (s + 1) & mask) {
+        if (cond.numberValues[cond.slots[s]] == value) return true;
+    }
+    return false;
+}
+
+static bool sameText(const string& expected, const char* text, uint32_t length) {
+    return expected.size() == length && memcmp(expected.data(), text, length) == 0;
+}
+
+static bool inTexts(const BoundCondition& cond, const char* text, uint32_t length) {
+    if (cond.slots.empty()) {
+        for (size_t i = 0; i < cond.textValues.size(); i++) {
+            if (sameText(cond.textValues[i], text, length)) return true;
+        }
+        return false;
+    }
+    size_t mask = cond.slots.size() - 1;
+    for (size_t s = hashKey(text, length) & mask; cond.slots[s] != -1; s = (s + 1) & mask) {
+        if (sameText(cond.textValues[cond.slots[s]], text, length)) return true;
+    }
+    return false;
+}
+
+static bool testInInt(const BoundCondition& cond, int row) {
+    return inInts(cond, cond.data->getInt(row)) != cond.negated;
+}
+
+static bool testInFloat(const BoundCondition& cond, int row) {
+    return inNumbers(cond, cond.data->getDouble(row)) != cond.negated;
+}
+
+static bool testInText(const BoundCondition& cond, int row) {
+    uint32_t length;
+    const char* text = cond.data->getText(row, length);
+    return inTexts(cond, text, length) != cond.negated;
+}
+
+// Open addressing at most half full, so a miss ends at an empty slot soon
+static void buildSlots(BoundCondition& bound, const vector<uint64_t>& hashes) {
+    size_t size = 1;
+    while (size < hashes.size() * 2) size <<= 1;
+    bound.slots.assign(size, -1);
+
+    size_t mask = size - 1;
+    for (size_t i = 0; i < hashes.size(); i++) {
+        size_t s = hashes[i] & mask;
+        while (bound.slots[s] != -1) s = (s + 1) & mask;
+        bound.slots[s] = (int)i;
+    }
+}
+
+// ================== AND / OR ==================
+
+static bool testAll(const BoundCondition& cond, int row) {
+    for (size_t i = 0; i < cond.children.size(); i++) {
+        if (!cond.children[i].test(cond.children[i], row)) return false;
+    }
+    return true;
+}
+
+static bool testAny(const BoundCondition& cond, int row) {
+    for (size_t i = 0; i < cond.children.size(); i++) {
+        if (cond.children[i].test(cond.children[i], row)) return true;
+    }
+    return false;
+}
+
+// Evaluated by a FilterKernels kernel over whole batches
+static bool isVectorized(const BoundCondition& cond) {
+    if (cond.kind != BOUND_COMPARE && cond.kind != BOUND_IN) return false;
+    if (cond.kind == BOUND_IN && !cond.slots.empty()) return false;
+    DataType type = cond.data->getType();
+    return type == FLOAT || (type == INT && (cond.kind == BOUND_IN || cond.integerLiteral));
+}
+
+// AND: cheapest per rejected row first. OR: cheapest per accepted row first.
+static bool runsBeforeInAnd(const BoundCondition& a, const BoundCondition& b) {
+    return a.cost * max(1 - b.selectivity, 1e-9) < b.cost * max(1 - a.selectivity, 1e-9);
+}
+
+static bool runsBeforeInOr(const BoundCondition& a, const BoundCondition& b) {
+    return a.cost * max(b.selectivity, 1e-9) < b.cost * max(a.selectivity, 1e-9);
+}
+
+// Orders the children of an AND or OR and derives its estimates: each
+// child is only tested on the rows the ones before it left undecided
+static void orderChildren(BoundCondition& bound) {
+    bool conjunction = bound.kind == BOUND_AND;
+    stable_sort(bound.children.begin(), bound.children.end(),
+        conjunction ? runsBeforeInAnd : runsBeforeInOr);
+
+    double undecided = 1;
+    bound.cost = 0;
+    for (size_t i = 0; i < bound.children.size(); i++) {
+        const BoundCondition& child = bound.children[i];
+        bound.cost += undecided * child.cost;
+        undecided *= conjunction ? child.selectivity : 1 - child.selectivity;
+    }
+    bound.selectivity = conjunction ? undecided : 1 - undecided;
+    bound.test = conjunction ? testAll : testAny;
+}
+
+// ================== BINDING ==================
+
+CompareOp CompiledPredicate::parseOperator(const string& op) {
+    if (op == "=")  return OP_EQ;
+    if (op == "!=") return OP_NE;
+    if (op == "<")  return OP_LT;
+    if (op == ">")  return OP_GT;
+    if (op == "<=") return OP_LE;
+    if (op == ">=") return OP_GE;
+    throw runtime_error("Unknown operator: " + op);
+}
+
+static void bindComparison(const Table& table, const Condition& cond, BoundCondition& bound) {
+    bound.op = CompiledPredicate::parseOperator(cond.op);
+    bound.numberValue = atof(cond.value.c_str());
+
+    DataType type = bound.data->getType();
+    if (type == INT) {
+        bound.integerLiteral = ColumnVector::parseInt(cond.value, bound.intValue);
+        bound.test = bound.integerLiteral ? pickIntTest(bound.op) : pickIntAsDoubleTest(bound.op);
+        bound.cost = bound.integerLiteral ? KERNEL_COST : NUMBER_COST;
+    }
+    else if (type == FLOAT) {
+        bound.test = pickFloatTest(bound.op);
+        bound.cost = KERNEL_COST;
+    }
+    else {
+        bound.textValue = cond.value;
+        bound.test = pickTextTest(bound.op);
+        bound.cost = TEXT_COST;
+    }
+
+    bound.selectivity = table.getStats().selectivity(table, cond);
+}
+
+// The list is converted as `=` would compare it: on an INT column a value
+// that is not an integer (after atof) never matches and is dropped
+static void bindList(const Table& table, const Condition& cond, BoundCondition& bound) {
+    bound.negated = cond.op == "NOT IN";
+    DataType type = bound.data->getType();
+    bool hashed = (int)cond.values.size() > CompiledPredicate::IN_SCAN_MAX;
+    vector<uint64_t> hashes;
+
+    for (size_t i = 0; i < cond.values.size(); i++) {
+        const string& value = cond.values[i];
+        if (type == INT) {
+            int64_t number;
+            if (!ColumnVector::parseInt(value, number)) {
+                double real = atof(value.c_str());
+                if (real != floor(real) || fabs(real) >= 9.2e18) continue;
+                number = (int64_t)real;
+            }
+            bound.intValues.push_back(number);
+            hashes.push_back(hashInt(number));
+        }
+        else if (type == FLOAT) {
+            bound.numberValues.push_back(atof(value.c_str()));
+            hashes.push_back(hashDouble(bound.numberValues.back()));
+        }
+        else {
+            bound.textValues.push_back(value);
+            hashes.push_back(hashKey(value.data(), value.size()));
+        }
+    }
+
+    if (hashed) buildSlots(bound, hashes);
+
+    if (type == INT) bound.test = testInInt;
+    else if (type == FLOAT) bound.test = testInFloat;
+    else bound.test = testInText;
+
+    bound.selectivity = table.getStats().selectivity(table, cond);
+    if (hashed) bound.cost = (type == VARCHAR) ? PROBE_COST + TEXT_COST : PROBE_COST;
+    else if (type == VARCHAR) bound.cost = TEXT_COST * max((size_t)1, hashes.size());
+    else bound.cost = KERNEL_COST * max((size_t)1, hashes.size());
+}
+
+// Returns false when the condition is ignored: it names an unknown column
+// (as Condition-based matching always did), or it is an OR with such a
+// branch, which then always holds
+static bool bind(const Table& table, const Condition& cond, BoundCondition& bound) {
+    bound.kind = BOUND_COMPARE;
+    bound.columnIndex = -1;
+    bound.data = NULL;
+    bound.op = OP_EQ;
+    bound.integerLiteral = false;
+    bound.intValue = 0;
+    bound.numberValue = 0;
+    bound.negated = false;
+    bound.selectivity = 1;
+    bound.cost = 0;
+    bound.test = NULL;
+
+    if (cond.kind == CONDITION_AND || cond.kind == CONDITION_OR) {
+        bound.kind = (cond.kind == CONDITION_AND) ? BOUND_AND : BOUND_OR;
+        for (size_t i = 0; i < cond.children.size(); i++) {
+            BoundCondition child;
+            if (bind(table, cond.children[i], child)) bound.children.push_back(child);
+            else if (cond.kind == CONDITION_OR) return false;
+        }
+        if (bound.children.empty()) return false;
+        if (bound.children.size() == 1) {
+            BoundCondition only = bound.children[0];
+            bound = only;
+            return true;
+        }
+        orderChildren(bound);
+        return true;
+    }
+
+    int colIndex = table.getColumnIndex(cond.columnName);
+    if (colIndex == -1) return false;
+    bound.columnIndex = colIndex;
+    bound.data = &table.getColumnData(colIndex);
+
+    if (cond.kind == CONDITION_IN) {
+        bound.kind = BOUND_IN;
+        bindList(table, cond, bound);
+    }
+    else {
+        bindComparison(table, cond, bound);
+    }
+    return true;
+}
+
+CompiledPredicate::CompiledPredicate() {
+}
+
+CompiledPredicate::CompiledPredicate(const Table& table, const vector<Condition>& conds) {
+    for (int c = 0; c < (int)conds.size(); c++) {
+        BoundCondition bound;
+        if (bind(table, conds[c], bound)) conditions.push_back(bound);
+    }
+    stable_sort(conditions.begin(), conditions.end(), runsBeforeInAnd);
+}
+
+// ================== EVALUATION ==================
+
+bool CompiledPredicate::matches(int row) const {
+    for (size_t i = 0; i < conditions.size(); i++) {
+        if (!conditions[i].test(conditions[i], row)) return false;
+    }
+    return true;
+}
+
+static bool anySelected(const uint64_t* selection, int words) {
+    uint64_t any = 0;
+    for (int w = 0; w < words; w++) any |= selection[w];
+    return any != 0;
+}
+
+// Clears the bits of `selection` (the batch of `count` rows from `start`)
+// whose rows fail `cond`. Cleared rows are never tested again, so an AND
+// stops at the first child that rejects a row and an OR at the first that
+// accepts it.
+static void filterBatch(const BoundCondition& cond, int start, int count, uint64_t* selection) {
+    int words = (count + 63) / 64;
+    uint64_t bits[FilterKernels::BATCH_WORDS];
+
+    if (cond.kind == BOUND_AND) {
+        for (size_t i = 0; i < cond.children.size() && anySelected(selection, words); i++) {
+            filterBatch(cond.children[i], start, count, selection);
+        }
+        return;
+    }
+
+    if (cond.kind == BOUND_OR) {
+        uint64_t undecided[FilterKernels::BATCH_WORDS];
+        uint64_t passed[FilterKernels::BATCH_WORDS];
+        for (int w = 0; w < words; w++) {
+            undecided[w] = selection[w];
+            passed[w] = 0;
+        }
+        for (size_t i = 0; i < cond.children.size() && anySelected(undecided, words); i++) {
+            for (int w = 0; w < words; w++) bits[w] = undecided[w];
+            filterBatch(cond.children[i], start, count, bits);
+            for (int w = 0; w < words; w++) {
+                passed[w] |= bits[w];
+                undecided[w] &= ~bits[w];
+            }
+        }
+        for (int w = 0; w < words; w++) selection[w] = passed[w];
+        return;
+    }
+
+    if (isVectorized(cond)) {
+        DataType type = cond.data->getType();
+        if (cond.kind == BOUND_COMPARE) {
+            if (type == INT) {
+                FilterKernels::compareInt64(cond.data->intData() + start, count, cond.op, cond.intValue, bits);
+            }
+            else {
+                FilterKernels::compareDouble(cond.data->doubleData() + start, count, cond.op, cond.numberValue, bits);
+            }
+        }
+        else {
+            // a short IN list: one equality kernel per value, ORed
+            uint64_t equal[FilterKernels::BATCH_WORDS];
+            for (int w = 0; w < words; w++) bits[w] = 0;
+            size_t listSize = (type == INT) ? cond.intValues.size() : cond.numberValues.size();
+            for (size_t v = 0; v < listSize; v++) {
+                if (type == INT) {
+                    FilterKernels::compareInt64(cond.data->intData() + start, count, OP_EQ, cond.intValues[v], equal);
+                }
+                else {
+                    FilterKernels::compareDouble(cond.data->doubleData() + start, count, OP_EQ, cond.numberValues[v], equal);
+                }
+                for (int w = 0; w < words; w++) bits[w] |= equal[w];
+            }
+            if (cond.negated) {
+                for (int w = 0; w < words; w++) bits[w] = ~bits[w];
+            }
+        }
+        for (int w = 0; w < words; w++) selection[w] &= bits[w];
+        return;
+    }
+
+    // row-at-a-time only for the rows still selected
+    for (int w = 0; w < words; w++) {
+        uint64_t word = selection[w];
+        uint64_t kept = 0;
+        while (word != 0) {
+            int bit = FilterKernels::countTrailingZeros(word);
+            word &= word - 1;
+            if (cond.test(cond, start + w * 64 + bit)) kept |= (uint64_t)1 << bit;
+        }
+        selection[w] = kept;
+    }
+}
+
+void CompiledPredicate::select(int begin, int end, vector<int>& out) const {
+    uint64_t selection[FilterKernels::BATCH_WORDS];
+
+    for (int start = begin; start < end; start += FilterKernels::BATCH_SIZE) {
+        int count = end - start;
+        if (count > FilterKernels::BATCH_SIZE) count = FilterKernels::BATCH_SIZE;
+        int words = (count + 63) / 64;
+
+        for (int w = 0; w < FilterKernels::BATCH_WORDS; w++) {
+            selection[w] = ~(uint64_t)0;
+        }
+        if (count % 64 != 0) {
+            selection[words - 1] = ((uint64_t)1 << (count % 64)) - 1;
+        }
+
+        for (size_t c = 0; c < conditions.size() && anySelected(selection, words); c++) {
+            filterBatch(conditions[c], start, count, selection);
+        }
+
+        for (int w = 0; w < words; w++) {
+            uint64_t word = selection[w];
+            while (word != 0) {
+                int bit = FilterKernels::countTrailingZeros(word);
+                word &= word - 1;
+                out.push_back(start + w * 64 + bit);
+            }
+        }
+    }
+}
+
+bool CompiledPredicate::isEmpty() const {
+    return conditions.empty();
+}
+
+double CompiledPredicate::getCost() const {
+    double cost = 0;
+    double undecided = 1;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        cost += undecided * conditions[i].cost;
+        undecided *= conditions[i].selectivity;
+    }
+    return cost;
+}
+
+const vector<BoundCondition>& CompiledPredicate::getConditions() const {
+    return conditions;
+}
@@ -0,0 +1,94 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+#include "Condition.h"
+#include "ColumnVector.h"
+
+class Table;
+
+enum CompareOp {
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE
+};
+
+enum BoundKind {
+    BOUND_COMPARE,
+    BOUND_IN,
+    BOUND_AND,
+    BOUND_OR
+};
+
+struct BoundCondition;
+typedef bool (*RowTest)(const BoundCondition& cond, int row);
+
+// A Condition resolved against a table: column looked up once, literal
+// parsed into the column's type, comparison picked per type and operator.
+struct BoundCondition {
+    BoundKind kind;
+    int columnIndex;     // -1 for AND and OR
+    const ColumnVector* data;
+    CompareOp op;
+
+    bool integerLiteral; // INT column compared exactly as int64_t
+    int64_t intValue;
+    double numberValue;
+    string textValue;
+
+    // IN: the list in the column's type (an INT column keeps the values
+    // that can equal an integer). Lists longer than IN_SCAN_MAX are probed
+    // through `slots`, an open-addressing hash set of list positions.
+    bool negated;        // NOT IN
+    vector<int64_t> intValues;
+    vector<double> numberValues;
+    vector<string> textValues;
+    vector<int> slots;   // -1 for an empty slot; empty when the list is scanned
+
+    vector<BoundCondition> children;  // AND, OR; cheapest, most decisive first
+
+    // Estimates that order conditions before evaluation
+    double selectivity;  // fraction of rows that pass
+    double cost;         // work per row tested, a plain comparison being 1
+
+    RowTest test;
+};
+
+class CompiledPredicate {
+private:
+    vector<BoundCondition> conditions;  // ANDed, in evaluation order
+
+public:
+    // IN lists up to this long are compared value by value
+    static const int IN_SCAN_MAX = 4;
+
+    CompiledPredicate();
+    CompiledPredicate(const Table& table, const vector<Condition>& conds);
+
+    bool matches(int row) const;
+
+    // Appends the rows in [begin, end) that satisfy every condition.
+    // Works in batches: each condition produces a bitmap for the batch
+    // (SIMD kernels for INT/FLOAT columns) and the bitmaps are ANDed.
+    // Conditions run cheapest and most selective first, and each one
+    // only tests the rows that are still undecided.
+    void select(int begin, int end, vector<int>& out) const;
+    bool isEmpty() const;
+
+    // Expected work per row tested, later conditions only seeing the rows
+    // the earlier ones passed
+    double getCost() const;
+
+    const vector<BoundCondition>& getConditions() const;
+
+    static CompareOp parseOperator(const string& op);
+};
+
+#endif
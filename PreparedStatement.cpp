@@ -0,0 +1,638 @@
+#include "PreparedStatement.h"
+#include "DatabaseEngine.h"
+#include "Table.h"
+#include "QueryParser.h"
+#include "ResultSet.h"
+#include "ColumnVector.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// Parameters are renamed to MARKER + number before parsing, so each one
+// can be found again in whichever value the parser put it
+static const char MARKER = '\x01';
+
+// Whether the word ending at `end` in sql is one a value follows: LIMIT,
+// OFFSET, BETWEEN or the AND of a BETWEEN
+static bool afterValueKeyword(const string& sql, size_t end) {
+    size_t begin = end + 1;
+    while (begin > 0 && (isalnum((unsigned char)sql[begin - 1]) || sql[begin - 1] == '_')) begin--;
+    string word = sql.substr(begin, end + 1 - begin);
+    transform(word.begin(), word.end(), word.begin(), ::toupper);
+    return word == "LIMIT" || word == "OFFSET" || word == "BETWEEN" || word == "AND";
+}
+
+// The value slots of the WHERE conditions in tree order, each with the
+// comparison or IN list it belongs to
+static void conditionValues(vector<Condition>& conditions, vector<string*>& values,
+    vector<const Condition*>& owners) {
+    vector<Condition*> leaves;
+    for (size_t c = 0; c < conditions.size(); c++) {
+        conditions[c].getLeaves(leaves);
+    }
+    for (size_t l = 0; l < leaves.size(); l++) {
+        Condition* leaf = leaves[l];
+        if (leaf->kind == CONDITION_COMPARE) {
+            values.push_back(&leaf->value);
+            owners.push_back(leaf);
+            continue;
+        }
+        for (size_t v = 0; v < leaf->values.size(); v++) {
+            values.push_back(&leaf->values[v]);
+            owners.push_back(leaf);
+        }
+    }
+}
+
+// n for a value that is exactly parameter n, else 0
+static int parameterNumber(const string& value) {
+    if (value.size() < 2 || value[0] != MARKER) return 0;
+    for (size_t i = 1; i < value.size(); i++) {
+        if (!isdigit((unsigned char)value[i])) return 0;
+    }
+    return atoi(value.c_str() + 1);
+}
+
+QueryResult::QueryResult()
+    : status(STATUS_OK), rowsAffected(0), rows(NULL) {
+}
+
+QueryResult::~QueryResult() {
+    delete rows;
+}
+
+void QueryResult::reset() {
+    delete rows;
+    rows = NULL;
+    status = STATUS_OK;
+    message.clear();
+    rowsAffected = 0;
+}
+
+StatusCode QueryResult::getStatus() const {
+    return status;
+}
+
+bool QueryResult::ok() const {
+    return status == STATUS_OK;
+}
+
+const string& QueryResult::getMessage() const {
+    return message;
+}
+
+long long QueryResult::getRowsAffected() const {
+    return rowsAffected;
+}
+
+ResultSet* QueryResult::getRows() {
+    return rows;
+}
+
+ResultSet* QueryResult::releaseRows() {
+    ResultSet* released = rows;
+    rows = NULL;
+    return released;
+}
+
+PreparedStatement::Parameter::Parameter()
+    : target(TARGET_VALUE), row(0), slot(0), type(INT), size(0), bound(false) {
+}
+
+PreparedStatement::PreparedStatement(DatabaseEngine& owner, const string& statement)
+    : engine(owner), sql(statement), prepareStatus(STATUS_OK), catalogVersion(0),
+    kind(STATEMENT_SELECT), table(NULL), keyCondition(-1) {
+    prepareStatus = resolve();
+}
+
+StatusCode PreparedStatement::getStatus() const {
+    return prepareStatus;
+}
+
+const string& PreparedStatement::getMessage() const {
+    return prepareMessage;
+}
+
+const string& PreparedStatement::getSql() const {
+    return sql;
+}
+
+const string& PreparedStatement::getTableName() const {
+    return tableName;
+}
+
+int PreparedStatement::getParameterCount() const {
+    return (int)parameters.size();
+}
+
+StatusCode PreparedStatement::fail(StatusCode code, const string& text, QueryResult* result) {
+    if (result != NULL) {
+        result->status = code;
+        result->message = text;
+    }
+    else {
+        prepareMessage = text;
+    }
+    return code;
+}
+
+// Bindings survive when the parameters still line up, and are kept while
+// the statement cannot be resolved (say, its table is being recreated)
+StatusCode PreparedStatement::resolve() {
+    vector<Parameter> previous;
+    previous.swap(parameters);
+
+    StatusCode status = parse();
+    if (status != STATUS_OK) {
+        parameters.swap(previous);
+    }
+    else if (previous.size() == parameters.size()) {
+        for (int i = 0; i < (int)parameters.size(); i++) {
+            parameters[i].bound = previous[i].bound;
+            parameters[i].value = previous[i].value;
+        }
+    }
+    return status;
+}
+
+// Marks the lone '?' values, parses the statement and looks up the table
+// and columns it names
+StatusCode PreparedStatement::parse() {
+    parameters.clear();
+    catalogVersion = engine.catalogVersion;
+    prepareMessage.clear();
+    table = NULL;
+    columnIndices.clear();
+    rows.clear();
+    updates.clear();
+    conditions.clear();
+    aggregate.clear();
+    order.clear();
+    keyCondition = -1;
+
+    // A '?' is a parameter when it is a whole value: after ',', '(', an
+    // operator, LIMIT, OFFSET, BETWEEN or AND and not glued to a word
+    string marked;
+    int count = 0;
+    for (size_t i = 0; i < sql.size(); i++) {
+        char c = sql[i];
+        if (c == '?') {
+            size_t before = sql.find_last_not_of(" \t\r\n", i == 0 ? string::npos : i - 1);
+            bool afterValueStart = i > 0 && before != string::npos &&
+                (strchr(",(=<>", sql[before]) != NULL || afterValueKeyword(sql, before));
+            bool glued = i + 1 < sql.size() &&
+                (isalnum((unsigned char)sql[i + 1]) || sql[i + 1] == '_');
+            if (afterValueStart && !glued) {
+                marked += MARKER;
+                marked += to_string(++count);
+                continue;
+            }
+        }
+        marked += c;
+    }
+
+    tableName.clear();
+    vector<string> columnNames;
+    vector<int> numbers(count + 1, 0);
+    try {
+        size_t start = marked.find_first_not_of(" \t\r\n");
+        string keyword = (start == string::npos) ? "" : marked.substr(start, 6);
+        transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+
+        if (keyword == "SELECT") {
+            kind = STATEMENT_SELECT;
+            JoinQuery join;
+            QueryParser::parseSelect(marked, tableName, columnNames, conditions, aggregate, order, join);
+            if (!join.isEmpty()) {
+                return fail(STATUS_SYNTAX_ERROR, "A SELECT with JOIN cannot be prepared", NULL);
+            }
+        }
+        else if (keyword == "INSERT") {
+            kind = STATEMENT_INSERT;
+            QueryParser::parseInsert(marked, tableName, rows);
+        }
+        else if (keyword == "UPDATE") {
+            kind = STATEMENT_UPDATE;
+            QueryParser::parseUpdate(marked, tableName, updates, conditions);
+        }
+        else if (keyword == "DELETE") {
+            kind = STATEMENT_DELETE;
+            QueryParser::parseDelete(marked, tableName, conditions);
+        }
+        else {
+            return fail(STATUS_SYNTAX_ERROR,
+                "Only SELECT, INSERT, UPDATE and DELETE can be prepared", NULL);
+        }
+    }
+    catch (exception& e) {
+        return fail(STATUS_SYNTAX_ERROR, e.what(), NULL);
+    }
+
+    map<string, Table*>::iterator it = engine.tables.find(tableName);
+    if (it == engine.tables.end()) {
+        return fail(STATUS_NO_SUCH_TABLE, "Table '" + tableName + "' does not exist!", NULL);
+    }
+    table = it->second;
+
+    // SELECT columns; empty means all, as ResultSet expects
+    for (int i = 0; i < (int)columnNames.size(); i++) {
+        int idx = table->getColumnIndex(columnNames[i]);
+        if (idx == -1) {
+            return fail(STATUS_NO_SUCH_COLUMN, "Column '" + columnNames[i] + "' does not exist!", NULL);
+        }
+        columnIndices.push_back(idx);
+    }
+
+    const vector<Column>& columns = table->getColumns();
+
+    // Record where each parameter lands, in the order of the slots
+    for (int r = 0; r < (int)rows.size(); r++) {
+        if ((int)rows[r].size() != table->getColumnCount()) {
+            return fail(STATUS_SYNTAX_ERROR, "Expected " + to_string(table->getColumnCount()) +
+                " values but got " + to_string(rows[r].size()), NULL);
+        }
+        for (int c = 0; c < (int)rows[r].size(); c++) {
+            int number = parameterNumber(rows[r][c]);
+            if (number == 0) continue;
+            Parameter p;
+            p.target = TARGET_VALUE;
+            p.row = r;
+            p.slot = c;
+            p.type = columns[c].getType();
+            p.size = columns[c].getSize();
+            numbers[number] = (int)parameters.size() + 1;
+            parameters.push_back(p);
+        }
+    }
+
+    map<string, string>::iterator u;
+    for (u = updates.begin(); u != updates.end(); ++u) {
+        int colIndex = table->getColumnIndex(u->first);
+        if (colIndex == -1) {
+            return fail(STATUS_NO_SUCH_COLUMN, "Column '" + u->first + "' does not exist!", NULL);
+        }
+        int number = parameterNumber(u->second);
+        if (number == 0) continue;
+        Parameter p;
+        p.target = TARGET_SET;
+        p.row = 0;
+        p.slot = colIndex;
+        p.name = u->first;
+        p.type = columns[colIndex].getType();
+        p.size = columns[colIndex].getSize();
+        numbers[number] = (int)parameters.size() + 1;
+        parameters.push_back(p);
+    }
+
+    StatusCode status = resolveConditions();
+    if (status != STATUS_OK) return status;
+
+    vector<string*> values;
+    vector<const Condition*> owners;
+    conditionValues(conditions, values, owners);
+    for (int v = 0; v < (int)values.size(); v++) {
+        int number = parameterNumber(*values[v]);
+        if (number == 0) continue;
+        int colIndex = table->getColumnIndex(owners[v]->columnName);
+        Parameter p;
+        p.target = TARGET_CONDITION;
+        p.row = 0;
+        p.slot = v;
+        p.type = columns[colIndex].getType();
+        p.size = columns[colIndex].getSize();
+        numbers[number] = (int)parameters.size() + 1;
+        parameters.push_back(p);
+    }
+
+    status = resolveAggregate(numbers);
+    if (status != STATUS_OK) return status;
+
+    status = resolveOrder(numbers);
+    if (status != STATUS_OK) return status;
+
+    return resolveParameters(numbers);
+}
+
+// Checks the select list, GROUP BY and HAVING against the table. A HAVING
+// parameter takes the type of what it is compared with, any number for a
+// numeric aggregate.
+StatusCode PreparedStatement::resolveAggregate(vector<int>& numbers) {
+    if (aggregate.isEmpty()) return STATUS_OK;
+
+    vector<string> names = aggregate.groupBy;
+    for (int i = 0; i < (int)aggregate.outputs.size(); i++) {
+        names.push_back(aggregate.outputs[i].column);
+    }
+    for (int i = 0; i < (int)aggregate.having.size(); i++) {
+        names.push_back(aggregate.having[i].term.column);
+    }
+    for (int i = 0; i < (int)names.size(); i++) {
+        if (!names[i].empty() && table->getColumnIndex(names[i]) == -1) {
+            return fail(STATUS_NO_SUCH_COLUMN, "Column '" + names[i] + "' does not exist!", NULL);
+        }
+    }
+
+    try {
+        HashAggregate check(*table, aggregate);
+    }
+    catch (exception& e) {
+        return fail(STATUS_SYNTAX_ERROR, e.what(), NULL);
+    }
+
+    const vector<Column>& columns = table->getColumns();
+    for (int h = 0; h < (int)aggregate.having.size(); h++) {
+        int number = parameterNumber(aggregate.having[h].value);
+        if (number == 0) continue;
+
+        const AggregateTerm& term = aggregate.having[h].term;
+        int colIndex = table->getColumnIndex(term.column);
+        DataType columnType = (colIndex == -1) ? INT : columns[colIndex].getType();
+        Parameter p;
+        p.target = TARGET_HAVING;
+        p.row = 0;
+        p.slot = h;
+        p.type = columnType;
+        if (term.function != AGGREGATE_NONE) {
+            p.type = HashAggregate::resultType(term.function, columnType) == VARCHAR ? VARCHAR : FLOAT;
+        }
+        p.size = (colIndex == -1) ? 0 : columns[colIndex].getSize();
+        numbers[number] = (int)parameters.size() + 1;
+        parameters.push_back(p);
+    }
+    return STATUS_OK;
+}
+
+static string upper(string text) {
+    transform(text.begin(), text.end(), text.begin(), ::toupper);
+    return text;
+}
+
+// ORDER BY names columns of the table, or for an aggregate query entries
+// of the select list. LIMIT and OFFSET parameters are whole numbers.
+StatusCode PreparedStatement::resolveOrder(vector<int>& numbers) {
+    for (int k = 0; k < (int)order.keys.size(); k++) {
+        const string& column = order.keys[k].term.column;
+        if (!column.empty() && table->getColumnIndex(column) == -1) {
+            return fail(STATUS_NO_SUCH_COLUMN, "Column '" + column + "' does not exist!", NULL);
+        }
+    }
+
+    try {
+        if (aggregate.isEmpty()) {
+            vector<SortKey> keys;
+            ExternalSort::resolveKeys(*table, order, false, keys);
+        }
+        else {
+            for (int k = 0; k < (int)order.keys.size(); k++) {
+                const AggregateTerm& term = order.keys[k].term;
+                string name = HashAggregate::label(term.function, term.column);
+                bool selected = false;
+                for (int o = 0; o < (int)aggregate.outputs.size(); o++) {
+                    const AggregateTerm& output = aggregate.outputs[o];
+                    if (upper(HashAggregate::label(output.function, output.column)) == upper(name)) selected = true;
+                }
+                if (!selected) throw runtime_error("ORDER BY " + name + " must be in the select list");
+            }
+        }
+        if (parameterNumber(order.limit) == 0) order.getLimit();
+        if (parameterNumber(order.offset) == 0) order.getOffset();
+    }
+    catch (exception& e) {
+        return fail(STATUS_SYNTAX_ERROR, e.what(), NULL);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        int number = parameterNumber(i == 0 ? order.limit : order.offset);
+        if (number == 0) continue;
+        Parameter p;
+        p.target = (i == 0) ? TARGET_LIMIT : TARGET_OFFSET;
+        p.row = 0;
+        p.slot = 0;
+        p.type = INT;
+        p.size = 0;
+        numbers[number] = (int)parameters.size() + 1;
+        parameters.push_back(p);
+    }
+    return STATUS_OK;
+}
+
+// The slots were collected clause by clause; put them back in text order
+// (UPDATE's SET list comes out of the parser sorted by column name)
+StatusCode PreparedStatement::resolveParameters(const vector<int>& numbers) {
+    vector<Parameter> ordered;
+    for (int n = 1; n < (int)numbers.size(); n++) {
+        if (numbers[n] == 0) {
+            return fail(STATUS_SYNTAX_ERROR, "Parameter " + to_string(n) +
+                " is not a whole value", NULL);
+        }
+        ordered.push_back(parameters[numbers[n] - 1]);
+        ordered.back().bound = false;
+    }
+    parameters.swap(ordered);
+    return STATUS_OK;
+}
+
+// Unlike the REPL, an unknown WHERE column is an error here. A lone
+// "pk = value" condition is planned as a direct hash lookup.
+StatusCode PreparedStatement::resolveConditions() {
+    vector<const Condition*> leaves;
+    for (int c = 0; c < (int)conditions.size(); c++) {
+        conditions[c].getLeaves(leaves);
+    }
+    for (int l = 0; l < (int)leaves.size(); l++) {
+        if (table->getColumnIndex(leaves[l]->columnName) == -1) {
+            return fail(STATUS_NO_SUCH_COLUMN, "Column '" + leaves[l]->columnName +
+                "' does not exist!", NULL);
+        }
+    }
+
+    if (kind == STATEMENT_SELECT && conditions.size() == 1 &&
+        conditions[0].kind == CONDITION_COMPARE && conditions[0].op == "=" &&
+        table->getPrimaryKeyIndex() != -1 &&
+        table->getColumnIndex(conditions[0].columnName) == table->getPrimaryKeyIndex()) {
+        keyCondition = 0;
+    }
+    return STATUS_OK;
+}
+
+StatusCode PreparedStatement::checkIndex(int index) {
+    if (catalogVersion != engine.catalogVersion) {
+        shared_lock<shared_mutex> guard(engine.catalogLock);
+        prepareStatus = resolve();
+    }
+    if (prepareStatus != STATUS_OK) return prepareStatus;
+    if (index < 1 || index > (int)parameters.size()) {
+        return STATUS_BIND_ERROR;
+    }
+    return STATUS_OK;
+}
+
+// WHERE and HAVING values are only compared, so only INSERT and SET values
+// are held to the VARCHAR length
+StatusCode PreparedStatement::store(int index, const string& value) {
+    StatusCode status = checkIndex(index);
+    if (status != STATUS_OK) return status;
+
+    Parameter& p = parameters[index - 1];
+    if (p.type == INT && !DatabaseEngine::isValidInt(value)) return STATUS_TYPE_MISMATCH;
+    if (p.type == FLOAT && !DatabaseEngine::isValidFloat(value)) return STATUS_TYPE_MISMATCH;
+    if ((p.target == TARGET_LIMIT || p.target == TARGET_OFFSET) && !value.empty() && value[0] == '-') {
+        return STATUS_TYPE_MISMATCH;
+    }
+    if (p.type == VARCHAR && (p.target == TARGET_VALUE || p.target == TARGET_SET) &&
+        (int)value.length() > p.size) {
+        return STATUS_CONSTRAINT;
+    }
+
+    p.value = value;
+    p.bound = true;
+    return STATUS_OK;
+}
+
+StatusCode PreparedStatement::bind(int index, int64_t value) {
+    return store(index, to_string(value));
+}
+
+StatusCode PreparedStatement::bind(int index, int value) {
+    return store(index, to_string(value));
+}
+
+StatusCode PreparedStatement::bind(int index, double value) {
+    StatusCode status = checkIndex(index);
+    if (status != STATUS_OK) return status;
+    if (parameters[index - 1].type == INT || !isfinite(value)) return STATUS_TYPE_MISMATCH;
+
+    // Plain decimal notation, which is what FLOAT columns accept
+    string text = ColumnVector::formatDouble(value);
+    if (text.find_first_of("eE") != string::npos) {
+        char buf[400];
+        snprintf(buf, sizeof(buf), "%.17f", value);
+        text = buf;
+    }
+    return store(index, text);
+}
+
+StatusCode PreparedStatement::bind(int index, const string& value) {
+    return store(index, value);
+}
+
+StatusCode PreparedStatement::bind(int index, const char* value) {
+    return store(index, string(value));
+}
+
+StatusCode PreparedStatement::bindNull(int index) {
+    StatusCode status = checkIndex(index);
+    if (status != STATUS_OK) return status;
+
+    parameters[index - 1].value.clear();
+    parameters[index - 1].bound = true;
+    return STATUS_OK;
+}
+
+void PreparedStatement::clearBindings() {
+    for (int i = 0; i < (int)parameters.size(); i++) {
+        parameters[i].bound = false;
+        parameters[i].value.clear();
+    }
+}
+
+StatusCode PreparedStatement::execute(QueryResult& result) {
+    shared_lock<shared_mutex> guard(engine.catalogLock);
+    return run(result);
+}
+
+StatusCode PreparedStatement::run(QueryResult& result) {
+    result.reset();
+
+    if (catalogVersion != engine.catalogVersion) {
+        prepareStatus = resolve();
+    }
+    if (prepareStatus != STATUS_OK) {
+        return fail(prepareStatus, prepareMessage, &result);
+    }
+
+    vector<string*> values;
+    vector<const Condition*> owners;
+    conditionValues(conditions, values, owners);
+
+    for (int i = 0; i < (int)parameters.size(); i++) {
+        const Parameter& p = parameters[i];
+        if (!p.bound) {
+            return fail(STATUS_BIND_ERROR, "Parameter " + to_string(i + 1) + " is not bound", &result);
+        }
+        if (p.target == TARGET_VALUE) rows[p.row][p.slot] = p.value;
+        else if (p.target == TARGET_SET) updates[p.name] = p.value;
+        else if (p.target == TARGET_HAVING) aggregate.having[p.slot].value = p.value;
+        else if (p.target == TARGET_LIMIT) order.limit = p.value;    // NULL: no limit
+        else if (p.target == TARGET_OFFSET) order.offset = p.value;
+        else *values[p.slot] = p.value;
+    }
+
+    try {
+        string message;
+        StatusCode status = STATUS_OK;
+
+        switch (kind) {
+        case STATEMENT_SELECT: {
+            // The rows keep the view; the groups of an aggregate are built from it
+            Table* view;
+            engine.openSnapshot(&table, 1, &view);
+            try {
+                if (!aggregate.isEmpty()) {
+                    result.rows = engine.runAggregate(view, aggregate, conditions, order, NULL);
+                }
+                else {
+                    if (keyCondition != -1 && view->isLoaded()) {
+                        vector<int> matches;
+                        int row = view->findRowByPrimaryKey(conditions[keyCondition].value);
+                        if (row != -1) matches.push_back(row);
+                        result.rows = new ResultSet(*view, columnIndices, matches, true);
+                        result.rows->setWindow(order.getOffset(), order.getLimit());
+                    }
+                    else {
+                        result.rows = engine.runSelect(view, columnIndices, conditions, order, NULL);
+                    }
+                    result.rows->takeTable(view);
+                    view = NULL;
+                }
+            }
+            catch (...) {
+                delete view;
+                throw;
+            }
+            delete view;
+            break;
+        }
+
+        case STATEMENT_INSERT:
+            status = engine.runInsert(table, rows, message);
+            if (status == STATUS_OK) result.rowsAffected = (long long)rows.size();
+            break;
+
+        case STATEMENT_UPDATE: {
+            int updatedCount = 0;
+            status = engine.runUpdate(table, updates, conditions, updatedCount, message);
+            result.rowsAffected = updatedCount;
+            break;
+        }
+
+        case STATEMENT_DELETE:
+            result.rowsAffected = engine.runDelete(table, conditions);
+            break;
+
+        default:
+            break;
+        }
+
+        if (status != STATUS_OK) return fail(status, message, &result);
+    }
+    catch (exception& e) {
+        return fail(STATUS_ERROR, e.what(), &result);
+    }
+    return STATUS_OK;
+}
@@ -0,0 +1,154 @@
+#ifndef PREPAREDSTATEMENT_H
+#define PREPAREDSTATEMENT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+using namespace std;
+
+#include "Column.h"
+#include "Condition.h"
+#include "Statement.h"
+#include "HashAggregate.h"
+#include "ExternalSort.h"
+
+class DatabaseEngine;
+class Table;
+class ResultSet;
+
+// Outcome of an embedded statement
+enum StatusCode {
+    STATUS_OK = 0,
+    STATUS_SYNTAX_ERROR,
+    STATUS_NO_SUCH_TABLE,
+    STATUS_NO_SUCH_COLUMN,
+    STATUS_CONSTRAINT,      // NOT NULL, PRIMARY KEY or VARCHAR length
+    STATUS_TYPE_MISMATCH,
+    STATUS_BIND_ERROR,      // bad parameter number or unbound parameter
+    STATUS_ERROR
+};
+
+// What execute() produced: a status, the error text when it failed, the
+// number of rows inserted, updated or deleted, and for SELECT the rows.
+class QueryResult {
+private:
+    StatusCode status;
+    string message;
+    long long rowsAffected;
+    ResultSet* rows;
+
+    friend class PreparedStatement;
+
+    QueryResult(const QueryResult&);
+    QueryResult& operator=(const QueryResult&);
+
+public:
+    QueryResult();
+    ~QueryResult();
+
+    void reset();
+
+    StatusCode getStatus() const;
+    bool ok() const;
+    const string& getMessage() const;
+    long long getRowsAffected() const;
+
+    // SELECT rows, or NULL. They read a snapshot of the table, which later
+    // statements leave as it was.
+    ResultSet* getRows();
+    ResultSet* releaseRows();  // the caller now deletes them
+};
+
+// A statement parsed and resolved once and executed many times. Each '?'
+// standing alone as a value (VALUES, SET, WHERE, HAVING, LIMIT or OFFSET)
+// is a parameter, numbered from 1 in the order they appear. Different
+// statements may run on different threads; one statement is used by one
+// thread at a time.
+class PreparedStatement {
+private:
+    // Where a parameter's value goes
+    enum ParameterTarget {
+        TARGET_VALUE,     // INSERT row `row`, column `slot`
+        TARGET_SET,       // UPDATE column named `name`
+        TARGET_CONDITION, // WHERE value `slot`, counting through the condition trees
+        TARGET_HAVING,    // HAVING condition `slot`
+        TARGET_LIMIT,
+        TARGET_OFFSET
+    };
+
+    struct Parameter {
+        ParameterTarget target;
+        int row;
+        int slot;
+        string name;
+        DataType type;
+        int size;
+        bool bound;
+        string value;  // empty for NULL
+
+        Parameter();
+    };
+
+    DatabaseEngine& engine;
+    string sql;
+    StatusCode prepareStatus;
+    string prepareMessage;
+
+    // Resolved at prepare time and valid while the catalog is unchanged
+    unsigned long catalogVersion;
+    StatementType kind;
+    string tableName;
+    Table* table;
+    vector<int> columnIndices;
+    vector<vector<string> > rows;
+    map<string, string> updates;
+    vector<Condition> conditions;
+    AggregateQuery aggregate;
+    SortQuery order;
+    int keyCondition;  // WHERE pk = ... as the only condition: a hash lookup, or -1
+
+    vector<Parameter> parameters;
+
+    StatusCode resolve();
+    StatusCode parse();
+    StatusCode resolveParameters(const vector<int>& numbers);
+    StatusCode resolveConditions();
+    StatusCode resolveAggregate(vector<int>& numbers);
+    StatusCode resolveOrder(vector<int>& numbers);
+    StatusCode fail(StatusCode code, const string& text, QueryResult* result);
+    StatusCode checkIndex(int index);
+    StatusCode store(int index, const string& value);
+    // execute() with the catalog lock already held
+    StatusCode run(QueryResult& result);
+
+    friend class DatabaseEngine;
+
+    PreparedStatement(const PreparedStatement&);
+    PreparedStatement& operator=(const PreparedStatement&);
+
+public:
+    PreparedStatement(DatabaseEngine& owner, const string& statement);
+
+    StatusCode getStatus() const;  // of prepare
+    const string& getMessage() const;
+    const string& getSql() const;
+    const string& getTableName() const;
+    int getParameterCount() const;
+
+    // Parameters are numbered from 1; values are checked against the
+    // column type when bound and kept until rebound or cleared
+    StatusCode bind(int index, int64_t value);
+    StatusCode bind(int index, int value);
+    StatusCode bind(int index, double value);
+    StatusCode bind(int index, const string& value);
+    StatusCode bind(int index, const char* value);
+    StatusCode bindNull(int index);
+    void clearBindings();
+
+    // Runs with the current bindings. If a table was created, dropped or
+    // reloaded since prepare, the statement is resolved again first.
+    StatusCode execute(QueryResult& result);
+};
+
+#endif
@@ -1,325 +1,930 @@
 #include "QueryParser.h"
 
-#include <sstream>
-#include <algorithm>
-#include <cctype>
 #include <stdexcept>
 #include <cstdlib>  // for atoi
+#include <cctype>
 
 
 using namespace std;
 
-string QueryParser::trim(const string& str) {
-    int first = 0;
-    int last = (int)str.length() - 1;
+// Keywords that end an unquoted value, per clause
+static const char* const NO_STOP_WORDS[] = { NULL };
+static const char* const SET_VALUE_END[] = { "WHERE", NULL };
+static const char* const COPY_FILE_END[] = { "WITH", NULL };
+static const char* const WHERE_VALUE_END[] = { "AND", "OR", "GROUP", "HAVING", "ORDER", "LIMIT", NULL };
+static const char* const BETWEEN_LOW_END[] = { "AND", NULL };
+static const char* const HAVING_VALUE_END[] = { "AND", "ORDER", "LIMIT", NULL };
+static const char* const LIMIT_VALUE_END[] = { "OFFSET", NULL };
+
+QueryParser::QueryParser(string_view sql)
+    : lexer(sql) {
+}
 
-    while (first <= last && isspace((unsigned char)str[first])) first++;
-    while (last >= first && isspace((unsigned char)str[last])) last--;
+Statement* QueryParser::parse(string_view sql) {
+    QueryParser parser(sql);
+    return parser.readStatement();
+}
 
-    if (first > last) return "";
-    return str.substr(first, last - first + 1);
+// ================== ERRORS ==================
+
+void QueryParser::fail(const char* expected) {
+    const Token& token = lexer.peek();
+    string found = (token.type == TOKEN_END) ? "end of statement" : "'" + string(token.text) + "'";
+    throw runtime_error(string("Expected ") + expected + " but found " + found);
 }
 
-string QueryParser::toUpper(const string& str) {
-    string result = str;
-    transform(result.begin(), result.end(), result.begin(), ::toupper);
-    return result;
+Token QueryParser::expect(TokenType type, const char* what) {
+    if (lexer.peek().type != type) fail(what);
+    return lexer.next();
 }
 
-DataType QueryParser::parseDataType(const string& typeStr, int& size) {
-    string upper = toUpper(typeStr);
-    size = 0;
+void QueryParser::expectKeyword(const char* keyword) {
+    if (!lexer.peek().is(keyword)) fail(keyword);
+    lexer.next();
+}
 
-    if (upper == "INT") {
-        return INT;
+void QueryParser::expectSymbol(const char* symbol) {
+    if (!lexer.peek().isSymbol(symbol)) {
+        string quoted = string("'") + symbol + "'";
+        fail(quoted.c_str());
     }
-    else if (upper == "FLOAT") {
-        return FLOAT;
+    lexer.next();
+}
+
+string_view QueryParser::expectName(const char* what) {
+    return expect(TOKEN_WORD, what).text;
+}
+
+// An optional ';' and nothing after it
+void QueryParser::readEnd() {
+    if (lexer.peek().isSymbol(";")) lexer.next();
+    if (lexer.peek().type != TOKEN_END) fail("end of statement");
+}
+
+// ================== STATEMENTS ==================
+
+Statement* QueryParser::readStatement() {
+    Statement* statement = NULL;
+    const Token& first = lexer.peek();
+
+    if (first.is("CREATE")) {
+        lexer.next();
+        if (lexer.peek().is("TABLE")) statement = new CreateTableStatement();
+        else if (lexer.peek().is("INDEX")) statement = new CreateIndexStatement();
+        else fail("TABLE or INDEX");
+    }
+    else if (first.is("DROP")) {
+        lexer.next();
+        if (lexer.peek().is("TABLE")) statement = new DropTableStatement();
+        else if (lexer.peek().is("INDEX")) statement = new DropIndexStatement();
+        else fail("TABLE or INDEX");
+    }
+    else {
+        if (first.is("INSERT")) statement = new InsertStatement();
+        else if (first.is("SELECT")) statement = new SelectStatement();
+        else if (first.is("UPDATE")) statement = new UpdateStatement();
+        else if (first.is("DELETE")) statement = new DeleteStatement();
+        else if (first.is("COPY")) statement = new CopyStatement();
+        else if (first.is("ANALYZE")) statement = new AnalyzeStatement();
+        else fail("a statement");
     }
-    else if (upper.find("VARCHAR") == 0) {
-        size_t start = upper.find('(');
-        size_t end = upper.find(')');
-        if (start != string::npos && end != string::npos) {
-            size = stoi(upper.substr(start + 1, end - start - 1));
+
+    try {
+        lexer.next();
+        switch (statement->type) {
+        case STATEMENT_CREATE_TABLE:
+            readCreateTable(*(CreateTableStatement*)statement);
+            break;
+        case STATEMENT_DROP_TABLE:
+            statement->table = expectName("a table name");
+            break;
+        case STATEMENT_CREATE_INDEX:
+            readCreateIndex(*(CreateIndexStatement*)statement);
+            break;
+        case STATEMENT_DROP_INDEX:
+            ((DropIndexStatement*)statement)->index = expectName("an index name");
+            break;
+        case STATEMENT_INSERT:
+            readInsert(*(InsertStatement*)statement);
+            break;
+        case STATEMENT_SELECT:
+            readSelect(*(SelectStatement*)statement);
+            break;
+        case STATEMENT_UPDATE:
+            readUpdate(*(UpdateStatement*)statement);
+            break;
+        case STATEMENT_DELETE:
+            readDelete(*(DeleteStatement*)statement);
+            break;
+        case STATEMENT_COPY:
+            readCopy(*(CopyStatement*)statement);
+            break;
+        case STATEMENT_ANALYZE:
+            if (lexer.peek().type == TOKEN_WORD) statement->table = lexer.next().text;
+            break;
+        }
+        readEnd();
+    }
+    catch (...) {
+        delete statement;
+        throw;
+    }
+    return statement;
+}
+
+// CREATE TABLE name (column type [PRIMARY KEY] [NOT NULL], ...)
+void QueryParser::readCreateTable(CreateTableStatement& statement) {
+    statement.table = expectName("a table name");
+    expectSymbol("(");
+
+    while (true) {
+        statement.columns.push_back(ColumnDefinition());
+        readColumnDefinition(statement.columns.back());
+        if (!lexer.peek().isSymbol(",")) break;
+        lexer.next();
+    }
+
+    expectSymbol(")");
+}
+
+void QueryParser::readColumnDefinition(ColumnDefinition& column) {
+    column.name = expectName("a column name");
+    column.size = 0;
+    column.primaryKey = false;
+    column.notNull = false;
+
+    Token type = expect(TOKEN_WORD, "a data type");
+    if (type.is("INT")) {
+        column.type = INT;
+    }
+    else if (type.is("FLOAT")) {
+        column.type = FLOAT;
+    }
+    else if (type.is("VARCHAR")) {
+        column.type = VARCHAR;
+        column.size = 255;
+        if (lexer.peek().isSymbol("(")) {
+            lexer.next();
+            column.size = atoi(string(expect(TOKEN_NUMBER, "a VARCHAR size").text).c_str());
+            expectSymbol(")");
+        }
+    }
+    else {
+        throw runtime_error("Unknown data type: " + string(type.text));
+    }
+
+    while (true) {
+        if (lexer.peek().is("PRIMARY")) {
+            lexer.next();
+            expectKeyword("KEY");
+            column.primaryKey = true;
+        }
+        else if (lexer.peek().is("NOT")) {
+            lexer.next();
+            expectKeyword("NULL");
+            column.notNull = true;
         }
         else {
-            size = 255;
+            break;
         }
-        return VARCHAR;
     }
+}
 
+// CREATE INDEX name ON table(column)
+void QueryParser::readCreateIndex(CreateIndexStatement& statement) {
+    statement.index = expectName("an index name");
+    expectKeyword("ON");
+    statement.table = expectName("a table name");
+    expectSymbol("(");
+    statement.column = expectName("a column name");
+    if (lexer.peek().isSymbol(",")) {
+        throw runtime_error("Only single-column indexes are supported");
+    }
+    expectSymbol(")");
+}
 
-    throw runtime_error("Unknown data type: " + typeStr);
+// INSERT INTO name VALUES (v, ...)[, (v, ...) ...]
+void QueryParser::readInsert(InsertStatement& statement) {
+    expectKeyword("INTO");
+    statement.table = expectName("a table name");
+    expectKeyword("VALUES");
+
+    while (true) {
+        expectSymbol("(");
+        if (!lexer.peek().isSymbol(")")) {
+            statement.values.push_back(readValue(true, true, NO_STOP_WORDS));
+            while (lexer.peek().isSymbol(",")) {
+                lexer.next();
+                statement.values.push_back(readValue(true, true, NO_STOP_WORDS));
+            }
+        }
+        expectSymbol(")");
+        statement.rowEnds.push_back((int)statement.values.size());
+        if (!lexer.peek().isSymbol(",")) break;
+        lexer.next();
+    }
 }
 
-Table* QueryParser::parseCreateTable(const string& query) {
-    string upperQuery = toUpper(query);
-    size_t tablePos = upperQuery.find("TABLE");
-    size_t nameStart = query.find_first_not_of(" \t", tablePos + 5);
-    size_t parenStart = query.find('(', nameStart);
+// SELECT * | item, ... FROM name [[INNER | LEFT] JOIN name ON column = column]
+//     [WHERE ...] [GROUP BY column, ...] [HAVING ...]
+//     [ORDER BY item [ASC | DESC], ...] [LIMIT n [OFFSET m]]
+void QueryParser::readSelect(SelectStatement& statement) {
+    if (lexer.peek().isSymbol("*")) {
+        lexer.next();
+    }
+    else {
+        if (lexer.peek().is("FROM")) fail("a column name or *");
+        statement.columns.push_back(readSelectItem("a column name or *"));
+        while (lexer.peek().isSymbol(",")) {
+            lexer.next();
+            statement.columns.push_back(readSelectItem("a column name"));
+        }
+    }
 
-    if (nameStart == string::npos || parenStart == string::npos) {
-        throw runtime_error("Invalid CREATE TABLE syntax");
+    expectKeyword("FROM");
+    statement.table = expectName("a table name");
+    readJoin(statement);
+    readWhere(statement.where);
+
+    if (lexer.peek().is("GROUP")) {
+        lexer.next();
+        expectKeyword("BY");
+        statement.groupBy.push_back(readColumnName("a column name"));
+        while (lexer.peek().isSymbol(",")) {
+            lexer.next();
+            statement.groupBy.push_back(readColumnName("a column name"));
+        }
     }
+    readHaving(statement.having);
+    readOrderBy(statement.orderBy);
+
+    if (lexer.peek().is("LIMIT")) {
+        lexer.next();
+        statement.limit = readValue(false, false, LIMIT_VALUE_END);
+        if (statement.limit.text.empty()) fail("a LIMIT count");
+        if (lexer.peek().is("OFFSET")) {
+            lexer.next();
+            statement.offset = readValue(false, false, NO_STOP_WORDS);
+            if (statement.offset.text.empty()) fail("an OFFSET count");
+        }
+    }
+}
 
-    string tableName = trim(query.substr(nameStart, parenStart - nameStart));
-    Table* table = new Table(tableName);
+// column | COUNT(*) | COUNT(column) | SUM, AVG, MIN or MAX(column)
+SelectItem QueryParser::readSelectItem(const char* what) {
+    SelectItem item;
+    item.function = AGGREGATE_NONE;
 
-    size_t parenEnd = query.find_last_of(')');
-    if (parenEnd == string::npos) {
-        delete table;
-        throw runtime_error("Missing closing parenthesis");
+    Token name = expect(TOKEN_WORD, what);
+    if (!lexer.peek().isSymbol("(")) {
+        item.column = readQualified(name);
+        return item;
     }
 
-    string columnDefs = query.substr(parenStart + 1, parenEnd - parenStart - 1);
+    if (name.is("COUNT")) item.function = AGGREGATE_COUNT;
+    else if (name.is("SUM")) item.function = AGGREGATE_SUM;
+    else if (name.is("AVG")) item.function = AGGREGATE_AVG;
+    else if (name.is("MIN")) item.function = AGGREGATE_MIN;
+    else if (name.is("MAX")) item.function = AGGREGATE_MAX;
+    else throw runtime_error("Unknown function '" + string(name.text) + "'");
+    lexer.next();
 
-    stringstream ss(columnDefs);
-    string columnDef;
-    int pkCount = 0;
+    if (item.function == AGGREGATE_COUNT && lexer.peek().isSymbol("*")) {
+        lexer.next();
+    }
+    else {
+        item.column = readColumnName("a column name");
+    }
+    expectSymbol(")");
+    return item;
+}
 
-    while (getline(ss, columnDef, ',')) {
-        columnDef = trim(columnDef);
-        string upperDef = toUpper(columnDef);
+// column | table.column, written without spaces
+string_view QueryParser::readColumnName(const char* what) {
+    return readQualified(expect(TOKEN_WORD, what));
+}
 
-        stringstream colStream(columnDef);
-        string colName, colType;
-        colStream >> colName >> colType;
+// The rest of a column name whose first word was just read
+string_view QueryParser::readQualified(const Token& name) {
+    const Token& dot = lexer.peek();
+    if (!dot.isSymbol(".") || dot.offset != name.end()) return name.text;
+    lexer.next();
+
+    const Token& column = lexer.peek();
+    if (column.type != TOKEN_WORD || column.offset != name.end() + 1) fail("a column name after '.'");
+    size_t end = column.end();
+    lexer.next();
+    return lexer.slice(name.offset, end);
+}
 
-        if (colName.empty() || colType.empty()) {
-            delete table;
-            throw runtime_error("Invalid column definition: " + columnDef);
-        }
+// UPDATE name SET column = value, ... [WHERE ...]
+void QueryParser::readUpdate(UpdateStatement& statement) {
+    statement.table = expectName("a table name");
+    expectKeyword("SET");
+
+    while (true) {
+        Assignment assignment;
+        assignment.column = expectName("a column name");
+        expectSymbol("=");
+        assignment.value = readValue(true, false, SET_VALUE_END);
+        statement.assignments.push_back(assignment);
+        if (!lexer.peek().isSymbol(",")) break;
+        lexer.next();
+    }
 
-        // Check for constraints
-        bool isPK = (upperDef.find("PRIMARY KEY") != string::npos);
-        bool isNN = (upperDef.find("NOT NULL") != string::npos);
+    readWhere(statement.where);
+}
 
-        if (isPK) {
-            pkCount++;
-            if (pkCount > 1) {
-                delete table;
-                throw runtime_error("Table can have only one PRIMARY KEY");
-            }
-        }
+// DELETE [*] FROM name [WHERE ...]
+void QueryParser::readDelete(DeleteStatement& statement) {
+    if (lexer.peek().isSymbol("*")) lexer.next();
+    expectKeyword("FROM");
+    statement.table = expectName("a table name");
+    readWhere(statement.where);
+}
 
-        int size;
-        DataType type = parseDataType(colType, size);
-        Column col(colName, type, size, isPK, isNN);
-        table->addColumn(col);
+// COPY table FROM 'file' [WITH (DELIMITER 'c', HEADER)]
+void QueryParser::readCopy(CopyStatement& statement) {
+    statement.table = expectName("a table name");
+    expectKeyword("FROM");
+    if (lexer.peek().type != TOKEN_STRING) {
+        throw runtime_error("COPY needs a quoted file name");
+    }
+    statement.file = readValue(false, false, COPY_FILE_END);
+    if (statement.file.text.empty()) {
+        throw runtime_error("COPY needs a table and a file name");
     }
 
-    if (table->getColumnCount() == 0) {
-        delete table;
-        throw runtime_error("Table must have at least one column");
+    if (!lexer.peek().is("WITH")) return;
+    lexer.next();
+    expectSymbol("(");
+
+    while (true) {
+        if (lexer.peek().type != TOKEN_WORD) fail("a COPY option");
+        Token option = lexer.next();
+        if (option.is("HEADER")) {
+            statement.header = true;
+        }
+        else if (option.is("DELIMITER")) {
+            Token value = lexer.next();
+            string delimiter;
+            if (value.type == TOKEN_STRING) delimiter = string(value.text.substr(1, value.text.size() - 2));
+            else if (value.is("TAB")) delimiter = "\t";
+            else delimiter = string(value.text);
+
+            if (delimiter == "\\t") delimiter = "\t";
+            if (delimiter.length() != 1 || delimiter[0] == '"' || delimiter[0] == '\n' || delimiter[0] == '\r') {
+                throw runtime_error("DELIMITER must be a single character");
+            }
+            statement.delimiter = delimiter[0];
+        }
+        else {
+            throw runtime_error("Unknown COPY option '" + string(option.text) + "'");
+        }
+        if (!lexer.peek().isSymbol(",")) break;
+        lexer.next();
     }
 
-    return table;
+    expectSymbol(")");
 }
 
-void QueryParser::parseInsert(const string& query,
-    string& tableName,
-    vector<string>& values) {
-    string upperQuery = toUpper(query);
-    size_t intoPos = upperQuery.find("INTO");
-    size_t tableStart = query.find_first_not_of(" \t", intoPos + 4);
-    size_t valuesPos = upperQuery.find("VALUES", tableStart);
+// ================== CLAUSES ==================
 
-    if (tableStart == string::npos || valuesPos == string::npos) {
-        throw runtime_error("Invalid INSERT syntax");
+// [[INNER | LEFT [OUTER]] JOIN name ON column = column]
+void QueryParser::readJoin(SelectStatement& statement) {
+    if (lexer.peek().is("LEFT")) {
+        lexer.next();
+        if (lexer.peek().is("OUTER")) lexer.next();
+        statement.leftJoin = true;
+        expectKeyword("JOIN");
+    }
+    else if (lexer.peek().is("INNER")) {
+        lexer.next();
+        expectKeyword("JOIN");
+    }
+    else if (lexer.peek().is("JOIN")) {
+        lexer.next();
+    }
+    else {
+        return;
     }
 
-    tableName = trim(query.substr(tableStart, valuesPos - tableStart));
+    statement.joinTable = expectName("a table name");
+    expectKeyword("ON");
+    statement.joinLeft = readColumnName("a column name");
+    expectSymbol("=");
+    statement.joinRight = readColumnName("a column name");
+}
 
-    size_t parenStart = query.find('(', valuesPos);
-    size_t parenEnd = query.find_last_of(')');
+// [WHERE expression]. The expression's top-level ANDs are split into
+// `where`; OR binds looser than AND, and AND looser than NOT.
+void QueryParser::readWhere(vector<Comparison>& where) {
+    if (!lexer.peek().is("WHERE")) return;
+    lexer.next();
 
-    if (parenStart == string::npos || parenEnd == string::npos) {
-        throw runtime_error("Missing parentheses in VALUES");
-    }
+    Comparison expression = readOr();
+    if (expression.kind == COMPARISON_AND) where.swap(expression.children);
+    else where.push_back(expression);
+}
 
-    string valueStr = query.substr(parenStart + 1, parenEnd - parenStart - 1);
+// term [OR term ...]
+Comparison QueryParser::readOr() {
+    Comparison first = readAnd();
+    if (!lexer.peek().is("OR")) return first;
+
+    Comparison either;
+    either.kind = COMPARISON_OR;
+    either.children.push_back(first);
+    while (lexer.peek().is("OR")) {
+        lexer.next();
+        either.children.push_back(readAnd());
+    }
+    return either;
+}
 
-    stringstream ss(valueStr);
-    string value;
+// factor [AND factor ...]
+Comparison QueryParser::readAnd() {
+    Comparison first = readNot();
+    if (!lexer.peek().is("AND")) return first;
+
+    Comparison both;
+    both.kind = COMPARISON_AND;
+    both.children.push_back(first);
+    while (lexer.peek().is("AND")) {
+        lexer.next();
+        both.children.push_back(readNot());
+    }
+    return both;
+}
 
-    while (getline(ss, value, ',')) {
-        values.push_back(trim(value));
+// NOT factor, ( expression ), or a comparison
+Comparison QueryParser::readNot() {
+    if (lexer.peek().is("NOT")) {
+        lexer.next();
+        Comparison negation;
+        negation.kind = COMPARISON_NOT;
+        negation.children.push_back(readNot());
+        return negation;
+    }
+    if (lexer.peek().isSymbol("(")) {
+        lexer.next();
+        Comparison inner = readOr();
+        expectSymbol(")");
+        return inner;
     }
+    return readComparison();
 }
 
-void QueryParser::parseSelect(const string& query,
-    string& tableName,
-    vector<string>& columns,
-    vector<Condition>& conditions) {
-    string upperQuery = toUpper(query);
+// column op value, column [NOT] IN (value, ...) or
+// column [NOT] BETWEEN value AND value
+Comparison QueryParser::readComparison() {
+    Comparison comparison;
+    comparison.column = readColumnName("a column name");
 
-    // Find FROM
-    size_t fromPos = upperQuery.find("FROM");
-    if (fromPos == string::npos) {
-        throw runtime_error("SELECT must have FROM clause");
+    if (lexer.peek().is("NOT")) {
+        lexer.next();
+        comparison.negated = true;
+        if (!lexer.peek().is("IN") && !lexer.peek().is("BETWEEN")) fail("IN or BETWEEN");
     }
 
-    // Extract columns (SELECT ... FROM)
-    string colPart = trim(query.substr(6, fromPos - 6)); // after "SELECT"
-
-    if (colPart == "*") {
-        // Select all columns
-        columns.clear();
+    if (lexer.peek().is("IN")) {
+        lexer.next();
+        comparison.kind = COMPARISON_IN;
+        expectSymbol("(");
+        while (true) {
+            if (lexer.peek().isSymbol(")")) fail("a value");
+            comparison.values.push_back(readValue(true, true, NO_STOP_WORDS));
+            if (!lexer.peek().isSymbol(",")) break;
+            lexer.next();
+        }
+        expectSymbol(")");
+    }
+    else if (lexer.peek().is("BETWEEN")) {
+        lexer.next();
+        comparison.kind = COMPARISON_BETWEEN;
+        comparison.values.push_back(readValue(false, true, BETWEEN_LOW_END));
+        expectKeyword("AND");
+        comparison.values.push_back(readValue(false, true, WHERE_VALUE_END));
     }
     else {
-        // Parse specific columns
-        stringstream ss(colPart);
-        string col;
-        while (getline(ss, col, ',')) {
-            columns.push_back(trim(col));
-        }
+        comparison.op = readOperator();
+        comparison.value = readValue(false, true, WHERE_VALUE_END);
+    }
+    return comparison;
+}
+
+// [HAVING item op value [AND ...]], an item as in the select list
+void QueryParser::readHaving(vector<HavingComparison>& having) {
+    if (!lexer.peek().is("HAVING")) return;
+    lexer.next();
+
+    while (true) {
+        HavingComparison comparison;
+        comparison.item = readSelectItem("a column name or aggregate");
+        comparison.op = readOperator();
+        comparison.value = readValue(false, false, HAVING_VALUE_END);
+        having.push_back(comparison);
+        if (!lexer.peek().is("AND")) break;
+        lexer.next();
     }
+}
 
-    // Extract table name
-    size_t wherePos = upperQuery.find("WHERE", fromPos);
-    size_t tableEnd = (wherePos != string::npos) ? wherePos : query.length();
-    tableName = trim(query.substr(fromPos + 4, tableEnd - (fromPos + 4)));
+// [ORDER BY item [ASC | DESC], ...], an item as in the select list
+void QueryParser::readOrderBy(vector<OrderItem>& orderBy) {
+    if (!lexer.peek().is("ORDER")) return;
+    lexer.next();
+    expectKeyword("BY");
+
+    while (true) {
+        OrderItem order;
+        order.item = readSelectItem("a column name or aggregate");
+        order.descending = false;
+        if (lexer.peek().is("ASC")) {
+            lexer.next();
+        }
+        else if (lexer.peek().is("DESC")) {
+            lexer.next();
+            order.descending = true;
+        }
+        orderBy.push_back(order);
+        if (!lexer.peek().isSymbol(",")) break;
+        lexer.next();
+    }
+}
 
-    // Parse WHERE clause if exists
-    if (wherePos != string::npos) {
-        parseWhereClause(query.substr(wherePos + 5), conditions);
+// One of = != <> < > <= >=, with <> given as !=
+string_view QueryParser::readOperator() {
+    const Token& op = lexer.peek();
+    string_view text;
+    if (op.isSymbol("=") || op.isSymbol("!=") || op.isSymbol("<") ||
+        op.isSymbol(">") || op.isSymbol("<=") || op.isSymbol(">=")) {
+        text = op.text;
     }
+    else if (op.isSymbol("<>")) {
+        text = "!=";
+    }
+    else {
+        fail("a comparison operator");
+    }
+    lexer.next();
+    return text;
 }
 
-void QueryParser::parseDelete(const string& query,
-    string& tableName,
-    vector<Condition>& conditions) {
-    string upperQuery = toUpper(query);
+bool QueryParser::atValueEnd(bool stopAtComma, bool stopAtParen, const char* const* stopWords) const {
+    const Token& token = lexer.peek();
+    if (token.type == TOKEN_END || token.isSymbol(";") ||
+        (stopAtComma && token.isSymbol(",")) ||
+        (stopAtParen && token.isSymbol(")"))) {
+        return true;
+    }
+    for (int i = 0; stopWords[i] != NULL; i++) {
+        if (token.is(stopWords[i])) return true;
+    }
+    return false;
+}
 
-    size_t fromPos = upperQuery.find("FROM");
+// A quoted string, or every token up to the next separator (a ',' or ')'
+// outside parentheses, a stop word, or the end) taken as written
+Literal QueryParser::readValue(bool stopAtComma, bool stopAtParen, const char* const* stopWords) {
+    Literal value;
+
+    if (lexer.peek().type == TOKEN_STRING) {
+        Token token = lexer.next();
+        value.quote = token.text[0];
+        value.text = token.text.substr(1, token.text.size() - 2);
+        value.escaped = value.text.find(value.quote) != string_view::npos;
+        if (!atValueEnd(stopAtComma, stopAtParen, stopWords)) fail("the end of the quoted value");
+        return value;
+    }
 
-    if (fromPos == string::npos) {
-        throw runtime_error("DELETE must have FROM clause");
+    size_t begin = lexer.peek().offset;
+    size_t end = begin;
+    int depth = 0;
+    while (depth > 0 || !atValueEnd(stopAtComma, stopAtParen, stopWords)) {
+        const Token& token = lexer.peek();
+        if (token.type == TOKEN_END || token.isSymbol(";")) break;
+        if (token.isSymbol("(")) depth++;
+        else if (token.isSymbol(")") && depth > 0) depth--;
+        end = token.end();
+        lexer.next();
     }
 
-    // Extract table name
-    size_t wherePos = upperQuery.find("WHERE", fromPos);
-    size_t tableEnd = (wherePos != string::npos) ? wherePos : query.length();
-    tableName = trim(query.substr(fromPos + 4, tableEnd - (fromPos + 4)));
+    value.text = lexer.slice(begin, end);
+    return value;
+}
+
+// ================== ENGINE FORMS ==================
 
-    // Parse WHERE clause if exists
-    if (wherePos != string::npos) {
-        parseWhereClause(query.substr(wherePos + 5), conditions);
+Statement* QueryParser::parseAs(const string& query, StatementType type, const char* name) {
+    Statement* statement = parse(query);
+    if (statement->type != type) {
+        delete statement;
+        throw runtime_error(string("Expected a ") + name + " statement");
     }
-    // If no WHERE clause and DELETE *, conditions will be empty (delete all)
+    return statement;
 }
 
-void QueryParser::parseUpdate(const string& query,
-    string& tableName,
-    map<string, string>& updates,
-    vector<Condition>& conditions) {
-    string upperQuery = toUpper(query);
+// A column name of a single-table statement without its table qualifier;
+// kept as written when `table` is empty
+static string columnOf(string_view reference, string_view table) {
+    size_t dot = reference.find('.');
+    if (dot == string_view::npos || table.empty()) return string(reference);
 
-    size_t updatePos = upperQuery.find("UPDATE");
-    size_t setPos = upperQuery.find("SET", updatePos);
+    string_view qualifier = reference.substr(0, dot);
+    bool same = qualifier.size() == table.size();
+    for (size_t i = 0; same && i < table.size(); i++) {
+        same = toupper((unsigned char)qualifier[i]) == toupper((unsigned char)table[i]);
+    }
+    if (!same) throw runtime_error("Table '" + string(qualifier) + "' is not part of the query");
+    return string(reference.substr(dot + 1));
+}
 
-    if (setPos == string::npos) {
-        throw runtime_error("UPDATE must have SET clause");
+// The operator that holds exactly when `op` does not
+static string negateOperator(string_view op) {
+    if (op == "=") return "!=";
+    if (op == "!=") return "=";
+    if (op == "<") return ">=";
+    if (op == ">=") return "<";
+    if (op == ">") return "<=";
+    return ">";  // <=
+}
+
+// Appends the engine form of `comparison`, negated when `negate`. An AND
+// is spread into its children so `conditions` stays a list of ANDed
+// entries. NOT is pushed down to the comparisons (NOT a < 1 is a >= 1,
+// NOT (x OR y) is NOT x AND NOT y), and BETWEEN becomes a >= and a <=.
+static void addCondition(const Comparison& comparison, string_view table, bool negate,
+    vector<Condition>& conditions) {
+    switch (comparison.kind) {
+    case COMPARISON_VALUE:
+        conditions.push_back(Condition(columnOf(comparison.column, table),
+            negate ? negateOperator(comparison.op) : string(comparison.op), comparison.value.toString()));
+        return;
+
+    case COMPARISON_IN: {
+        Condition list(CONDITION_IN);
+        list.columnName = columnOf(comparison.column, table);
+        list.op = (comparison.negated != negate) ? "NOT IN" : "IN";
+        for (size_t i = 0; i < comparison.values.size(); i++) {
+            list.values.push_back(comparison.values[i].toString());
+        }
+        conditions.push_back(list);
+        return;
     }
 
-    // Extract table name
-    tableName = trim(query.substr(updatePos + 6, setPos - (updatePos + 6)));
+    case COMPARISON_BETWEEN: {
+        string column = columnOf(comparison.column, table);
+        if (comparison.negated == negate) {
+            conditions.push_back(Condition(column, ">=", comparison.values[0].toString()));
+            conditions.push_back(Condition(column, "<=", comparison.values[1].toString()));
+            return;
+        }
+        Condition outside(CONDITION_OR);
+        outside.children.push_back(Condition(column, "<", comparison.values[0].toString()));
+        outside.children.push_back(Condition(column, ">", comparison.values[1].toString()));
+        conditions.push_back(outside);
+        return;
+    }
 
-    // Find WHERE position
-    size_t wherePos = upperQuery.find("WHERE", setPos);
-    size_t setEnd = (wherePos != string::npos) ? wherePos : query.length();
+    case COMPARISON_NOT:
+        addCondition(comparison.children[0], table, !negate, conditions);
+        return;
 
-    // Parse SET clause
-    string setPart = query.substr(setPos + 3, setEnd - (setPos + 3));
-    stringstream ss(setPart);
-    string assignment;
+    case COMPARISON_AND:
+    case COMPARISON_OR:
+        break;
+    }
 
-    while (getline(ss, assignment, ',')) {
-        assignment = trim(assignment);
-        size_t eqPos = assignment.find('=');
-        if (eqPos != string::npos) {
-            string col = trim(assignment.substr(0, eqPos));
-            string val = trim(assignment.substr(eqPos + 1));
-            updates[col] = val;
+    if ((comparison.kind == COMPARISON_AND) != negate) {
+        for (size_t i = 0; i < comparison.children.size(); i++) {
+            addCondition(comparison.children[i], table, negate, conditions);
         }
+        return;
     }
 
-    // Parse WHERE clause if exists
-    if (wherePos != string::npos) {
-        parseWhereClause(query.substr(wherePos + 5), conditions);
+    Condition either(CONDITION_OR);
+    for (size_t i = 0; i < comparison.children.size(); i++) {
+        vector<Condition> branch;
+        addCondition(comparison.children[i], table, negate, branch);
+        if (branch.size() > 1) {
+            Condition both(CONDITION_AND);
+            both.children.swap(branch);
+            either.children.push_back(both);
+        }
+        else if (branch[0].kind == CONDITION_OR) {
+            either.children.insert(either.children.end(), branch[0].children.begin(),
+                branch[0].children.end());
+        }
+        else {
+            either.children.push_back(branch[0]);
+        }
     }
+    conditions.push_back(either);
 }
 
-void QueryParser::parseWhereClause(const string& whereStr,
+void QueryParser::toConditions(const vector<Comparison>& where, string_view table,
     vector<Condition>& conditions) {
-    string trimmed = trim(whereStr);
-
-    // Simple parser: splits by AND (doesn't handle OR yet)
-    vector<string> parts;
-    size_t pos = 0;
-    string temp = trimmed;
-    string upperTemp = toUpper(temp);
-
-    while ((pos = upperTemp.find(" AND ")) != string::npos) {
-        parts.push_back(temp.substr(0, pos));
-        temp = temp.substr(pos + 5);
-        upperTemp = toUpper(temp);
+    conditions.reserve(conditions.size() + where.size());
+    for (int i = 0; i < (int)where.size(); i++) {
+        addCondition(where[i], table, false, conditions);
     }
-    parts.push_back(temp);
+}
 
-    for (size_t i = 0; i < parts.size(); i++) {
-        string condStr = trim(parts[i]);
+Table* QueryParser::parseCreateTable(const string& query) {
+    CreateTableStatement* statement =
+        (CreateTableStatement*)parseAs(query, STATEMENT_CREATE_TABLE, "CREATE TABLE");
 
-        // Find operator
-        string op;
-        size_t opPos = string::npos;
+    Table* table = new Table(string(statement->table));
+    int pkCount = 0;
 
-        if ((opPos = condStr.find("!=")) != string::npos) {
-            op = "!=";
+    for (int i = 0; i < (int)statement->columns.size(); i++) {
+        const ColumnDefinition& def = statement->columns[i];
+        if (def.primaryKey && ++pkCount > 1) {
+            delete table;
+            delete statement;
+            throw runtime_error("Table can have only one PRIMARY KEY");
         }
-        else if ((opPos = condStr.find("<=")) != string::npos) {
-            op = "<=";
+        table->addColumn(Column(string(def.name), def.type, def.size, def.primaryKey, def.notNull));
+    }
+
+    delete statement;
+    return table;
+}
+
+void QueryParser::parseInsert(const string& query,
+    string& tableName,
+    vector<vector<string> >& rows) {
+    InsertStatement* statement = (InsertStatement*)parseAs(query, STATEMENT_INSERT, "INSERT");
+
+    tableName = string(statement->table);
+    rows.resize(statement->getRowCount());
+    for (int r = 0; r < statement->getRowCount(); r++) {
+        int start = statement->getRowStart(r);
+        rows[r].reserve(statement->rowEnds[r] - start);
+        for (int v = start; v < statement->rowEnds[r]; v++) {
+            rows[r].push_back(statement->values[v].toString());
         }
-        else if ((opPos = condStr.find(">=")) != string::npos) {
-            op = ">=";
+    }
+
+    delete statement;
+}
+
+void QueryParser::parseSelect(const string& query,
+    string& tableName,
+    vector<string>& columns,
+    vector<Condition>& conditions,
+    AggregateQuery& aggregate,
+    SortQuery& order,
+    JoinQuery& join) {
+    SelectStatement* statement = (SelectStatement*)parseAs(query, STATEMENT_SELECT, "SELECT");
+
+    tableName = string(statement->table);
+    columns.clear();
+    aggregate.clear();
+    order.clear();
+    join.clear();
+    string_view table = statement->table;
+    if (!statement->joinTable.empty()) {
+        join.table = string(statement->joinTable);
+        join.type = statement->leftJoin ? JOIN_LEFT : JOIN_INNER;
+        join.leftKey = string(statement->joinLeft);
+        join.rightKey = string(statement->joinRight);
+        table = string_view();
+    }
+
+    try {
+        for (int i = 0; i < (int)statement->columns.size(); i++) {
+            const SelectItem& item = statement->columns[i];
+            if (statement->isAggregate()) {
+                aggregate.outputs.push_back(AggregateTerm(item.function, columnOf(item.column, table)));
+            }
+            else {
+                columns.push_back(columnOf(item.column, table));
+            }
         }
-        else if ((opPos = condStr.find("=")) != string::npos) {
-            op = "=";
+        for (int i = 0; i < (int)statement->groupBy.size(); i++) {
+            aggregate.groupBy.push_back(columnOf(statement->groupBy[i], table));
         }
-        else if ((opPos = condStr.find("<")) != string::npos) {
-            op = "<";
+        for (int i = 0; i < (int)statement->having.size(); i++) {
+            const HavingComparison& comparison = statement->having[i];
+            HavingCondition condition;
+            condition.term = AggregateTerm(comparison.item.function, columnOf(comparison.item.column, table));
+            condition.op = string(comparison.op);
+            condition.value = comparison.value.toString();
+            aggregate.having.push_back(condition);
         }
-        else if ((opPos = condStr.find(">")) != string::npos) {
-            op = ">";
+        for (int i = 0; i < (int)statement->orderBy.size(); i++) {
+            const OrderItem& item = statement->orderBy[i];
+            SortTerm term;
+            term.term = AggregateTerm(item.item.function, columnOf(item.item.column, table));
+            term.descending = item.descending;
+            order.keys.push_back(term);
         }
+        order.limit = statement->limit.toString();
+        order.offset = statement->offset.toString();
+        toConditions(statement->where, table, conditions);
+    }
+    catch (...) {
+        delete statement;
+        throw;
+    }
 
-        if (opPos != string::npos) {
-            string col = trim(condStr.substr(0, opPos));
-            string val = trim(condStr.substr(opPos + op.length()));
-            conditions.push_back(Condition(col, op, val));
-        }
+    delete statement;
+}
+void QueryParser::parseDelete(const string& query,
+    string& tableName,
+    vector<Condition>& conditions) {
+    DeleteStatement* statement = (DeleteStatement*)parseAs(query, STATEMENT_DELETE, "DELETE");
+
+    tableName = string(statement->table);
+    try {
+        toConditions(statement->where, statement->table, conditions);
+    }
+    catch (...) {
+        delete statement;
+        throw;
     }
+
+    delete statement;
 }
 
-string QueryParser::parseDropTable(const string& query) {
-    string upperQuery = toUpper(query);
-    size_t tablePos = upperQuery.find("TABLE");
+void QueryParser::parseUpdate(const string& query,
+    string& tableName,
+    map<string, string>& updates,
+    vector<Condition>& conditions) {
+    UpdateStatement* statement = (UpdateStatement*)parseAs(query, STATEMENT_UPDATE, "UPDATE");
 
-    if (tablePos == string::npos) {
-        throw runtime_error("DROP TABLE syntax error");
+    tableName = string(statement->table);
+    for (int i = 0; i < (int)statement->assignments.size(); i++) {
+        const Assignment& assignment = statement->assignments[i];
+        updates[string(assignment.column)] = assignment.value.toString();
     }
-
-    string tableName = trim(query.substr(tablePos + 5)); // after "TABLE"
-    
-    // Remove trailing semicolon if present (though main loop handles splitting by ;)
-    if (!tableName.empty() && tableName[tableName.length() - 1] == ';') {
-        tableName = tableName.substr(0, tableName.length() - 1);
+    try {
+        toConditions(statement->where, statement->table, conditions);
     }
-    tableName = trim(tableName);
-
-    if (tableName.empty()) {
-        throw runtime_error("Table name missing in DROP TABLE command");
+    catch (...) {
+        delete statement;
+        throw;
     }
 
+    delete statement;
+}
+
+string QueryParser::parseDropTable(const string& query) {
+    Statement* statement = parseAs(query, STATEMENT_DROP_TABLE, "DROP TABLE");
+    string tableName(statement->table);
+    delete statement;
+    return tableName;
+}
+
+void QueryParser::parseCreateIndex(const string& query,
+    string& indexName,
+    string& tableName,
+    string& columnName) {
+    CreateIndexStatement* statement =
+        (CreateIndexStatement*)parseAs(query, STATEMENT_CREATE_INDEX, "CREATE INDEX");
+
+    indexName = string(statement->index);
+    tableName = string(statement->table);
+    columnName = string(statement->column);
+
+    delete statement;
+}
+
+string QueryParser::parseAnalyze(const string& query) {
+    Statement* statement = parseAs(query, STATEMENT_ANALYZE, "ANALYZE");
+    string tableName(statement->table);
+    delete statement;
     return tableName;
 }
+
+string QueryParser::parseExplain(const string& query, bool& analyze) {
+    QueryParser parser(query);
+    parser.expectKeyword("EXPLAIN");
+    analyze = parser.lexer.peek().is("ANALYZE");
+    if (analyze) parser.lexer.next();
+    if (!parser.lexer.peek().is("SELECT")) parser.fail("SELECT");
+    return query.substr(parser.lexer.peek().offset);
+}
+
+string QueryParser::parseDropIndex(const string& query) {
+    DropIndexStatement* statement = (DropIndexStatement*)parseAs(query, STATEMENT_DROP_INDEX, "DROP INDEX");
+    string indexName(statement->index);
+    delete statement;
+    return indexName;
+}
+
+void QueryParser::parseCopy(const string& query,
+    string& tableName,
+    string& fileName,
+    char& delimiter,
+    bool& header) {
+    CopyStatement* statement = (CopyStatement*)parseAs(query, STATEMENT_COPY, "COPY");
+
+    tableName = string(statement->table);
+    fileName = statement->file.toString();
+    delimiter = statement->delimiter;
+    header = statement->header;
+
+    delete statement;
+}
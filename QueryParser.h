@@ -2,33 +2,91 @@
 #define QUERYPARSER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 using namespace std;
 #include "Table.h"
 #include "Condition.h"
 #include "Column.h"
+#include "Lexer.h"
+#include "Statement.h"
+#include "HashAggregate.h"
+#include "ExternalSort.h"
+#include "HashJoin.h"
 #include <cstdlib>
 
 
+// Recursive-descent parser over the Lexer's tokens. parse() builds the
+// syntax tree; the parseX helpers below turn it into what the engine uses.
 class QueryParser {
 private:
-    static string trim(const string& str);
-    static string toUpper(const string& str);
-    static DataType parseDataType(const string& typeStr, int& size);
-    static void parseWhereClause(const string& whereStr, vector<Condition>& conditions);
+    Lexer lexer;
+
+    explicit QueryParser(string_view sql);
+
+    Statement* readStatement();
+    void readCreateTable(CreateTableStatement& statement);
+    void readCreateIndex(CreateIndexStatement& statement);
+    void readInsert(InsertStatement& statement);
+    void readSelect(SelectStatement& statement);
+    void readUpdate(UpdateStatement& statement);
+    void readDelete(DeleteStatement& statement);
+    void readCopy(CopyStatement& statement);
+    void readJoin(SelectStatement& statement);
+
+    void readColumnDefinition(ColumnDefinition& column);
+    SelectItem readSelectItem(const char* what);
+    string_view readColumnName(const char* what);
+    string_view readQualified(const Token& name);
+    void readWhere(vector<Comparison>& where);
+    Comparison readOr();
+    Comparison readAnd();
+    Comparison readNot();
+    Comparison readComparison();
+    void readHaving(vector<HavingComparison>& having);
+    void readOrderBy(vector<OrderItem>& orderBy);
+    string_view readOperator();
+    // stopWords: NULL-terminated list of keywords that end the value
+    Literal readValue(bool stopAtComma, bool stopAtParen, const char* const* stopWords);
+    bool atValueEnd(bool stopAtComma, bool stopAtParen, const char* const* stopWords) const;
+    void readEnd();
+
+    Token expect(TokenType type, const char* what);
+    void expectKeyword(const char* keyword);
+    void expectSymbol(const char* symbol);
+    string_view expectName(const char* what);
+    [[noreturn]] void fail(const char* expected);
+
+    static Statement* parseAs(const string& query, StatementType type, const char* name);
+    // `table` is the statement's only table, whose name may qualify its
+    // columns; empty for a join, whose names are kept as written
+    static void toConditions(const vector<Comparison>& where, string_view table,
+        vector<Condition>& conditions);
 
 public:
+    // Syntax tree of one statement (caller deletes); throws runtime_error
+    // on a syntax error. The tree points into `sql`.
+    static Statement* parse(string_view sql);
+
     static Table* parseCreateTable(const string& query);
 
+    // One entry per VALUES tuple
     static void parseInsert(const string& query,
         string& tableName,
-        vector<string>& values);
+        vector<vector<string> >& rows);
 
+    // A plain SELECT fills `columns`; one with aggregates, GROUP BY or
+    // HAVING fills `aggregate` instead. ORDER BY and LIMIT go to `order`,
+    // a JOIN to `join`. Without a join, column names lose their table
+    // qualifier; with one they are kept as written.
     static void parseSelect(const string& query,
         string& tableName,
         vector<string>& columns,
-        vector<Condition>& conditions);
+        vector<Condition>& conditions,
+        AggregateQuery& aggregate,
+        SortQuery& order,
+        JoinQuery& join);
 
     static void parseDelete(const string& query,
         string& tableName,
@@ -40,6 +98,27 @@ public:
         vector<Condition>& conditions);
 
     static string parseDropTable(const string& query);
+
+    static void parseCreateIndex(const string& query,
+        string& indexName,
+        string& tableName,
+        string& columnName);
+
+    static string parseDropIndex(const string& query);
+
+    // ANALYZE [table]: the table name, empty for every table
+    static string parseAnalyze(const string& query);
+
+    // EXPLAIN [ANALYZE] SELECT ...: the SELECT's text; `analyze` tells
+    // whether it is to be run and measured
+    static string parseExplain(const string& query, bool& analyze);
+
+    // COPY table FROM 'file' [WITH (DELIMITER 'c', HEADER)]
+    static void parseCopy(const string& query,
+        string& tableName,
+        string& fileName,
+        char& delimiter,
+        bool& header);
 };
 
 #endif
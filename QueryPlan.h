@@ -0,0 +1,77 @@
+#ifndef QUERYPLAN_H
+#define QUERYPLAN_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+// One operator of a SELECT as EXPLAIN shows it: what it does, how many
+// rows the planner expects from it and, under EXPLAIN ANALYZE, what it
+// measured. Times include the operators below it. Counters that an
+// operator does not measure stay negative (rows) or zero and are not shown.
+struct PlanNode {
+    string name;                // Seq Scan, Index Scan, Sort, ...
+    string detail;              // table, index, keys
+    vector<string> lines;       // Filter: ..., spills, ...
+    double estimatedRows;       // -1 when not estimated
+    bool analyzing;             // measured as well as planned
+    double inputRows;           // rows expected of the table scanned below when
+                                // it is a join's output, -1 to count its rows
+
+    long long rowsIn;           // rows read or tested
+    long long rowsOut;          // rows passed on
+    double wallSeconds;
+    double cpuSeconds;          // of the whole process, so pool threads count
+    uint64_t bytes;             // column data read, or spilled to disk
+    size_t memoryPeak;          // largest working set the operator held
+    bool folded;                // a scan whose rows the operator above reads in
+                                // place: its time is counted there
+
+    vector<PlanNode*> children;
+
+    PlanNode(const string& operatorName, const string& operatorDetail, double estimate, bool measure);
+    ~PlanNode();
+
+    // A new operator feeding this one
+    PlanNode* add(const string& operatorName, const string& operatorDetail, double estimate);
+
+    // A new operator between this one and `child`, one of those feeding it
+    PlanNode* wrap(PlanNode* child, const string& operatorName, const string& operatorDetail, double estimate);
+
+    // First operator down the leftmost path that feeds no other
+    PlanNode* leaf();
+
+    void print(ostream& out, int depth) const;
+
+private:
+    PlanNode(const PlanNode&);
+    PlanNode& operator=(const PlanNode&);
+};
+
+// Adds the wall and CPU time between construction and stop() (or
+// destruction) to an operator; does nothing for a NULL one, so the
+// executor can time its steps whether or not a plan is being measured.
+// An operator timed in several pieces, such as a scan of slices, sums them.
+class OperatorTimer {
+private:
+    PlanNode* node;
+    chrono::steady_clock::time_point wallStart;
+    double cpuStart;
+
+    OperatorTimer(const OperatorTimer&);
+    OperatorTimer& operator=(const OperatorTimer&);
+
+public:
+    explicit OperatorTimer(PlanNode* planNode);
+    ~OperatorTimer();
+
+    void stop();
+
+    // CPU time used by the process so far
+    static double processCpuSeconds();
+};
+
+#endif
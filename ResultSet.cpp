@@ -0,0 +1,210 @@
+#include "ResultSet.h"
+#include "Table.h"
+#include "PagedScan.h"
+#include "ExternalSort.h"
+
+using namespace std;
+
+ResultBatch::ResultBatch()
+    : source(NULL), columnMap(NULL) {
+}
+
+int ResultBatch::size() const {
+    return (int)rows.size();
+}
+
+int ResultBatch::getColumnCount() const {
+    return (int)columnMap->size();
+}
+
+const ColumnVector& ResultBatch::getColumn(int col) const {
+    return source->getColumnData((*columnMap)[col]);
+}
+
+int ResultBatch::getRow(int i) const {
+    return rows[i];
+}
+
+string ResultBatch::getString(int i, int col) const {
+    return getColumn(col).getString(rows[i]);
+}
+
+void ResultBatch::appendValue(int i, int col, string& out) const {
+    getColumn(col).appendString(rows[i], out);
+}
+
+ResultSet::ResultSet(const Table& source, const vector<int>& columnIndices)
+    : filtered(false), table(&source), ownedTable(NULL), allRows(true), position(0), scan(NULL),
+    chunk(NULL), sorter(NULL), skip(0), remaining(-1) {
+    init(source, columnIndices);
+}
+
+ResultSet::ResultSet(const Table& source, const vector<int>& columnIndices, vector<int>& matches,
+    bool filteredRows)
+    : filtered(filteredRows), table(&source), ownedTable(NULL), allRows(false), position(0), scan(NULL),
+    chunk(NULL), sorter(NULL), skip(0), remaining(-1) {
+    init(source, columnIndices);
+    rows.swap(matches);
+}
+
+ResultSet::ResultSet(Table* built, bool filteredRows)
+    : filtered(filteredRows), table(built), ownedTable(built), allRows(true), position(0), scan(NULL),
+    chunk(NULL), sorter(NULL), skip(0), remaining(-1) {
+    init(*built, vector<int>());
+}
+
+// Copied rows come in chunks holding just the result's columns
+ResultSet::ResultSet(const Table& source, const vector<int>& columnIndices, ExternalSort* sorted,
+    bool filteredRows)
+    : filtered(filteredRows), table(&source), ownedTable(NULL), allRows(false), position(0), scan(NULL),
+    chunk(NULL), sorter(sorted), skip(0), remaining(-1) {
+    init(source, columnIndices);
+    if (sorter->copiesRows()) {
+        for (int i = 0; i < (int)columnMap.size(); i++) columnMap[i] = i;
+    }
+}
+
+ResultSet::ResultSet(Table* built, ExternalSort* sorted)
+    : filtered(true), table(built), ownedTable(built), allRows(false), position(0), scan(NULL),
+    chunk(NULL), sorter(sorted), skip(0), remaining(-1) {
+    init(*built, vector<int>());
+}
+
+ResultSet::ResultSet(const Table& source, const vector<int>& columnIndices, PagedScan* pagedScan,
+    const vector<Condition>& where)
+    : filtered(!where.empty()), table(NULL), ownedTable(NULL), allRows(false), position(0),
+    scan(pagedScan), conditions(where), chunk(NULL), sorter(NULL), skip(0), remaining(-1) {
+    init(source, columnIndices);
+}
+
+ResultSet::~ResultSet() {
+    delete chunk;
+    delete scan;
+    delete sorter;
+    delete ownedTable;
+}
+
+// An empty column list means every column, as in SELECT *
+void ResultSet::init(const Table& source, const vector<int>& columnIndices) {
+    tableName = source.getTableName();
+    columnMap = columnIndices;
+    if (columnMap.empty()) {
+        for (int i = 0; i < source.getColumnCount(); i++) columnMap.push_back(i);
+    }
+
+    const vector<Column>& tableColumns = source.getColumns();
+    for (int i = 0; i < (int)columnMap.size(); i++) {
+        ResultColumn col;
+        col.name = tableColumns[columnMap[i]].getName();
+        col.type = tableColumns[columnMap[i]].getType();
+        columns.push_back(col);
+    }
+}
+
+const string& ResultSet::getTableName() const {
+    return tableName;
+}
+
+bool ResultSet::isFiltered() const {
+    return filtered;
+}
+
+const vector<ResultColumn>& ResultSet::getColumns() const {
+    return columns;
+}
+
+void ResultSet::setWindow(long long offset, long long limit) {
+    skip = offset;
+    remaining = limit;
+    if (offset > 0 || limit != -1) filtered = true;
+}
+
+void ResultSet::markFiltered() {
+    filtered = true;
+}
+
+void ResultSet::takeTable(Table* built) {
+    ownedTable = built;
+}
+
+// Skipped rows of a loaded table are stepped over without being batched;
+// a LIMIT stops reading, so a streamed table is not read to the end
+bool ResultSet::next(ResultBatch& batch) {
+    while (remaining != 0) {
+        if (skip > 0 && scan == NULL && sorter == NULL) {
+            int total = allRows ? table->getRowCount() : (int)rows.size();
+            long long step = min(skip, (long long)(total - position));
+            position += (int)step;
+            skip -= step;
+        }
+
+        if (!fill(batch)) return false;
+
+        long long size = batch.size();
+        if (skip >= size) {
+            skip -= size;
+            continue;
+        }
+        if (skip > 0) {
+            batch.rows.erase(batch.rows.begin(), batch.rows.begin() + skip);
+            skip = 0;
+        }
+        if (remaining != -1) {
+            if ((long long)batch.rows.size() > remaining) batch.rows.resize((size_t)remaining);
+            remaining -= batch.rows.size();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool ResultSet::fill(ResultBatch& batch) {
+    batch.columnMap = &columnMap;
+    batch.rows.clear();
+
+    if (sorter != NULL) {
+        if (!sorter->copiesRows()) {
+            batch.source = table;
+            return sorter->nextRows(batch.rows, BATCH_ROWS) > 0;
+        }
+        delete chunk;
+        chunk = sorter->nextChunk(BATCH_ROWS);
+        if (chunk == NULL) return false;
+        batch.source = chunk;
+        for (int r = 0; r < chunk->getRowCount(); r++) batch.rows.push_back(r);
+        return true;
+    }
+
+    if (scan == NULL) {
+        int total = allRows ? table->getRowCount() : (int)rows.size();
+        if (position >= total) return false;
+
+        int end = total - position > BATCH_ROWS ? position + BATCH_ROWS : total;
+        batch.source = table;
+        if (allRows) {
+            for (int r = position; r < end; r++) batch.rows.push_back(r);
+        }
+        else {
+            batch.rows.assign(rows.begin() + position, rows.begin() + end);
+        }
+        position = end;
+        return true;
+    }
+
+    // Slices whose rows all fail the WHERE clause are skipped
+    while (position >= (int)chunkRows.size()) {
+        delete chunk;
+        chunk = NULL;
+
+        int firstRow;
+        chunk = scan->next(firstRow, conditions, chunkRows);
+        if (chunk == NULL) return false;
+        position = 0;
+    }
+
+    int end = (int)chunkRows.size() - position > BATCH_ROWS ? position + BATCH_ROWS : (int)chunkRows.size();
+    batch.source = chunk;
+    batch.rows.assign(chunkRows.begin() + position, chunkRows.begin() + end);
+    position = end;
+    return true;
+}
@@ -0,0 +1,128 @@
+#ifndef RESULTSET_H
+#define RESULTSET_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Column.h"
+#include "Condition.h"
+#include "ColumnVector.h"
+
+class Table;
+class PagedScan;
+class ExternalSort;
+
+struct ResultColumn {
+    string name;
+    DataType type;
+};
+
+// A slice of a result: up to ResultSet::BATCH_ROWS rows of one source
+// table, with the result's columns mapped onto that table's columns.
+// Valid until the next call to ResultSet::next().
+class ResultBatch {
+private:
+    const Table* source;
+    const vector<int>* columnMap;
+    vector<int> rows;
+
+    friend class ResultSet;
+
+public:
+    ResultBatch();
+
+    int size() const;
+    int getColumnCount() const;
+
+    // Column `col` of the result and the position of batch row `i` in it
+    const ColumnVector& getColumn(int col) const;
+    int getRow(int i) const;
+
+    string getString(int i, int col) const;
+    void appendValue(int i, int col, string& out) const; // appends nothing for NULL
+};
+
+// Rows produced by a query, read batch by batch. The rows are not copied:
+// batches point into the columns of the table read (or, for a table
+// streamed through the buffer pool, into the current slice). For an engine
+// table that is a view of a snapshot, which writers leave untouched.
+class ResultSet {
+private:
+    string tableName;
+    bool filtered;
+    vector<ResultColumn> columns;
+    vector<int> columnMap;
+
+    // Loaded table: either every row or the listed positions
+    const Table* table;
+    Table* ownedTable;  // built for this result, such as aggregated groups
+    bool allRows;
+    vector<int> rows;
+    int position;
+
+    // Streamed table: one slice at a time, filtered as it arrives
+    PagedScan* scan;
+    vector<Condition> conditions;
+    Table* chunk;
+    vector<int> chunkRows;
+
+    // Sorted rows: positions in `table`, or chunks of copied rows
+    ExternalSort* sorter;
+
+    // OFFSET rows still to skip, and LIMIT rows still to return (-1: all)
+    long long skip;
+    long long remaining;
+
+    void init(const Table& source, const vector<int>& columnIndices);
+    bool fill(ResultBatch& batch);
+
+    ResultSet(const ResultSet&);
+    ResultSet& operator=(const ResultSet&);
+
+public:
+    static const int BATCH_ROWS = 4096;
+
+    // All rows of a loaded table
+    ResultSet(const Table& source, const vector<int>& columnIndices);
+
+    // The given rows of a loaded table, in that order; takes the vector's
+    // contents. filteredRows: a WHERE clause chose them.
+    ResultSet(const Table& source, const vector<int>& columnIndices, vector<int>& matches, bool filteredRows);
+
+    // Every row of a table built for this result; takes ownership of it
+    ResultSet(Table* built, bool filteredRows);
+
+    // Rows of a loaded or streamed table in the order of a finished sort;
+    // takes ownership of the sort
+    ResultSet(const Table& source, const vector<int>& columnIndices, ExternalSort* sorted,
+        bool filteredRows);
+
+    // Rows of a table built for this result in the order of a finished
+    // sort; takes ownership of both
+    ResultSet(Table* built, ExternalSort* sorted);
+
+    // Rows of a streamed table matching the conditions; takes ownership of the scan
+    ResultSet(const Table& source, const vector<int>& columnIndices, PagedScan* pagedScan,
+        const vector<Condition>& where);
+
+    ~ResultSet();
+
+    const string& getTableName() const;
+    bool isFiltered() const; // produced by a WHERE clause, LIMIT or OFFSET
+    const vector<ResultColumn>& getColumns() const;
+
+    // OFFSET and LIMIT (-1 for none), applied as the rows are read
+    void setWindow(long long offset, long long limit);
+    // For rows a WHERE clause chose before the result was built, such as
+    // conditions pushed below a join
+    void markFiltered();
+
+    // Deletes `built`, the table this result reads, along with the result
+    void takeTable(Table* built);
+
+    // Fills the next non-empty batch; false once the result is exhausted
+    bool next(ResultBatch& batch);
+};
+
+#endif
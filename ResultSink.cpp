@@ -0,0 +1,161 @@
+#include "ResultSink.h"
+
+using namespace std;
+
+ResultSink::~ResultSink() {
+}
+
+long long ResultSink::drain(ResultSet& result, ResultSink& sink) {
+    long long rowCount = 0;
+    ResultBatch batch;
+
+    sink.begin(result);
+    while (result.next(batch)) {
+        sink.write(batch);
+        rowCount += batch.size();
+    }
+    sink.end(result, rowCount);
+    return rowCount;
+}
+
+BufferedSink::BufferedSink(ostream& stream)
+    : out(stream) {
+    buffer.reserve(BUFFER_BYTES + 4096);
+}
+
+BufferedSink::~BufferedSink() {
+    flush();
+}
+
+void BufferedSink::flushIfFull() {
+    if (buffer.size() >= BUFFER_BYTES) {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+}
+
+void BufferedSink::flush() {
+    if (!buffer.empty()) {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    out.flush();
+}
+
+TablePrinter::TablePrinter(ostream& stream)
+    : BufferedSink(stream) {
+}
+
+void TablePrinter::begin(const ResultSet& result) {
+    const vector<ResultColumn>& columns = result.getColumns();
+
+    buffer += "\nTable: " + result.getTableName() + "\n";
+    buffer += "--------------------------------------\n";
+
+    for (int i = 0; i < (int)columns.size(); i++) {
+        if (i > 0) buffer += " | ";
+        buffer += columns[i].name;
+    }
+    buffer += '\n';
+
+    for (int i = 0; i < (int)columns.size(); i++) {
+        if (i > 0) buffer += "-+-";
+        buffer += "----------";
+    }
+    buffer += '\n';
+}
+
+void TablePrinter::write(const ResultBatch& batch) {
+    int columnCount = batch.getColumnCount();
+    for (int r = 0; r < batch.size(); r++) {
+        for (int c = 0; c < columnCount; c++) {
+            if (c > 0) buffer += " | ";
+            batch.appendValue(r, c, buffer);
+        }
+        buffer += '\n';
+        flushIfFull();
+    }
+}
+
+void TablePrinter::end(const ResultSet& result, long long rowCount) {
+    if (result.isFiltered()) {
+        if (rowCount == 0) buffer += "No matching rows found.\n";
+        buffer += "\nRows returned: " + to_string(rowCount) + "\n";
+    }
+    else {
+        if (rowCount == 0) buffer += "No data in table.\n";
+        buffer += "\nTotal rows: " + to_string(rowCount) + "\n";
+    }
+    flush();
+}
+
+CsvWriter::CsvWriter(ostream& stream, char fieldDelimiter)
+    : BufferedSink(stream), delimiter(fieldDelimiter) {
+}
+
+void CsvWriter::appendField(const string& value) {
+    bool quote = value.find_first_of(string(1, delimiter) + "\"\r\n") != string::npos;
+    if (!quote) {
+        buffer += value;
+        return;
+    }
+
+    buffer += '"';
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '"') buffer += '"';
+        buffer += value[i];
+    }
+    buffer += '"';
+}
+
+void CsvWriter::begin(const ResultSet& result) {
+    const vector<ResultColumn>& columns = result.getColumns();
+    for (int i = 0; i < (int)columns.size(); i++) {
+        if (i > 0) buffer += delimiter;
+        appendField(columns[i].name);
+    }
+    buffer += '\n';
+}
+
+void CsvWriter::write(const ResultBatch& batch) {
+    int columnCount = batch.getColumnCount();
+    for (int r = 0; r < batch.size(); r++) {
+        for (int c = 0; c < columnCount; c++) {
+            if (c > 0) buffer += delimiter;
+            const ColumnVector& column = batch.getColumn(c);
+            if (column.getType() == VARCHAR) {
+                field.clear();
+                batch.appendValue(r, c, field);
+                appendField(field);
+            }
+            else {
+                batch.appendValue(r, c, buffer);
+            }
+        }
+        buffer += '\n';
+        flushIfFull();
+    }
+}
+
+void CsvWriter::end(const ResultSet& result, long long rowCount) {
+    flush();
+}
+
+CountingSink::CountingSink()
+    : rowCount(0) {
+}
+
+void CountingSink::begin(const ResultSet& result) {
+    rowCount = 0;
+}
+
+void CountingSink::write(const ResultBatch& batch) {
+    rowCount += batch.size();
+}
+
+void CountingSink::end(const ResultSet& result, long long rows) {
+}
+
+long long CountingSink::getRowCount() const {
+    return rowCount;
+}
@@ -0,0 +1,85 @@
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <string>
+#include <ostream>
+using namespace std;
+
+#include "ResultSet.h"
+
+// Consumer of a ResultSet; drain() feeds it begin, the batches, then end.
+class ResultSink {
+public:
+    virtual ~ResultSink();
+
+    virtual void begin(const ResultSet& result) = 0;
+    virtual void write(const ResultBatch& batch) = 0;
+    virtual void end(const ResultSet& result, long long rowCount) = 0;
+
+    // Reads the whole result into the sink; returns the row count
+    static long long drain(ResultSet& result, ResultSink& sink);
+};
+
+// Text is collected in one large buffer and written out in big blocks,
+// instead of a stream operation per cell and a flush per row.
+class BufferedSink : public ResultSink {
+private:
+    ostream& out;
+
+protected:
+    string buffer;
+
+    void flushIfFull();
+    void flush();
+
+public:
+    static const size_t BUFFER_BYTES = 1 << 20;
+
+    explicit BufferedSink(ostream& stream);
+    virtual ~BufferedSink();
+};
+
+// The REPL table layout: "Table: name", header, "a | b" rows and a
+// "Total rows" (or, for a WHERE result, "Rows returned") footer
+class TablePrinter : public BufferedSink {
+public:
+    explicit TablePrinter(ostream& stream);
+
+    virtual void begin(const ResultSet& result);
+    virtual void write(const ResultBatch& batch);
+    virtual void end(const ResultSet& result, long long rowCount);
+};
+
+// RFC 4180 CSV with a header line; fields holding the delimiter, a quote
+// or a line break are quoted
+class CsvWriter : public BufferedSink {
+private:
+    char delimiter;
+    string field;
+
+    void appendField(const string& value);
+
+public:
+    CsvWriter(ostream& stream, char fieldDelimiter = ',');
+
+    virtual void begin(const ResultSet& result);
+    virtual void write(const ResultBatch& batch);
+    virtual void end(const ResultSet& result, long long rowCount);
+};
+
+// Discards the rows and only counts them, for benchmarks
+class CountingSink : public ResultSink {
+private:
+    long long rowCount;
+
+public:
+    CountingSink();
+
+    virtual void begin(const ResultSet& result);
+    virtual void write(const ResultBatch& batch);
+    virtual void end(const ResultSet& result, long long rows);
+
+    long long getRowCount() const;
+};
+
+#endif
@@ -0,0 +1,546 @@
+#include "Server.h"
+#include "Session.h"
+#include "WireProtocol.h"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+
+static const uint64_t LISTEN_EVENT = 0;
+static const uint64_t WAKE_EVENT = 1;
+static const int FIRST_CONNECTION = 2;
+
+// A connection stops reading ahead of the request being run past this,
+// and stops taking requests while this much of its output is unsent
+static const size_t INPUT_LIMIT = 1024 * 1024;
+static const size_t OUTPUT_LIMIT = 4 * 1024 * 1024;
+
+// ================== OUTPUT CAPTURE ==================
+
+// The engine prints its results to cout. While a worker runs a request,
+// what it writes to cout goes to that request's response; other threads
+// still write to the console. The engine never changes cout's formatting
+// state, so the workers only share the stream, not what they print.
+class SessionOutput : public streambuf {
+private:
+    streambuf* console;
+    static thread_local streambuf* target;
+
+    streambuf* current() const {
+        return target != NULL ? target : console;
+    }
+
+protected:
+    virtual int_type overflow(int_type c) {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        return current()->sputc(traits_type::to_char_type(c));
+    }
+
+    virtual streamsize xsputn(const char* data, streamsize count) {
+        return current()->sputn(data, count);
+    }
+
+    virtual int sync() {
+        return current()->pubsync();
+    }
+
+public:
+    explicit SessionOutput(streambuf* original) : console(original) {}
+
+    streambuf* getConsole() const {
+        return console;
+    }
+
+    // Sends the calling thread's output to buffer, or back to the console for NULL
+    static void capture(streambuf* buffer) {
+        target = buffer;
+    }
+};
+
+thread_local streambuf* SessionOutput::target = NULL;
+
+// A request's response text, kept up to `limit` bytes: one frame carries
+// no more, so the rest is only counted instead of held in memory
+class ResponseBuffer : public streambuf {
+private:
+    string text;
+    size_t limit;
+    uint64_t total;
+
+    void append(const char* data, size_t count) {
+        total += count;
+        if (text.size() < limit) text.append(data, min(count, limit - text.size()));
+    }
+
+protected:
+    virtual int_type overflow(int_type c) {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        append(&ch, 1);
+        return c;
+    }
+
+    virtual streamsize xsputn(const char* data, streamsize count) {
+        append(data, (size_t)count);
+        return count;
+    }
+
+public:
+    explicit ResponseBuffer(size_t maxBytes) : limit(maxBytes), total(0) {}
+
+    bool isComplete() const {
+        return total <= limit;
+    }
+
+    uint64_t size() const {
+        return total;
+    }
+
+    const string& str() const {
+        return text;
+    }
+};
+
+static void wake(int fd) {
+    uint64_t one = 1;
+    ssize_t written = write(fd, &one, sizeof(one));
+    (void)written;  // a full counter already wakes the loop
+}
+
+// ================== SERVER ==================
+
+Server::Server(DatabaseCatalog& databases, int workers)
+    : catalog(databases), workerCount(workers > 0 ? workers : 1), listenFd(-1), epollFd(-1), wakeFd(-1),
+    stopping(false), nextConnection(FIRST_CONNECTION), workersStopping(false) {
+}
+
+Server::~Server() {
+    if (listenFd >= 0) ::close(listenFd);
+    if (epollFd >= 0) ::close(epollFd);
+    if (wakeFd >= 0) ::close(wakeFd);
+}
+
+bool Server::listen(const string& host, int port, string& error) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo* addresses = NULL;
+    int status = getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses);
+    if (status != 0) {
+        error = gai_strerror(status);
+        return false;
+    }
+
+    for (addrinfo* address = addresses; address != NULL && listenFd < 0; address = address->ai_next) {
+        int fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            address->ai_protocol);
+        if (fd < 0) {
+            error = strerror(errno);
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            listenFd = fd;
+        }
+        else {
+            error = strerror(errno);
+            ::close(fd);
+        }
+    }
+    freeaddrinfo(addresses);
+    if (listenFd < 0) return false;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_EVENT;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.u64 = WAKE_EVENT;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    return true;
+}
+
+void Server::stop() {
+    stopping = true;
+    if (wakeFd >= 0) wake(wakeFd);
+}
+
+void Server::run() {
+    if (listenFd < 0) return;
+
+    SessionOutput redirect(cout.rdbuf());
+    cout.rdbuf(&redirect);
+    for (int i = 0; i < workerCount; i++) {
+        workers.push_back(thread(&Server::workerLoop, this));
+    }
+
+    epoll_event events[64];
+    while (!stopping) {
+        int count = epoll_wait(epollFd, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error: epoll_wait failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        for (int i = 0; i < count && !stopping; i++) {
+            uint64_t key = events[i].data.u64;
+            if (key == LISTEN_EVENT) {
+                acceptConnections();
+                continue;
+            }
+            if (key == WAKE_EVENT) {
+                uint64_t counter;
+                while (read(wakeFd, &counter, sizeof(counter)) > 0) {}
+                receiveReplies();
+                continue;
+            }
+
+            // Looked up again after reading: the connection may have closed
+            map<int, Connection*>::iterator it = connections.find((int)key);
+            if (it != connections.end() && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                readConnection(it->second);
+                it = connections.find((int)key);
+            }
+            if (it != connections.end() && (events[i].events & EPOLLOUT)) {
+                writeConnection(it->second);
+                dispatch(it->second);
+            }
+        }
+    }
+
+    endSessions();
+    cout.rdbuf(redirect.getConsole());
+}
+
+void Server::acceptConnections() {
+    while (true) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // EAGAIN once the backlog is empty; out of descriptors, try on the next event
+            return;
+        }
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        Connection* connection = new Connection();
+        connection->id = nextConnection++;
+        connection->fd = fd;
+        connection->sent = 0;
+        connection->session = NULL;
+        connection->busy = false;
+        connection->readClosed = false;
+        connection->ending = false;
+        connection->events = 0;
+        connections[connection->id] = connection;
+        watch(connection);
+    }
+}
+
+void Server::readConnection(Connection* connection) {
+    char buffer[64 * 1024];
+    while (!connection->readClosed) {
+        if (connection->busy && connection->input.size() >= INPUT_LIMIT) break;
+
+        ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            connection->input.append(buffer, (size_t)received);
+            continue;
+        }
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        // End of the requests, or a reset: nothing can be sent back after a reset
+        connection->readClosed = true;
+        if (received < 0) {
+            connection->output.clear();
+            connection->sent = 0;
+        }
+    }
+    dispatch(connection);
+}
+
+void Server::writeConnection(Connection* connection) {
+    while (connection->sent < connection->output.size()) {
+        ssize_t written = send(connection->fd, connection->output.data() + connection->sent,
+            connection->output.size() - connection->sent, MSG_NOSIGNAL);
+        if (written > 0) {
+            connection->sent += (size_t)written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        // The client is gone
+        connection->output.clear();
+        connection->sent = 0;
+        connection->input.clear();
+        connection->readClosed = true;
+    }
+    if (connection->sent == connection->output.size()) {
+        connection->output.clear();
+        connection->sent = 0;
+    }
+}
+
+// Hands the next complete request to the pool, or closes a connection
+// that has nothing left to do. The connection may be gone on return.
+void Server::dispatch(Connection* connection) {
+    if (connection->busy) {
+        watch(connection);
+        return;
+    }
+
+    if (!connection->ending && connection->output.size() - connection->sent < OUTPUT_LIMIT) {
+        string request;
+        try {
+            if (WireProtocol::takeFrame(connection->input, request)) {
+                submit(connection, request, false);
+                watch(connection);
+                return;
+            }
+        }
+        catch (runtime_error&) {
+            // An oversized frame: the rest of the stream cannot be trusted
+            connection->input.clear();
+            connection->readClosed = true;
+        }
+    }
+
+    bool finished = connection->readClosed || connection->ending;
+    if (finished && connection->sent == connection->output.size()) {
+        closeConnection(connection);
+        return;
+    }
+    watch(connection);
+}
+
+void Server::submit(Connection* connection, const string& request, bool close) {
+    Job job;
+    job.connection = connection->id;
+    job.session = connection->session;
+    job.request = request;
+    job.close = close;
+
+    connection->session = NULL;
+    connection->busy = true;
+    {
+        lock_guard<mutex> guard(jobLock);
+        jobs.push_back(job);
+    }
+    jobReady.notify_one();
+}
+
+void Server::receiveReplies() {
+    deque<Reply> ready;
+    {
+        lock_guard<mutex> guard(replyLock);
+        ready.swap(replies);
+    }
+
+    for (size_t i = 0; i < ready.size(); i++) {
+        Reply& reply = ready[i];
+        map<int, Connection*>::iterator it = connections.find(reply.connection);
+        if (it == connections.end()) continue;
+
+        Connection* connection = it->second;
+        connection->busy = false;
+        connection->session = reply.session;
+        if (reply.closed) {
+            connections.erase(it);
+            delete connection;
+            continue;
+        }
+
+        if (connection->fd >= 0) connection->output += reply.frame;
+        if (reply.ended) connection->ending = true;
+        writeConnection(connection);
+        dispatch(connection);
+    }
+}
+
+// The socket is closed at once; the session, which may checkpoint its
+// database, is ended by a worker
+void Server::closeConnection(Connection* connection) {
+    if (connection->fd >= 0) {
+        ::close(connection->fd);  // also leaves the epoll set
+        connection->fd = -1;
+        connection->events = 0;
+    }
+    if (connection->session != NULL) {
+        submit(connection, "", true);
+        return;
+    }
+    connections.erase(connection->id);
+    delete connection;
+}
+
+void Server::watch(Connection* connection) {
+    if (connection->fd < 0) return;
+
+    uint32_t wanted = 0;
+    bool reading = !connection->readClosed && !connection->ending;
+    if (reading && (!connection->busy || connection->input.size() < INPUT_LIMIT)) wanted |= EPOLLIN;
+    if (connection->sent < connection->output.size()) wanted |= EPOLLOUT;
+    if (wanted == connection->events) return;
+
+    // Without interest the descriptor leaves the set, or a hung-up
+    // socket would keep reporting EPOLLHUP
+    epoll_event event;
+    event.events = wanted;
+    event.data.u64 = (uint64_t)connection->id;
+    if (wanted == 0) epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, &event);
+    else epoll_ctl(epollFd, connection->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = wanted;
+}
+
+void Server::endSessions() {
+    ::close(listenFd);
+    listenFd = -1;
+
+    {
+        lock_guard<mutex> guard(jobLock);
+        workersStopping = true;
+    }
+    jobReady.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+
+    // Take back the sessions the workers held
+    for (size_t i = 0; i < replies.size(); i++) {
+        map<int, Connection*>::iterator it = connections.find(replies[i].connection);
+        if (it != connections.end()) it->second->session = replies[i].session;
+    }
+    replies.clear();
+
+    for (map<int, Connection*>::iterator it = connections.begin(); it != connections.end(); ++it) {
+        Connection* connection = it->second;
+        if (connection->fd >= 0) ::close(connection->fd);
+        delete connection->session;
+        delete connection;
+    }
+    connections.clear();
+}
+
+// ================== WORKERS ==================
+
+void Server::workerLoop() {
+    while (true) {
+        Job job;
+        {
+            unique_lock<mutex> guard(jobLock);
+            while (jobs.empty() && !workersStopping) jobReady.wait(guard);
+            if (jobs.empty()) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        Reply reply;
+        runJob(job, reply);
+        {
+            lock_guard<mutex> guard(replyLock);
+            replies.push_back(reply);
+        }
+        wake(wakeFd);
+    }
+}
+
+void Server::runJob(Job& job, Reply& reply) {
+    reply.connection = job.connection;
+    reply.session = NULL;
+    reply.ended = false;
+    reply.closed = job.close;
+
+    // room for the status byte and the database name in the same frame
+    ResponseBuffer output(WireProtocol::MAX_FRAME - 1024);
+    SessionOutput::capture(&output);
+
+    if (job.close) {
+        delete job.session;
+        SessionOutput::capture(NULL);
+        return;
+    }
+
+    bool open = true;
+    try {
+        if (job.session == NULL) job.session = new Session(catalog, true);
+
+        vector<string> commands;
+        Session::splitCommands(job.request, commands);
+        for (size_t i = 0; i < commands.size() && open; i++) {
+            open = job.session->execute(commands[i]);
+            cout << endl;
+        }
+    }
+    catch (exception& e) {
+        cout << "Error: " << e.what() << endl;
+    }
+    SessionOutput::capture(NULL);
+
+    // A session that could not start ends with its first request
+    reply.session = job.session;
+    reply.ended = !open || job.session == NULL;
+    string database = job.session != NULL ? job.session->getDatabase() : "";
+    WireProtocol::ResponseStatus status = reply.ended ? WireProtocol::RESPONSE_CLOSED : WireProtocol::RESPONSE_OPEN;
+    if (output.isComplete()) {
+        WireProtocol::appendFrame(reply.frame, WireProtocol::encodeResponse(status, database, output.str()));
+    }
+    else {
+        string error = "Error: The response of " + to_string(output.size()) + " bytes exceeds the " +
+            to_string(WireProtocol::MAX_FRAME / (1024 * 1024)) + " MB a response can carry; narrow the " +
+            "query with WHERE or LIMIT.\n";
+        WireProtocol::appendFrame(reply.frame, WireProtocol::encodeResponse(status, database, error));
+    }
+}
+
+#else
+
+Server::Server(DatabaseCatalog& databases, int workers)
+    : catalog(databases), workerCount(workers > 0 ? workers : 1), listenFd(-1), epollFd(-1), wakeFd(-1),
+    stopping(false), nextConnection(0), workersStopping(false) {
+}
+
+Server::~Server() {
+}
+
+bool Server::listen(const string& host, int port, string& error) {
+    error = "server mode needs Linux (epoll)";
+    return false;
+}
+
+void Server::run() {
+}
+
+void Server::stop() {
+    stopping = true;
+}
+
+#endif
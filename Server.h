@@ -0,0 +1,112 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+#include "DatabaseCatalog.h"
+
+class Session;
+
+// TCP server for the shell commands (WireProtocol.h).
+//
+// One I/O thread runs an epoll loop: it accepts connections, reads their
+// requests and writes the responses, never blocking on either. Requests
+// are run by a pool of worker threads, each connection in its own Session
+// (so USE is per connection) and one request at a time, in order.
+// Statements on the same database run concurrently too: SELECTs read a
+// snapshot and writes lock only the table they change.
+//
+// Linux only; elsewhere listen() fails.
+class Server {
+private:
+    struct Connection {
+        int id;
+        int fd;
+        string input;        // received, not yet a complete request
+        string output;       // responses not yet sent
+        size_t sent;         // bytes of output already sent
+        Session* session;    // NULL until the first request, or while a worker holds it
+        bool busy;           // a request or the close is with a worker
+        bool readClosed;     // the client sent everything it will send
+        bool ending;         // close once output is sent
+        uint32_t events;     // registered with epoll, 0 when not
+    };
+
+    // Work for the pool: a request, or the end of a session
+    struct Job {
+        int connection;
+        Session* session;
+        string request;
+        bool close;
+    };
+
+    struct Reply {
+        int connection;
+        Session* session;
+        string frame;        // empty for a closed session
+        bool ended;          // the session ended with this request
+        bool closed;
+    };
+
+    DatabaseCatalog& catalog;
+    int workerCount;
+
+    int listenFd;
+    int epollFd;
+    int wakeFd;              // eventfd: replies are ready, or stop() was called
+    atomic<bool> stopping;
+
+    // I/O thread only
+    map<int, Connection*> connections;
+    int nextConnection;
+
+    mutex jobLock;
+    condition_variable jobReady;
+    deque<Job> jobs;
+    bool workersStopping;
+    vector<thread> workers;
+
+    mutex replyLock;
+    deque<Reply> replies;
+
+    void acceptConnections();
+    void readConnection(Connection* connection);
+    void writeConnection(Connection* connection);
+    void dispatch(Connection* connection);
+    void submit(Connection* connection, const string& request, bool close);
+    void receiveReplies();
+    void closeConnection(Connection* connection);
+    void watch(Connection* connection);
+    void endSessions();
+
+    void workerLoop();
+    void runJob(Job& job, Reply& reply);
+
+    Server(const Server&);
+    Server& operator=(const Server&);
+
+public:
+    Server(DatabaseCatalog& databases, int workers);
+    ~Server();
+
+    // Binds and listens; false with the reason in error
+    bool listen(const string& host, int port, string& error);
+
+    // Serves until stop(); then lets the requests already received finish
+    // and ends every session. Responses not yet sent are dropped.
+    void run();
+
+    // Safe to call from a signal handler
+    void stop();
+};
+
+#endif
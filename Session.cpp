@@ -0,0 +1,484 @@
+#include "Session.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+using namespace std;
+
+static const char* MASTER_DATABASE = "master";
+
+static string trimString(const string& str) {
+    int first = 0;
+    int last = (int)str.size() - 1;
+
+    while (first <= last && isspace((unsigned char)str[first])) first++;
+    while (last >= first && isspace((unsigned char)str[last])) last--;
+
+    if (first > last) return "";
+    return str.substr(first, last - first + 1);
+}
+
+// SET WAL_SYNC = STATEMENT | <n> MS | <n> RECORDS
+static void setWalSync(DatabaseEngine& db, SessionSettings& settings, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    string mode = (eqPos == string::npos) ? "" : trimString(upperQuery.substr(eqPos + 1));
+
+    if (mode == "STATEMENT") {
+        settings.syncSet = true;
+        settings.syncMode = SYNC_EVERY_STATEMENT;
+        settings.syncParam = 0;
+        db.setSyncMode(SYNC_EVERY_STATEMENT);
+        cout << "WAL is synced after every statement." << endl;
+        return;
+    }
+
+    istringstream iss(mode);
+    int n = 0;
+    string unit;
+    iss >> n >> unit;
+
+    if (n > 0 && unit == "MS") {
+        settings.syncSet = true;
+        settings.syncMode = SYNC_INTERVAL;
+        settings.syncParam = n;
+        db.setSyncMode(SYNC_INTERVAL, n);
+        cout << "WAL is synced every " << n << " ms." << endl;
+    }
+    else if (n > 0 && unit == "RECORDS") {
+        settings.syncSet = true;
+        settings.syncMode = SYNC_RECORDS;
+        settings.syncParam = n;
+        db.setSyncMode(SYNC_RECORDS, n);
+        cout << "WAL is synced every " << n << " records." << endl;
+    }
+    else {
+        cout << "Error: Expected SET WAL_SYNC = STATEMENT | <n> MS | <n> RECORDS" << endl;
+    }
+}
+
+// SET OUTPUT = TABLE | CSV | COUNT
+static void setOutput(OutputFormat& output, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    string format = (eqPos == string::npos) ? "" : trimString(upperQuery.substr(eqPos + 1));
+
+    if (format == "TABLE") output = OUTPUT_TABLE;
+    else if (format == "CSV") output = OUTPUT_CSV;
+    else if (format == "COUNT") output = OUTPUT_COUNT;
+    else {
+        cout << "Error: Expected SET OUTPUT = TABLE | CSV | COUNT" << endl;
+        return;
+    }
+    cout << "SELECT output format set to " << format << "." << endl;
+}
+
+// SET THREADS = <n>
+static void setThreads(DatabaseEngine& db, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    istringstream iss(eqPos == string::npos ? "" : upperQuery.substr(eqPos + 1));
+    int n = 0;
+    string rest;
+    iss >> n;
+
+    if (n > 0 && n <= 1024 && !iss.fail() && !(iss >> rest)) {
+        db.setThreadCount(n);
+        cout << "Parallel scans use " << n << " thread(s)." << endl;
+    }
+    else {
+        cout << "Error: Expected SET THREADS = <n> (1-1024)" << endl;
+    }
+}
+
+// SET BUFFER_POOL = <n> MB
+static void setBufferPool(DatabaseEngine& db, SessionSettings& settings, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    istringstream iss(eqPos == string::npos ? "" : upperQuery.substr(eqPos + 1));
+    int n = 0;
+    string unit;
+    iss >> n >> unit;
+
+    if (n > 0 && unit == "MB") {
+        settings.bufferPool = (size_t)n * 1024 * 1024;
+        db.setBufferPoolSize(settings.bufferPool);
+        cout << "Buffer pool size set to " << n << " MB." << endl;
+    }
+    else {
+        cout << "Error: Expected SET BUFFER_POOL = <n> MB" << endl;
+    }
+}
+
+// SET SORT_MEMORY = <n> MB
+static void setSortMemory(DatabaseEngine& db, SessionSettings& settings, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    istringstream iss(eqPos == string::npos ? "" : upperQuery.substr(eqPos + 1));
+    int n = 0;
+    string unit;
+    iss >> n >> unit;
+
+    if (n > 0 && unit == "MB") {
+        settings.sortMemory = (size_t)n * 1024 * 1024;
+        db.setSortMemory(settings.sortMemory);
+        cout << "ORDER BY sorts up to " << n << " MB in memory before spilling to disk." << endl;
+    }
+    else {
+        cout << "Error: Expected SET SORT_MEMORY = <n> MB" << endl;
+    }
+}
+
+// SET JOIN_MEMORY = <n> MB
+static void setJoinMemory(DatabaseEngine& db, SessionSettings& settings, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    istringstream iss(eqPos == string::npos ? "" : upperQuery.substr(eqPos + 1));
+    int n = 0;
+    string unit;
+    iss >> n >> unit;
+
+    if (n > 0 && unit == "MB") {
+        settings.joinMemory = (size_t)n * 1024 * 1024;
+        db.setJoinMemory(settings.joinMemory);
+        cout << "JOIN hashes up to " << n << " MB in memory before partitioning to disk." << endl;
+    }
+    else {
+        cout << "Error: Expected SET JOIN_MEMORY = <n> MB" << endl;
+    }
+}
+
+// SET PLAN_CACHE = <n>
+static void setPlanCache(DatabaseEngine& db, SessionSettings& settings, const string& upperQuery) {
+    size_t eqPos = upperQuery.find('=');
+    istringstream iss(eqPos == string::npos ? "" : upperQuery.substr(eqPos + 1));
+    int n = -1;
+    string rest;
+    iss >> n;
+
+    if (n >= 0 && !iss.fail() && !(iss >> rest)) {
+        settings.planCache = n;
+        db.setPlanCacheSize((size_t)n);
+        cout << "Plan cache holds up to " << n << " query shapes." << endl;
+    }
+    else {
+        cout << "Error: Expected SET PLAN_CACHE = <n>" << endl;
+    }
+}
+
+// ================== HELP TEXT ==================
+
+void Session::printHelp() {
+    cout << "\nSupported commands:" << endl;
+    cout << "  CREATE DATABASE db_name" << endl;
+    cout << "  LIST DATABASES" << endl;
+    cout << "  DROP DATABASE db_name" << endl;
+    cout << "  USE db_name" << endl;
+    cout << "  CREATE TABLE table_name (col1 type1 [PRIMARY KEY] [NOT NULL], ...)" << endl;
+    cout << "  INSERT INTO table_name VALUES (val1, val2, ...)[, (...), ...]" << endl;
+    cout << "  COPY table_name FROM 'file.csv' [WITH (DELIMITER ',', HEADER)]" << endl;
+    cout << "  SELECT * FROM table_name [WHERE condition]" << endl;
+    cout << "  SELECT col1, col2 FROM table_name [WHERE condition]" << endl;
+    cout << "  SELECT col, COUNT(*), SUM(col2) FROM table_name [WHERE condition] GROUP BY col [HAVING COUNT(*) > n]" << endl;
+    cout << "  SELECT ... [ORDER BY col [ASC|DESC], ...] [LIMIT n [OFFSET m]]" << endl;
+    cout << "  SELECT a.col, b.col FROM a [LEFT] JOIN b ON a.x = b.y [WHERE condition]" << endl;
+    cout << "  UPDATE table_name SET col1=val1, col2=val2 [WHERE condition]" << endl;
+    cout << "  DELETE FROM table_name" << endl;
+    cout << "  DELETE FROM table_name WHERE condition" << endl;
+    cout << "  DROP TABLE table_name" << endl;
+    cout << "  CREATE INDEX index_name ON table_name(column)" << endl;
+    cout << "  DROP INDEX index_name" << endl;
+    cout << "  ANALYZE [table_name]" << endl;
+    cout << "  EXPLAIN [ANALYZE] SELECT ..." << endl;
+    cout << "  DROP database db_name" << endl;
+    cout << "  LIST DATABASES" << endl;
+    cout << "  LIST TABLES" << endl;
+    cout << "  CHECKPOINT" << endl;
+    cout << "  SET WAL_SYNC = STATEMENT | <n> MS | <n> RECORDS" << endl;
+    cout << "  SET BUFFER_POOL = <n> MB" << endl;
+    cout << "  SHOW BUFFER STATS" << endl;
+    cout << "  SET SORT_MEMORY = <n> MB" << endl;
+    cout << "  SET JOIN_MEMORY = <n> MB" << endl;
+    cout << "  SET PLAN_CACHE = <n>" << endl;
+    cout << "  SHOW CACHE STATS" << endl;
+    cout << "  SET THREADS = <n>" << endl;
+    cout << "  SET OUTPUT = TABLE | CSV | COUNT" << endl;
+    cout << "  HELP" << endl;
+    cout << "  EXIT" << endl;
+    cout << "\nSupported types: INT, FLOAT, VARCHAR(size)" << endl;
+    cout << "Supported operators in WHERE: =, !=, <>, <, >, <=, >=" << endl;
+    cout << "Supported aggregates: COUNT(*), COUNT(col), SUM, AVG, MIN, MAX" << endl;
+}
+
+// ================== STATEMENTS ==================
+
+// The commands that run against one database; false for any other.
+// The SET commands also record the setting in `settings`.
+static bool runStatement(DatabaseEngine& db, const string& query, const string& upperQuery, bool shared,
+    SessionSettings& settings) {
+    if (upperQuery == "LIST TABLES") {
+        db.listTables();
+    }
+    else if (upperQuery.find("CREATE TABLE") == 0) {
+        db.createTable(query);
+    }
+    else if (upperQuery.find("INSERT INTO") == 0) {
+        db.insertInto(query);
+    }
+    else if (upperQuery.find("COPY ") == 0) {
+        db.copyFrom(query);
+    }
+    else if (upperQuery.find("SELECT") == 0) {
+        db.selectFrom(query, settings.output);
+    }
+    else if (upperQuery.find("UPDATE") == 0) {
+        db.updateTable(query);
+    }
+    else if (upperQuery.find("DELETE") == 0) {
+        db.deleteFrom(query);
+    }
+    else if (upperQuery.find("DROP TABLE") == 0) {
+        db.dropTable(query);
+    }
+    else if (upperQuery.find("CREATE INDEX") == 0) {
+        db.createIndex(query);
+    }
+    else if (upperQuery.find("DROP INDEX") == 0) {
+        db.dropIndex(query);
+    }
+    else if (upperQuery.find("EXPLAIN") == 0) {
+        db.explain(query);
+    }
+    else if (upperQuery.find("ANALYZE") == 0) {
+        db.analyze(query);
+    }
+    else if (upperQuery.find("SET WAL_SYNC") == 0) {
+        setWalSync(db, settings, upperQuery);
+    }
+    else if (upperQuery.find("SET BUFFER_POOL") == 0) {
+        setBufferPool(db, settings, upperQuery);
+    }
+    else if (upperQuery.find("SET SORT_MEMORY") == 0) {
+        setSortMemory(db, settings, upperQuery);
+    }
+    else if (upperQuery.find("SET JOIN_MEMORY") == 0) {
+        setJoinMemory(db, settings, upperQuery);
+    }
+    else if (upperQuery.find("SET OUTPUT") == 0) {
+        setOutput(settings.output, upperQuery);
+    }
+    else if (upperQuery.find("SET THREADS") == 0) {
+        // the pool is the process's, and resizing it under running scans is unsafe
+        if (shared) cout << "Error: SET THREADS is not available to server sessions; start the server with --threads." << endl;
+        else setThreads(db, upperQuery);
+    }
+    else if (upperQuery == "SHOW BUFFER STATS") {
+        db.showBufferStats();
+    }
+    else if (upperQuery.find("SET PLAN_CACHE") == 0) {
+        setPlanCache(db, settings, upperQuery);
+    }
+    else if (upperQuery == "SHOW CACHE STATS") {
+        db.showCacheStats();
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// ================== SESSION ==================
+
+SessionSettings::SessionSettings()
+    : output(OUTPUT_TABLE), syncSet(false), syncMode(SYNC_EVERY_STATEMENT), syncParam(0),
+    bufferPool(0), sortMemory(0), joinMemory(0), planCache(-1) {
+}
+
+void SessionSettings::applyTo(DatabaseEngine& db) const {
+    if (syncSet) db.setSyncMode(syncMode, syncParam);
+    if (bufferPool > 0) db.setBufferPoolSize(bufferPool);
+    if (sortMemory > 0) db.setSortMemory(sortMemory);
+    if (joinMemory > 0) db.setJoinMemory(joinMemory);
+    if (planCache >= 0) db.setPlanCacheSize((size_t)planCache);
+}
+
+Session::Session(DatabaseCatalog& owner, bool sharedProcess)
+    : catalog(owner), database(NULL), shared(sharedProcess) {
+    database = catalog.open(MASTER_DATABASE);
+    if (database == NULL) throw runtime_error("Database 'master' could not be opened.");
+}
+
+Session::~Session() {
+    catalog.close(database);
+}
+
+const string& Session::getDatabase() const {
+    return database->name;
+}
+
+void Session::splitCommands(const string& line, vector<string>& commands) {
+    commands.clear();
+    string temp;
+    char quote = 0;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quote != 0) {
+            if (c == quote) quote = 0;
+            temp += c;
+        }
+        else if (c == '\'' || c == '"') {
+            quote = c;
+            temp += c;
+        }
+        else if (c == ';') {
+            string cmd = trimString(temp);
+            if (!cmd.empty()) commands.push_back(cmd);
+            temp.clear();
+        }
+        else {
+            temp += c;
+        }
+    }
+    // last part (no trailing ;)
+    temp = trimString(temp);
+    if (!temp.empty()) commands.push_back(temp);
+}
+
+// Opens the database before leaving the current one, which is checkpointed
+// and closed if no other session uses it
+bool Session::useDatabase(const string& name) {
+    DatabaseCatalog::Database* next = catalog.open(name);
+    if (next == NULL) return false;
+    catalog.close(database);
+    database = next;
+    settings.applyTo(database->engine);
+    return true;
+}
+
+void Session::printInvalidName(const string& name) {
+    cout << "Error: Invalid database name '" << name << "' (not '.' or '..', without '/' or '\\', at most "
+        << DatabaseCatalog::MAX_NAME_LENGTH << " characters)." << endl;
+}
+
+void Session::createDatabase(const string& query) {
+    string dbName = trimString(query.substr(15));      // after "CREATE DATABASE"
+
+    if (dbName.empty()) {
+        cout << "Error: Database name is required." << endl;
+    }
+    else if (!DatabaseCatalog::isValidName(dbName)) {
+        printInvalidName(dbName);
+    }
+    else if (catalog.exists(dbName) || !catalog.create(dbName)) {
+        cout << "Error: Database '" << dbName << "' already exists." << endl;
+    }
+    else {
+        cout << "Database '" << dbName
+            << "' created in folder '" << catalog.folderOf(dbName) << "'." << endl;
+    }
+}
+
+void Session::dropDatabase(const string& query) {
+    string dbName = trimString(query.substr(13));      // after "DROP DATABASE"
+
+    if (dbName.empty()) {
+        cout << "Error: Database name is required." << endl;
+        return;
+    }
+    if (!DatabaseCatalog::isValidName(dbName)) {
+        printInvalidName(dbName);
+        return;
+    }
+    if (dbName == MASTER_DATABASE) {
+        cout << "Error: Cannot drop system database 'master'." << endl;
+        return;
+    }
+    if (!catalog.exists(dbName)) {
+        cout << "Error: Database '" << dbName << "' does not exist." << endl;
+        return;
+    }
+
+    if (database->name == dbName) {
+        cout << "Switching to 'master' before dropping active database..." << endl;
+        useDatabase(MASTER_DATABASE);
+    }
+
+    switch (catalog.drop(dbName)) {
+    case DatabaseCatalog::DROP_OK:
+        cout << "Database '" << dbName << "' dropped successfully." << endl;
+        break;
+    case DatabaseCatalog::DROP_INVALID:
+        printInvalidName(dbName);
+        break;
+    case DatabaseCatalog::DROP_MISSING:
+        cout << "Error: Database '" << dbName << "' does not exist." << endl;
+        break;
+    case DatabaseCatalog::DROP_IN_USE:
+        cout << "Error: Database '" << dbName << "' is in use by another session." << endl;
+        break;
+    default:
+        cout << "Error: Could not drop database (system error)." << endl;
+        break;
+    }
+}
+
+void Session::listDatabases() {
+    vector<string> names;
+    catalog.list(names);
+
+    cout << "Databases:" << endl;
+    for (size_t i = 0; i < names.size(); i++) {
+        cout << "  - " << names[i] << endl;
+    }
+}
+
+bool Session::execute(const string& command) {
+    string query = trimString(command);
+
+    // build uppercase version for matching
+    string upperQuery = query;
+    transform(upperQuery.begin(), upperQuery.end(),
+        upperQuery.begin(), ::toupper);
+
+    // the database is checkpointed when the session ends, unless another session has it open
+    if (upperQuery == "EXIT" || upperQuery == "QUIT") {
+        cout << "Goodbye!" << endl;
+        return false;
+    }
+    else if (upperQuery.find("CREATE DATABASE") == 0) {
+        createDatabase(query);
+    }
+    else if (upperQuery == "LIST DATABASES") {
+        listDatabases();
+    }
+    else if (upperQuery.find("DROP DATABASE") == 0) {
+        dropDatabase(query);
+    }
+    else if (upperQuery.find("USE ") == 0) {
+        string dbName = trimString(query.substr(4));       // after "USE "
+
+        if (dbName.empty()) {
+            cout << "Error: Database name is required." << endl;
+        }
+        else if (!DatabaseCatalog::isValidName(dbName)) {
+            printInvalidName(dbName);
+        }
+        else if (!useDatabase(dbName)) {
+            cout << "Error: Database '" << dbName << "' does not exist." << endl;
+        }
+        else {
+            cout << "Switched to database '" << database->name << "'." << endl;
+        }
+    }
+    else if (upperQuery == "CHECKPOINT") {
+        catalog.checkpoint(database);
+        cout << "Checkpoint written to '" << catalog.fileOf(database->name) << "'." << endl;
+    }
+    else if (upperQuery == "HELP") {
+        printHelp();
+    }
+    else {
+        if (!runStatement(database->engine, query, upperQuery, shared, settings)) {
+            cout << "Unknown command: " << query
+                << "\nType 'HELP' for a list of commands or 'EXIT' to quit." << endl;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "DatabaseCatalog.h"
+
+// What a session SET. The output format is the session's own; the others
+// configure the database's engine, so they are applied again to each
+// database the session switches to with USE.
+struct SessionSettings {
+    OutputFormat output;
+
+    bool syncSet;
+    SyncMode syncMode;
+    int syncParam;
+    size_t bufferPool;   // bytes; 0 while not set
+    size_t sortMemory;   // bytes; 0 while not set
+    size_t joinMemory;   // bytes; 0 while not set
+    long long planCache; // shapes; -1 while not set
+
+    SessionSettings();
+    void applyTo(DatabaseEngine& db) const;
+};
+
+// One user's connection to the engine: the REPL, or a client of the
+// server. Runs the shell commands against its current database (the one
+// chosen with USE, "master" at first) and prints their output to cout.
+class Session {
+private:
+    DatabaseCatalog& catalog;
+    DatabaseCatalog::Database* database;  // current, open for this session
+    bool shared;  // one of several sessions in the process
+    SessionSettings settings;
+
+    bool useDatabase(const string& name);
+    void createDatabase(const string& query);
+    void dropDatabase(const string& query);
+    void listDatabases();
+    static void printInvalidName(const string& name);
+
+    Session(const Session&);
+    Session& operator=(const Session&);
+
+public:
+    // A shared session refuses the settings that would change every
+    // session's process at once (SET THREADS)
+    Session(DatabaseCatalog& owner, bool sharedProcess);
+    ~Session();
+
+    const string& getDatabase() const;
+
+    // Splits a line into its commands at ';' outside quotes, trimmed
+    static void splitCommands(const string& line, vector<string>& commands);
+
+    // Runs one command; false once the session has ended (EXIT or QUIT)
+    bool execute(const string& command);
+
+    static void printHelp();
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "Statement.h"
+
+using namespace std;
+
+Literal::Literal()
+    : quote(0), escaped(false) {
+}
+
+string Literal::toString() const {
+    if (!escaped) return string(text);
+
+    // A doubled quote inside a quoted value stands for one
+    string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        result += text[i];
+        if (text[i] == quote && i + 1 < text.size() && text[i + 1] == quote) i++;
+    }
+    return result;
+}
+
+Comparison::Comparison()
+    : kind(COMPARISON_VALUE), negated(false) {
+}
+
+Statement::Statement(StatementType statementType)
+    : type(statementType) {
+}
+
+Statement::~Statement() {
+}
+
+CreateTableStatement::CreateTableStatement()
+    : Statement(STATEMENT_CREATE_TABLE) {
+}
+
+DropTableStatement::DropTableStatement()
+    : Statement(STATEMENT_DROP_TABLE) {
+}
+
+CreateIndexStatement::CreateIndexStatement()
+    : Statement(STATEMENT_CREATE_INDEX) {
+}
+
+DropIndexStatement::DropIndexStatement()
+    : Statement(STATEMENT_DROP_INDEX) {
+}
+
+InsertStatement::InsertStatement()
+    : Statement(STATEMENT_INSERT) {
+}
+
+int InsertStatement::getRowCount() const {
+    return (int)rowEnds.size();
+}
+
+int InsertStatement::getRowStart(int row) const {
+    return row == 0 ? 0 : rowEnds[row - 1];
+}
+
+SelectStatement::SelectStatement()
+    : Statement(STATEMENT_SELECT), leftJoin(false) {
+}
+
+bool SelectStatement::isAggregate() const {
+    if (!groupBy.empty() || !having.empty()) return true;
+    for (int i = 0; i < (int)columns.size(); i++) {
+        if (columns[i].function != AGGREGATE_NONE) return true;
+    }
+    return false;
+}
+
+UpdateStatement::UpdateStatement()
+    : Statement(STATEMENT_UPDATE) {
+}
+
+DeleteStatement::DeleteStatement()
+    : Statement(STATEMENT_DELETE) {
+}
+
+CopyStatement::CopyStatement()
+    : Statement(STATEMENT_COPY), delimiter(','), header(false) {
+}
+
+AnalyzeStatement::AnalyzeStatement()
+    : Statement(STATEMENT_ANALYZE) {
+}
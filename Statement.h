@@ -0,0 +1,201 @@
+#ifndef STATEMENT_H
+#define STATEMENT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+#include "Column.h"
+
+// Syntax tree of one statement, built by QueryParser::parse. Names and
+// values are views into the statement text, which must outlive the tree.
+
+enum StatementType {
+    STATEMENT_CREATE_TABLE,
+    STATEMENT_DROP_TABLE,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_DROP_INDEX,
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_UPDATE,
+    STATEMENT_DELETE,
+    STATEMENT_COPY,
+    STATEMENT_ANALYZE
+};
+
+// A value as written: the text between the quotes of a quoted value, or
+// the raw text of an unquoted one (which may span several tokens, as in
+// John Smith or 2024-01-31). An empty unquoted value is NULL.
+struct Literal {
+    string_view text;
+    char quote;    // the quote character, or 0 when unquoted
+    bool escaped;  // holds doubled quotes
+
+    Literal();
+    string toString() const;
+};
+
+enum ComparisonKind {
+    COMPARISON_VALUE,    // column op value; op is one of = != < > <= >=
+    COMPARISON_IN,       // column [NOT] IN (value, ...)
+    COMPARISON_BETWEEN,  // column [NOT] BETWEEN value AND value
+    COMPARISON_AND,
+    COMPARISON_OR,
+    COMPARISON_NOT       // of its one child
+};
+
+// A node of a WHERE expression
+struct Comparison {
+    ComparisonKind kind;
+    string_view column;
+    string_view op;
+    Literal value;
+    vector<Literal> values;         // the IN list, or the BETWEEN bounds
+    bool negated;                   // NOT IN, NOT BETWEEN
+    vector<Comparison> children;    // AND, OR, NOT
+
+    Comparison();
+};
+
+enum AggregateFunction {
+    AGGREGATE_NONE,  // a plain column
+    AGGREGATE_COUNT,
+    AGGREGATE_SUM,
+    AGGREGATE_AVG,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX
+};
+
+// A select list entry: a column, or an aggregate of one (no column for COUNT(*))
+struct SelectItem {
+    AggregateFunction function;
+    string_view column;
+};
+
+// HAVING item op value
+struct HavingComparison {
+    SelectItem item;
+    string_view op;
+    Literal value;
+};
+
+// ORDER BY item [ASC | DESC]
+struct OrderItem {
+    SelectItem item;
+    bool descending;
+};
+
+struct Assignment {
+    string_view column;
+    Literal value;
+};
+
+struct ColumnDefinition {
+    string_view name;
+    DataType type;
+    int size;
+    bool primaryKey;
+    bool notNull;
+};
+
+class Statement {
+public:
+    StatementType type;
+    string_view table;
+
+    explicit Statement(StatementType statementType);
+    virtual ~Statement();
+};
+
+class CreateTableStatement : public Statement {
+public:
+    vector<ColumnDefinition> columns;
+
+    CreateTableStatement();
+};
+
+class DropTableStatement : public Statement {
+public:
+    DropTableStatement();
+};
+
+class CreateIndexStatement : public Statement {
+public:
+    string_view index;
+    string_view column;
+
+    CreateIndexStatement();
+};
+
+class DropIndexStatement : public Statement {
+public:
+    string_view index;
+
+    DropIndexStatement();
+};
+
+// VALUES tuples stored back to back; rowEnds[r] is one past row r's last value
+class InsertStatement : public Statement {
+public:
+    vector<Literal> values;
+    vector<int> rowEnds;
+
+    InsertStatement();
+
+    int getRowCount() const;
+    int getRowStart(int row) const;
+};
+
+// Column names in a SELECT may be qualified with their table: users.id
+class SelectStatement : public Statement {
+public:
+    vector<SelectItem> columns;        // empty for *
+    string_view joinTable;             // [INNER | LEFT] JOIN joinTable ON joinLeft = joinRight
+    bool leftJoin;
+    string_view joinLeft;
+    string_view joinRight;
+    vector<Comparison> where;          // ANDed; each may be an expression tree
+    vector<string_view> groupBy;
+    vector<HavingComparison> having;   // ANDed
+    vector<OrderItem> orderBy;
+    Literal limit;                     // empty text when not given
+    Literal offset;
+
+    SelectStatement();
+
+    // Has an aggregate, GROUP BY or HAVING
+    bool isAggregate() const;
+};
+
+class UpdateStatement : public Statement {
+public:
+    vector<Assignment> assignments;
+    vector<Comparison> where;
+
+    UpdateStatement();
+};
+
+class DeleteStatement : public Statement {
+public:
+    vector<Comparison> where;
+
+    DeleteStatement();
+};
+
+class CopyStatement : public Statement {
+public:
+    Literal file;
+    char delimiter;
+    bool header;
+
+    CopyStatement();
+};
+
+// ANALYZE [table]; without a table every table is analyzed
+class AnalyzeStatement : public Statement {
+public:
+    AnalyzeStatement();
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include "Statistics.h"
+#include "Table.h"
+#include "ThreadPool.h"
+#include "FilterKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Selectivity guesses for tables that were never analyzed
+static const double EQUAL_SELECTIVITY = 0.1;
+static const double RANGE_SELECTIVITY = 1.0 / 3;
+
+// CostModel: a row found through an index is looked up in the tree,
+// sorted back into table order and tested; a scanned row is visited and
+// tested; a parallel scan pays for dispatching morsels and joining results
+static const double INDEX_ROW_COST = 4.0;
+static const double SCAN_ROW_COST = 0.1;
+static const double PARALLEL_START_COST = 50000.0;
+
+static uint64_t hashKey(const char* data, size_t length) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < length; i++, shift += 8) {
+        tail |= (uint64_t)(unsigned char)data[i] << shift;
+    }
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+// The sketch reads register and rank from separate bit ranges, so every
+// bit must depend on the whole key; short keys leave hashKey's low bits
+// nearly constant
+static uint64_t mixBits(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+ColumnStats::ColumnStats()
+    : nullCount(0), distinct(0) {
+}
+
+TableStats::TableStats()
+    : rowCount(-1) {
+}
+
+bool TableStats::isAnalyzed() const {
+    return rowCount >= 0;
+}
+
+// ================== ESTIMATES ==================
+
+static bool isRange(const string& op) {
+    return op == "<" || op == "<=" || op == ">" || op == ">=";
+}
+
+// Fraction of the non-NULL values equal to `value`: one distinct value's
+// share, or more when the value fills whole histogram buckets
+double TableStats::equalFraction(const ColumnStats& stats, bool numeric, const string& value) const {
+    size_t bounds;
+    size_t repeats;
+    if (numeric) {
+        const vector<double>& b = stats.numberBounds;
+        double x = atof(value.c_str());
+        if (x < b.front() || x > b.back()) return 0;
+        bounds = b.size();
+        repeats = (size_t)(upper_bound(b.begin(), b.end(), x) - lower_bound(b.begin(), b.end(), x));
+    }
+    else {
+        const vector<string>& b = stats.textBounds;
+        if (value < b.front() || value > b.back()) return 0;
+        bounds = b.size();
+        repeats = (size_t)(upper_bound(b.begin(), b.end(), value) - lower_bound(b.begin(), b.end(), value));
+    }
+
+    double fraction = 1.0 / max(stats.distinct, 1.0);
+    if (repeats > 1 && bounds > 1) {
+        fraction = max(fraction, (double)(repeats - 1) / (double)(bounds - 1));
+    }
+    return fraction;
+}
+
+// Fraction of the non-NULL values below `value` (or equal, when
+// inclusive), interpolating linearly inside a numeric bucket
+double TableStats::belowFraction(const ColumnStats& stats, bool numeric, const string& value,
+    bool inclusive) const {
+    size_t buckets;
+    size_t position;  // first bound not below the value
+    double within = 0.5;
+
+    if (numeric) {
+        const vector<double>& b = stats.numberBounds;
+        double x = atof(value.c_str());
+        buckets = b.size() - 1;
+        position = (size_t)(lower_bound(b.begin(), b.end(), x) - b.begin());
+        if (position > 0 && position <= buckets && b[position] > b[position - 1]) {
+            within = (x - b[position - 1]) / (b[position] - b[position - 1]);
+        }
+    }
+    else {
+        const vector<string>& b = stats.textBounds;
+        buckets = b.size() - 1;
+        position = (size_t)(lower_bound(b.begin(), b.end(), value) - b.begin());
+    }
+
+    double below;
+    if (position == 0) below = 0;
+    else if (position > buckets) below = 1;
+    else below = ((double)(position - 1) + within) / (double)buckets;
+
+    if (inclusive) below += equalFraction(stats, numeric, value);
+    return min(below, 1.0);
+}
+
+// column op value. A NULL reads as 0 or an empty string in comparisons,
+// so NULL rows pass exactly when the comparison holds for that reading.
+double TableStats::compareFraction(const Table& table, int column, const string& op,
+    const string& value) const {
+    if (!isAnalyzed() || column >= (int)columns.size()) {
+        if (op == "=" || op == "!=") {
+            double equal = EQUAL_SELECTIVITY;
+            // a key value is in at most one row
+            if (column == table.getPrimaryKeyIndex() && table.getRowCount() > 0) {
+                equal = 1.0 / table.getRowCount();
+            }
+            return (op == "=") ? equal : 1 - equal;
+        }
+        return RANGE_SELECTIVITY;
+    }
+
+    const ColumnStats& stats = columns[column];
+    DataType type = table.getColumns()[column].getType();
+    bool numeric = type != VARCHAR;
+    double nulls = (rowCount > 0) ? min(1.0, (double)stats.nullCount / (double)rowCount) : 0;
+
+    double fraction = 0;
+    bool empty = numeric ? stats.numberBounds.empty() : stats.textBounds.empty();
+    if (!empty) {
+        if (op == "=") fraction = equalFraction(stats, numeric, value);
+        else if (op == "!=") fraction = 1 - equalFraction(stats, numeric, value);
+        else if (op == "<") fraction = belowFraction(stats, numeric, value, false);
+        else if (op == "<=") fraction = belowFraction(stats, numeric, value, true);
+        else if (op == ">") fraction = 1 - belowFraction(stats, numeric, value, true);
+        else fraction = 1 - belowFraction(stats, numeric, value, false);
+    }
+
+    bool nullPasses = Condition("", op, value).evaluate("", type);
+    return (1 - nulls) * fraction + (nullPasses ? nulls : 0);
+}
+
+double TableStats::selectivity(const Table& table, const Condition& condition) const {
+    if (condition.kind == CONDITION_AND) {
+        return selectivity(table, condition.children);
+    }
+    if (condition.kind == CONDITION_OR) {
+        double none = 1;
+        for (size_t i = 0; i < condition.children.size(); i++) {
+            none *= 1 - selectivity(table, condition.children[i]);
+        }
+        return 1 - none;
+    }
+
+    // unknown columns are ignored, so they pass every row
+    int column = table.getColumnIndex(condition.columnName);
+    if (column == -1) return 1;
+
+    if (condition.kind == CONDITION_COMPARE) {
+        return compareFraction(table, column, condition.op, condition.value);
+    }
+
+    double found = 0;
+    for (size_t i = 0; i < condition.values.size(); i++) {
+        found += compareFraction(table, column, "=", condition.values[i]);
+    }
+    found = min(found, 1.0);
+    return (condition.op == "IN") ? found : 1 - found;
+}
+
+double TableStats::selectivity(const Table& table, const vector<Condition>& conditions) const {
+    double result = 1;
+    vector<bool> combined(conditions.size(), false);
+
+    for (size_t i = 0; i < conditions.size(); i++) {
+        if (combined[i]) continue;
+        const Condition& condition = conditions[i];
+        int column = (condition.kind == CONDITION_COMPARE) ? table.getColumnIndex(condition.columnName) : -1;
+        if (!isAnalyzed() || column == -1 || !isRange(condition.op)) {
+            result *= selectivity(table, condition);
+            continue;
+        }
+
+        // a >= 10 AND a <= 20 keeps the rows between the two, rather than
+        // the product of the two fractions
+        double low = 0, high = 1;
+        for (size_t j = i; j < conditions.size(); j++) {
+            const Condition& other = conditions[j];
+            if (other.kind != CONDITION_COMPARE || !isRange(other.op) ||
+                table.getColumnIndex(other.columnName) != column) {
+                continue;
+            }
+            combined[j] = true;
+            double fraction = compareFraction(table, column, other.op, other.value);
+            if (other.op[0] == '<') high = min(high, fraction);
+            else low = max(low, 1 - fraction);
+        }
+        result *= max(high - low, 0.0);
+    }
+    return result;
+}
+
+// ================== ENCODING ==================
+
+// row count, column count, then per column: NULL count, distinct count,
+// bound kind (0 numbers, 1 text), bound count and the bounds
+void TableStats::encode(string& out) const {
+    putU64(out, (uint64_t)rowCount);
+    putU32(out, (uint32_t)columns.size());
+    for (size_t c = 0; c < columns.size(); c++) {
+        const ColumnStats& stats = columns[c];
+        putU64(out, (uint64_t)stats.nullCount);
+        putU64(out, (uint64_t)llround(stats.distinct));
+        bool text = !stats.textBounds.empty();
+        putU8(out, text ? 1 : 0);
+        if (text) {
+            putU32(out, (uint32_t)stats.textBounds.size());
+            for (size_t i = 0; i < stats.textBounds.size(); i++) {
+                putString(out, stats.textBounds[i]);
+            }
+        }
+        else {
+            putU32(out, (uint32_t)stats.numberBounds.size());
+            for (size_t i = 0; i < stats.numberBounds.size(); i++) {
+                uint64_t bits;
+                memcpy(&bits, &stats.numberBounds[i], sizeof(bits));
+                putU64(out, bits);
+            }
+        }
+    }
+}
+
+void TableStats::decode(ByteReader& in) {
+    rowCount = (long long)in.u64();
+    columns.assign(in.u32(), ColumnStats());
+    for (size_t c = 0; c < columns.size(); c++) {
+        ColumnStats& stats = columns[c];
+        stats.nullCount = (long long)in.u64();
+        stats.distinct = (double)in.u64();
+        bool text = in.u8() != 0;
+        uint32_t count = in.u32();
+        for (uint32_t i = 0; i < count; i++) {
+            if (text) {
+                stats.textBounds.push_back(in.str());
+                continue;
+            }
+            uint64_t bits = in.u64();
+            double bound;
+            memcpy(&bound, &bits, sizeof(bound));
+            stats.numberBounds.push_back(bound);
+        }
+    }
+}
+
+// ================== COLLECTION ==================
+
+StatsCollector::StatsCollector(const Table& table)
+    : rowCount(0), slice(NULL) {
+    const vector<Column>& cols = table.getColumns();
+    states.resize(cols.size());
+    for (size_t c = 0; c < cols.size(); c++) {
+        ColumnState& state = states[c];
+        state.type = cols[c].getType();
+        state.nullCount = 0;
+        state.seen = 0;
+        state.registers.assign((size_t)1 << SKETCH_BITS, 0);
+        state.minNumber = state.maxNumber = 0;
+        state.random = 0x9E3779B97F4A7C15ULL * (c + 1);
+    }
+}
+
+void StatsCollector::add(const Table& rows) {
+    slice = &rows;
+    ThreadPool::shared().run(addColumn, this, (int)states.size());
+    slice = NULL;
+    rowCount += rows.getRowCount();
+}
+
+void StatsCollector::addColumn(void* context, int column) {
+    StatsCollector* collector = (StatsCollector*)context;
+    ColumnState& state = collector->states[column];
+    const ColumnVector& data = collector->slice->getColumnData(column);
+    int rows = collector->slice->getRowCount();
+
+    for (int row = 0; row < rows; row++) {
+        if (data.isNull(row)) {
+            state.nullCount++;
+            continue;
+        }
+        if (state.type == INT) {
+            int64_t value = data.getInt(row);
+            collector->addValue(state, hashKey((const char*)&value, sizeof(value)), (double)value, NULL, 0);
+        }
+        else if (state.type == FLOAT) {
+            double value = data.getDouble(row);
+            if (value == 0) value = 0;  // -0.0 is the same value as 0.0
+            collector->addValue(state, hashKey((const char*)&value, sizeof(value)), value, NULL, 0);
+        }
+        else {
+            uint32_t length;
+            const char* text = data.getText(row, length);
+            collector->addValue(state, hashKey(text, length), 0, text, length);
+        }
+    }
+}
+
+void StatsCollector::addValue(ColumnState& state, uint64_t hash, double number, const char* text,
+    uint32_t length) {
+    // HyperLogLog: the low bits pick a register, which keeps the longest
+    // run of trailing zero bits seen in the rest of the hash, plus one
+    hash = mixBits(hash);
+    uint64_t rest = hash >> SKETCH_BITS;
+    uint8_t rank = (uint8_t)((rest == 0) ? 64 - SKETCH_BITS + 1 : FilterKernels::countTrailingZeros(rest) + 1);
+    uint8_t& reg = state.registers[hash & (((uint64_t)1 << SKETCH_BITS) - 1)];
+    if (rank > reg) reg = rank;
+
+    bool numeric = state.type != VARCHAR;
+    if (numeric) {
+        if (state.seen == 0 || number < state.minNumber) state.minNumber = number;
+        if (state.seen == 0 || number > state.maxNumber) state.maxNumber = number;
+    }
+    else {
+        if (state.seen == 0 || state.minText.compare(0, string::npos, text, length) > 0) {
+            state.minText.assign(text, length);
+        }
+        if (state.seen == 0 || state.maxText.compare(0, string::npos, text, length) < 0) {
+            state.maxText.assign(text, length);
+        }
+    }
+    state.seen++;
+
+    // Reservoir sampling: the n-th value replaces a random entry with
+    // probability SAMPLE_SIZE / n, so every value is equally likely kept
+    if (state.seen <= SAMPLE_SIZE) {
+        if (numeric) state.numbers.push_back(number);
+        else state.texts.push_back(string(text, length));
+        return;
+    }
+    state.random ^= state.random << 13;
+    state.random ^= state.random >> 7;
+    state.random ^= state.random << 17;
+    uint64_t pick = state.random % (uint64_t)state.seen;
+    if (pick >= (uint64_t)SAMPLE_SIZE) return;
+    if (numeric) state.numbers[(size_t)pick] = number;
+    else state.texts[(size_t)pick].assign(text, length);
+}
+
+// BUCKETS + 1 evenly spaced entries of the sorted sample
+template <typename T>
+static void cutHistogram(const vector<T>& sorted, const T& minimum, const T& maximum, vector<T>& bounds) {
+    int buckets = StatsCollector::BUCKETS;
+    bounds.resize(buckets + 1);
+    for (int i = 0; i <= buckets; i++) {
+        bounds[i] = sorted[(size_t)((double)i * (double)(sorted.size() - 1) / buckets)];
+    }
+    bounds[0] = minimum;
+    bounds[buckets] = maximum;
+}
+
+template <typename T>
+static double countDistinct(const vector<T>& sorted) {
+    double distinct = 0;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (i == 0 || sorted[i] != sorted[i - 1]) distinct++;
+    }
+    return distinct;
+}
+
+static double sketchEstimate(const vector<uint8_t>& registers) {
+    double m = (double)registers.size();
+    double sum = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < registers.size(); i++) {
+        sum += ldexp(1.0, -(int)registers[i]);
+        if (registers[i] == 0) zeros++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // small counts: linear counting over the empty registers is closer
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros);
+    return estimate;
+}
+
+TableStats StatsCollector::finish() {
+    TableStats stats;
+    stats.rowCount = rowCount;
+    stats.columns.resize(states.size());
+
+    for (size_t c = 0; c < states.size(); c++) {
+        ColumnState& state = states[c];
+        ColumnStats& column = stats.columns[c];
+        column.nullCount = state.nullCount;
+        if (state.seen == 0) continue;
+
+        // While the sample still holds every value it is counted exactly
+        bool complete = state.seen <= SAMPLE_SIZE;
+        if (state.type != VARCHAR) {
+            sort(state.numbers.begin(), state.numbers.end());
+            cutHistogram(state.numbers, state.minNumber, state.maxNumber, column.numberBounds);
+            if (complete) column.distinct = countDistinct(state.numbers);
+        }
+        else {
+            sort(state.texts.begin(), state.texts.end());
+            cutHistogram(state.texts, state.minText, state.maxText, column.textBounds);
+            if (complete) column.distinct = countDistinct(state.texts);
+        }
+        if (!complete) {
+            column.distinct = min((double)state.seen, max(1.0, floor(sketchEstimate(state.registers) + 0.5)));
+        }
+    }
+    return stats;
+}
+
+// ================== COSTS ==================
+
+double CostModel::scanCost(long long rows, double rowCost, int threads) {
+    double cost = (double)rows * (SCAN_ROW_COST + rowCost) / max(threads, 1);
+    if (threads > 1) cost += PARALLEL_START_COST;
+    return cost;
+}
+
+double CostModel::indexCost(double rows, double rowCost) {
+    return rows * (INDEX_ROW_COST + rowCost);
+}
@@ -0,0 +1,108 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+#include "Column.h"
+#include "Condition.h"
+#include "Encoding.h"
+
+class Table;
+
+// Distribution of one column as of the last ANALYZE. NULLs are counted
+// apart; the other values are described by an estimate of how many are
+// distinct and an equi-depth histogram: BUCKETS + 1 bounds, the minimum
+// first and the maximum last, with about as many values between each
+// pair of bounds. INT and FLOAT bounds are kept as numbers, VARCHAR
+// bounds as text.
+struct ColumnStats {
+    long long nullCount;
+    double distinct;
+    vector<double> numberBounds;  // empty when every value is NULL
+    vector<string> textBounds;
+
+    ColumnStats();
+};
+
+// A table's column statistics and the selectivity estimates drawn from
+// them. Estimates are fractions of the rows, so they still apply after
+// the table has grown or shrunk; before the first ANALYZE they are fixed
+// guesses per operator.
+class TableStats {
+private:
+    double compareFraction(const Table& table, int column, const string& op, const string& value) const;
+    double equalFraction(const ColumnStats& stats, bool numeric, const string& value) const;
+    double belowFraction(const ColumnStats& stats, bool numeric, const string& value, bool inclusive) const;
+
+public:
+    long long rowCount;  // when analyzed, -1 before
+    vector<ColumnStats> columns;
+
+    TableStats();
+
+    bool isAnalyzed() const;
+
+    // Estimated fraction of the table's rows that pass. For a list (ANDed)
+    // the range comparisons on one column are combined into one range.
+    double selectivity(const Table& table, const Condition& condition) const;
+    double selectivity(const Table& table, const vector<Condition>& conditions) const;
+
+    void encode(string& out) const;
+    void decode(ByteReader& in);
+};
+
+// Builds TableStats over a table a slice at a time (a loaded table is a
+// single slice; a streamed one arrives as PagedScan slices). Per column
+// it counts NULLs, tracks the range, feeds a HyperLogLog sketch for the
+// distinct count and keeps a reservoir sample that the histogram is cut
+// from. The columns of a slice are processed in parallel.
+class StatsCollector {
+private:
+    struct ColumnState {
+        DataType type;
+        long long nullCount;
+        long long seen;              // non-NULL values
+        vector<uint8_t> registers;   // HyperLogLog, 2^SKETCH_BITS of them
+        vector<double> numbers;      // sample of an INT or FLOAT column
+        vector<string> texts;        // sample of a VARCHAR column
+        double minNumber, maxNumber;
+        string minText, maxText;
+        uint64_t random;             // reservoir sampling state
+    };
+
+    vector<ColumnState> states;
+    long long rowCount;
+    const Table* slice;  // during add()
+
+    static void addColumn(void* context, int column);
+    void addValue(ColumnState& state, uint64_t hash, double number, const char* text, uint32_t length);
+
+    StatsCollector(const StatsCollector&);
+    StatsCollector& operator=(const StatsCollector&);
+
+public:
+    static const int BUCKETS = 64;
+    static const int SAMPLE_SIZE = 30000;
+    static const int SKETCH_BITS = 12;
+
+    explicit StatsCollector(const Table& table);
+
+    void add(const Table& rows);
+    TableStats finish();
+};
+
+// Relative costs of the access paths, in units of one row-at-a-time
+// comparison (see CompiledPredicate)
+class CostModel {
+public:
+    // Testing every row at `rowCost` each, on one thread or split over
+    // `threads` of the pool
+    static double scanCost(long long rows, double rowCost, int threads);
+    // Fetching `rows` rows found by an index, in table order, and testing them
+    static double indexCost(double rows, double rowCost);
+};
+
+#endif
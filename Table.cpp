@@ -1,10 +1,64 @@
 #include "Table.h"
+#include "Predicate.h"
+#include "Checksum.h"
+#include "ThreadPool.h"
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_set>
 
 using namespace std;
 
+// Where handles read: every committed row, and their own pending ones
+static const uint64_t LATEST_SNAPSHOT = TableRows::PENDING - 1;
+
+// A generation that replaces a written one starts with room for at least
+// this many rows
+static const int MIN_CAPACITY = 1024;
+
+// Rows indexed per hold of the latch
+static const int LATCH_ROWS = 4096;
+
+TableRows::TableRows()
+    : capacity(0), committedRows(0), deletedRows(0), created(NULL), deleted(NULL), previous(NULL) {
+}
+
+TableRows::~TableRows() {
+    for (int i = 0; i < (int)indexes.size(); i++) {
+        delete indexes[i];
+    }
+    delete[] created;
+    delete[] deleted;
+    delete[] previous;
+}
+
+static void freeRows(void* rows) {
+    delete (TableRows*)rows;
+}
+
 Table::Table(string name)
-    : tableName(name), primaryKeyIndex(-1) {
+    : tableName(name), primaryKeyIndex(-1), generation(new TableRows()), rowCount(0), storage(NULL),
+    storedSize(0), versions(NULL), source(NULL), snapshot(LATEST_SNAPSHOT), pinSlot(-1), ownsRows(true),
+    writing(false), pendingFirst(0), liveRows(0), deadRows(0), lastCommit(0), dirty(true), flushedLsn(0) {
+}
+
+// A view: the schema is copied, the rows are filled in by openView()
+Table::Table(const Table* viewed)
+    : tableName(viewed->tableName), columns(viewed->columns), primaryKeyIndex(viewed->primaryKeyIndex),
+    generation(NULL), rowCount(0), storage(NULL), storedSize(0), versions(viewed->versions), source(viewed),
+    snapshot(LATEST_SNAPSHOT), pinSlot(-1), ownsRows(false), writing(false), pendingFirst(0), liveRows(0),
+    deadRows(0), lastCommit(0), dirty(false), flushedLsn(0) {
+}
+
+Table::~Table() {
+    TableRows* data = generation.load();
+    if (ownsRows) {
+        if (source == NULL && versions != NULL) versions->retire(freeRows, data);
+        else delete data;
+    }
+    if (source != NULL && versions != NULL) versions->unpin(pinSlot);
 }
 
 void Table::addColumn(const Column& col) {
@@ -12,10 +66,544 @@ void Table::addColumn(const Column& col) {
         primaryKeyIndex = (int)columns.size();
     }
     columns.push_back(col);
+    currentRows().columns.push_back(ColumnVector(col.getType()));
+}
+
+void Table::setVersions(VersionManager* manager) {
+    versions = manager;
+}
+
+TableRows& Table::currentRows() const {
+    return *generation.load();
+}
+
+// ================== SNAPSHOTS ==================
+
+Table* Table::openView() const {
+    Table* view = new Table(this);
+    if (versions != NULL) view->pinSlot = versions->pin();
+
+    lock_guard<mutex> guard(loadLock);
+    view->generation = generation.load();
+    const MappedFile* file = storage.load();
+    if (file != NULL) {
+        view->storage = file;
+        view->segments = segments;
+        view->storedSize = storedSize;
+        view->rowCount = rowCount;
+    }
+    return view;
+}
+
+bool Table::setSnapshot(uint64_t transaction) {
+    if (source->generation.load() != generation.load() || source->storage.load() != storage.load()) {
+        return false;
+    }
+    snapshot = transaction;
+    if (storage.load() != NULL) return true;
+
+    // Transactions commit in order, so the rows visible form a prefix
+    const TableRows& data = currentRows();
+    int committed = data.committedRows.load();
+    if (data.created == NULL) {
+        rowCount = committed;
+        return true;
+    }
+    int low = 0, high = committed;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (data.created[middle].load(memory_order_relaxed) <= transaction) low = middle + 1;
+        else high = middle;
+    }
+    rowCount = low;
+    return true;
+}
+
+bool Table::hasHiddenRows() const {
+    const TableRows& data = currentRows();
+    return data.deleted != NULL && data.deletedRows.load() > 0;
+}
+
+bool Table::isVisible(int row) const {
+    const TableRows& data = currentRows();
+    return row < rowCount &&
+        (data.deleted == NULL || data.deleted[row].load(memory_order_relaxed) > snapshot);
+}
+
+void Table::dropHidden(vector<int>& rows) const {
+    size_t kept = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (isVisible(rows[i])) rows[kept++] = rows[i];
+    }
+    rows.resize(kept);
+}
+
+// ================== GENERATIONS ==================
+
+// Empty rows for this schema, with the same index definitions
+TableRows* Table::newRows(int capacity, bool stamped) const {
+    const TableRows& current = currentRows();
+    TableRows* data = new TableRows();
+    for (int c = 0; c < (int)columns.size(); c++) {
+        data->columns.push_back(ColumnVector(columns[c].getType()));
+        data->columns[c].reserve(capacity);
+    }
+    for (int i = 0; i < (int)current.indexes.size(); i++) {
+        SecondaryIndex* index = new SecondaryIndex();
+        index->name = current.indexes[i]->name;
+        index->columnIndex = current.indexes[i]->columnIndex;
+        data->indexes.push_back(index);
+    }
+
+    data->capacity = capacity;
+    if (stamped) {
+        data->created = new atomic<uint64_t>[capacity]();
+        data->deleted = new atomic<uint64_t>[capacity]();
+        if (primaryKeyIndex != -1) data->previous = new int[capacity];
+    }
+    return data;
+}
+
+struct RowCopy {
+    const TableRows* from;
+    TableRows* to;
+    const vector<int>* kept;
+    int capacity;
+    int added;
+    const vector<size_t>* addedText;
+};
+
+static void copyColumn(void* context, int index) {
+    RowCopy* copy = (RowCopy*)context;
+    const ColumnVector& from = copy->from->columns[index];
+    ColumnVector& to = copy->to->columns[index];
+    const vector<int>& kept = *copy->kept;
+
+    // text gets room in proportion to the rows
+    size_t text = 0;
+    if (from.getType() == VARCHAR) {
+        uint32_t length;
+        for (size_t i = 0; i < kept.size(); i++) {
+            from.getText(kept[i], length);
+            text += length;
+        }
+        text += (*copy->addedText)[index];
+        int rows = (int)kept.size() + copy->added;
+        if (rows > 0) text = (size_t)((double)text * copy->capacity / rows);
+    }
+    to.reserve(copy->capacity, text);
+
+    // consecutive rows are copied a run at a time
+    size_t i = 0;
+    while (i < kept.size()) {
+        size_t run = i + 1;
+        while (run < kept.size() && kept[run] == kept[run - 1] + 1) run++;
+        to.appendFrom(from, kept[i], kept[run - 1] + 1);
+        i = run;
+    }
+}
+
+// A generation with room for `capacity` rows holding the rows in `kept`
+// (ascending) as they were, stamps included. `added` rows with addedText
+// bytes of text per column are about to follow.
+TableRows* Table::copyRows(const TableRows& from, const vector<int>& kept, int capacity,
+    int added, const vector<size_t>& addedText) {
+    TableRows* to = newRows(capacity, true);
+    try {
+        RowCopy copy;
+        copy.from = &from;
+        copy.to = to;
+        copy.kept = &kept;
+        copy.capacity = capacity;
+        copy.added = added;
+        copy.addedText = &addedText;
+        // Columns are independent, so large tables copy them in parallel
+        if ((int)kept.size() < PARALLEL_MIN_ROWS) {
+            for (int c = 0; c < (int)columns.size(); c++) copyColumn(&copy, c);
+        }
+        else {
+            ThreadPool::shared().run(copyColumn, &copy, (int)columns.size());
+        }
+
+        int committed = from.committedRows.load();
+        int keptCommitted = 0, keptDeleted = 0;
+        for (int i = 0; i < (int)kept.size(); i++) {
+            int r = kept[i];
+            uint64_t created = (from.created != NULL) ? from.created[r].load(memory_order_relaxed) : 0;
+            uint64_t deleted = (from.deleted != NULL) ? from.deleted[r].load(memory_order_relaxed) : TableRows::LIVE;
+            to->created[i].store(created, memory_order_relaxed);
+            to->deleted[i].store(deleted, memory_order_relaxed);
+            if (r < committed) {
+                keptCommitted++;
+                if (deleted != TableRows::LIVE && deleted != TableRows::PENDING) keptDeleted++;
+            }
+        }
+        to->committedRows = keptCommitted;
+        to->deletedRows = keptDeleted;
+        indexRows(*to, 0, (int)kept.size());
+    }
+    catch (...) {
+        delete to;
+        throw;
+    }
+    return to;
+}
+
+// Publishes `next` as the table's rows; views of the old ones keep them
+// until they close
+void Table::replaceRows(TableRows* next) {
+    TableRows* old = generation.exchange(next);
+    if (versions != NULL) versions->retire(freeRows, old);
+    else delete old;
+}
+
+// The generation to write `added` more rows to, holding textBytes bytes
+// of text per column (stamped: with version stamps). Rows are appended
+// in place while the arrays have room, so readers of the rows before are
+// undisturbed; otherwise they move to a generation twice the size first.
+// A table only its owner reads just grows its arrays.
+TableRows& Table::reserveRows(int added, const vector<size_t>& textBytes, bool stamped) {
+    TableRows& data = currentRows();
+    if (versions == NULL && !stamped && data.created == NULL) {
+        for (int c = 0; c < (int)data.columns.size(); c++) {
+            data.columns[c].reserve(rowCount + added);
+        }
+        return data;
+    }
+
+    bool fits = data.created != NULL && rowCount + added <= data.capacity;
+    for (int c = 0; c < (int)data.columns.size() && fits; c++) {
+        fits = data.columns[c].hasRoom(added, textBytes[c]);
+    }
+    if (fits) return data;
+
+    int capacity = max(max(rowCount + added, data.capacity * 2), MIN_CAPACITY);
+    vector<int> kept(rowCount);
+    for (int r = 0; r < rowCount; r++) kept[r] = r;
+    TableRows* grown = copyRows(data, kept, capacity, added, textBytes);
+    replaceRows(grown);
+    return *grown;
+}
+
+// Stamps rows [first, rowCount) as written by the open transaction
+void Table::markAppended(TableRows& data, int first) {
+    if (data.created == NULL) return;
+    for (int r = first; r < rowCount; r++) {
+        data.created[r].store(TableRows::PENDING, memory_order_relaxed);
+        data.deleted[r].store(TableRows::LIVE, memory_order_relaxed);
+    }
+}
+
+// Stamps what the open transaction wrote, then lets views see it: the
+// stamps are stored before committedRows, which readers load first
+void Table::stampPending(uint64_t transaction) {
+    TableRows& data = currentRows();
+    int appended = rowCount - pendingFirst;
+    int removed = (int)pendingDeletes.size();
+    if (data.created != NULL) {
+        for (int r = pendingFirst; r < rowCount; r++) {
+            data.created[r].store(transaction, memory_order_relaxed);
+        }
+        for (int i = 0; i < removed; i++) {
+            data.deleted[pendingDeletes[i]].store(transaction, memory_order_relaxed);
+        }
+    }
+    data.deletedRows.fetch_add(removed);
+    data.committedRows.store(rowCount);
+
+    liveRows += appended - removed;
+    deadRows += removed;
+    if (appended > 0 || removed > 0) lastCommit = transaction;
+    pendingFirst = rowCount;
+    pendingDeletes.clear();
+}
+
+// Outside a transaction a change is committed as soon as it is made
+void Table::finishChange() {
+    if (!writing) stampPending(lastCommit.load());
+}
+
+void Table::beginWrite() {
+    writeLock.lock();
+    writing = true;
+    pendingFirst = rowCount;
+    pendingDeletes.clear();
+}
+
+void Table::commit(uint64_t transaction) {
+    stampPending(transaction);
+    writing = false;
+    writeLock.unlock();
+}
+
+// The rows appended stay, stamped deleted from the start so no snapshot
+// sees them, until compaction drops them
+void Table::rollback() {
+    TableRows& data = currentRows();
+    int appended = rowCount - pendingFirst;
+    if (data.created != NULL) {
+        uint64_t before = lastCommit.load();
+        for (int r = pendingFirst; r < rowCount; r++) {
+            data.created[r].store(before, memory_order_relaxed);
+            data.deleted[r].store(0, memory_order_relaxed);
+        }
+        for (size_t i = 0; i < pendingDeletes.size(); i++) {
+            data.deleted[pendingDeletes[i]].store(TableRows::LIVE, memory_order_relaxed);
+        }
+    }
+    data.deletedRows.fetch_add(appended);
+    data.committedRows.store(rowCount);
+    deadRows += appended;
+
+    pendingFirst = rowCount;
+    pendingDeletes.clear();
+    writing = false;
+    writeLock.unlock();
+}
+
+void Table::lockWrites() {
+    writeLock.lock();
+}
+
+void Table::unlockWrites() {
+    writeLock.unlock();
+}
+
+bool Table::compact(uint64_t horizon) {
+    TableRows& data = currentRows();
+    if (data.deleted == NULL || data.deletedRows.load() == 0) return false;
+
+    vector<int> kept;
+    kept.reserve(liveRows.load());
+    for (int r = 0; r < rowCount; r++) {
+        if (data.deleted[r].load(memory_order_relaxed) > horizon) kept.push_back(r);
+    }
+    if ((int)kept.size() == rowCount) return false;
+
+    int rows = (int)kept.size();
+    TableRows* packed = copyRows(data, kept, max(rows + rows / 2, MIN_CAPACITY), 0,
+        vector<size_t>(columns.size(), 0));
+    // An open transaction's rows are all kept; they just move up
+    pendingFirst = (int)(lower_bound(kept.begin(), kept.end(), pendingFirst) - kept.begin());
+    for (size_t i = 0; i < pendingDeletes.size(); i++) {
+        pendingDeletes[i] = (int)(lower_bound(kept.begin(), kept.end(), pendingDeletes[i]) - kept.begin());
+    }
+    rowCount = rows;
+    deadRows = packed->deletedRows.load();
+    replaceRows(packed);
+    return true;
+}
+
+int Table::getLiveRowCount() const {
+    return liveRows.load();
+}
+
+int Table::getDeadRowCount() const {
+    return deadRows.load();
+}
+
+uint64_t Table::getLastCommit() const {
+    return lastCommit.load();
+}
+
+// ================== STORAGE ==================
+
+void Table::attachStorage(const MappedFile* file, const vector<ColumnSegment>& columnSegments, int rows) {
+    storage = file;
+    segments = columnSegments;
+    rowCount = rows;
+    liveRows = rows;
+    storedSize = 0;
+    for (int c = 0; c < (int)segments.size(); c++) {
+        storedSize += (size_t)segments[c].length;
+    }
+}
+
+bool Table::isLoaded() const {
+    return storage.load() == NULL;
+}
+
+// Readers may load a table at the same time: the first decodes, the
+// others wait for it. A view loads rows of its own.
+void Table::load() {
+    if (storage.load() == NULL) return;
+    lock_guard<mutex> guard(loadLock);
+    const MappedFile* file = storage.load();
+    if (file == NULL) return;
+
+    TableRows* loaded = newRows(0, false);
+    try {
+        for (int c = 0; c < (int)columns.size(); c++) {
+            const ColumnSegment& seg = segments[c];
+            if (seg.offset + seg.length > file->getSize()) {
+                throw runtime_error("Data for table '" + tableName + "' is truncated");
+            }
+
+            const char* data = file->getData() + seg.offset;
+            if (Checksum::crc32(data, (size_t)seg.length) != seg.crc) {
+                throw runtime_error("Checksum mismatch in table '" + tableName + "'");
+            }
+            loaded->columns[c].decode(data, (size_t)seg.length, rowCount);
+        }
+        loaded->capacity = rowCount;
+        loaded->committedRows = rowCount;
+        indexRows(*loaded, 0, rowCount);
+    }
+    catch (...) {
+        delete loaded;
+        throw;
+    }
+
+    if (source != NULL) {
+        generation = loaded;
+        ownsRows = true;
+    }
+    else {
+        replaceRows(loaded);
+    }
+    segments.clear();
+    storage = NULL;
+}
+
+void Table::loadEncoded(const vector<string>& encoded, int rows) {
+    TableRows& data = currentRows();
+    for (int c = 0; c < (int)data.columns.size(); c++) {
+        data.columns[c].decode(encoded[c].data(), encoded[c].size(), rows);
+    }
+    rowCount = rows;
+    liveRows = rows;
+    data.capacity = rows;
+    data.committedRows = rows;
+    indexRows(data, 0, rows);
 }
 
+void Table::adoptColumns(vector<ColumnVector>& columnData, int rows) {
+    TableRows& data = currentRows();
+    for (int c = 0; c < (int)data.columns.size(); c++) {
+        swap(data.columns[c], columnData[c]);
+    }
+    rowCount = rows;
+    liveRows = rows;
+    data.capacity = rows;
+    data.committedRows = rows;
+    indexRows(data, 0, rows);
+}
+
+const vector<ColumnSegment>& Table::getSegments() const {
+    return segments;
+}
+
+const MappedFile* Table::getStorage() const {
+    return storage.load();
+}
+
+size_t Table::getStoredSize() const {
+    return storedSize;
+}
+
+bool Table::isDirty() const {
+    return dirty;
+}
+
+void Table::markDirty() {
+    dirty = true;
+}
+
+void Table::markClean(uint64_t lsn) {
+    dirty = false;
+    flushedLsn = lsn;
+}
+
+const TableStats& Table::getStats() const {
+    return (source != NULL) ? source->stats : stats;
+}
+
+void Table::setStats(const TableStats& tableStats) {
+    stats = tableStats;
+}
+
+uint64_t Table::getFlushedLsn() const {
+    return flushedLsn;
+}
+
+// ================== WRITES ==================
+
 void Table::addRow(const Row& row) {
-    rows.push_back(row);
+    vector<vector<string> > rows(1);
+    for (int c = 0; c < (int)columns.size(); c++) {
+        rows[0].push_back(row.getValue(c));
+    }
+    appendRows(rows);
+}
+
+void Table::appendRows(const vector<vector<string> >& rows) {
+    int added = (int)rows.size();
+    if (added == 0) return;
+
+    vector<size_t> textBytes(columns.size(), 0);
+    for (int c = 0; c < (int)columns.size(); c++) {
+        if (columns[c].getType() != VARCHAR) continue;
+        for (int r = 0; r < added; r++) textBytes[c] += rows[r][c].size();
+    }
+    TableRows& data = reserveRows(added, textBytes, false);
+
+    // Column at a time: a tight append loop per vector
+    int first = rowCount;
+    for (int c = 0; c < (int)data.columns.size(); c++) {
+        ColumnVector& column = data.columns[c];
+        for (int r = 0; r < added; r++) {
+            column.append(rows[r][c]);
+        }
+    }
+    rowCount += added;
+    markAppended(data, first);
+    indexRows(data, first, rowCount);
+    dirty = true;
+    finishChange();
+}
+
+int Table::findDuplicateKeys(const vector<vector<string> >& rows, vector<bool>& duplicate) const {
+    duplicate.assign(rows.size(), false);
+    if (primaryKeyIndex == -1) return 0;
+
+    int found = 0;
+    if (!currentRows().primaryKeyMap.empty()) {
+        for (int r = 0; r < (int)rows.size(); r++) {
+            if (findRowByPrimaryKey(rows[r][primaryKeyIndex]) != -1) {
+                duplicate[r] = true;
+                found++;
+            }
+        }
+    }
+
+    // Repeats within the batch: INT keys are sorted as numbers, which is
+    // much cheaper than hashing their text
+    if (columns[primaryKeyIndex].getType() == INT) {
+        vector<pair<long long, int> > keys;
+        keys.reserve(rows.size());
+        for (int r = 0; r < (int)rows.size(); r++) {
+            keys.push_back(make_pair(strtoll(rows[r][primaryKeyIndex].c_str(), NULL, 10), r));
+        }
+        sort(keys.begin(), keys.end());
+        for (int i = 1; i < (int)keys.size(); i++) {
+            int r = keys[i].second;
+            if (keys[i].first == keys[i - 1].first && !duplicate[r]) {
+                duplicate[r] = true;
+                found++;
+            }
+        }
+        return found;
+    }
+
+    unordered_set<string> seen;
+    seen.reserve(rows.size());
+    for (int r = 0; r < (int)rows.size(); r++) {
+        if (!seen.insert(normalizeKey(rows[r][primaryKeyIndex])).second && !duplicate[r]) {
+            duplicate[r] = true;
+            found++;
+        }
+    }
+    return found;
 }
 
 string Table::getTableName() const {
@@ -30,12 +618,30 @@ const vector<Column>& Table::getColumns() const {
     return columns;
 }
 
-vector<Row>& Table::getRows() {
-    return rows;
+string Table::getValue(int row, int col) const {
+    return currentRows().columns[col].getString(row);
 }
 
-const vector<Row>& Table::getRows() const {
-    return rows;
+Row Table::getRow(int row) const {
+    const TableRows& data = currentRows();
+    Row result;
+    for (int c = 0; c < (int)data.columns.size(); c++) {
+        result.addValue(data.columns[c].getString(row));
+    }
+    return result;
+}
+
+const ColumnVector& Table::getColumnData(int col) const {
+    return currentRows().columns[col];
+}
+
+size_t Table::getMemoryUsage() const {
+    const TableRows& data = currentRows();
+    size_t total = 0;
+    for (int c = 0; c < (int)data.columns.size(); c++) {
+        total += data.columns[c].memoryUsage();
+    }
+    return total;
 }
 
 int Table::getColumnCount() const {
@@ -43,14 +649,13 @@ int Table::getColumnCount() const {
 }
 
 int Table::getRowCount() const {
-    return (int)rows.size();
+    return rowCount;
 }
 
 int Table::getPrimaryKeyIndex() const {
     return primaryKeyIndex;
 }
 
-#include <algorithm>
 #include <cctype>
 
 // helper for case insensitive string compare
@@ -73,142 +678,551 @@ int Table::getColumnIndex(const string& colName) const {
     return -1;
 }
 
+// Numeric keys are compared by value (WHERE id = 01 must find id 1),
+// so they are stored in a canonical text form.
+string Table::normalizeKey(const string& value) const {
+    DataType type = columns[primaryKeyIndex].getType();
+    if (type == INT) {
+        return to_string(strtoll(value.c_str(), NULL, 10));
+    }
+    if (type == FLOAT) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", strtod(value.c_str(), NULL));
+        return buf;
+    }
+    return value;
+}
+
+string Table::primaryKeyAt(const TableRows& rows, int row) const {
+    const ColumnVector& data = rows.columns[primaryKeyIndex];
+    if (data.getType() == INT) {
+        return to_string((long long)data.getInt(row));
+    }
+    if (data.getType() == FLOAT) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", data.getDouble(row));
+        return buf;
+    }
+    return data.getString(row);
+}
+
+IndexKey Table::keyAt(const TableRows& rows, int row, int col) const {
+    const ColumnVector& data = rows.columns[col];
+    if (data.getType() == VARCHAR) {
+        return IndexKey(data.getString(row), VARCHAR);
+    }
+    return IndexKey(data.getNumber(row), data.getType());
+}
+
 bool Table::hasPrimaryKey(const string& value) const {
-    if (primaryKeyIndex == -1) return false;
+    return findRowByPrimaryKey(value) != -1;
+}
 
-    for (int i = 0; i < (int)rows.size(); i++) {
-        if (rows[i].getValue(primaryKeyIndex) == value) {
-            return true;
-        }
+// The map holds the newest row with the key; older versions follow it
+// through previous until one is visible from here. Views latch the map,
+// which the writer may be changing; everyone else is the writer.
+int Table::findRowByPrimaryKey(const string& value) const {
+    if (primaryKeyIndex == -1) return -1;
+
+    const TableRows& data = currentRows();
+    string key = normalizeKey(value);
+    int row;
+    {
+        shared_lock<shared_mutex> latch(data.latch, defer_lock);
+        if (source != NULL) latch.lock();
+        unordered_map<string, int>::const_iterator it = data.primaryKeyMap.find(key);
+        if (it == data.primaryKeyMap.end()) return -1;
+        row = it->second;
     }
-    return false;
+    while (row != -1 && !isVisible(row)) {
+        row = (data.previous != NULL) ? data.previous[row] : -1;
+    }
+    return row;
 }
 
-void Table::display() const {
-    cout << "Table '" << tableName << "' created successfully!" << endl;
-    cout << "Columns:" << endl;
-    for (int i = 0; i < (int)columns.size(); i++) {
-        cout << "  - " << columns[i].getFullDefinition() << endl;
+AccessPath::AccessPath()
+    : kind(ACCESS_SCAN), index(NULL), condition(-1), estimatedRows(0), rowsRead(0), bytesRead(0) {
+}
+
+// ================== READS ==================
+
+// Picks an access path for the (ANDed) conditions. Only plain
+// comparisons and IN lists can use an index; OR trees are left to the
+// scan. A pk = x or pk IN (...) is always looked up. Otherwise, among the
+// indexed columns, the one expected to return the fewest rows is used,
+// and once the table is analyzed only when fetching those rows costs less
+// than scanning; a scan runs in parallel when the cost model expects that
+// to be faster.
+AccessPath Table::chooseAccess(const vector<Condition>& conditions, const CompiledPredicate& predicate) const {
+    const TableStats& stats = getStats();
+    const vector<SecondaryIndex*>& indexes = currentRows().indexes;
+    AccessPath path;
+    path.estimatedRows = stats.selectivity(*this, conditions) * rowCount;
+
+    if (primaryKeyIndex != -1) {
+        for (int c = 0; c < (int)conditions.size(); c++) {
+            const Condition& cond = conditions[c];
+            if (getColumnIndex(cond.columnName) != primaryKeyIndex) continue;
+            if ((cond.kind == CONDITION_COMPARE && cond.op == "=") ||
+                (cond.kind == CONDITION_IN && cond.op == "IN")) {
+                path.kind = ACCESS_PRIMARY_KEY;
+                path.condition = c;
+                return path;
+            }
+        }
     }
+
+    // A parallel scan pays off once the work per morsel outweighs
+    // handing the morsels to the pool
+    double rowCost = predicate.getCost();
+    int threads = ThreadPool::shared().getThreadCount();
+    double serialCost = CostModel::scanCost(rowCount, rowCost, 1);
+    double parallelCost = CostModel::scanCost(rowCount, rowCost, threads);
+    bool parallel = rowCount >= PARALLEL_MIN_ROWS && threads > 1 && parallelCost < serialCost;
+    path.kind = parallel ? ACCESS_PARALLEL_SCAN : ACCESS_SCAN;
+
+    int best = -1;
+    double bestRows = 0;
+    for (int c = 0; c < (int)conditions.size(); c++) {
+        const Condition& first = conditions[c];
+        bool list = first.kind == CONDITION_IN && first.op == "IN";
+        if (!list && (first.kind != CONDITION_COMPARE || first.op == "!=")) continue;
+        int colIndex = getColumnIndex(first.columnName);
+        if (colIndex == -1) continue;
+
+        const SecondaryIndex* index = NULL;
+        for (int i = 0; i < (int)indexes.size(); i++) {
+            if (indexes[i]->columnIndex == colIndex) index = indexes[i];
+        }
+        if (index == NULL) continue;
+
+        // the conditions the index lookup would use
+        vector<Condition> used;
+        if (list) {
+            used.push_back(first);
+        }
+        else {
+            for (int k = c; k < (int)conditions.size(); k++) {
+                const Condition& cond = conditions[k];
+                if (cond.kind == CONDITION_COMPARE && cond.op != "!=" &&
+                    getColumnIndex(cond.columnName) == colIndex) {
+                    used.push_back(cond);
+                }
+            }
+        }
+
+        double rows = stats.selectivity(*this, used) * rowCount;
+        if (best == -1 || rows < bestRows) {
+            best = c;
+            path.index = index;
+            bestRows = rows;
+        }
+    }
+
+    if (best == -1) return path;
+    if (stats.isAnalyzed() &&
+        CostModel::indexCost(bestRows, rowCost) >= (parallel ? parallelCost : serialCost)) {
+        path.index = NULL;
+        return path;
+    }
+    path.kind = ACCESS_INDEX;
+    path.condition = best;
+    return path;
 }
 
-void Table::displayData(const vector<int>& columnIndices) const {
-    cout << "\nTable: " << tableName << endl;
-    cout << "--------------------------------------" << endl;
+// The rows an index path finds: a superset of the matching rows, possibly
+// unsorted and with repeats
+void Table::readIndex(const AccessPath& path, const vector<Condition>& conditions, vector<int>& candidates) const {
+    const Condition& first = conditions[path.condition];
 
-    vector<int> displayCols = columnIndices;
-    if (displayCols.empty()) {
-        for (int i = 0; i < (int)columns.size(); i++) {
-            displayCols.push_back(i);
+    // one hash lookup per value
+    if (path.kind == ACCESS_PRIMARY_KEY) {
+        const vector<string>& values = (first.kind == CONDITION_IN) ? first.values : vector<string>(1, first.value);
+        for (int v = 0; v < (int)values.size(); v++) {
+            int row = findRowByPrimaryKey(values[v]);
+            if (row != -1) candidates.push_back(row);
         }
+        return;
     }
 
-    // Print headers
-    for (int i = 0; i < (int)displayCols.size(); i++) {
-        cout << columns[displayCols[i]].getName();
-        if (i < (int)displayCols.size() - 1) cout << " | ";
+    shared_lock<shared_mutex> latch(currentRows().latch, defer_lock);
+    if (source != NULL) latch.lock();
+
+    int colIndex = path.index->columnIndex;
+    DataType type = columns[colIndex].getType();
+    if (first.kind == CONDITION_IN) {
+        for (int v = 0; v < (int)first.values.size(); v++) {
+            IndexKey key(first.values[v], type);
+            path.index->tree.range(&key, true, &key, true, candidates);
+        }
+        return;
     }
-    cout << endl;
 
-    for (int i = 0; i < (int)displayCols.size(); i++) {
-        cout << "----------";
-        if (i < (int)displayCols.size() - 1) cout << "-+-";
+    // Narrow [low, high] using every comparison on this column
+    IndexKey low, high;
+    bool hasLow = false, hasHigh = false;
+    bool lowInclusive = true, highInclusive = true;
+
+    for (int k = path.condition; k < (int)conditions.size(); k++) {
+        const Condition& cond = conditions[k];
+        if (cond.kind != CONDITION_COMPARE || getColumnIndex(cond.columnName) != colIndex) continue;
+
+        IndexKey key(cond.value, type);
+        bool setsLow = (cond.op == "=" || cond.op == ">" || cond.op == ">=");
+        bool setsHigh = (cond.op == "=" || cond.op == "<" || cond.op == "<=");
+        bool inclusive = (cond.op == "=" || cond.op == ">=" || cond.op == "<=");
+
+        if (setsLow && (!hasLow || low < key || (low == key && !inclusive))) {
+            low = key;
+            lowInclusive = inclusive;
+            hasLow = true;
+        }
+        if (setsHigh && (!hasHigh || key < high || (key == high && !inclusive))) {
+            high = key;
+            highInclusive = inclusive;
+            hasHigh = true;
+        }
     }
-    cout << endl;
 
-    if (rows.empty()) {
-        cout << "No data in table." << endl;
+    path.index->tree.range(hasLow ? &low : NULL, lowInclusive,
+        hasHigh ? &high : NULL, highInclusive, candidates);
+}
+
+AccessPath Table::planAccess(const vector<Condition>& conditions) const {
+    CompiledPredicate predicate(*this, conditions);
+    return chooseAccess(conditions, predicate);
+}
+
+struct MorselScan {
+    const CompiledPredicate* predicate;
+    int rowCount;
+    vector<vector<int> > results; // one per morsel
+};
+
+static void scanMorsel(void* context, int index) {
+    MorselScan* scan = (MorselScan*)context;
+    int begin = index * Table::MORSEL_ROWS;
+    int end = min(begin + Table::MORSEL_ROWS, scan->rowCount);
+    scan->predicate->select(begin, end, scan->results[index]);
+}
+
+// Columns a condition reads
+static void markColumns(const BoundCondition& cond, vector<bool>& read) {
+    if (cond.columnIndex != -1) read[cond.columnIndex] = true;
+    for (size_t i = 0; i < cond.children.size(); i++) {
+        markColumns(cond.children[i], read);
     }
-    else {
-        for (int r = 0; r < (int)rows.size(); r++) {
-            const Row& row = rows[r];
-            for (int i = 0; i < (int)displayCols.size(); i++) {
-                cout << row.getValue(displayCols[i]);
-                if (i < (int)displayCols.size() - 1) cout << " | ";
+}
+
+void Table::findMatchingRows(const vector<Condition>& conditions, vector<int>& matches) const {
+    findMatchingRows(conditions, matches, NULL);
+}
+
+void Table::findMatchingRows(const vector<Condition>& conditions, vector<int>& matches, AccessPath* used) const {
+    matches.clear();
+
+    // column lookups and literal parsing happen once here, not per row
+    CompiledPredicate predicate(*this, conditions);
+    AccessPath path = chooseAccess(conditions, predicate);
+
+    if (path.kind == ACCESS_PRIMARY_KEY || path.kind == ACCESS_INDEX) {
+        vector<int> candidates;
+        readIndex(path, conditions, candidates);
+        // keep table order so results look the same as a full scan
+        sort(candidates.begin(), candidates.end());
+        candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+        for (int i = 0; i < (int)candidates.size(); i++) {
+            // the trees hold every row version
+            if (isVisible(candidates[i]) && predicate.matches(candidates[i])) {
+                matches.push_back(candidates[i]);
             }
-            cout << endl;
         }
+        path.rowsRead = (long long)candidates.size();
     }
+    else if (path.kind == ACCESS_SCAN) {
+        predicate.select(0, rowCount, matches);
+        if (hasHiddenRows()) dropHidden(matches);
+        path.rowsRead = rowCount;
+    }
+    else {
+        // Morsels are filtered on the pool; concatenating their results in
+        // morsel order gives the same row order as a serial scan
+        MorselScan scan;
+        scan.predicate = &predicate;
+        scan.rowCount = rowCount;
+        int morsels = (rowCount + MORSEL_ROWS - 1) / MORSEL_ROWS;
+        scan.results.resize(morsels);
+        ThreadPool::shared().run(scanMorsel, &scan, morsels);
 
-    cout << "\nTotal rows: " << rows.size() << endl;
+        size_t total = 0;
+        for (int i = 0; i < morsels; i++) total += scan.results[i].size();
+        matches.reserve(total);
+        for (int i = 0; i < morsels; i++) {
+            matches.insert(matches.end(), scan.results[i].begin(), scan.results[i].end());
+        }
+        if (hasHiddenRows()) dropHidden(matches);
+        path.rowsRead = rowCount;
+    }
+
+    if (used == NULL) return;
+
+    // bytes read: each tested row's share of the columns the tests use
+    if (rowCount > 0) {
+        const TableRows& data = currentRows();
+        vector<bool> read(columns.size(), false);
+        const vector<BoundCondition>& bound = predicate.getConditions();
+        for (size_t i = 0; i < bound.size(); i++) markColumns(bound[i], read);
+        double rowBytes = 0;
+        for (size_t c = 0; c < read.size(); c++) {
+            if (read[c]) rowBytes += (double)data.columns[c].memoryUsage() / rowCount;
+        }
+        path.bytesRead = (uint64_t)(rowBytes * path.rowsRead);
+    }
+    *used = path;
 }
 
-int Table::deleteRows(const vector<Condition>& conditions) {
-    if (conditions.empty()) {
-        // DELETE * (all rows)
-        int count = (int)rows.size();
-        rows.clear();
-        return count;
+struct OrderedScan {
+    const Table* table;
+    const CompiledPredicate* predicate;
+    vector<int>* rows;
+    int limit;
+};
+
+bool Table::collectOrdered(void* context, int row) {
+    OrderedScan* scan = (OrderedScan*)context;
+    if (scan->table->isVisible(row) && scan->predicate->matches(row)) scan->rows->push_back(row);
+    return (int)scan->rows->size() < scan->limit;
+}
+
+// The index must not put a NULL among the values: a VARCHAR NULL is ""
+// in the index, which sorts first as NULLs do, but a numeric NULL is 0
+const SecondaryIndex* Table::orderedIndex(int column) const {
+    const TableRows& rows = currentRows();
+    const SecondaryIndex* index = NULL;
+    for (int i = 0; i < (int)rows.indexes.size(); i++) {
+        if (rows.indexes[i]->columnIndex == column) index = rows.indexes[i];
     }
+    if (index == NULL) return NULL;
 
-    vector<Row> newRows;
-    int deletedCount = 0;
+    const ColumnVector& data = rows.columns[column];
+    if (data.getType() != VARCHAR) {
+        const ColumnVector::NullWord* nulls = data.nullData();
+        for (int w = 0; w < (rowCount + 63) / 64; w++) {
+            if (nulls[w].load() != 0) return NULL;
+        }
+    }
+    return index;
+}
 
-    for (int r = 0; r < (int)rows.size(); r++) {
-        const Row& row = rows[r];
-        bool matchesAll = true;
+bool Table::findOrderedRows(int column, bool descending, const vector<Condition>& conditions,
+    int limit, vector<int>& rows) const {
+    const SecondaryIndex* index = orderedIndex(column);
+    if (index == NULL) return false;
 
-        for (int c = 0; c < (int)conditions.size(); c++) {
-            const Condition& cond = conditions[c];
-            int colIndex = getColumnIndex(cond.columnName);
-            if (colIndex == -1) continue;
+    rows.clear();
+    if (limit <= 0) return true;
+
+    CompiledPredicate predicate(*this, conditions);
+    OrderedScan scan;
+    scan.table = this;
+    scan.predicate = &predicate;
+    scan.rows = &rows;
+    scan.limit = limit;
+
+    shared_lock<shared_mutex> latch(currentRows().latch, defer_lock);
+    if (source != NULL) latch.lock();
+    index->tree.scan(descending, collectOrdered, &scan);
+    return true;
+}
 
-            string actualValue = row.getValue(colIndex);
-            DataType colType = columns[colIndex].getType();
+// ================== INDEXES ==================
 
-            if (!cond.evaluate(actualValue, colType)) {
-                matchesAll = false;
-                break;
+// Built aside, then swapped in under the latch
+void Table::buildIndex(TableRows& data, SecondaryIndex* index, int rows) {
+    vector<pair<IndexKey, int> > entries;
+    entries.reserve(rows);
+    for (int r = 0; r < rows; r++) {
+        entries.push_back(make_pair(keyAt(data, r, index->columnIndex), r));
+    }
+    BPlusTree built;
+    built.build(entries);
+
+    unique_lock<shared_mutex> latch(data.latch);
+    index->tree.swap(built);
+}
+
+// Adds rows [first, end) to the primary key map, chaining each to the
+// row it replaces there, and to the indexes. The keys are made before the
+// latch is taken, and it is taken for a chunk of rows at a time, so a big
+// batch does not hold up readers' lookups for long.
+void Table::indexRows(TableRows& data, int first, int end) {
+    if (first >= end) return;
+
+    if (primaryKeyIndex != -1) {
+        vector<string> keys;
+        for (int chunk = first; chunk < end; chunk += LATCH_ROWS) {
+            int last = min(end, chunk + LATCH_ROWS);
+            keys.clear();
+            for (int r = chunk; r < last; r++) keys.push_back(primaryKeyAt(data, r));
+
+            unique_lock<shared_mutex> latch(data.latch);
+            // Doubling like the columns do: reserving the exact size on
+            // every batch would rehash the whole map each time
+            if ((size_t)last > data.primaryKeyMap.size() * 2) data.primaryKeyMap.reserve(last);
+            for (int r = chunk; r < last; r++) {
+                pair<unordered_map<string, int>::iterator, bool> entry =
+                    data.primaryKeyMap.insert(make_pair(move(keys[r - chunk]), r));
+                int older = entry.second ? -1 : entry.first->second;
+                entry.first->second = r;
+                if (data.previous != NULL) data.previous[r] = older;
             }
         }
+    }
 
-        if (!matchesAll) {
-            newRows.push_back(row);
+    for (int i = 0; i < (int)data.indexes.size(); i++) {
+        SecondaryIndex* index = data.indexes[i];
+        // A bulk build beats per-key inserts once the batch outweighs the tree
+        if (end - first > first) {
+            buildIndex(data, index, end);
+            continue;
         }
-        else {
-            deletedCount++;
+        vector<IndexKey> keys;
+        for (int chunk = first; chunk < end; chunk += LATCH_ROWS) {
+            int last = min(end, chunk + LATCH_ROWS);
+            keys.clear();
+            for (int r = chunk; r < last; r++) keys.push_back(keyAt(data, r, index->columnIndex));
+
+            unique_lock<shared_mutex> latch(data.latch);
+            for (int r = chunk; r < last; r++) {
+                index->tree.insert(keys[r - chunk], r);
+            }
         }
     }
+}
+
+void Table::createIndex(const string& indexName, int columnIndex) {
+    SecondaryIndex* index = new SecondaryIndex();
+    index->name = indexName;
+    index->columnIndex = columnIndex;
+    TableRows& data = currentRows();
+    if (isLoaded()) buildIndex(data, index, rowCount); // otherwise built by load()
+    data.indexes.push_back(index);
+    dirty = true;
+}
+
+bool Table::dropIndex(const string& indexName) {
+    vector<SecondaryIndex*>& indexes = currentRows().indexes;
+    for (int i = 0; i < (int)indexes.size(); i++) {
+        if (iequals(indexes[i]->name, indexName)) {
+            delete indexes[i];
+            indexes.erase(indexes.begin() + i);
+            dirty = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Table::hasIndex(const string& indexName) const {
+    const vector<SecondaryIndex*>& indexes = currentRows().indexes;
+    for (int i = 0; i < (int)indexes.size(); i++) {
+        if (iequals(indexes[i]->name, indexName)) return true;
+    }
+    return false;
+}
+
+const vector<SecondaryIndex*>& Table::getIndexes() const {
+    return currentRows().indexes;
+}
+
+void Table::display() const {
+    cout << "Table '" << tableName << "' created successfully!" << endl;
+    cout << "Columns:" << endl;
+    for (int i = 0; i < (int)columns.size(); i++) {
+        cout << "  - " << columns[i].getFullDefinition() << endl;
+    }
+}
+
+// Rows are only stamped deleted; compaction drops them once no snapshot
+// can see them
+int Table::deleteRows(const vector<Condition>& conditions) {
+    vector<int> matches;
+    findMatchingRows(conditions, matches);
+    if (matches.empty()) return 0;
 
-    rows = newRows;
-    return deletedCount;
+    TableRows& data = reserveRows(0, vector<size_t>(columns.size(), 0), true);
+    for (int i = 0; i < (int)matches.size(); i++) {
+        data.deleted[matches[i]].store(TableRows::PENDING, memory_order_relaxed);
+        pendingDeletes.push_back(matches[i]);
+    }
+    dirty = true;
+    finishChange();
+
+    return (int)matches.size();
 }
 
+// Each updated row is deleted and its new version appended, so readers
+// of the old version are undisturbed; updated rows move to the end.
 int Table::updateRows(const map<string, string>& updates,
     const vector<Condition>& conditions) {
-    int updatedCount = 0;
+    // Find matching rows first so a PRIMARY KEY violation leaves the table untouched
+    vector<int> matches;
+    findMatchingRows(conditions, matches);
 
-    for (int r = 0; r < (int)rows.size(); r++) {
-        Row& row = rows[r];
-        bool matchesAll = true;
-
-        // Check if row matches all conditions
-        for (int c = 0; c < (int)conditions.size(); c++) {
-            const Condition& cond = conditions[c];
-            int colIndex = getColumnIndex(cond.columnName);
-            if (colIndex == -1) continue;
+    // the new value of each column, NULL where it keeps the old one
+    vector<const string*> values(columns.size(), (const string*)NULL);
+    string newKey;
+    bool updatesKey = false;
+    map<string, string>::const_iterator it;
+    for (it = updates.begin(); it != updates.end(); ++it) {
+        int colIndex = getColumnIndex(it->first);
+        if (colIndex == -1) continue;
+        values[colIndex] = &it->second;
+        if (colIndex == primaryKeyIndex) {
+            updatesKey = true;
+            newKey = it->second;
+        }
+    }
 
-            string actualValue = row.getValue(colIndex);
-            DataType colType = columns[colIndex].getType();
+    if (updatesKey && !matches.empty()) {
+        int owner = findRowByPrimaryKey(newKey);
+        if (matches.size() > 1 || (owner != -1 && owner != matches[0])) {
+            throw runtime_error("Duplicate PRIMARY KEY value '" + newKey + "'");
+        }
+    }
+    if (matches.empty()) return 0;
 
-            if (!cond.evaluate(actualValue, colType)) {
-                matchesAll = false;
-                break;
-            }
+    int added = (int)matches.size();
+    const TableRows& current = currentRows();
+    vector<size_t> textBytes(columns.size(), 0);
+    for (int c = 0; c < (int)columns.size(); c++) {
+        if (columns[c].getType() != VARCHAR) continue;
+        uint32_t length;
+        for (int m = 0; m < added; m++) {
+            if (values[c] != NULL) length = (uint32_t)values[c]->size();
+            else current.columns[c].getText(matches[m], length);
+            textBytes[c] += length;
         }
+    }
+    TableRows& data = reserveRows(added, textBytes, true);
 
-        if (matchesAll) {
-            // Update the row
-            map<string, string>::const_iterator it;
-            for (it = updates.begin(); it != updates.end(); ++it) {
-                int colIndex = getColumnIndex(it->first);
-                if (colIndex != -1) {
-                    row.setValue(colIndex, it->second);
-                }
-            }
-            updatedCount++;
+    int first = rowCount;
+    for (int c = 0; c < (int)data.columns.size(); c++) {
+        ColumnVector& column = data.columns[c];
+        for (int m = 0; m < added; m++) {
+            if (values[c] != NULL) column.append(*values[c]);
+            else column.appendFrom(column, matches[m]);
         }
     }
+    rowCount += added;
+    markAppended(data, first);
+    for (int m = 0; m < added; m++) {
+        data.deleted[matches[m]].store(TableRows::PENDING, memory_order_relaxed);
+        pendingDeletes.push_back(matches[m]);
+    }
+    indexRows(data, first, rowCount);
+    dirty = true;
+    finishChange();
 
-    return updatedCount;
+    return added;
 }
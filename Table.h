@@ -4,42 +4,305 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
 
 using namespace std;
 
 #include "Column.h"
 #include "Row.h"
 #include "Condition.h"
+#include "BPlusTree.h"
+#include "ColumnVector.h"
+#include "MappedFile.h"
+#include "Statistics.h"
+#include "VersionManager.h"
 
+class CompiledPredicate;
+
+struct SecondaryIndex {
+    string name;
+    int columnIndex;
+    BPlusTree tree;
+};
+
+enum AccessKind {
+    ACCESS_SCAN,            // every row tested on one thread
+    ACCESS_PARALLEL_SCAN,   // every row tested, in morsels on the thread pool
+    ACCESS_PRIMARY_KEY,     // hash lookups of pk = x or pk IN (...)
+    ACCESS_INDEX            // a B+tree range or probes, the rows found then tested
+};
+
+// How findMatchingRows reads a table for some conditions, and what that
+// read cost once done
+struct AccessPath {
+    AccessKind kind;
+    const SecondaryIndex* index;  // ACCESS_INDEX
+    int condition;                // ACCESS_PRIMARY_KEY and ACCESS_INDEX: the one looked up
+    double estimatedRows;         // rows expected to match every condition
+    long long rowsRead;           // rows tested
+    uint64_t bytesRead;           // column data the tests read
+
+    AccessPath();
+};
+
+// Where one column's encoded values sit inside a mapped data file
+struct ColumnSegment {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t crc;
+};
+
+// One generation of a table's rows. Writers append in place while the
+// arrays have room, and otherwise copy the rows into a bigger generation
+// that replaces this one; readers keep the generation they started with.
+//
+// created[r] and deleted[r] are the transactions that wrote and deleted
+// row r: PENDING until the writer commits, deleted LIVE while the row is
+// not deleted. An UPDATE deletes the row and appends its new version;
+// previous[r] links a row to the older one with the same primary key.
+// Rows read from a file carry no stamps (the arrays are NULL) until the
+// first change: all of them are live.
+struct TableRows {
+    static const uint64_t LIVE = UINT64_MAX;
+    static const uint64_t PENDING = UINT64_MAX - 1;
+
+    // Column-major storage: one typed vector per column
+    vector<ColumnVector> columns;
+    int capacity;                 // rows the arrays hold without moving
+
+    atomic<int> committedRows;    // rows readers may look at
+    atomic<int> deletedRows;      // of those, rows stamped deleted
+
+    atomic<uint64_t>* created;
+    atomic<uint64_t>* deleted;
+    int* previous;                // -1 ends the chain; NULL without a primary key
+
+    // primary key value (normalized) -> newest row with it
+    unordered_map<string, int> primaryKeyMap;
+    // over every row, deleted ones included
+    vector<SecondaryIndex*> indexes;
+
+    // Held shared by readers around lookups in the map and the trees, and
+    // exclusively by the writer changing them
+    mutable shared_mutex latch;
+
+    TableRows();
+    ~TableRows();
+
+private:
+    TableRows(const TableRows&);
+    TableRows& operator=(const TableRows&);
+};
+
+// A table of the engine is read through views (openView): each keeps the
+// rows as of its snapshot, so readers never wait for writers. Writers
+// take the table's write lock (beginWrite) and stamp their changes at
+// commit(); the engine's collector compacts away the rows no snapshot
+// can see any more.
 class Table {
 private:
     string tableName;
     vector<Column> columns;
-    vector<Row> rows;
     int primaryKeyIndex;
 
+    // The current rows; a view's stay those it opened
+    atomic<TableRows*> generation;
+    // Rows that can be read: for a view those committed as of its
+    // snapshot, otherwise every row written, pending ones included
+    int rowCount;
+
+    // Set while the rows are still only in the data file (see load())
+    atomic<const MappedFile*> storage;
+    vector<ColumnSegment> segments;
+    size_t storedSize;
+    mutable mutex loadLock;
+
+    // Replaced generations are retired here (NULL: freed at once, as
+    // for the engine's scratch tables, which only their owner reads)
+    VersionManager* versions;
+
+    // Views: the table read, the snapshot and the epoch slot pinned
+    const Table* source;
+    uint64_t snapshot;
+    int pinSlot;
+    bool ownsRows;   // loaded its own rows (see load())
+
+    // The open transaction (see beginWrite)
+    mutex writeLock;
+    bool writing;
+    int pendingFirst;             // first row it appended
+    vector<int> pendingDeletes;   // rows it deleted
+
+    atomic<int> liveRows;
+    atomic<int> deadRows;         // deleted rows not compacted away yet
+    atomic<uint64_t> lastCommit;  // the newest transaction that changed the table
+
+    // Changed since last written to its file; flushedLsn is the log
+    // position that file is current to.
+    bool dirty;
+    uint64_t flushedLsn;
+
+    TableStats stats;  // as of the last ANALYZE
+
+    explicit Table(const Table* viewed);
+
+    TableRows& currentRows() const;
+    TableRows* newRows(int capacity, bool stamped) const;
+    TableRows* copyRows(const TableRows& from, const vector<int>& kept, int capacity,
+        int added, const vector<size_t>& addedText);
+    void replaceRows(TableRows* next);
+    TableRows& reserveRows(int added, const vector<size_t>& textBytes, bool stamped);
+    void markAppended(TableRows& data, int first);
+    void finishChange();
+    void stampPending(uint64_t transaction);
+    void dropHidden(vector<int>& rows) const;
+
+    string normalizeKey(const string& value) const;
+    string primaryKeyAt(const TableRows& data, int row) const;
+    IndexKey keyAt(const TableRows& data, int row, int col) const;
+    void buildIndex(TableRows& data, SecondaryIndex* index, int rows);
+    void indexRows(TableRows& data, int first, int end);
+    AccessPath chooseAccess(const vector<Condition>& conditions, const CompiledPredicate& predicate) const;
+    void readIndex(const AccessPath& path, const vector<Condition>& conditions, vector<int>& candidates) const;
+    static bool collectOrdered(void* context, int row);
+
+    Table(const Table&);
+    Table& operator=(const Table&);
+
 public:
+    // Full scans of at least PARALLEL_MIN_ROWS rows are split into
+    // MORSEL_ROWS ranges and run on the shared thread pool, when the cost
+    // model expects that to be faster
+    static const int MORSEL_ROWS = 16384;
+    static const int PARALLEL_MIN_ROWS = 4 * MORSEL_ROWS;
+
     Table(string name);
+    ~Table();
 
     void addColumn(const Column& col);
+
+    // Makes the table shared: replaced rows are retired to `manager`
+    // instead of freed, and openView() becomes available
+    void setVersions(VersionManager* manager);
+
+    // A read-only view of the table (caller deletes), to be given its
+    // snapshot with setSnapshot(). The rows stay valid while it lives.
+    Table* openView() const;
+    // Fixes the view to the rows committed as of `transaction`; false
+    // when the table changed generation, or was loaded, since openView():
+    // open a new view then.
+    bool setSnapshot(uint64_t transaction);
+
+    // Whether some row below getRowCount() is deleted as seen from here,
+    // so a full scan must skip it
+    bool hasHiddenRows() const;
+    bool isVisible(int row) const;
+
+    // Writers: beginWrite() takes the write lock and opens a transaction;
+    // the changes up to commit() stay invisible to views, and rollback()
+    // undoes them. Changes outside a transaction (log replay, scratch
+    // tables) are committed at once.
+    void beginWrite();
+    void commit(uint64_t transaction);
+    void rollback();
+    // The write lock alone, for checkpoints and compaction
+    void lockWrites();
+    void unlockWrites();
+
+    // Copies the rows not deleted at or before `horizon` into a new
+    // generation, dropping the rest. The write lock must be held (or the
+    // catalog exclusively). False when there was nothing to drop.
+    bool compact(uint64_t horizon);
+
+    int getLiveRowCount() const;
+    int getDeadRowCount() const;
+    uint64_t getLastCommit() const;
+
+    // Lazy loading: the schema is known up front, the rows are decoded from
+    // the mapped file on first use. The file must outlive the table or load().
+    void attachStorage(const MappedFile* file, const vector<ColumnSegment>& columnSegments, int rows);
+    bool isLoaded() const;
+    void load();
+
+    // Fills an empty table from ColumnVector::encode output, one per column
+    void loadEncoded(const vector<string>& encoded, int rows);
+    // Fills an empty table with finished columns, one per column (takes their contents)
+    void adoptColumns(vector<ColumnVector>& data, int rows);
+
+    // Column segments, the file holding them and their total size while
+    // not loaded (the file is NULL once loaded)
+    const vector<ColumnSegment>& getSegments() const;
+    const MappedFile* getStorage() const;
+    size_t getStoredSize() const;
+
+    bool isDirty() const;
+    void markDirty();
+    void markClean(uint64_t lsn);
+    uint64_t getFlushedLsn() const;
+
+    // Statistics used to estimate how many rows conditions keep; saved
+    // with the table
+    const TableStats& getStats() const;
+    void setStats(const TableStats& tableStats);
+
     void addRow(const Row& row);
 
+    // Appends already validated rows (one value per column) in one pass
+    void appendRows(const vector<vector<string> >& rows);
+
+    // Flags rows whose primary key is already in the table or repeats an
+    // earlier row of the batch; returns how many were flagged
+    int findDuplicateKeys(const vector<vector<string> >& rows, vector<bool>& duplicate) const;
+
     string getTableName() const;
     vector<Column>& getColumns();
     const vector<Column>& getColumns() const;
 
-    vector<Row>& getRows();
-    const vector<Row>& getRows() const;
+    // Row-oriented view over the columns
+    string getValue(int row, int col) const;
+    Row getRow(int row) const;
+    const ColumnVector& getColumnData(int col) const;
+    size_t getMemoryUsage() const;
 
     int getColumnCount() const;
+    // Rows that can be read (see rowCount): deleted ones are included, so
+    // check isVisible() when hasHiddenRows()
     int getRowCount() const;
     int getPrimaryKeyIndex() const;
 
     int getColumnIndex(const string& colName) const;
     bool hasPrimaryKey(const string& value) const;
+    int findRowByPrimaryKey(const string& value) const;
+
+    // Positions (ascending) of the rows matching all conditions; uses the
+    // primary key or a secondary index when a condition allows it and the
+    // statistics do not make a scan cheaper. `used`, when given, receives
+    // the access path taken and what it read.
+    void findMatchingRows(const vector<Condition>& conditions, vector<int>& matches) const;
+    void findMatchingRows(const vector<Condition>& conditions, vector<int>& matches, AccessPath* used) const;
+
+    // The access path findMatchingRows would take, without reading rows
+    AccessPath planAccess(const vector<Condition>& conditions) const;
+
+    // Up to `limit` rows matching all conditions, read in the order of an
+    // index on `column` (largest first when descending) so the scan stops
+    // early. False when no index gives that order: there is none, or the
+    // numeric column holds NULLs, which the index files under 0.
+    bool findOrderedRows(int column, bool descending, const vector<Condition>& conditions,
+        int limit, vector<int>& rows) const;
+    // The index findOrderedRows would walk, or NULL when it returns false
+    const SecondaryIndex* orderedIndex(int column) const;
+
+    void createIndex(const string& indexName, int columnIndex);
+    bool dropIndex(const string& indexName);
+    bool hasIndex(const string& indexName) const;
+    const vector<SecondaryIndex*>& getIndexes() const;
 
     void display() const;
-    void displayData(const vector<int>& columnIndices = vector<int>()) const;
 
     int deleteRows(const vector<Condition>& conditions);
     int updateRows(const map<string, string>& updates,
@@ -0,0 +1,147 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads)
+    : threadCount(0), queued(0), stopping(false) {
+    start(threads);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool((int)thread::hardware_concurrency());
+    return pool;
+}
+
+void ThreadPool::start(int threads) {
+    threadCount = (threads < 1) ? 1 : threads;
+    stopping = false;
+    for (int i = 0; i < threadCount; i++) {
+        queues.push_back(new Queue());
+    }
+    for (int i = 1; i < threadCount; i++) {
+        workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        lock_guard<mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (int i = 0; i < (int)workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    for (int i = 0; i < (int)queues.size(); i++) {
+        delete queues[i];
+    }
+    queues.clear();
+}
+
+void ThreadPool::resize(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads == threadCount) return;
+    stop();
+    start(threads);
+}
+
+int ThreadPool::getThreadCount() const {
+    return threadCount;
+}
+
+// Own queue first, oldest job first; otherwise steal the newest job of
+// another queue, which is the furthest from what its owner is working on
+bool ThreadPool::takeJob(int self, Job& job) {
+    for (int i = 0; i < (int)queues.size(); i++) {
+        Queue* queue = queues[(self + i) % queues.size()];
+        lock_guard<mutex> guard(queue->lock);
+        if (queue->jobs.empty()) continue;
+
+        if (i == 0) {
+            job = queue->jobs.front();
+            queue->jobs.pop_front();
+        }
+        else {
+            job = queue->jobs.back();
+            queue->jobs.pop_back();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Job& job) {
+    Batch* batch = job.batch;
+    batch->task(batch->context, job.index);
+
+    // Decremented under the lock: run() may return (and destroy the batch)
+    // as soon as it sees zero
+    lock_guard<mutex> guard(batch->lock);
+    if (--batch->remaining == 0) batch->done.notify_all();
+}
+
+void ThreadPool::workerLoop(int self) {
+    while (true) {
+        Job job;
+        if (takeJob(self, job)) {
+            execute(job);
+            continue;
+        }
+
+        unique_lock<mutex> guard(sleepLock);
+        while (!stopping && queued == 0) wake.wait(guard);
+        if (stopping) return;
+    }
+}
+
+void ThreadPool::run(Task task, void* context, int count) {
+    if (count <= 0) return;
+
+    if (threadCount == 1 || count == 1) {
+        for (int i = 0; i < count; i++) task(context, i);
+        return;
+    }
+
+    Batch batch;
+    batch.task = task;
+    batch.context = context;
+    batch.remaining = count;
+
+    {
+        lock_guard<mutex> guard(runLock);
+        int queueCount = (int)queues.size();
+        for (int q = 0; q < queueCount; q++) {
+            int first = (int)((long long)count * q / queueCount);
+            int last = (int)((long long)count * (q + 1) / queueCount);
+            if (first == last) continue;
+
+            lock_guard<mutex> queueGuard(queues[q]->lock);
+            for (int i = first; i < last; i++) {
+                Job job;
+                job.batch = &batch;
+                job.index = i;
+                queues[q]->jobs.push_back(job);
+            }
+            queued += last - first;
+        }
+    }
+    {
+        lock_guard<mutex> guard(sleepLock);
+    }
+    wake.notify_all();
+
+    // Help until every job has been taken, then wait for the stragglers
+    Job job;
+    while (batch.remaining > 0 && takeJob(0, job)) {
+        execute(job);
+    }
+
+    unique_lock<mutex> guard(batch.lock);
+    while (batch.remaining > 0) batch.done.wait(guard);
+}
@@ -0,0 +1,77 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+using namespace std;
+
+// Work-stealing pool shared by scans and loaders.
+//
+// run() spreads task indices over one queue per thread in contiguous
+// blocks; a thread takes from the front of its own queue and, once empty,
+// steals from the back of the others. The calling thread works too, so a
+// pool of n threads starts n - 1 workers.
+class ThreadPool {
+public:
+    typedef void (*Task)(void* context, int index);
+
+private:
+    struct Batch {
+        Task task;
+        void* context;
+        atomic<int> remaining;
+        mutex lock;
+        condition_variable done;
+    };
+
+    struct Job {
+        Batch* batch;
+        int index;
+    };
+
+    struct Queue {
+        mutex lock;
+        deque<Job> jobs;
+    };
+
+    int threadCount;
+    vector<Queue*> queues;   // queues[0] belongs to callers of run()
+    vector<thread> workers;
+
+    mutex sleepLock;
+    condition_variable wake;
+    atomic<int> queued;
+    bool stopping;
+
+    mutex runLock;           // one batch is spread over the queues at a time
+
+    bool takeJob(int self, Job& job);
+    void execute(const Job& job);
+    void workerLoop(int self);
+    void start(int threads);
+    void stop();
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    // Process-wide pool, sized to the hardware until resized
+    static ThreadPool& shared();
+
+    // Not to be called while run() is in progress
+    void resize(int threads);
+    int getThreadCount() const;
+
+    // Calls task(context, i) for every i in [0, count) and returns once all
+    // calls have finished
+    void run(Task task, void* context, int count);
+};
+
+#endif
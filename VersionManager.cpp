@@ -0,0 +1,80 @@
+#include "VersionManager.h"
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+VersionManager::VersionManager() : lastCommitted(0), epoch(0) {
+    readers[0] = 0;
+    readers[1] = 0;
+}
+
+VersionManager::~VersionManager() {
+    // no reader can be left once the engine goes
+    for (size_t i = 0; i < retired.size(); i++) {
+        retired[i].free(retired[i].object);
+    }
+}
+
+uint64_t VersionManager::getLastCommitted() const {
+    return lastCommitted.load();
+}
+
+void VersionManager::publish(uint64_t transaction) {
+    lastCommitted.store(transaction);
+}
+
+int VersionManager::pin() {
+    while (true) {
+        uint64_t seen = epoch.load();
+        int slot = (int)(seen & 1);
+        readers[slot].fetch_add(1);
+        if (epoch.load() == seen) return slot;
+        // the epoch moved between the two reads: count in the new slot
+        readers[slot].fetch_sub(1);
+    }
+}
+
+void VersionManager::unpin(int slot) {
+    readers[slot].fetch_sub(1);
+}
+
+void VersionManager::retire(Reclaimer free, void* object) {
+    Retired entry;
+    entry.free = free;
+    entry.object = object;
+    lock_guard<mutex> guard(retireLock);
+    retired.push_back(entry);
+}
+
+static void waitForReaders(atomic<int>& count) {
+    for (int spins = 0; count.load() != 0; spins++) {
+        if (spins < 64) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(200));
+    }
+}
+
+// Returns once every reader that pinned before the call has unpinned:
+// first the slot of the previous epoch drains, then the epoch advances
+// and the current slot drains.
+void VersionManager::synchronize() {
+    uint64_t current = epoch.load();
+    waitForReaders(readers[(current + 1) & 1]);
+    epoch.store(current + 1);
+    waitForReaders(readers[current & 1]);
+}
+
+void VersionManager::reclaim() {
+    lock_guard<mutex> guard(reclaimLock);
+    vector<Retired> batch;
+    {
+        lock_guard<mutex> retiring(retireLock);
+        batch.swap(retired);
+    }
+    if (batch.empty()) return;
+
+    synchronize();
+    for (size_t i = 0; i < batch.size(); i++) {
+        batch[i].free(batch[i].object);
+    }
+}
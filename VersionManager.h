@@ -0,0 +1,64 @@
+#ifndef VERSIONMANAGER_H
+#define VERSIONMANAGER_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+// Commit numbers and deferred frees for snapshot reads (one per engine).
+//
+// Every committed change gets the next transaction number; a reader's
+// snapshot is the last number published when it started, and it sees the
+// row versions created at or before it and not deleted by then.
+//
+// Readers never lock: they pin() an epoch while they hold pointers into
+// shared structures. Whatever a writer replaces (a table's rows, a mapped
+// file) is retire()d instead of freed, and reclaim() frees it once every
+// reader pinned before the retire has unpinned.
+class VersionManager {
+public:
+    typedef void (*Reclaimer)(void* object);
+
+private:
+    struct Retired {
+        Reclaimer free;
+        void* object;
+    };
+
+    atomic<uint64_t> lastCommitted;
+
+    // Readers count themselves in the slot of the epoch they saw; the
+    // epoch only moves on once the other slot has drained
+    atomic<uint64_t> epoch;
+    atomic<int> readers[2];
+
+    mutex retireLock;
+    vector<Retired> retired;
+    mutex reclaimLock;    // one reclaim() at a time
+
+    void synchronize();
+
+    VersionManager(const VersionManager&);
+    VersionManager& operator=(const VersionManager&);
+
+public:
+    VersionManager();
+    ~VersionManager();
+
+    uint64_t getLastCommitted() const;
+    // Makes everything stamped with `transaction` visible to new snapshots;
+    // callers publish in order
+    void publish(uint64_t transaction);
+
+    // The returned slot goes back to unpin()
+    int pin();
+    void unpin(int slot);
+
+    void retire(Reclaimer free, void* object);
+    // Frees what was retired so far; waits for the readers pinned before
+    void reclaim();
+};
+
+#endif
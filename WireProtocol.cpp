@@ -0,0 +1,64 @@
+#include "WireProtocol.h"
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace std;
+
+void WireProtocol::appendFrame(string& out, const string& payload) {
+    if (payload.size() > MAX_FRAME) {
+        throw runtime_error("Frame of " + to_string(payload.size()) + " bytes exceeds the limit");
+    }
+    uint32_t length = (uint32_t)payload.size();
+    out += (char)((length >> 24) & 0xFF);
+    out += (char)((length >> 16) & 0xFF);
+    out += (char)((length >> 8) & 0xFF);
+    out += (char)(length & 0xFF);
+    out += payload;
+}
+
+bool WireProtocol::takeFrame(string& buffer, string& payload) {
+    if (buffer.size() < 4) return false;
+
+    uint32_t length = ((uint32_t)(unsigned char)buffer[0] << 24) | ((uint32_t)(unsigned char)buffer[1] << 16) |
+        ((uint32_t)(unsigned char)buffer[2] << 8) | (uint32_t)(unsigned char)buffer[3];
+    if (length > MAX_FRAME) throw runtime_error("Frame of " + to_string(length) + " bytes exceeds the limit");
+    if (buffer.size() < 4 + (size_t)length) return false;
+
+    payload.assign(buffer, 4, length);
+    buffer.erase(0, 4 + (size_t)length);
+    return true;
+}
+
+string WireProtocol::encodeResponse(ResponseStatus status, const string& database, const string& output) {
+    string payload;
+    payload.reserve(2 + database.size() + output.size());
+    payload += (char)status;
+    payload += database;
+    payload += '\n';
+    payload += output;
+    return payload;
+}
+
+bool WireProtocol::decodeResponse(const string& payload, ResponseStatus& status, string& database, string& output) {
+    size_t newline = payload.find('\n', 1);
+    if (payload.empty() || newline == string::npos) return false;
+    if (payload[0] != RESPONSE_OPEN && payload[0] != RESPONSE_CLOSED) return false;
+
+    status = (ResponseStatus)payload[0];
+    database.assign(payload, 1, newline - 1);
+    output.assign(payload, newline + 1, string::npos);
+    return true;
+}
+
+bool WireProtocol::parseAddress(const string& text, string& host, int& port) {
+    size_t colon = text.rfind(':');
+    if (colon == string::npos || colon == 0 || colon + 1 == text.size()) return false;
+
+    string digits = text.substr(colon + 1);
+    if (digits.find_first_not_of("0123456789") != string::npos || digits.size() > 5) return false;
+    port = atoi(digits.c_str());
+    if (port <= 0 || port > 65535) return false;
+
+    host = text.substr(0, colon);
+    return true;
+}
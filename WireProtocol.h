@@ -0,0 +1,40 @@
+#ifndef WIREPROTOCOL_H
+#define WIREPROTOCOL_H
+
+#include <string>
+#include <cstdint>
+using namespace std;
+
+// Messages between the server and its clients. Each is a frame: the
+// payload length as 4 bytes big-endian, then the payload.
+//   request:  shell commands, separated by ';' as on the REPL's line
+//   response: one status byte, the session's current database, '\n', then
+//             the text the commands printed
+// A connection carries one request at a time in each direction; a client
+// may send the next request before reading the response (pipelining).
+class WireProtocol {
+public:
+    static const uint32_t MAX_FRAME = 64 * 1024 * 1024;
+
+    enum ResponseStatus {
+        RESPONSE_OPEN = 0,
+        RESPONSE_CLOSED = 1   // the session ended (EXIT); the server closes the connection
+    };
+
+    // Appends payload as a frame. Throws runtime_error for a payload
+    // longer than MAX_FRAME, which the other side would refuse.
+    static void appendFrame(string& out, const string& payload);
+
+    // Moves the first complete frame of buffer into payload; false while
+    // the frame is incomplete. Throws runtime_error for a frame longer
+    // than MAX_FRAME.
+    static bool takeFrame(string& buffer, string& payload);
+
+    static string encodeResponse(ResponseStatus status, const string& database, const string& output);
+    static bool decodeResponse(const string& payload, ResponseStatus& status, string& database, string& output);
+
+    // "host:port"; false when malformed
+    static bool parseAddress(const string& text, string& host, int& port);
+};
+
+#endif
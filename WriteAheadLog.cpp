@@ -0,0 +1,213 @@
+#include "WriteAheadLog.h"
+#include "Checksum.h"
+#include "FileSystem.h"
+#include "Encoding.h"
+#include <fstream>
+#include <chrono>
+
+using namespace std;
+
+// ---------- record encoding ----------
+
+static bool decodePayload(const string& payload, LogRecord& record) {
+    if (payload.size() < 13) return false;
+
+    const char* p = payload.data();
+    const char* end = p + payload.size();
+    record.lsn = getU64(p);
+    record.type = (LogRecordType)(unsigned char)p[8];
+    uint32_t fieldCount = getU32(p + 9);
+    p += 13;
+
+    record.fields.clear();
+    for (uint32_t i = 0; i < fieldCount; i++) {
+        if (end - p < 4) return false;
+        uint32_t length = getU32(p);
+        p += 4;
+        if ((uint32_t)(end - p) < length) return false;
+        record.fields.push_back(string(p, length));
+        p += length;
+    }
+    return p == end;
+}
+
+// ---------- WriteAheadLog ----------
+
+WriteAheadLog::WriteAheadLog()
+    : fd(-1), nextLsn(1), fileSize(0),
+    syncMode(SYNC_EVERY_STATEMENT), syncParam(0), pendingRecords(0),
+    stopping(false) {
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close();
+}
+
+bool WriteAheadLog::open(const string& logPath, uint64_t validLength, uint64_t firstLsn) {
+    close();
+
+    fd = FileSystem::openForWrite(logPath);
+    if (fd == -1) return false;
+
+    path = logPath;
+    FileSystem::truncate(fd, validLength);
+    fileSize = validLength;
+    nextLsn = firstLsn;
+    pendingRecords = 0;
+
+    if (syncMode == SYNC_INTERVAL) startFlusher();
+    return true;
+}
+
+void WriteAheadLog::close() {
+    stopFlusher();
+
+    lock_guard<mutex> guard(lock);
+    if (fd == -1) return;
+
+    syncLocked();
+    FileSystem::close(fd);
+    fd = -1;
+}
+
+bool WriteAheadLog::isOpen() const {
+    return fd != -1;
+}
+
+uint64_t WriteAheadLog::append(LogRecordType type, const vector<string>& fields) {
+    lock_guard<mutex> guard(lock);
+    if (fd == -1) return 0;
+
+    uint64_t lsn = nextLsn++;
+
+    // The payload is built in place after the 8-byte frame header, which
+    // is filled in once its length and checksum are known
+    size_t payloadSize = 13;
+    for (size_t i = 0; i < fields.size(); i++) payloadSize += 4 + fields[i].size();
+
+    string frame;
+    frame.reserve(8 + payloadSize);
+    frame.append(8, '\0');
+    putU64(frame, lsn);
+    frame.push_back((char)type);
+    putU32(frame, (uint32_t)fields.size());
+    for (size_t i = 0; i < fields.size(); i++) {
+        putU32(frame, (uint32_t)fields[i].size());
+        frame += fields[i];
+    }
+
+    string header;
+    putU32(header, (uint32_t)payloadSize);
+    putU32(header, Checksum::crc32(frame.data() + 8, payloadSize));
+    frame.replace(0, 8, header);
+
+    FileSystem::writeAll(fd, frame.data(), frame.size());
+    fileSize += frame.size();
+    pendingRecords++;
+
+    if (syncMode == SYNC_EVERY_STATEMENT ||
+        (syncMode == SYNC_RECORDS && pendingRecords >= syncParam)) {
+        syncLocked();
+    }
+
+    return lsn;
+}
+
+void WriteAheadLog::syncLocked() {
+    if (fd == -1 || pendingRecords == 0) return;
+    FileSystem::sync(fd);
+    pendingRecords = 0;
+}
+
+void WriteAheadLog::sync() {
+    lock_guard<mutex> guard(lock);
+    syncLocked();
+}
+
+void WriteAheadLog::reset() {
+    lock_guard<mutex> guard(lock);
+    if (fd == -1) return;
+
+    FileSystem::truncate(fd, 0);
+    FileSystem::sync(fd);
+    fileSize = 0;
+    pendingRecords = 0;
+}
+
+void WriteAheadLog::setSyncMode(SyncMode mode, int param) {
+    stopFlusher();
+    {
+        lock_guard<mutex> guard(lock);
+        syncMode = mode;
+        syncParam = param < 1 ? 1 : param;
+        syncLocked();
+    }
+    if (syncMode == SYNC_INTERVAL && fd != -1) startFlusher();
+}
+
+SyncMode WriteAheadLog::getSyncMode() const {
+    return syncMode;
+}
+
+int WriteAheadLog::getSyncParam() const {
+    return syncParam;
+}
+
+void WriteAheadLog::startFlusher() {
+    stopping = false;
+    flusher = thread(&WriteAheadLog::flusherLoop, this);
+}
+
+void WriteAheadLog::stopFlusher() {
+    if (!flusher.joinable()) return;
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    flusher.join();
+}
+
+void WriteAheadLog::flusherLoop() {
+    unique_lock<mutex> guard(lock);
+    while (!stopping) {
+        wake.wait_for(guard, chrono::milliseconds(syncParam));
+        syncLocked();
+    }
+}
+
+uint64_t WriteAheadLog::getSize() const {
+    return fileSize;
+}
+
+uint64_t WriteAheadLog::getNextLsn() const {
+    return nextLsn;
+}
+
+void WriteAheadLog::readAll(const string& logPath, vector<LogRecord>& records, uint64_t& validLength) {
+    validLength = 0;
+
+    ifstream in(logPath.c_str(), ios::binary);
+    if (!in) return;
+
+    in.seekg(0, ios::end);
+    uint64_t totalLength = (uint64_t)in.tellg();
+    in.seekg(0, ios::beg);
+
+    char header[8];
+    while (in.read(header, 8)) {
+        uint32_t length = getU32(header);
+        uint32_t crc = getU32(header + 4);
+        if (validLength + 8 + length > totalLength) break; // torn tail
+
+        string payload(length, '\0');
+        if (length > 0 && !in.read(&payload[0], length)) break;
+        if (Checksum::crc32(payload.data(), payload.size()) != crc) break;
+
+        LogRecord record;
+        if (!decodePayload(payload, record)) break;
+
+        records.push_back(record);
+        validLength += 8 + length;
+    }
+}
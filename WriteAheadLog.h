@@ -0,0 +1,90 @@
+#ifndef WRITEAHEADLOG_H
+#define WRITEAHEADLOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+enum LogRecordType {
+    LOG_CREATE_TABLE = 1, // table, then name/type/size/pk/nn per column
+    LOG_DROP_TABLE,       // table
+    LOG_INSERT,           // table, then each row's values in turn
+    LOG_DELETE,           // table, then column/op/value per condition
+    LOG_UPDATE,           // table, update count, column/value pairs, column/op/value per condition
+    LOG_CREATE_INDEX,     // index, table, column
+    LOG_DROP_INDEX        // index
+};
+
+// When appended records are forced to stable storage
+enum SyncMode {
+    SYNC_EVERY_STATEMENT, // fsync after each record
+    SYNC_INTERVAL,        // background fsync every N ms
+    SYNC_RECORDS          // fsync once N records are pending
+};
+
+struct LogRecord {
+    uint64_t lsn;
+    LogRecordType type;
+    vector<string> fields;
+};
+
+// Append-only redo log. Each record is framed as
+//   [u32 payload length][u32 crc32 of payload][payload]
+//   payload = [u64 lsn][u8 type][u32 field count]([u32 length][bytes])*
+// Records are written to the OS immediately; fsync is grouped per SyncMode.
+class WriteAheadLog {
+private:
+    string path;
+    int fd;
+    uint64_t nextLsn;
+    uint64_t fileSize;
+
+    SyncMode syncMode;
+    int syncParam;
+    int pendingRecords;
+
+    mutex lock;
+    condition_variable wake;
+    thread flusher;
+    bool stopping;
+
+    WriteAheadLog(const WriteAheadLog&);
+    WriteAheadLog& operator=(const WriteAheadLog&);
+
+    void syncLocked();
+    void startFlusher();
+    void stopFlusher();
+    void flusherLoop();
+
+public:
+    WriteAheadLog();
+    ~WriteAheadLog();
+
+    // Opens (creating if needed) and truncates anything past validLength,
+    // e.g. a torn record left by a crash.
+    bool open(const string& logPath, uint64_t validLength, uint64_t firstLsn);
+    void close();
+    bool isOpen() const;
+
+    uint64_t append(LogRecordType type, const vector<string>& fields);
+    void sync();
+
+    // Empties the log after a checkpoint; LSNs keep increasing.
+    void reset();
+
+    void setSyncMode(SyncMode mode, int param);
+    SyncMode getSyncMode() const;
+    int getSyncParam() const;
+
+    uint64_t getSize() const;
+    uint64_t getNextLsn() const;
+
+    // Reads every intact record; validLength is the offset after the last one.
+    static void readAll(const string& logPath, vector<LogRecord>& records, uint64_t& validLength);
+};
+
+#endif
@@ -0,0 +1,502 @@
+// dbengine_bench: throughput and latency of the engine's core operations
+// at several table sizes, written as JSON so runs of different versions
+// can be compared.
+//
+// Every size gets a fresh database in its own directory and a table
+//     bench (id INT PRIMARY KEY, k INT, v FLOAT, s VARCHAR(16))
+// filled with rows from a seeded generator, so the same seed always
+// produces the same data and the same lookups. Then, in order:
+//   insert    batches of BATCH_ROWS rows through insertBatch
+//   lookup    SELECT * ... WHERE id = ? for random ids
+//   scan      SELECT id, v ... WHERE v < 100 (about 10% of the rows), every row tested
+//   update    UPDATE ... SET v = ? WHERE id = ? for random ids
+//   delete    DELETE ... WHERE id = ? for spread-out ids; the rows are
+//             compacted away later, in the background
+//   save      a checkpoint of the whole table
+//   load      opening the checkpoint in a new engine and reading every row once
+// Statements other than inserts go through prepared statements, and each
+// result is read to the end. The engine's own messages are discarded.
+
+#include "DatabaseEngine.h"
+#include "FileSystem.h"
+#include "PreparedStatement.h"
+#include "ResultSet.h"
+#include "ResultSink.h"
+#include "ThreadPool.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+#ifndef DBENGINE_VERSION
+#define DBENGINE_VERSION "unknown"
+#endif
+#ifndef DBENGINE_REVISION
+#define DBENGINE_REVISION "unknown"
+#endif
+
+static const int BATCH_ROWS = 10000;
+static const char* TABLE_NAME = "bench";
+
+struct Options {
+    vector<long long> sizes;
+    int operations;      // lookups and updates per size
+    uint64_t seed;
+    int threads;
+    bool syncEveryStatement;
+    bool keepFiles;
+    string directory;
+    string output;       // empty for stdout
+
+    Options();
+};
+
+Options::Options()
+    : operations(10000), seed(42), threads(0), syncEveryStatement(false), keepFiles(false),
+    directory("dbengine_bench_data") {
+    for (long long rows = 1000; rows <= 10000000; rows *= 10) sizes.push_back(rows);
+}
+
+// Timings of one operation at one table size
+struct Measurement {
+    long long tableRows;
+    string operation;
+    long long rows;               // rows inserted, returned or changed
+    vector<double> latencies;     // seconds, one per statement
+    double seconds;               // total
+};
+
+// ================== DATA ==================
+
+// splitmix64: small, fast and the same on every platform
+class Random {
+private:
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    long long below(long long bound) {
+        return (long long)(next() % (uint64_t)bound);
+    }
+};
+
+static string formatValue(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", value);
+    return text;
+}
+
+static void makeRow(Random& random, long long id, vector<string>& row) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+    row.resize(4);
+    row[0] = to_string(id);
+    row[1] = to_string(random.below(1000));
+    row[2] = formatValue((double)random.below(100000) / 100);
+
+    int length = 4 + (int)random.below(9);
+    row[3].assign(length, ' ');
+    for (int i = 0; i < length; i++) row[3][i] = letters[random.below(26)];
+}
+
+// ================== TIMING ==================
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Keeps the engine's progress messages out of the results
+class QuietOutput {
+private:
+    streambuf* saved;
+
+public:
+    QuietOutput() : saved(cout.rdbuf(NULL)) {}
+    ~QuietOutput() {
+        cout.rdbuf(saved);
+        cout.clear();
+    }
+};
+
+static void check(StatusCode status, const QueryResult& result, const string& what) {
+    if (status != STATUS_OK) throw runtime_error(what + ": " + result.getMessage());
+}
+
+static PreparedStatement* prepare(DatabaseEngine& db, const string& sql) {
+    PreparedStatement* statement = db.prepare(sql);
+    if (statement->getStatus() != STATUS_OK) {
+        string message = statement->getMessage();
+        delete statement;
+        throw runtime_error("Could not prepare '" + sql + "': " + message);
+    }
+    return statement;
+}
+
+// Runs a prepared statement and reads its rows; returns the rows returned
+// or changed
+static long long run(PreparedStatement& statement, Measurement& measurement) {
+    QueryResult result;
+    Clock::time_point start = Clock::now();
+    check(statement.execute(result), result, statement.getSql());
+    long long rows = result.getRowsAffected();
+    if (result.getRows() != NULL) {
+        CountingSink sink;
+        rows = ResultSink::drain(*result.getRows(), sink);
+    }
+    double seconds = secondsSince(start);
+    measurement.latencies.push_back(seconds);
+    measurement.seconds += seconds;
+    measurement.rows += rows;
+    return rows;
+}
+
+static Measurement start(long long tableRows, const string& operation) {
+    Measurement measurement;
+    measurement.tableRows = tableRows;
+    measurement.operation = operation;
+    measurement.rows = 0;
+    measurement.seconds = 0;
+    return measurement;
+}
+
+// ================== OPERATIONS ==================
+
+static Measurement benchInsert(DatabaseEngine& db, long long tableRows, Random& random) {
+    Measurement measurement = start(tableRows, "insert");
+    vector<vector<string> > batch;
+    for (long long first = 0; first < tableRows; first += BATCH_ROWS) {
+        long long count = min((long long)BATCH_ROWS, tableRows - first);
+        batch.resize((size_t)count);
+        for (long long i = 0; i < count; i++) makeRow(random, first + i, batch[(size_t)i]);
+
+        Clock::time_point begin = Clock::now();
+        if (!db.insertBatch(TABLE_NAME, batch)) throw runtime_error("Insert failed");
+        double seconds = secondsSince(begin);
+        measurement.latencies.push_back(seconds);
+        measurement.seconds += seconds;
+        measurement.rows += count;
+    }
+    return measurement;
+}
+
+static Measurement benchLookup(DatabaseEngine& db, long long tableRows, int operations, Random& random) {
+    Measurement measurement = start(tableRows, "lookup");
+    PreparedStatement* statement = prepare(db, string("SELECT * FROM ") + TABLE_NAME + " WHERE id = ?");
+    try {
+        for (int i = 0; i < operations; i++) {
+            statement->bind(1, (int64_t)random.below(tableRows));
+            run(*statement, measurement);
+        }
+    }
+    catch (...) {
+        delete statement;
+        throw;
+    }
+    delete statement;
+    return measurement;
+}
+
+static Measurement benchScan(DatabaseEngine& db, long long tableRows) {
+    Measurement measurement = start(tableRows, "scan");
+    PreparedStatement* statement = prepare(db, string("SELECT id, v FROM ") + TABLE_NAME + " WHERE v < ?");
+    // enough runs for a stable median on small tables, a few on large ones
+    long long runs = max(3LL, min(50LL, 10000000LL / tableRows));
+    try {
+        statement->bind(1, 100.0);
+        for (long long i = 0; i < runs; i++) run(*statement, measurement);
+    }
+    catch (...) {
+        delete statement;
+        throw;
+    }
+    delete statement;
+    return measurement;
+}
+
+static Measurement benchUpdate(DatabaseEngine& db, long long tableRows, int operations, Random& random) {
+    Measurement measurement = start(tableRows, "update");
+    PreparedStatement* statement = prepare(db, string("UPDATE ") + TABLE_NAME + " SET v = ? WHERE id = ?");
+    try {
+        for (int i = 0; i < operations; i++) {
+            statement->bind(1, (double)random.below(100000) / 100);
+            statement->bind(2, (int64_t)random.below(tableRows));
+            run(*statement, measurement);
+        }
+    }
+    catch (...) {
+        delete statement;
+        throw;
+    }
+    delete statement;
+    return measurement;
+}
+
+static Measurement benchDelete(DatabaseEngine& db, long long tableRows, int operations) {
+    Measurement measurement = start(tableRows, "delete");
+    PreparedStatement* statement = prepare(db, string("DELETE FROM ") + TABLE_NAME + " WHERE id = ?");
+    long long count = max(10LL, min((long long)operations, min(tableRows / 10, 10000000LL / tableRows)));
+    long long step = max(1LL, tableRows / count);
+    try {
+        for (long long i = 0; i < count; i++) {
+            statement->bind(1, (int64_t)(i * step));
+            run(*statement, measurement);
+        }
+    }
+    catch (...) {
+        delete statement;
+        throw;
+    }
+    delete statement;
+    return measurement;
+}
+
+static Measurement benchSave(DatabaseEngine& db, long long tableRows, long long liveRows, const string& file) {
+    Measurement measurement = start(tableRows, "save");
+    measurement.rows = liveRows;
+    Clock::time_point begin = Clock::now();
+    db.saveToDisk(file);
+    measurement.seconds = secondsSince(begin);
+    measurement.latencies.push_back(measurement.seconds);
+    return measurement;
+}
+
+static Measurement benchLoad(long long tableRows, long long liveRows, const string& file, bool syncEveryStatement) {
+    Measurement measurement = start(tableRows, "load");
+    Clock::time_point begin = Clock::now();
+    DatabaseEngine db;
+    db.loadFromDisk(file);
+    if (!syncEveryStatement) db.setSyncMode(SYNC_INTERVAL, 100);
+
+    PreparedStatement* statement = prepare(db, string("SELECT COUNT(*) FROM ") + TABLE_NAME);
+    QueryResult result;
+    StatusCode status = statement->execute(result);
+    delete statement;
+    check(status, result, "Reading the loaded table");
+    CountingSink sink;
+    ResultSink::drain(*result.getRows(), sink);
+
+    measurement.seconds = secondsSince(begin);
+    measurement.latencies.push_back(measurement.seconds);
+    measurement.rows = liveRows;
+    return measurement;
+}
+
+// One table size from an empty directory to the reloaded checkpoint
+static void benchSize(const Options& options, long long tableRows, vector<Measurement>& measurements) {
+    string folder = FileSystem::joinPath(options.directory, "rows_" + to_string(tableRows));
+    if (FileSystem::directoryExists(folder)) FileSystem::removeDirectory(folder);
+    if (!FileSystem::createDirectory(folder)) throw runtime_error("Could not create '" + folder + "'");
+    string file = FileSystem::joinPath(folder, "database.db");
+
+    Random random(options.seed ^ (uint64_t)tableRows);
+    int operations = (int)min((long long)options.operations, tableRows);
+    long long liveRows = 0;
+    {
+        QuietOutput quiet;
+        DatabaseEngine db;
+        db.loadFromDisk(file);
+        if (!options.syncEveryStatement) db.setSyncMode(SYNC_INTERVAL, 100);
+        db.createTable(string("CREATE TABLE ") + TABLE_NAME +
+            " (id INT PRIMARY KEY, k INT, v FLOAT, s VARCHAR(16))");
+
+        measurements.push_back(benchInsert(db, tableRows, random));
+        measurements.push_back(benchLookup(db, tableRows, operations, random));
+        measurements.push_back(benchScan(db, tableRows));
+        measurements.push_back(benchUpdate(db, tableRows, operations, random));
+        measurements.push_back(benchDelete(db, tableRows, operations));
+        liveRows = tableRows - measurements.back().rows;
+        measurements.push_back(benchSave(db, tableRows, liveRows, file));
+    }
+    {
+        QuietOutput quiet;
+        measurements.push_back(benchLoad(tableRows, liveRows, file, options.syncEveryStatement));
+    }
+
+    if (!options.keepFiles) FileSystem::removeDirectory(folder);
+}
+
+// ================== REPORT ==================
+
+static double percentile(const vector<double>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index = (size_t)(fraction * (double)(sorted.size() - 1) + 0.5);
+    return sorted[min(index, sorted.size() - 1)];
+}
+
+static string jsonNumber(double value) {
+    char text[48];
+    snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+static string jsonString(const string& value) {
+    string quoted = "\"";
+    for (size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+            continue;
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static void writeJson(ostream& out, const Options& options, const vector<Measurement>& measurements) {
+    out << "{\n";
+    out << "  \"benchmark\": \"dbengine_bench\",\n";
+    out << "  \"version\": " << jsonString(DBENGINE_VERSION) << ",\n";
+    out << "  \"revision\": " << jsonString(DBENGINE_REVISION) << ",\n";
+    out << "  \"seed\": " << options.seed << ",\n";
+    out << "  \"threads\": " << ThreadPool::shared().getThreadCount() << ",\n";
+    out << "  \"wal_sync\": " << jsonString(options.syncEveryStatement ? "statement" : "100ms") << ",\n";
+    out << "  \"results\": [";
+
+    for (size_t i = 0; i < measurements.size(); i++) {
+        const Measurement& m = measurements[i];
+        vector<double> sorted = m.latencies;
+        sort(sorted.begin(), sorted.end());
+        double count = (double)sorted.size();
+
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"table_rows\": " << m.tableRows
+            << ", \"operation\": " << jsonString(m.operation)
+            << ", \"statements\": " << sorted.size()
+            << ", \"rows\": " << m.rows
+            << ", \"seconds\": " << jsonNumber(m.seconds)
+            << ", \"statements_per_sec\": " << jsonNumber(m.seconds > 0 ? count / m.seconds : 0)
+            << ", \"rows_per_sec\": " << jsonNumber(m.seconds > 0 ? (double)m.rows / m.seconds : 0)
+            << ", \"mean_us\": " << jsonNumber(count > 0 ? m.seconds / count * 1e6 : 0)
+            << ", \"p50_us\": " << jsonNumber(percentile(sorted, 0.50) * 1e6)
+            << ", \"p95_us\": " << jsonNumber(percentile(sorted, 0.95) * 1e6)
+            << ", \"p99_us\": " << jsonNumber(percentile(sorted, 0.99) * 1e6)
+            << ", \"max_us\": " << jsonNumber(sorted.empty() ? 0 : sorted.back() * 1e6)
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// ================== MAIN ==================
+
+static void printUsage() {
+    cerr << "Usage: dbengine_bench [options]\n"
+        << "  --sizes N,N,...   table sizes (default 1000,10000,100000,1000000,10000000)\n"
+        << "  --ops N           lookups and updates per size (default 10000)\n"
+        << "  --seed N          data and key generator seed (default 42)\n"
+        << "  --threads N       engine threads (default: all cores)\n"
+        << "  --fsync           sync the log after every statement (default: every 100 ms)\n"
+        << "  --dir PATH        scratch directory (default dbengine_bench_data)\n"
+        << "  --keep            keep the databases written\n"
+        << "  --output FILE     write the JSON there instead of stdout\n";
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            options.sizes.clear();
+            stringstream list(argv[++i]);
+            string item;
+            while (getline(list, item, ',')) {
+                long long rows = atoll(item.c_str());
+                if (rows <= 0 || rows > 2000000000LL) return false;
+                options.sizes.push_back(rows);
+            }
+            if (options.sizes.empty()) return false;
+        }
+        else if (arg == "--ops" && hasValue) {
+            options.operations = atoi(argv[++i]);
+            if (options.operations <= 0) return false;
+        }
+        else if (arg == "--seed" && hasValue) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (arg == "--threads" && hasValue) {
+            options.threads = atoi(argv[++i]);
+            if (options.threads <= 0) return false;
+        }
+        else if (arg == "--dir" && hasValue) {
+            options.directory = argv[++i];
+        }
+        else if (arg == "--output" && hasValue) {
+            options.output = argv[++i];
+        }
+        else if (arg == "--fsync") {
+            options.syncEveryStatement = true;
+        }
+        else if (arg == "--keep") {
+            options.keepFiles = true;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 2;
+    }
+    if (options.threads > 0) ThreadPool::shared().resize(options.threads);
+
+    if (!FileSystem::directoryExists(options.directory) && !FileSystem::createDirectory(options.directory)) {
+        cerr << "Error: Could not create '" << options.directory << "'" << endl;
+        return 1;
+    }
+
+    vector<Measurement> measurements;
+    try {
+        for (size_t i = 0; i < options.sizes.size(); i++) {
+            size_t first = measurements.size();
+            benchSize(options, options.sizes[i], measurements);
+            for (size_t m = first; m < measurements.size(); m++) {
+                cerr << options.sizes[i] << " rows, " << measurements[m].operation << ": "
+                    << jsonNumber(measurements[m].seconds) << " s" << endl;
+            }
+        }
+    }
+    catch (exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    if (!options.keepFiles) FileSystem::removeDirectory(options.directory);
+
+    if (options.output.empty()) {
+        writeJson(cout, options, measurements);
+    }
+    else {
+        ofstream out(options.output.c_str());
+        writeJson(out, options, measurements);
+        if (!out) {
+            cerr << "Error: Could not write '" << options.output << "'" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
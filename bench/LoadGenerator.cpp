@@ -0,0 +1,298 @@
+// dbengine_load: queries per second and latency of a running server
+// (dbms --listen) under concurrent clients.
+//
+// One connection first builds the table
+//     load (id INT PRIMARY KEY, v INT)
+// in its own database. Then every client thread opens a connection and,
+// until the time is up, sends one statement at a time and waits for its
+// response: a point SELECT by random id or, for --write-percent of them,
+// an UPDATE of one row. Statements in the warm-up are not counted.
+// Results are JSON, like dbengine_bench's.
+
+#include "Client.h"
+#include "WireProtocol.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+using namespace std;
+
+struct Options {
+    string address;
+    string database;
+    int clients;
+    double seconds;
+    double warmup;
+    long long rows;
+    int writePercent;
+    uint64_t seed;
+    string output;   // empty for stdout
+
+    Options();
+};
+
+Options::Options()
+    : address("127.0.0.1:5433"), database("loadgen"), clients(8), seconds(10), warmup(1), rows(100000),
+    writePercent(0), seed(42) {
+}
+
+// What one client measured
+struct ClientResult {
+    vector<double> latencies;   // seconds, of the counted statements
+    long long reads;
+    long long writes;
+    long long errors;           // responses reporting an error
+    string failure;             // why the client stopped early, if it did
+
+    ClientResult() : reads(0), writes(0), errors(0) {}
+};
+
+// splitmix64, as in dbengine_bench
+class Random {
+private:
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    long long below(long long bound) {
+        return (long long)(next() % (uint64_t)bound);
+    }
+};
+
+typedef chrono::steady_clock Clock;
+
+static bool isError(const string& output) {
+    return output.compare(0, 6, "Error:") == 0 || output.find("\nError:") != string::npos;
+}
+
+static bool connect(Client& client, const Options& options, string& error) {
+    string host;
+    int port = 0;
+    WireProtocol::parseAddress(options.address, host, port);
+    return client.connect(host, port, error);
+}
+
+// ================== SETUP ==================
+
+static bool createTable(const Options& options, string& error) {
+    Client client;
+    string output;
+    if (!connect(client, options, error)) return false;
+
+    // the database may be left from an earlier run, the table too
+    if (!client.query("CREATE DATABASE " + options.database, output)) return false;
+    if (!client.query("USE " + options.database, error) || isError(error)) return false;
+    if (!client.query("DROP TABLE load", output)) return false;
+    if (!client.query("CREATE TABLE load (id INT PRIMARY KEY, v INT)", error) || isError(error)) return false;
+
+    Random random(options.seed);
+    const long long ROWS_PER_INSERT = 1000;
+    for (long long first = 0; first < options.rows; first += ROWS_PER_INSERT) {
+        ostringstream insert;
+        insert << "INSERT INTO load VALUES ";
+        long long last = min(options.rows, first + ROWS_PER_INSERT);
+        for (long long id = first; id < last; id++) {
+            insert << (id == first ? "" : ", ") << "(" << id << ", " << random.below(1000000) << ")";
+        }
+        if (!client.query(insert.str(), error) || isError(error)) return false;
+    }
+    client.query("EXIT", output);
+    return true;
+}
+
+// ================== CLIENTS ==================
+
+static void runClient(const Options& options, int number, Clock::time_point start, ClientResult* result) {
+    Client client;
+    string output;
+    if (!connect(client, options, result->failure)) return;
+    if (!client.query("USE " + options.database, output) || isError(output)) {
+        result->failure = output;
+        return;
+    }
+
+    Random random(options.seed + 1 + (uint64_t)number);
+    Clock::time_point counted = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(options.warmup));
+    Clock::time_point end = counted + chrono::duration_cast<Clock::duration>(chrono::duration<double>(options.seconds));
+    char statement[128];
+
+    while (true) {
+        Clock::time_point sent = Clock::now();
+        if (sent >= end) break;
+
+        long long id = random.below(options.rows);
+        bool write = random.below(100) < options.writePercent;
+        if (write) {
+            snprintf(statement, sizeof(statement), "UPDATE load SET v = %lld WHERE id = %lld",
+                random.below(1000000), id);
+        }
+        else {
+            snprintf(statement, sizeof(statement), "SELECT * FROM load WHERE id = %lld", id);
+        }
+
+        if (!client.query(statement, output)) {
+            result->failure = output;
+            return;
+        }
+        if (sent < counted) continue;
+
+        result->latencies.push_back(chrono::duration<double>(Clock::now() - sent).count());
+        if (write) result->writes++;
+        else result->reads++;
+        if (isError(output)) result->errors++;
+    }
+    client.query("EXIT", output);
+}
+
+// ================== REPORT ==================
+
+static double percentile(const vector<double>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index = (size_t)(fraction * (double)(sorted.size() - 1) + 0.5);
+    return sorted[min(index, sorted.size() - 1)];
+}
+
+static string jsonNumber(double value) {
+    char text[48];
+    snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+static void writeJson(ostream& out, const Options& options, const vector<ClientResult>& results) {
+    vector<double> latencies;
+    long long reads = 0, writes = 0, errors = 0;
+    int failedClients = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        latencies.insert(latencies.end(), results[i].latencies.begin(), results[i].latencies.end());
+        reads += results[i].reads;
+        writes += results[i].writes;
+        errors += results[i].errors;
+        if (!results[i].failure.empty()) failedClients++;
+    }
+    sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (size_t i = 0; i < latencies.size(); i++) total += latencies[i];
+    double count = (double)latencies.size();
+
+    out << "{\n";
+    out << "  \"benchmark\": \"dbengine_load\",\n";
+    out << "  \"server\": \"" << options.address << "\",\n";
+    out << "  \"clients\": " << options.clients << ",\n";
+    out << "  \"seconds\": " << jsonNumber(options.seconds) << ",\n";
+    out << "  \"rows\": " << options.rows << ",\n";
+    out << "  \"write_percent\": " << options.writePercent << ",\n";
+    out << "  \"seed\": " << options.seed << ",\n";
+    out << "  \"requests\": " << latencies.size() << ",\n";
+    out << "  \"reads\": " << reads << ",\n";
+    out << "  \"writes\": " << writes << ",\n";
+    out << "  \"errors\": " << errors << ",\n";
+    out << "  \"failed_clients\": " << failedClients << ",\n";
+    out << "  \"qps\": " << jsonNumber(count / options.seconds) << ",\n";
+    out << "  \"mean_us\": " << jsonNumber(count > 0 ? total / count * 1e6 : 0) << ",\n";
+    out << "  \"p50_us\": " << jsonNumber(percentile(latencies, 0.50) * 1e6) << ",\n";
+    out << "  \"p95_us\": " << jsonNumber(percentile(latencies, 0.95) * 1e6) << ",\n";
+    out << "  \"p99_us\": " << jsonNumber(percentile(latencies, 0.99) * 1e6) << ",\n";
+    out << "  \"p999_us\": " << jsonNumber(percentile(latencies, 0.999) * 1e6) << ",\n";
+    out << "  \"max_us\": " << jsonNumber(latencies.empty() ? 0 : latencies.back() * 1e6) << "\n";
+    out << "}\n";
+}
+
+// ================== MAIN ==================
+
+static void printUsage() {
+    cerr << "Usage: dbengine_load [options]\n"
+        << "  --connect HOST:PORT  server (default 127.0.0.1:5433)\n"
+        << "  --clients N          concurrent connections (default 8)\n"
+        << "  --seconds S          measured time (default 10)\n"
+        << "  --warmup S           time before measuring (default 1)\n"
+        << "  --rows N             rows in the table (default 100000)\n"
+        << "  --write-percent P    UPDATEs among the statements (default 0)\n"
+        << "  --database NAME      database to create the table in (default loadgen)\n"
+        << "  --seed N             key generator seed (default 42)\n"
+        << "  --output FILE        write the JSON there instead of stdout\n";
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        string value = argv[++i];
+
+        if (arg == "--connect") options.address = value;
+        else if (arg == "--clients") options.clients = atoi(value.c_str());
+        else if (arg == "--seconds") options.seconds = atof(value.c_str());
+        else if (arg == "--warmup") options.warmup = atof(value.c_str());
+        else if (arg == "--rows") options.rows = atoll(value.c_str());
+        else if (arg == "--write-percent") options.writePercent = atoi(value.c_str());
+        else if (arg == "--database") options.database = value;
+        else if (arg == "--seed") options.seed = strtoull(value.c_str(), NULL, 10);
+        else if (arg == "--output") options.output = value;
+        else return false;
+    }
+
+    string host;
+    int port = 0;
+    return WireProtocol::parseAddress(options.address, host, port) && options.clients > 0 &&
+        options.clients <= 10000 && options.seconds > 0 && options.warmup >= 0 && options.rows > 0 &&
+        options.writePercent >= 0 && options.writePercent <= 100 && !options.database.empty();
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 2;
+    }
+
+    cerr << "Loading " << options.rows << " rows into " << options.database << ".load..." << endl;
+    string error;
+    if (!createTable(options, error)) {
+        cerr << "Error: Setup failed: " << error << endl;
+        return 1;
+    }
+
+    cerr << options.clients << " client(s) for " << options.warmup << " s warm-up + "
+        << options.seconds << " s..." << endl;
+    vector<ClientResult> results(options.clients);
+    vector<thread> clients;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < options.clients; i++) {
+        clients.push_back(thread(runClient, cref(options), i, start, &results[i]));
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+        clients[i].join();
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (!results[i].failure.empty()) cerr << "Client " << i << ": " << results[i].failure << endl;
+    }
+
+    if (options.output.empty()) {
+        writeJson(cout, options, results);
+    }
+    else {
+        ofstream out(options.output.c_str());
+        writeJson(out, options, results);
+        if (!out) {
+            cerr << "Error: Could not write '" << options.output << "'" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,121 +1,142 @@
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
-#include <map>
-#include <algorithm>
-#include <cctype>
-#include "Column.h"
-#include "Row.h"
-#include "Table.h"
-#include "Condition.h"
-#include "QueryParser.h"
-#include "DatabaseEngine.h"
-#include <sys/stat.h>
-#include <direct.h>  
-#include <io.h>  
+#include <cstdlib>
+#include <csignal>
+#include "DatabaseCatalog.h"
+#include "Session.h"
+#include "Server.h"
+#include "Client.h"
+#include "WireProtocol.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
 
 const string BASE_DB_FOLDER = "databases";
 
-bool directoryExists(const string& path) {
-    struct _stat info;
-    if (_stat(path.c_str(), &info) != 0) {
-        return false; // cannot access
-    }
-    return (info.st_mode & _S_IFDIR) != 0;
+// ================== SERVER ==================
+
+static Server* runningServer = NULL;
+
+static void stopServer(int) {
+    if (runningServer != NULL) runningServer->stop();
 }
 
-void createDirectoryIfNotExists(const string& path) {
-    if (!directoryExists(path)) {
-        _mkdir(path.c_str());
+// dbms --listen host:port: serves the databases until SIGINT or SIGTERM
+static int runServer(const string& address, int workers) {
+    string host;
+    int port = 0;
+    if (!WireProtocol::parseAddress(address, host, port)) {
+        cerr << "Error: Expected --listen host:port" << endl;
+        return 2;
     }
-}
 
-string trimString(const string& str) {
-    int first = 0;
-    int last = (int)str.size() - 1;
+    DatabaseCatalog catalog(BASE_DB_FOLDER);
+    Server server(catalog, workers);
+    string error;
+    if (!server.listen(host, port, error)) {
+        cerr << "Error: Could not listen on " << address << ": " << error << endl;
+        return 1;
+    }
 
-    while (first <= last && isspace((unsigned char)str[first])) first++;
-    while (last >= first && isspace((unsigned char)str[last])) last--;
+    runningServer = &server;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    cout << "Listening on " << address << " with " << workers << " worker(s). Press Ctrl+C to stop." << endl;
 
-    if (first > last) return "";
-    return str.substr(first, last - first + 1);
-}
+    server.run();
 
-string getDatabaseFolder(const string& dbName) {
-    return BASE_DB_FOLDER + "\\" + dbName;
-}
-
-string getDatabaseFile(const string& dbName) {
-    return getDatabaseFolder(dbName) + "\\database.db";
+    runningServer = NULL;
+    cout << "Server stopped." << endl;
+    return 0;
 }
 
-void listDatabases() {
-    string searchPath = BASE_DB_FOLDER + "\\*.*";
-    struct _finddata_t fileinfo;
-    intptr_t handle = _findfirst(searchPath.c_str(), &fileinfo);
+// dbms --connect host:port: the shell, run by a server
+static int runRemoteShell(const string& address) {
+    string host;
+    int port = 0;
+    if (!WireProtocol::parseAddress(address, host, port)) {
+        cerr << "Error: Expected --connect host:port" << endl;
+        return 2;
+    }
 
-    if (handle == -1) {
-        cout << "No databases found (or error accessing folder)." << endl;
-        return;
+    Client client;
+    string output;
+    // an empty request opens the session and reports its database
+    if (!client.connect(host, port, output) || !client.query("", output)) {
+        cerr << output << endl;
+        return 1;
     }
 
-    cout << "Databases:" << endl;
-    do {
-        if (fileinfo.attrib & _A_SUBDIR) {
-            string name = fileinfo.name;
-            if (name != "." && name != "..") {
-                cout << "  - " << name << endl;
-            }
+    string line;
+    while (client.isOpen()) {
+        cout << "dbms@" << address << "[" << client.getDatabase() << "]> ";
+        if (!getline(cin, line)) {
+            cout << endl;
+            break;
         }
-    } while (_findnext(handle, &fileinfo) == 0);
+        if (line.empty()) continue;
 
-    _findclose(handle);
+        bool received = client.query(line, output);
+        cout << output;
+        if (!received) {
+            cout << endl;
+            return 1;
+        }
+    }
+    return 0;
 }
 
-// ================== HELP TEXT ==================
-
-void printHelp() {
-    cout << "\nSupported commands:" << endl;
-    cout << "  CREATE DATABASE db_name" << endl;
-    cout << "  LIST DATABASES" << endl;
-    cout << "  DROP DATABASE db_name" << endl;
-    cout << "  USE db_name" << endl;
-    cout << "  CREATE TABLE table_name (col1 type1 [PRIMARY KEY] [NOT NULL], ...)" << endl;
-    cout << "  INSERT INTO table_name VALUES (val1, val2, ...)" << endl;
-    cout << "  SELECT * FROM table_name [WHERE condition]" << endl;
-    cout << "  SELECT col1, col2 FROM table_name [WHERE condition]" << endl;
-    cout << "  UPDATE table_name SET col1=val1, col2=val2 [WHERE condition]" << endl;
-    cout << "  DELETE FROM table_name" << endl;
-    cout << "  DELETE FROM table_name WHERE condition" << endl;
-    cout << "  DROP TABLE table_name" << endl;
-    cout << "  DROP database db_name" << endl;
-    cout << "  LIST DATABASES" << endl;
-    cout << "  LIST TABLES" << endl;
-    cout << "  HELP" << endl;
-    cout << "  EXIT" << endl;
-    cout << "\nSupported types: INT, FLOAT, VARCHAR(size)" << endl;
-    cout << "Supported operators in WHERE: =, !=, <, >, <=, >=" << endl;
+static void printUsage() {
+    cerr << "Usage: dbms                                 interactive shell" << endl;
+    cerr << "       dbms --listen host:port [--workers n] [--threads n]" << endl;
+    cerr << "       dbms --connect host:port" << endl;
 }
 
 // ================== MAIN ==================
 
-int main() {
-    DatabaseEngine db;
+int main(int argc, char** argv) {
+    string listenAddress;
+    string connectAddress;
+    int workers = 8;
 
-    // default database
-    string currentDatabase = "master";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--listen" && hasValue) {
+            listenAddress = argv[++i];
+        }
+        else if (arg == "--connect" && hasValue) {
+            connectAddress = argv[++i];
+        }
+        else if (arg == "--workers" && hasValue) {
+            workers = atoi(argv[++i]);
+            if (workers <= 0 || workers > 1024) {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (arg == "--threads" && hasValue) {
+            int threads = atoi(argv[++i]);
+            if (threads <= 0 || threads > 1024) {
+                printUsage();
+                return 2;
+            }
+            ThreadPool::shared().resize(threads);
+        }
+        else {
+            printUsage();
+            return 2;
+        }
+    }
 
-    // make sure base folder and master DB folder exist
-    createDirectoryIfNotExists(BASE_DB_FOLDER);
-    createDirectoryIfNotExists(getDatabaseFolder(currentDatabase));
+    if (!listenAddress.empty()) return runServer(listenAddress, workers);
+    if (!connectAddress.empty()) return runRemoteShell(connectAddress);
 
-    // load master database if file exists
-    db.loadFromDisk(getDatabaseFile(currentDatabase));
+    // make sure base folder and master DB folder exist, and load master
+    DatabaseCatalog catalog(BASE_DB_FOLDER);
+    Session session(catalog, false);
 
     // printHelp();
     cout << "\nExamples:" << endl;
@@ -131,157 +152,21 @@ int main() {
     bool shouldExit = false;
 
     while (!shouldExit) {
-        cout << "dbms[" << currentDatabase << "]> ";
+        cout << "dbms[" << session.getDatabase() << "]> ";
         getline(cin, line);
 
         if (line.empty()) continue;
 
-        // -------- split input line into commands by ';' --------
+        // -------- split input line into commands by ';' outside quotes --------
         vector<string> commands;
-        string temp;
-
-        for (size_t i = 0; i < line.size(); ++i) {
-            char c = line[i];
-            if (c == ';') {
-                string cmd = trimString(temp);
-                if (!cmd.empty()) commands.push_back(cmd);
-                temp.clear();
-            }
-            else {
-                temp += c;
-            }
-        }
-        // last part (no trailing ;)
-        temp = trimString(temp);
-        if (!temp.empty()) commands.push_back(temp);
-
-        if (commands.empty()) continue;
+        Session::splitCommands(line, commands);
 
         // -------- process each command separately --------
         for (size_t ci = 0; ci < commands.size(); ++ci) {
-            string query = commands[ci];
-
-            // build uppercase version for matching
-            string upperQuery = query;
-            transform(upperQuery.begin(), upperQuery.end(),
-                upperQuery.begin(), ::toupper);
-
-            if (upperQuery == "EXIT" || upperQuery == "QUIT") {
-                db.saveToDisk(getDatabaseFile(currentDatabase));
-                cout << "Goodbye!" << endl;
+            if (!session.execute(commands[ci])) {
                 shouldExit = true;
                 break; // break command loop
             }
-            else if (upperQuery.find("CREATE DATABASE") == 0) {
-                string dbName = query.substr(15);      // after "CREATE DATABASE"
-                dbName = trimString(dbName);
-
-                if (dbName.empty()) {
-                    cout << "Error: Database name is required." << endl;
-                }
-                else {
-                    string folder = getDatabaseFolder(dbName);
-                    if (directoryExists(folder)) {
-                        cout << "Error: Database '" << dbName << "' already exists." << endl;
-                    }
-                    else {
-                        createDirectoryIfNotExists(folder);
-                        cout << "Database '" << dbName
-                            << "' created in folder '" << folder << "'." << endl;
-                    }
-                }
-            }
-
-            else if (upperQuery == "LIST DATABASES") {
-                listDatabases();
-            }
-            else if (upperQuery.find("DROP DATABASE") == 0) {
-                string dbName = query.substr(13);      // after "DROP DATABASE"
-                dbName = trimString(dbName);
-
-                if (dbName.empty()) {
-                    cout << "Error: Database name is required." << endl;
-                }
-                else if (dbName == "master") {
-                    cout << "Error: Cannot drop system database 'master'." << endl;
-                }
-                else {
-                    string folder = getDatabaseFolder(dbName);
-                    if (!directoryExists(folder)) {
-                        cout << "Error: Database '" << dbName << "' does not exist." << endl;
-                    }
-                    else {
-                        if (currentDatabase == dbName) {
-                            cout << "Switching to 'master' before dropping active database..." << endl;
-                            currentDatabase = "master";
-                            db.loadFromDisk(getDatabaseFile(currentDatabase));
-                        }
-
-                        string cmd = "rmdir /S /Q \"" + folder + "\"";
-                        int ret = system(cmd.c_str());
-                        if (ret == 0) {
-                            cout << "Database '" << dbName << "' dropped successfully." << endl;
-                        }
-                        else {
-                            cout << "Error: Could not drop database (system error)." << endl;
-                        }
-                    }
-                }
-            }
-            else if (upperQuery.find("USE ") == 0) {
-                string dbName = query.substr(4);       // after "USE "
-                dbName = trimString(dbName);
-
-                if (dbName.empty()) {
-                    cout << "Error: Database name is required." << endl;
-                }
-                else {
-                    string folder = getDatabaseFolder(dbName);
-                    if (!directoryExists(folder)) {
-                        cout << "Error: Database '" << dbName << "' does not exist." << endl;
-                    }
-                    else {
-                        // save current DB before switching
-                        db.saveToDisk(getDatabaseFile(currentDatabase));
-                        currentDatabase = dbName;
-                        db.loadFromDisk(getDatabaseFile(currentDatabase));
-                        cout << "Switched to database '" << currentDatabase << "'." << endl;
-                    }
-                }
-            }
-            else if (upperQuery == "LIST TABLES") {
-                db.listTables();
-            }
-            else if (upperQuery.find("CREATE TABLE") == 0) {
-                db.createTable(query);
-                db.saveToDisk(getDatabaseFile(currentDatabase));
-            }
-            else if (upperQuery.find("INSERT INTO") == 0) {
-                db.insertInto(query);
-                db.saveToDisk(getDatabaseFile(currentDatabase));
-            }
-            else if (upperQuery.find("SELECT") == 0) {
-                db.selectFrom(query);
-            }
-            else if (upperQuery.find("UPDATE") == 0) {
-                db.updateTable(query);
-                db.saveToDisk(getDatabaseFile(currentDatabase));
-            }
-            else if (upperQuery.find("DELETE") == 0) {
-                db.deleteFrom(query);
-                db.saveToDisk(getDatabaseFile(currentDatabase));
-            }
-            else if (upperQuery.find("DROP TABLE") == 0) {
-                db.dropTable(query);
-                db.saveToDisk(getDatabaseFile(currentDatabase));
-            }
-            else if (upperQuery == "HELP") {
-                printHelp();
-            }
-            else {
-                cout << "Unknown command: " << query
-                    << "\nType 'HELP' for a list of commands or 'EXIT' to quit." << endl;
-            }
 
             cout << endl;
         }